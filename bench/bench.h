@@ -0,0 +1,54 @@
+/* 
+ * This file is part of the EspressoOS project (https://github.com/rdex999/EspressoOS.git).
+ * Copyright (c) 2025 David Weizman.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* 
+ * Host benchmarks for libk. The libk sources are compiled for the host with the same flags as the kernel, with their 
+ * libc-named functions renamed to k_<name> (see BENCH_RENAMES in the makefile), so they dont clash with the host C library.
+ * Run with: make bench
+ */
+
+/* A benchmarked operation, runs once per iteration with the context that was given to bench_run. */
+typedef void (*bench_function_t)(void* context);
+
+/* Runs <function> <iterations> times (after a warm-up run), returns the average time of a single run in nanoseconds. */
+double bench_run(bench_function_t function, void* context, size_t iterations);
+
+/* Same as bench_run, but <prepare> runs before every iteration and isnt timed. (For flushing the cache, for example) */
+double bench_run_prepared(bench_function_t function, bench_function_t prepare, void* context, size_t iterations);
+
+/* Returns the amount of iterations to run so about <total> bytes are processed in <size> byte runs. At least 4. */
+size_t bench_iterations(size_t size, size_t total);
+
+/* Evict <size> bytes at <buffer> from all cache levels. */
+void bench_flush(const void* buffer, size_t size);
+
+/* Fill g_cpu_features like cpu_init does, but only with features the host OS has enabled. */
+void bench_cpu_init();
+
+void bench_string();
+void bench_nt();
+void bench_containers();
+
+/* Implemented in host.c, which is built against the host C library instead of libk. */
+uint64_t bench_time_ns();
+void* bench_alloc(size_t size);			/* Page aligned, for the string benchmarks. */
+void bench_free(void* ptr);
\ No newline at end of file
@@ -0,0 +1,200 @@
+/* 
+ * This file is part of the EspressoOS project (https://github.com/rdex999/EspressoOS.git).
+ * Copyright (c) 2025 David Weizman.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <list.h>
+#include <hash_map.h>
+#include <static_vector.h>
+#include <span.h>
+#include <ring_buffer.h>
+#include "common.h"
+#include "bench.h"
+
+#define CONTAINER_BENCH_COUNT 			4096
+#define CONTAINER_BENCH_ITERATIONS 		256
+#define CONTAINER_BENCH_SCAN_COUNT 		256		/* Entries for the hash map vs linear scan comparison. */
+
+typedef struct container_item : list_node_t<>
+{
+	uint64_t value;
+} container_item_t;
+
+typedef struct container_pair
+{
+	uint64_t key;
+	uint64_t value;
+} container_pair_t;
+
+typedef struct container_bench
+{
+	container_item_t items[CONTAINER_BENCH_COUNT];
+	list_t<container_item_t> list;
+	hash_map_t<uint64_t, uint64_t> map;
+	container_pair_t pairs[CONTAINER_BENCH_SCAN_COUNT];
+	size_t count;
+	static_vector_t<uint64_t, CONTAINER_BENCH_COUNT> vector;
+	ring_buffer_t<uint64_t, CONTAINER_BENCH_COUNT> ring;
+	volatile uint64_t sum;
+} container_bench_t;
+
+/* Keys that arent sequential, so the hash map cant get lucky with its probing. */
+static inline uint64_t container_key(size_t index)
+{
+	return (uint64_t)index * 0x9E3779B97F4A7C15llu;
+}
+
+static void run_list_push_pop(void* context)
+{
+	container_bench_t* bench = (container_bench_t*)context;
+	for(size_t i = 0; i < CONTAINER_BENCH_COUNT; ++i)
+		bench->list.push_back(&bench->items[i]);
+
+	while(bench->list.pop_front());
+}
+
+static void run_list_iterate(void* context)
+{
+	container_bench_t* bench = (container_bench_t*)context;
+	uint64_t sum = 0;
+	for(container_item_t& item : bench->list)
+		sum += item.value;
+	bench->sum = sum;
+}
+
+static void run_map_insert_remove(void* context)
+{
+	container_bench_t* bench = (container_bench_t*)context;
+	for(size_t i = 0; i < bench->count; ++i)
+		bench->map.insert(container_key(i), i);
+
+	for(size_t i = 0; i < bench->count; ++i)
+		bench->map.remove(container_key(i));
+}
+
+static void run_map_find(void* context)
+{
+	container_bench_t* bench = (container_bench_t*)context;
+	uint64_t sum = 0;
+	for(size_t i = 0; i < bench->count; ++i)
+		sum += *bench->map.find(container_key(i));
+	bench->sum = sum;
+}
+
+static void run_map_find_miss(void* context)
+{
+	container_bench_t* bench = (container_bench_t*)context;
+	size_t misses = 0;
+	for(size_t i = 0; i < bench->count; ++i)
+		misses += bench->map.find(container_key(i + bench->count)) == NULL;
+	bench->sum = misses;
+}
+
+static void run_scan_find(void* context)
+{
+	container_bench_t* bench = (container_bench_t*)context;
+	uint64_t sum = 0;
+	for(size_t i = 0; i < bench->count; ++i)
+	{
+		uint64_t key = container_key(i);
+		for(size_t j = 0; j < bench->count; ++j)
+		{
+			if(bench->pairs[j].key == key)
+			{
+				sum += bench->pairs[j].value;
+				break;
+			}
+		}
+	}
+	bench->sum = sum;
+}
+
+static void run_vector_fill_iterate(void* context)
+{
+	container_bench_t* bench = (container_bench_t*)context;
+	for(size_t i = 0; i < CONTAINER_BENCH_COUNT; ++i)
+		bench->vector.push_back(i);
+
+	uint64_t sum = 0;
+	span_t<uint64_t> span = bench->vector.span();
+	for(uint64_t value : span)
+		sum += value;
+	bench->sum = sum;
+
+	bench->vector.clear();
+}
+
+static void run_ring_push_pop(void* context)
+{
+	container_bench_t* bench = (container_bench_t*)context;
+	for(size_t i = 0; i < CONTAINER_BENCH_COUNT; ++i)
+		bench->ring.push(i);
+
+	uint64_t sum = 0, value;
+	while(bench->ring.pop(&value))
+		sum += value;
+	bench->sum = sum;
+}
+
+/* Prints the time of a single operation, out of the <operations> that <function> does per run. */
+static void container_report(const char* name, bench_function_t function, container_bench_t* bench, size_t operations)
+{
+	double ns = bench_run(function, bench, CONTAINER_BENCH_ITERATIONS);
+	printf("  %-40s %8.2f ns/op\n", name, ns / (double)operations);
+}
+
+void bench_containers()
+{
+	container_bench_t* bench = new container_bench_t();
+	for(size_t i = 0; i < CONTAINER_BENCH_COUNT; ++i)
+		bench->items[i].value = i;
+
+	printf("\nContainers (%d entries):\n", CONTAINER_BENCH_COUNT);
+	container_report("list_t push_back + pop_front", run_list_push_pop, bench, CONTAINER_BENCH_COUNT * 2);
+
+	for(size_t i = 0; i < CONTAINER_BENCH_COUNT; ++i)
+		bench->list.push_back(&bench->items[i]);
+	container_report("list_t iterate", run_list_iterate, bench, CONTAINER_BENCH_COUNT);
+	while(bench->list.pop_front());
+
+	bench->count = CONTAINER_BENCH_COUNT;
+	container_report("hash_map_t insert + remove", run_map_insert_remove, bench, CONTAINER_BENCH_COUNT * 2);
+
+	for(size_t i = 0; i < CONTAINER_BENCH_COUNT; ++i)
+		bench->map.insert(container_key(i), i);
+	container_report("hash_map_t find (hit)", run_map_find, bench, CONTAINER_BENCH_COUNT);
+	container_report("hash_map_t find (miss)", run_map_find_miss, bench, CONTAINER_BENCH_COUNT);
+	bench->map.release();
+
+	container_report("static_vector_t push_back + span iterate", run_vector_fill_iterate, bench, CONTAINER_BENCH_COUNT * 2);
+	container_report("ring_buffer_t push + pop", run_ring_push_pop, bench, CONTAINER_BENCH_COUNT * 2);
+
+	/* A flat hash map against the linear scan that small tables usually get. */
+	bench->count = CONTAINER_BENCH_SCAN_COUNT;
+	for(size_t i = 0; i < CONTAINER_BENCH_SCAN_COUNT; ++i)
+	{
+		bench->pairs[i].key = container_key(i);
+		bench->pairs[i].value = i;
+		bench->map.insert(container_key(i), i);
+	}
+
+	printf("\nLookup of %d keys:\n", CONTAINER_BENCH_SCAN_COUNT);
+	container_report("linear scan", run_scan_find, bench, CONTAINER_BENCH_SCAN_COUNT);
+	container_report("hash_map_t find", run_map_find, bench, CONTAINER_BENCH_SCAN_COUNT);
+	bench->map.release();
+
+	delete bench;
+}
\ No newline at end of file
@@ -0,0 +1,53 @@
+/* 
+ * This file is part of the EspressoOS project (https://github.com/rdex999/EspressoOS.git).
+ * Copyright (c) 2025 David Weizman.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* 
+ * The only benchmark file that is built against the host C library (and without the kernel include directories),
+ * it provides the heap and the clock to the rest of the benchmark.
+ */
+
+#include <stdlib.h>
+#include <time.h>
+#include "bench.h"
+
+/* The renamed libk malloc and free. (Used by the containers, and by operator new) */
+void* k_malloc(size_t size)
+{
+	return malloc(size);
+}
+
+void k_free(void* ptr)
+{
+	free(ptr);
+}
+
+void* bench_alloc(size_t size)
+{
+	return aligned_alloc(4096, (size + 4095) & ~(size_t)4095);
+}
+
+void bench_free(void* ptr)
+{
+	free(ptr);
+}
+
+uint64_t bench_time_ns()
+{
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return (uint64_t)time.tv_sec * 1000000000llu + (uint64_t)time.tv_nsec;
+}
\ No newline at end of file
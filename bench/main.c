@@ -0,0 +1,129 @@
+/* 
+ * This file is part of the EspressoOS project (https://github.com/rdex999/EspressoOS.git).
+ * Copyright (c) 2025 David Weizman.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <immintrin.h>
+#include "cpu.h"
+#include "common.h"
+#include "bench.h"
+
+#define BENCH_CPUID_FEATURE_ECX_OSXSAVE 	(1 << 27)	/* The OS enabled XSAVE, so XGETBV can be used. */
+
+/* Defined by cpu.c in the kernel, which cant be built for the host. */
+uint32_t g_cpu_features = 0;
+
+double bench_run(bench_function_t function, void* context, size_t iterations)
+{
+	/* Timed as a whole, so the clock doesnt dominate short runs. */
+	function(context);
+
+	uint64_t start = bench_time_ns();
+	for(size_t i = 0; i < iterations; ++i)
+		function(context);
+
+	return (double)(bench_time_ns() - start) / (double)iterations;
+}
+
+double bench_run_prepared(bench_function_t function, bench_function_t prepare, void* context, size_t iterations)
+{
+	prepare(context);
+	function(context);
+
+	uint64_t total = 0;
+	for(size_t i = 0; i < iterations; ++i)
+	{
+		prepare(context);
+
+		uint64_t start = bench_time_ns();
+		function(context);
+		total += bench_time_ns() - start;
+	}
+	return (double)total / (double)iterations;
+}
+
+size_t bench_iterations(size_t size, size_t total)
+{
+	return MAX(total / size, (size_t)4);
+}
+
+void bench_flush(const void* buffer, size_t size)
+{
+	const uint8_t* p = (const uint8_t*)buffer;
+	for(size_t i = 0; i < size; i += CPU_CACHE_LINE_SIZE)
+		_mm_clflush(p + i);
+	_mm_mfence();
+}
+
+void bench_cpu_init()
+{
+	uint32_t max_code, unused, ebx, ecx, edx;
+	cpuid(CPUID_CODE_GET_VENDOR, &max_code, &ebx, &ecx, &edx);
+	cpuid(CPUID_CODE_GET_FEATURES, &unused, &ebx, &ecx, &edx);
+
+	uint32_t features = 0;
+	if(ecx & CPUID_FEATURE_ECX_POPCNT)
+		features |= CPU_FEATURE_POPCNT;
+
+	if(ecx & CPUID_FEATURE_ECX_SSE42)
+		features |= CPU_FEATURE_SSE42;
+
+	if(ecx & CPUID_FEATURE_ECX_PCLMULQDQ)
+		features |= CPU_FEATURE_PCLMULQDQ;
+
+	/* Unlike cpu_init, the YMM state cant be enabled here, so AVX is only used if the host OS enabled it. */
+	if((ecx & CPUID_FEATURE_ECX_XSAVE) && (ecx & BENCH_CPUID_FEATURE_ECX_OSXSAVE))
+	{
+		features |= CPU_FEATURE_XSAVE;
+
+		uint32_t xcr0_low, xcr0_high;
+		asm volatile("xgetbv" : "=a"(xcr0_low), "=d"(xcr0_high) : "c"(0));
+		if((ecx & CPUID_FEATURE_ECX_AVX) && (xcr0_low & (CPU_XCR0_SSE | CPU_XCR0_AVX)) == (CPU_XCR0_SSE | CPU_XCR0_AVX))
+			features |= CPU_FEATURE_AVX;
+	}
+
+	if(max_code >= CPUID_CODE_GET_EXTENDED_FEATURES)
+	{
+		cpuid_count(CPUID_CODE_GET_EXTENDED_FEATURES, 0, &unused, &ebx, &ecx, &edx);
+
+		if((ebx & CPUID_EXTENDED_FEATURE_EBX_AVX2) && (features & CPU_FEATURE_AVX))
+			features |= CPU_FEATURE_AVX2;
+
+		if(ebx & CPUID_EXTENDED_FEATURE_EBX_ERMS)
+			features |= CPU_FEATURE_ERMS;
+
+		if(edx & CPUID_EXTENDED_FEATURE_EDX_FSRM)
+			features |= CPU_FEATURE_FSRM;
+	}
+
+	g_cpu_features = features;
+}
+
+int main()
+{
+	bench_cpu_init();
+	printf("CPU features:%s%s%s%s\n",
+		cpu_has_features(CPU_FEATURE_AVX2) ? " AVX2" : "",
+		cpu_has_features(CPU_FEATURE_ERMS) ? " ERMS" : "",
+		cpu_has_features(CPU_FEATURE_FSRM) ? " FSRM" : "",
+		cpu_has_features(CPU_FEATURE_SSE42) ? " SSE4.2" : ""
+	);
+
+	bench_string();
+	bench_nt();
+	bench_containers();
+	return 0;
+}
\ No newline at end of file
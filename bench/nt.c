@@ -0,0 +1,163 @@
+/* 
+ * This file is part of the EspressoOS project (https://github.com/rdex999/EspressoOS.git).
+ * Copyright (c) 2025 David Weizman.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "cpu.h"
+#include "mm/vmm/vmm.h"
+#include "bench.h"
+
+#define NT_BENCH_TOTAL 				(16 * 1024 * 1024)		/* Bytes processed by each hot cache measurement. */
+#define NT_BENCH_HOT_SIZE 			(64 * 1024)				/* Fits in L2. */
+#define NT_BENCH_COLD_SIZE 			(16 * 1024 * 1024)		/* Bigger than most last level caches. */
+#define NT_BENCH_COLD_ITERATIONS 	16
+#define NT_BENCH_WORKING_SET 		(256 * 1024)
+
+typedef struct nt_bench
+{
+	uint8_t* dest;
+	uint8_t* src;
+	size_t size;
+
+	/* The bulk operation runs (untimed) between warming up and re-reading the working set. */
+	uint8_t* working_set;
+	bench_function_t bulk;
+	volatile uint64_t sum;
+} nt_bench_t;
+
+static void run_memset(void* context)
+{
+	nt_bench_t* bench = (nt_bench_t*)context;
+	memset(bench->dest, 0x5A, bench->size);
+}
+
+static void run_memcpy(void* context)
+{
+	nt_bench_t* bench = (nt_bench_t*)context;
+	memcpy(bench->dest, bench->src, bench->size);
+}
+
+static void run_memset_nt(void* context)
+{
+	nt_bench_t* bench = (nt_bench_t*)context;
+	memset_nt(bench->dest, 0x5A, bench->size);
+}
+
+static void run_memcpy_nt(void* context)
+{
+	nt_bench_t* bench = (nt_bench_t*)context;
+	memcpy_nt(bench->dest, bench->src, bench->size);
+}
+
+static void run_memset_pages(void* context)
+{
+	nt_bench_t* bench = (nt_bench_t*)context;
+	for(size_t i = 0; i < bench->size; i += VMM_PAGE_SIZE)
+		memset(bench->dest + i, 0, VMM_PAGE_SIZE);
+}
+
+static void run_clear_pages(void* context)
+{
+	nt_bench_t* bench = (nt_bench_t*)context;
+	for(size_t i = 0; i < bench->size; i += VMM_PAGE_SIZE)
+		clear_page(bench->dest + i);
+}
+
+static void flush_buffers(void* context)
+{
+	nt_bench_t* bench = (nt_bench_t*)context;
+	bench_flush(bench->dest, bench->size);
+	bench_flush(bench->src, bench->size);
+}
+
+static void read_working_set(void* context)
+{
+	nt_bench_t* bench = (nt_bench_t*)context;
+	uint64_t sum = 0;
+	for(size_t i = 0; i < NT_BENCH_WORKING_SET; i += CPU_CACHE_LINE_SIZE)
+		sum += bench->working_set[i];
+	bench->sum = sum;
+}
+
+static void warm_then_bulk(void* context)
+{
+	nt_bench_t* bench = (nt_bench_t*)context;
+	read_working_set(context);
+	bench->bulk(context);
+}
+
+static void nt_report(const char* cache, size_t size, const char* cached_name, double cached, const char* nt_name, double nt)
+{
+	printf("  %-4s %8zu B  %-12s %12.1f  %-10s %12.1f\n", cache, size, cached_name, cached, nt_name, nt);
+}
+
+void bench_nt()
+{
+	nt_bench_t bench;
+	bench.dest = (uint8_t*)bench_alloc(NT_BENCH_COLD_SIZE);
+	bench.src = (uint8_t*)bench_alloc(NT_BENCH_COLD_SIZE);
+	bench.working_set = (uint8_t*)bench_alloc(NT_BENCH_WORKING_SET);
+	memset(bench.src, 0x5A, NT_BENCH_COLD_SIZE);
+	memset(bench.working_set, 1, NT_BENCH_WORKING_SET);
+
+	printf("\nNon-temporal stores (ns per call):\n");
+
+	/* Hot: the buffers stay in the cache between runs. Cold: both buffers are flushed before every run. */
+	bench.size = NT_BENCH_HOT_SIZE;
+	size_t iterations = bench_iterations(bench.size, NT_BENCH_TOTAL);
+	nt_report("hot", bench.size, 
+		"memset", bench_run(run_memset, &bench, iterations), 
+		"memset_nt", bench_run(run_memset_nt, &bench, iterations));
+	nt_report("hot", bench.size, 
+		"memcpy", bench_run(run_memcpy, &bench, iterations), 
+		"memcpy_nt", bench_run(run_memcpy_nt, &bench, iterations));
+	nt_report("hot", bench.size, 
+		"memset pages", bench_run(run_memset_pages, &bench, iterations), 
+		"clear_page", bench_run(run_clear_pages, &bench, iterations));
+
+	bench.size = NT_BENCH_COLD_SIZE;
+	iterations = NT_BENCH_COLD_ITERATIONS;
+	nt_report("cold", bench.size, 
+		"memset", bench_run_prepared(run_memset, flush_buffers, &bench, iterations), 
+		"memset_nt", bench_run_prepared(run_memset_nt, flush_buffers, &bench, iterations));
+	nt_report("cold", bench.size, 
+		"memcpy", bench_run_prepared(run_memcpy, flush_buffers, &bench, iterations), 
+		"memcpy_nt", bench_run_prepared(run_memcpy_nt, flush_buffers, &bench, iterations));
+	nt_report("cold", bench.size, 
+		"memset pages", bench_run_prepared(run_memset_pages, flush_buffers, &bench, iterations), 
+		"clear_page", bench_run_prepared(run_clear_pages, flush_buffers, &bench, iterations));
+
+	/* How much of a warm working set survives a bulk operation, measured by the time it takes to read it again. */
+	printf("  reading a %zu B working set again after a %zu B bulk operation (ns):\n", 
+		(size_t)NT_BENCH_WORKING_SET, bench.size);
+
+	bench.bulk = run_memset;
+	double after_memset = bench_run_prepared(read_working_set, warm_then_bulk, &bench, iterations);
+	bench.bulk = run_memset_nt;
+	double after_memset_nt = bench_run_prepared(read_working_set, warm_then_bulk, &bench, iterations);
+	printf("    %-12s %12.1f  %-10s %12.1f\n", "memset", after_memset, "memset_nt", after_memset_nt);
+
+	bench.bulk = run_memcpy;
+	double after_memcpy = bench_run_prepared(read_working_set, warm_then_bulk, &bench, iterations);
+	bench.bulk = run_memcpy_nt;
+	double after_memcpy_nt = bench_run_prepared(read_working_set, warm_then_bulk, &bench, iterations);
+	printf("    %-12s %12.1f  %-10s %12.1f\n", "memcpy", after_memcpy, "memcpy_nt", after_memcpy_nt);
+
+	bench_free(bench.dest);
+	bench_free(bench.src);
+	bench_free(bench.working_set);
+}
\ No newline at end of file
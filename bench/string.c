@@ -0,0 +1,169 @@
+/* 
+ * This file is part of the EspressoOS project (https://github.com/rdex999/EspressoOS.git).
+ * Copyright (c) 2025 David Weizman.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "common.h"
+#include "bench.h"
+
+#define STRING_BENCH_TOTAL 			(16 * 1024 * 1024)		/* Bytes processed by each measurement. */
+#define STRING_BENCH_MAX_SIZE 		(1024 * 1024)
+#define STRING_BENCH_MOVE_OFFSET 	64						/* How far memmove moves the buffer forwards. (Overlapping) */
+
+typedef struct string_bench
+{
+	uint8_t* dest;
+	uint8_t* src;
+	size_t size;
+	volatile int result;			/* Keeps the result of memcmp, so the calls arent dead code. */
+} string_bench_t;
+
+/* The byte loops libk used before the size-tiered versions, as the baseline. */
+static void* reference_memset(void* dest, int ch, size_t size)
+{
+	uint8_t* d = (uint8_t*)dest;
+	for(size_t i = 0; i < size; i++)
+		d[i] = (uint8_t)ch;
+	return dest;
+}
+
+static int reference_memcmp(const void* lhs, const void* rhs, size_t count)
+{
+	const uint8_t* l = (const uint8_t*)lhs;
+	const uint8_t* r = (const uint8_t*)rhs;
+	for(size_t i = 0; i < count; ++i)
+	{
+		if(l[i] < r[i])
+			return -1;
+		else if(l[i] > r[i])
+			return 1;
+	}
+	return 0;
+}
+
+static void* reference_memcpy(void* dest, const void* src, size_t count)
+{
+	uint8_t* d = (uint8_t*)dest;
+	const uint8_t* s = (const uint8_t*)src;
+	for(size_t i = 0; i < count; ++i)
+		d[i] = s[i];
+	return dest;
+}
+
+static void* reference_memmove(void* dest, const void* src, size_t count)
+{
+	uint8_t* d = (uint8_t*)dest;
+	const uint8_t* s = (const uint8_t*)src;
+	if(d < s)
+		return reference_memcpy(dest, src, count);
+
+	for(size_t i = count; i > 0; --i)
+		d[i - 1] = s[i - 1];
+	return dest;
+}
+
+static void run_reference_memset(void* context)
+{
+	string_bench_t* bench = (string_bench_t*)context;
+	reference_memset(bench->dest, 0x5A, bench->size);
+}
+
+static void run_memset(void* context)
+{
+	string_bench_t* bench = (string_bench_t*)context;
+	memset(bench->dest, 0x5A, bench->size);
+}
+
+static void run_reference_memcpy(void* context)
+{
+	string_bench_t* bench = (string_bench_t*)context;
+	reference_memcpy(bench->dest, bench->src, bench->size);
+}
+
+static void run_memcpy(void* context)
+{
+	string_bench_t* bench = (string_bench_t*)context;
+	memcpy(bench->dest, bench->src, bench->size);
+}
+
+/* The buffers are equal (see bench_string), so the whole buffer is compared. */
+static void run_reference_memcmp(void* context)
+{
+	string_bench_t* bench = (string_bench_t*)context;
+	bench->result = reference_memcmp(bench->dest, bench->src, bench->size);
+}
+
+static void run_memcmp(void* context)
+{
+	string_bench_t* bench = (string_bench_t*)context;
+	bench->result = memcmp(bench->dest, bench->src, bench->size);
+}
+
+static void run_reference_memmove(void* context)
+{
+	string_bench_t* bench = (string_bench_t*)context;
+	reference_memmove(bench->src + STRING_BENCH_MOVE_OFFSET, bench->src, bench->size);
+}
+
+static void run_memmove(void* context)
+{
+	string_bench_t* bench = (string_bench_t*)context;
+	memmove(bench->src + STRING_BENCH_MOVE_OFFSET, bench->src, bench->size);
+}
+
+typedef struct string_case
+{
+	const char* name;
+	bench_function_t reference;
+	bench_function_t libk;
+} string_case_t;
+
+static const string_case_t s_string_cases[] = {
+	{ "memset", 	run_reference_memset, 	run_memset 	},
+	{ "memcpy", 	run_reference_memcpy, 	run_memcpy 	},
+	{ "memcmp", 	run_reference_memcmp, 	run_memcmp 	},
+	{ "memmove", 	run_reference_memmove, 	run_memmove },
+};
+
+static const size_t s_string_sizes[] = { 7, 64, 256, 1024, 4096, 64 * 1024, STRING_BENCH_MAX_SIZE };
+
+void bench_string()
+{
+	string_bench_t bench;
+	bench.dest = (uint8_t*)bench_alloc(STRING_BENCH_MAX_SIZE + STRING_BENCH_MOVE_OFFSET);
+	bench.src = (uint8_t*)bench_alloc(STRING_BENCH_MAX_SIZE + STRING_BENCH_MOVE_OFFSET);
+	memset(bench.src, 0x5A, STRING_BENCH_MAX_SIZE + STRING_BENCH_MOVE_OFFSET);
+
+	printf("\nString functions, byte loop vs libk (hot cache, ns per call):\n");
+	for(size_t c = 0; c < ARR_LEN(s_string_cases); ++c)
+	{
+		const string_case_t* string_case = &s_string_cases[c];
+		for(size_t s = 0; s < ARR_LEN(s_string_sizes); ++s)
+		{
+			bench.size = s_string_sizes[s];
+			size_t iterations = bench_iterations(bench.size, STRING_BENCH_TOTAL);
+
+			double reference = bench_run(string_case->reference, &bench, iterations);
+			double libk = bench_run(string_case->libk, &bench, iterations);
+			printf("  %-8s %8zu B  byte loop %12.1f  libk %12.1f  %6.1fx\n", 
+				string_case->name, bench.size, reference, libk, reference / libk);
+		}
+	}
+
+	bench_free(bench.dest);
+	bench_free(bench.src);
+}
\ No newline at end of file
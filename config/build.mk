@@ -22,7 +22,11 @@ export AS:=nasm
 export LD:=ld
 export CFLAGS+=-m64 -c -ffreestanding -Wall -Wextra \
 	-fno-stack-protector -fno-exceptions -fno-rtti 	\
+	-mno-red-zone \
 	-I $(SRC)/include -I libk/include
+# -mno-red-zone: Interrupts are taken on the current stack, and would overwrite the 128 bytes below RSP that leaf functions use.
+# To profile heap allocations (per call site and size class), build with: CFLAGS=-DALLOC_PROFILE make
+# The heap statistics are printed to the serial port at the end of kernel_main, use the QEMU flag -serial stdio to see them.
 export ASFLAGS+=-f elf64 -I $(SRC)
 
 export TEXT_END:=$(shell tput sgr0)
@@ -0,0 +1,45 @@
+/* 
+ * This file is part of the EspressoOS project (https://github.com/rdex999/EspressoOS.git).
+ * Copyright (c) 2025 David Weizman.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* The CRC32C (Castagnoli) polynomial, in reflected bit order. Same CRC as the SSE4.2 CRC32 instruction, iSCSI, ext4 and NVMe. */
+#define CHECKSUM_CRC32C_POLYNOMIAL 			0x82F63B78
+
+/* 
+ * The SSE4.2 implementation splits the data into 3 lanes of this size, so 3 CRC32 instructions are in flight at once. 
+ * (The instruction has a latency of 3 cycles, but a throughput of 1 per cycle)
+ */
+#define CHECKSUM_CRC32C_LANE_SIZE 			1024
+
+/* 
+ * Select the fastest CRC32C implementation for this CPU, and initialize its tables. Must be called after cpu_init().
+ * Until then, crc32c() uses the (slower) table driven implementation.
+ */
+void checksum_init();
+
+/* 
+ * Returns the CRC32C of <size> bytes at <data>, continuing from <crc>. 
+ * Pass 0 as <crc> for the first buffer, and the previous result to continue over multiple buffers.
+ */
+uint32_t crc32c(uint32_t crc, const void* data, size_t size);
+
+/* Returns the lowest byte of the sum of all bytes at <data>. (ACPI style checksums, valid if the sum is 0) */
+uint8_t checksum8(const void* data, size_t size);
\ No newline at end of file
@@ -0,0 +1,234 @@
+/* 
+ * This file is part of the EspressoOS project (https://github.com/rdex999/EspressoOS.git).
+ * Copyright (c) 2025 David Weizman.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Mix the bits of <value>, so keys that differ only in a few (low or high) bits spread over the whole table. (MurmurHash3 fmix64) */
+inline uint64_t hash_u64(uint64_t value)
+{
+	value ^= value >> 33;
+	value *= 0xFF51AFD7ED558CCDllu;
+	value ^= value >> 33;
+	value *= 0xC4CEB9FE1A85EC53llu;
+	value ^= value >> 33;
+	return value;
+}
+
+/* The default hash function of hash_map_t, for integers, enums and pointers. Specialize it for other key types. */
+template<typename K>
+struct hash_t
+{
+	inline uint64_t operator()(const K& key) const 	{ return hash_u64((uint64_t)key); }
+};
+
+/*
+ * A hash map stored in a single flat array of slots, using open addressing with linear probing.
+ * A lookup hashes the key once and then scans neighbouring slots, which are usually on the same cache line,
+ * instead of following pointers to buckets. Removing uses backward shift deletion, so there are no tombstones and
+ * lookups dont get slower over time.
+ * The capacity is a power of 2, and the table grows (doubles) when it becomes 3/4 full. Memory is allocated with malloc.
+ * Note: <K> and <V> must be trivially copyable, as slots are moved around with plain copies.
+ * Note: Pointers returned by find() and insert() are invalidated by the next insert() or remove().
+ * Note: There is no destructor (the kernel doesnt run global destructors), call release() to free the table.
+ */
+template<typename K, typename V, typename Hash = hash_t<K>>
+class hash_map_t
+{
+	static_assert(__is_trivially_copyable(K) && __is_trivially_copyable(V), "hash_map_t keys and values must be trivially copyable.");
+
+	typedef struct slot
+	{
+		K key;
+		V value;
+		bool used;
+	} slot_t;
+
+public:
+	static constexpr size_t MIN_CAPACITY = 16;
+
+	constexpr hash_map_t() : m_slots(NULL), m_capacity(0), m_size(0) {}
+
+	class iterator
+	{
+	public:
+		inline iterator(slot_t* slot, slot_t* end) : m_slot(slot), m_end(end) 	{ skip_unused(); }
+
+		inline const K& key() const 						{ return m_slot->key; }
+		inline V& value() const 							{ return m_slot->value; }
+		inline iterator& operator*() 						{ return *this; }
+		inline iterator& operator++() 						{ ++m_slot; skip_unused(); return *this; }
+		inline bool operator!=(const iterator& other) const { return m_slot != other.m_slot; }
+
+	private:
+		inline void skip_unused() 							{ while(m_slot != m_end && !m_slot->used) ++m_slot; }
+
+		slot_t* m_slot;
+		slot_t* m_end;
+	};
+
+	/* Iterate over all entries, in no particular order. Use it.key() and it.value() on the iterator. */
+	inline iterator begin() const 	{ return iterator(m_slots, m_slots + m_capacity); }
+	inline iterator end() const 	{ return iterator(m_slots + m_capacity, m_slots + m_capacity); }
+
+	inline size_t size() const 		{ return m_size; }
+	inline size_t capacity() const 	{ return m_capacity; }
+	inline bool empty() const 		{ return m_size == 0; }
+
+	/* Returns a pointer to the value of <key>, NULL if <key> is not in the map. */
+	V* find(const K& key) const
+	{
+		if(m_size == 0)
+			return NULL;
+
+		size_t mask = m_capacity - 1;
+		for(size_t i = Hash()(key) & mask; m_slots[i].used; i = (i + 1) & mask)
+		{
+			if(m_slots[i].key == key)
+				return &m_slots[i].value;
+		}
+
+		return NULL;
+	}
+
+	inline bool contains(const K& key) const 	{ return find(key) != NULL; }
+
+	/* 
+	 * Set the value of <key> to <value>, adding <key> if its not in the map. 
+	 * Returns a pointer to the value in the map, NULL if out of memory.
+	 */
+	V* insert(const K& key, const V& value)
+	{
+		if((m_size + 1) * 4 > m_capacity * 3 && !reserve(m_size + 1))
+			return NULL;
+
+		size_t mask = m_capacity - 1;
+		size_t i = Hash()(key) & mask;
+		for(; m_slots[i].used; i = (i + 1) & mask)
+		{
+			if(m_slots[i].key == key)
+			{
+				m_slots[i].value = value;
+				return &m_slots[i].value;
+			}
+		}
+
+		m_slots[i].key = key;
+		m_slots[i].value = value;
+		m_slots[i].used = true;
+		++m_size;
+		return &m_slots[i].value;
+	}
+
+	/* Remove <key> from the map. Returns true if it was removed, false if it was not in the map. */
+	bool remove(const K& key)
+	{
+		if(m_size == 0)
+			return false;
+
+		size_t mask = m_capacity - 1;
+		size_t hole = Hash()(key) & mask;
+		for(; m_slots[hole].used; hole = (hole + 1) & mask)
+		{
+			if(m_slots[hole].key == key)
+				break;
+		}
+
+		if(!m_slots[hole].used)
+			return false;
+
+		/* 
+		 * Backward shift deletion: Move following entries of the same probe run back into the hole, 
+		 * as long as the hole is between an entry's home slot and its current slot. 
+		 */
+		for(size_t i = (hole + 1) & mask; m_slots[i].used; i = (i + 1) & mask)
+		{
+			size_t home = Hash()(m_slots[i].key) & mask;
+			if(((i - home) & mask) >= ((i - hole) & mask))
+			{
+				m_slots[hole] = m_slots[i];
+				hole = i;
+			}
+		}
+
+		m_slots[hole].used = false;
+		--m_size;
+		return true;
+	}
+
+	/* Remove all entries, keeps the table. */
+	void clear()
+	{
+		for(size_t i = 0; i < m_capacity; ++i)
+			m_slots[i].used = false;
+
+		m_size = 0;
+	}
+
+	/* Remove all entries and free the table. */
+	void release()
+	{
+		free(m_slots);
+		m_slots = NULL;
+		m_capacity = 0;
+		m_size = 0;
+	}
+
+	/* Make room for at least <count> entries without growing. Returns true on success, false if out of memory. */
+	bool reserve(size_t count)
+	{
+		size_t capacity = m_capacity ? m_capacity : MIN_CAPACITY;
+		while(count * 4 > capacity * 3)
+			capacity *= 2;
+
+		if(capacity == m_capacity)
+			return true;
+
+		slot_t* slots = (slot_t*)malloc(capacity * sizeof(slot_t));
+		if(!slots)
+			return false;
+
+		for(size_t i = 0; i < capacity; ++i)
+			slots[i].used = false;
+
+		size_t mask = capacity - 1;
+		for(size_t i = 0; i < m_capacity; ++i)
+		{
+			if(!m_slots[i].used)
+				continue;
+
+			size_t j = Hash()(m_slots[i].key) & mask;
+			while(slots[j].used)
+				j = (j + 1) & mask;
+
+			slots[j] = m_slots[i];
+		}
+
+		free(m_slots);
+		m_slots = slots;
+		m_capacity = capacity;
+		return true;
+	}
+
+private:
+	slot_t* m_slots;
+	size_t m_capacity;
+	size_t m_size;
+};
\ No newline at end of file
@@ -0,0 +1,189 @@
+/* 
+ * This file is part of the EspressoOS project (https://github.com/rdex999/EspressoOS.git).
+ * Copyright (c) 2025 David Weizman.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+template<typename T, typename Tag>
+class list_t;
+
+/* 
+ * The links of an intrusive list. An object that should be on a list derives from list_node_t<Tag>, 
+ * an object that should be on multiple lists at the same time derives from one list_node_t per list, each with a different <Tag>.
+ * The links are stored in the object itself, so adding and removing from a list never allocates memory.
+ */
+template<typename Tag = void>
+class list_node_t
+{
+public:
+	constexpr list_node_t() : m_list_next(NULL), m_list_prev(NULL) {}
+
+private:
+	template<typename, typename> friend class list_t;
+
+	list_node_t* m_list_next;
+	list_node_t* m_list_prev;
+};
+
+/*
+ * An intrusive doubly linked list of objects of type <T>, which must derive from list_node_t<Tag>.
+ * The list is not circular (the first and last nodes point to NULL), so a list_t can be copied/moved in memory freely.
+ * The list doesnt own its objects, removing an object from the list doesnt free it.
+ * Note: An object can be on a single list_t<T, Tag> at a time.
+ * Note: When removing objects while iterating, get the next object (using next()) before removing the current one.
+ */
+template<typename T, typename Tag = void>
+class list_t
+{
+	typedef list_node_t<Tag> node_t;
+
+public:
+	constexpr list_t() : m_head(NULL), m_tail(NULL), m_size(0) {}
+
+	class iterator
+	{
+	public:
+		inline iterator(node_t* node) : m_node(node) {}
+
+		inline T& operator*() const 						{ return *static_cast<T*>(m_node); }
+		inline T* operator->() const 						{ return static_cast<T*>(m_node); }
+		inline iterator& operator++() 						{ m_node = m_node->m_list_next; return *this; }
+		inline bool operator!=(const iterator& other) const { return m_node != other.m_node; }
+		inline bool operator==(const iterator& other) const { return m_node == other.m_node; }
+
+	private:
+		node_t* m_node;
+	};
+
+	inline iterator begin() const 		{ return iterator(m_head); }
+	inline iterator end() const 		{ return iterator(NULL); }
+
+	inline bool empty() const 			{ return m_head == NULL; }
+	inline size_t size() const 			{ return m_size; }
+
+	/* Returns the first/last object in the list, NULL if the list is empty. */
+	inline T* front() const 			{ return to_item(m_head); }
+	inline T* back() const 				{ return to_item(m_tail); }
+
+	/* Returns the object after/before <item> in the list, NULL if <item> is the last/first object. */
+	inline static T* next(const T* item) 	{ return to_item(to_node(item)->m_list_next); }
+	inline static T* prev(const T* item) 	{ return to_item(to_node(item)->m_list_prev); }
+
+	void push_front(T* item)
+	{
+		node_t* node = to_node(item);
+		node->m_list_prev = NULL;
+		node->m_list_next = m_head;
+		if(m_head)
+			m_head->m_list_prev = node;
+		else
+			m_tail = node;
+
+		m_head = node;
+		++m_size;
+	}
+
+	void push_back(T* item)
+	{
+		node_t* node = to_node(item);
+		node->m_list_next = NULL;
+		node->m_list_prev = m_tail;
+		if(m_tail)
+			m_tail->m_list_next = node;
+		else
+			m_head = node;
+
+		m_tail = node;
+		++m_size;
+	}
+
+	/* Insert <item> right after <position>, which must be in this list. */
+	void insert_after(T* position, T* item)
+	{
+		node_t* pos = to_node(position);
+		node_t* node = to_node(item);
+		node->m_list_prev = pos;
+		node->m_list_next = pos->m_list_next;
+		if(pos->m_list_next)
+			pos->m_list_next->m_list_prev = node;
+		else
+			m_tail = node;
+
+		pos->m_list_next = node;
+		++m_size;
+	}
+
+	/* Insert <item> right before <position>, which must be in this list. */
+	void insert_before(T* position, T* item)
+	{
+		node_t* pos = to_node(position);
+		if(pos == m_head)
+		{
+			push_front(item);
+			return;
+		}
+
+		insert_after(to_item(pos->m_list_prev), item);
+	}
+
+	/* Remove <item> from the list. <item> Must be in this list. */
+	void remove(T* item)
+	{
+		node_t* node = to_node(item);
+		if(node->m_list_prev)
+			node->m_list_prev->m_list_next = node->m_list_next;
+		else
+			m_head = node->m_list_next;
+
+		if(node->m_list_next)
+			node->m_list_next->m_list_prev = node->m_list_prev;
+		else
+			m_tail = node->m_list_prev;
+
+		node->m_list_next = NULL;
+		node->m_list_prev = NULL;
+		--m_size;
+	}
+
+	/* Remove the first/last object from the list and return it. Returns NULL if the list is empty. */
+	T* pop_front()
+	{
+		T* item = front();
+		if(item)
+			remove(item);
+
+		return item;
+	}
+
+	T* pop_back()
+	{
+		T* item = back();
+		if(item)
+			remove(item);
+
+		return item;
+	}
+
+private:
+	inline static node_t* to_node(const T* item) 	{ return item ? const_cast<node_t*>(static_cast<const node_t*>(item)) : NULL; }
+	inline static T* to_item(node_t* node) 			{ return node ? static_cast<T*>(node) : NULL; }
+
+	node_t* m_head;
+	node_t* m_tail;
+	size_t m_size;
+};
\ No newline at end of file
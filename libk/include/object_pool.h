@@ -0,0 +1,238 @@
+/* 
+ * This file is part of the EspressoOS project (https://github.com/rdex999/EspressoOS.git).
+ * Copyright (c) 2025 David Weizman.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "mm/vmm/vmm.h"
+#include "common.h"
+#include "cpu.h"
+
+/*
+ * A pool of objects of type <T>. Objects are carved from slabs, each slab is a run of whole pages holding at least <N> objects.
+ * Free objects are kept on an intrusive free list (the link is stored inside the free slot itself), so allocating and freeing
+ * are O(1), and unlike malloc there is no header before each object. Objects of the same slab are contiguous in memory.
+ * The pool grows by one slab at a time, and slabs are given back to the VMM only by release().
+ * Note: The constructor is constexpr so a pool can be a global variable, as the kernel doesnt run global constructors.
+ * Note: This class is not thread safe, for a pool that can be used from all CPUs see percpu_object_pool_t.
+ */
+template<typename T, size_t N>
+class object_pool_t
+{
+	static_assert(N > 0, "A slab must hold at least one object.");
+
+public:
+	constexpr object_pool_t() : m_free(NULL), m_slabs(NULL), m_allocated(0), m_capacity(0) {}
+
+	/* Allocate an object and construct it using <args>. Returns NULL if out of memory. */
+	template<typename... Args>
+	T* create(Args&&... args)
+	{
+		void* slot = alloc();
+		if(!slot)
+			return NULL;
+
+		return new(slot) T(static_cast<Args&&>(args)...);
+	}
+
+	/* Destruct <object> and return it to the pool. <object> Must have been created by this pool. */
+	void destroy(T* object)
+	{
+		if(!object)
+			return;
+
+		object->~T();
+		free(object);
+	}
+
+	/* Allocate storage for a single object, without constructing it. Returns NULL if out of memory. */
+	void* alloc()
+	{
+		if(!m_free && !grow())
+			return NULL;
+
+		slot_t* slot = m_free;
+		m_free = slot->next;
+		++m_allocated;
+		return slot;
+	}
+
+	/* Return storage that was allocated with alloc() back to the pool. Does not destruct the object. */
+	void free(void* object)
+	{
+		if(!object)
+			return;
+
+		slot_t* slot = (slot_t*)object;
+		slot->next = m_free;
+		m_free = slot;
+		--m_allocated;
+	}
+
+	/*
+	 * Give all slabs back to the VMM.
+	 * Note: All objects must be destroyed before calling this function, any pointer to an object of this pool becomes invalid.
+	 */
+	void release()
+	{
+		slab_t* slab = m_slabs;
+		while(slab)
+		{
+			slab_t* next = slab->next;
+			vmm_free_pages((virt_addr_t)slab, SLAB_PAGES);
+			slab = next;
+		}
+
+		m_free = NULL;
+		m_slabs = NULL;
+		m_allocated = 0;
+		m_capacity = 0;
+	}
+
+	/* Returns the amount of objects currently allocated from the pool. */
+	inline size_t get_allocated() const 	{ return m_allocated; }
+
+	/* Returns the amount of objects the pool can hold without growing. */
+	inline size_t get_capacity() const 		{ return m_capacity; }
+
+private:
+	/* A free slot stores the link to the next free slot, an allocated slot stores the object. */
+	typedef union slot
+	{
+		union slot* next;
+		alignas(alignof(T)) uint8_t storage[sizeof(T)];
+	} slot_t;
+
+	/* Placed at the beginning of each slab, the slots come right after it. */
+	typedef struct slab
+	{
+		struct slab* next;
+	} slab_t;
+
+	static constexpr size_t SLOTS_OFFSET 	= ALIGN_UP(sizeof(slab_t), alignof(slot_t));
+	static constexpr size_t SLAB_PAGES 		= DIV_ROUND_UP(SLOTS_OFFSET + N * sizeof(slot_t), (size_t)VMM_PAGE_SIZE);
+	static constexpr size_t SLAB_SLOTS 		= (SLAB_PAGES * VMM_PAGE_SIZE - SLOTS_OFFSET) / sizeof(slot_t);	/* Use the whole slab, not just <N> */
+
+	/* Allocate a new slab and put all of its slots on the free list. Returns true on success, false if out of memory. */
+	bool grow()
+	{
+		virt_addr_t pages = vmm_alloc_pages(VMM_PAGE_P | VMM_PAGE_RW, SLAB_PAGES);
+		if(pages == (virt_addr_t)-1)
+			return false;
+
+		slab_t* slab = (slab_t*)pages;
+		slab->next = m_slabs;
+		m_slabs = slab;
+
+		/* Push the slots in reverse order, so objects are handed out from the lowest address upwards. */
+		slot_t* slots = (slot_t*)(pages + SLOTS_OFFSET);
+		for(size_t i = SLAB_SLOTS; i > 0; --i)
+		{
+			slots[i - 1].next = m_free;
+			m_free = &slots[i - 1];
+		}
+
+		m_capacity += SLAB_SLOTS;
+		return true;
+	}
+
+	slot_t* m_free;
+	slab_t* m_slabs;
+	size_t m_allocated;
+	size_t m_capacity;
+};
+
+/*
+ * An object pool with a separate free list for each CPU.
+ * Each CPU only ever touches its own pool, and interrupts are disabled while doing so, so no locks or atomic operations
+ * are needed and CPUs dont bounce cache lines between each other.
+ * An object that is freed on a different CPU than the one that allocated it goes to the free list of the freeing CPU.
+ * Note: Only release() the whole pool, slabs may be shared between the CPU pools once objects move between CPUs.
+ */
+template<typename T, size_t N>
+class percpu_object_pool_t
+{
+public:
+	constexpr percpu_object_pool_t() : m_pools() {}
+
+	/* Allocate an object from the current CPU's pool and construct it using <args>. Returns NULL if out of memory. */
+	template<typename... Args>
+	T* create(Args&&... args)
+	{
+		void* slot = alloc();
+		if(!slot)
+			return NULL;
+
+		return new(slot) T(static_cast<Args&&>(args)...);
+	}
+
+	/* Destruct <object> and return it to the current CPU's pool. */
+	void destroy(T* object)
+	{
+		if(!object)
+			return;
+
+		object->~T();
+		free(object);
+	}
+
+	/* Allocate storage for a single object from the current CPU's pool, without constructing it. Returns NULL if out of memory. */
+	void* alloc()
+	{
+		uint64_t flags = cpu_irq_save();
+		void* slot = m_pools[cpu_current_index()].pool.alloc();
+		cpu_irq_restore(flags);
+		return slot;
+	}
+
+	/* Return storage that was allocated with alloc() to the current CPU's pool. Does not destruct the object. */
+	void free(void* object)
+	{
+		uint64_t flags = cpu_irq_save();
+		m_pools[cpu_current_index()].pool.free(object);
+		cpu_irq_restore(flags);
+	}
+
+	/* Give the slabs of all CPUs back to the VMM. All objects must be destroyed before calling this function. */
+	void release()
+	{
+		for(size_t i = 0; i < CPU_MAX_COUNT; ++i)
+			m_pools[i].pool.release();
+	}
+
+	/* Returns the amount of objects currently allocated from all CPUs. */
+	size_t get_allocated() const
+	{
+		/* The counters of a single CPU may wrap when objects move between CPUs, but their sum is correct. */
+		size_t allocated = 0;
+		for(size_t i = 0; i < CPU_MAX_COUNT; ++i)
+			allocated += m_pools[i].pool.get_allocated();
+
+		return allocated;
+	}
+
+private:
+	/* Each CPU's pool is on its own cache line, so CPUs dont write to each others cache lines. */
+	struct alignas(CPU_CACHE_LINE_SIZE) cpu_pool
+	{
+		object_pool_t<T, N> pool;
+	};
+
+	cpu_pool m_pools[CPU_MAX_COUNT];
+};
\ No newline at end of file
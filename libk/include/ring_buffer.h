@@ -0,0 +1,76 @@
+/* 
+ * This file is part of the EspressoOS project (https://github.com/rdex999/EspressoOS.git).
+ * Copyright (c) 2025 David Weizman.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+/*
+ * A FIFO queue of up to <N> objects in a fixed array. <N> Must be a power of 2, so wrapping around is a mask instead of a division.
+ * The read and write positions are free running counters, so a full buffer and an empty buffer can be told apart
+ * without wasting a slot.
+ * Note: This class is not thread safe, the caller must lock around it.
+ */
+template<typename T, size_t N>
+class ring_buffer_t
+{
+	static_assert(N > 0 && (N & (N - 1)) == 0, "The capacity of a ring buffer must be a power of 2.");
+
+public:
+	constexpr ring_buffer_t() : m_items(), m_head(0), m_tail(0) {}
+
+	inline size_t size() const 			{ return m_tail - m_head; }
+	inline size_t capacity() const 		{ return N; }
+	inline bool empty() const 			{ return m_tail == m_head; }
+	inline bool full() const 			{ return size() == N; }
+
+	/* Add <item> to the back of the queue. Returns true on success, false if the buffer is full. */
+	bool push(const T& item)
+	{
+		if(full())
+			return false;
+
+		m_items[m_tail++ & (N - 1)] = item;
+		return true;
+	}
+
+	/* Remove the item at the front of the queue and write it into <item>. Returns true on success, false if the buffer is empty. */
+	bool pop(T* item)
+	{
+		if(empty())
+			return false;
+
+		*item = m_items[m_head++ & (N - 1)];
+		return true;
+	}
+
+	/* Returns a pointer to the item at the front of the queue without removing it, NULL if the buffer is empty. */
+	T* peek()
+	{
+		if(empty())
+			return NULL;
+
+		return &m_items[m_head & (N - 1)];
+	}
+
+	inline void clear() 	{ m_head = m_tail; }
+
+private:
+	T m_items[N];
+	size_t m_head;		/* Read position */
+	size_t m_tail;		/* Write position */
+};
\ No newline at end of file
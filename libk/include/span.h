@@ -0,0 +1,57 @@
+/* 
+ * This file is part of the EspressoOS project (https://github.com/rdex999/EspressoOS.git).
+ * Copyright (c) 2025 David Weizman.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+/* A non-owning view of <size> contiguous objects of type <T>. Cheap to copy, pass it by value. */
+template<typename T>
+class span_t
+{
+public:
+	constexpr span_t() : m_data(NULL), m_size(0) {}
+	constexpr span_t(T* data, size_t size) : m_data(data), m_size(size) {}
+
+	template<size_t N>
+	constexpr span_t(T (&array)[N]) : m_data(array), m_size(N) {}
+
+	inline T& operator[](size_t index) const 	{ return m_data[index]; }
+	inline T* data() const 						{ return m_data; }
+	inline size_t size() const 					{ return m_size; }
+	inline size_t size_bytes() const 			{ return m_size * sizeof(T); }
+	inline bool empty() const 					{ return m_size == 0; }
+
+	inline T* begin() const 					{ return m_data; }
+	inline T* end() const 						{ return m_data + m_size; }
+
+	/* Returns a span of <count> objects starting at <offset>, clamped to the end of this span. */
+	span_t subspan(size_t offset, size_t count = (size_t)-1) const
+	{
+		if(offset > m_size)
+			offset = m_size;
+
+		if(count > m_size - offset)
+			count = m_size - offset;
+
+		return span_t(m_data + offset, count);
+	}
+
+private:
+	T* m_data;
+	size_t m_size;
+};
\ No newline at end of file
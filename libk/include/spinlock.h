@@ -0,0 +1,64 @@
+/* 
+ * This file is part of the EspressoOS project (https://github.com/rdex999/EspressoOS.git).
+ * Copyright (c) 2025 David Weizman.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include "cpu.h"
+
+/*
+ * A test-and-test-and-set spin lock. Waiters spin on a plain load, so they dont bounce the cache line between CPUs
+ * until the lock looks free.
+ * Note: The constructor is constexpr so a lock can be a global variable, and an all zero lock is unlocked.
+ */
+class spinlock_t
+{
+public:
+	constexpr spinlock_t() : m_locked(0) {}
+
+	void lock()
+	{
+		while(__atomic_exchange_n(&m_locked, (uint32_t)1, __ATOMIC_ACQUIRE) != 0)
+		{
+			while(__atomic_load_n(&m_locked, __ATOMIC_RELAXED) != 0)
+				cpu_pause();
+		}
+	}
+
+	void unlock()
+	{
+		__atomic_store_n(&m_locked, (uint32_t)0, __ATOMIC_RELEASE);
+	}
+
+	/* Disable interrupts on the current CPU and take the lock. Returns the previous RFLAGS, for unlock_irq_restore(). */
+	uint64_t lock_irq_save()
+	{
+		uint64_t flags = cpu_irq_save();
+		lock();
+		return flags;
+	}
+
+	/* Release the lock and restore the interrupt flag from <flags>, which was returned by lock_irq_save(). */
+	void unlock_irq_restore(uint64_t flags)
+	{
+		unlock();
+		cpu_irq_restore(flags);
+	}
+
+private:
+	uint32_t m_locked;
+};
\ No newline at end of file
@@ -0,0 +1,111 @@
+/* 
+ * This file is part of the EspressoOS project (https://github.com/rdex999/EspressoOS.git).
+ * Copyright (c) 2025 David Weizman.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <span.h>
+
+/*
+ * A vector with a fixed capacity of <N> objects, stored inline (no heap allocation). 
+ * Objects are contiguous in memory, so iterating over them is cache friendly.
+ * Adding to a full vector fails (returns NULL/false) instead of growing.
+ * Note: The constructor is constexpr so a vector can be a global variable, as the kernel doesnt run global constructors.
+ * For the same reason there is no destructor, call clear() to destruct the objects.
+ */
+template<typename T, size_t N>
+class static_vector_t
+{
+public:
+	constexpr static_vector_t() : m_storage(), m_size(0) {}
+
+	inline T& operator[](size_t index) 				{ return data()[index]; }
+	inline const T& operator[](size_t index) const 	{ return data()[index]; }
+
+	inline T* data() 					{ return (T*)m_storage; }
+	inline const T* data() const 		{ return (const T*)m_storage; }
+	inline size_t size() const 			{ return m_size; }
+	inline size_t capacity() const 		{ return N; }
+	inline bool empty() const 			{ return m_size == 0; }
+	inline bool full() const 			{ return m_size == N; }
+
+	inline T* begin() 					{ return data(); }
+	inline T* end() 					{ return data() + m_size; }
+	inline const T* begin() const 		{ return data(); }
+	inline const T* end() const 		{ return data() + m_size; }
+
+	inline T& front() 					{ return data()[0]; }
+	inline T& back() 					{ return data()[m_size - 1]; }
+
+	inline span_t<T> span() 			{ return span_t<T>(data(), m_size); }
+
+	/* Construct an object at the end of the vector using <args>. Returns a pointer to it, NULL if the vector is full. */
+	template<typename... Args>
+	T* emplace_back(Args&&... args)
+	{
+		if(full())
+			return NULL;
+
+		return new(&data()[m_size++]) T(static_cast<Args&&>(args)...);
+	}
+
+	/* Add a copy of <item> to the end of the vector. Returns true on success, false if the vector is full. */
+	inline bool push_back(const T& item) 	{ return emplace_back(item) != NULL; }
+
+	/* Destruct the last object. The vector must not be empty. */
+	void pop_back()
+	{
+		data()[--m_size].~T();
+	}
+
+	/* Remove the object at <index>, moving the following objects back to keep the order. */
+	void erase(size_t index)
+	{
+		if(index >= m_size)
+			return;
+
+		for(size_t i = index; i + 1 < m_size; ++i)
+			data()[i] = static_cast<T&&>(data()[i + 1]);
+
+		pop_back();
+	}
+
+	/* Remove the object at <index> by moving the last object into its place. O(1), but doesnt keep the order. */
+	void erase_unordered(size_t index)
+	{
+		if(index >= m_size)
+			return;
+
+		if(index != m_size - 1)
+			data()[index] = static_cast<T&&>(data()[m_size - 1]);
+
+		pop_back();
+	}
+
+	/* Destruct all objects. */
+	void clear()
+	{
+		while(m_size)
+			pop_back();
+	}
+
+private:
+	alignas(T) uint8_t m_storage[N * sizeof(T)];
+	size_t m_size;
+};
\ No newline at end of file
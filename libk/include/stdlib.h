@@ -20,9 +20,38 @@
 #include <stddef.h>
 #include <stdint.h>
 
+typedef struct malloc_stats
+{
+	size_t mapped_bytes;			/* Bytes of heap memory mapped from the VMM, including block headers. */
+	size_t used_bytes;				/* Bytes in allocated blocks, not including block headers. */
+	size_t free_bytes;				/* Bytes in free blocks, not including block headers. */
+	size_t overhead_bytes;			/* Bytes used by block headers. */
+	size_t used_blocks;
+	size_t free_blocks;
+	size_t largest_free_block;		/* Size of the biggest free block, the biggest allocation that wont map new pages. */
+	size_t mapped_pages;
+	size_t used_pages;				/* Pages that contain at least one byte of an allocated block (or its header). */
+	unsigned int fragmentation;		/* 0-1000. How much of the free memory is not in the largest free block, in 0.1% units. */
+} malloc_stats_t;
+
 void* malloc(size_t size);
 void free(void* ptr);
 
+/* Walk the heap and fill <stats>. */
+void malloc_get_stats(malloc_stats_t* stats);
+
+/* 
+ * Print heap statistics using <print>, which is called with null terminated strings. (Pass serial_write, for example)
+ * When built with ALLOC_PROFILE, also prints the live allocations of each call site and the size class histogram.
+ */
+void malloc_dump(void (*print)(const char* string));
+
+/* 
+ * Convert <value> into a null terminated string in base <base> (2-16) and write it into <buffer>. 
+ * <buffer> Must have room for 65 characters in the worst case (base 2). Returns <buffer>.
+ */
+char* ulltoa(unsigned long long value, char* buffer, int base);
+
 unsigned int popcount64(uint64_t number);
 
 /* Basically just malloc, use these keywords when creating/deleting objects. */
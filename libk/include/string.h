@@ -20,6 +20,28 @@
 #include <stdint.h>
 #include <stddef.h>
 
+/* 
+ * The memory functions pick an implementation by size and by the features of the CPU (see g_cpu_features),
+ * so they require SSE to be enabled. (cpu_init)
+ */
 void* memset(void* dest, int ch, size_t size);
 int memcmp(const void* lhs, const void* rhs, size_t count);
-void* memcpy(void* dest, const void* src, size_t count);
\ No newline at end of file
+void* memcpy(void* dest, const void* src, size_t count);
+
+/* Same as memcpy, but <dest> and <src> may overlap. */
+void* memmove(void* dest, const void* src, size_t count);
+
+/* Returns a pointer to the first byte equal to <ch> in the first <count> bytes of <ptr>, NULL if there is none. */
+void* memchr(const void* ptr, int ch, size_t count);
+
+/* 
+ * Non-temporal versions of memset and memcpy. The stores bypass the cache, so filling or copying a big buffer that wont be
+ * read soon doesnt evict the cache lines of the code around it. Ends with SFENCE, so the stores are globally visible 
+ * (to other CPUs, devices and the page walker) when the function returns.
+ * Small sizes just use the normal (cached) versions.
+ */
+void* memset_nt(void* dest, int ch, size_t size);
+void* memcpy_nt(void* dest, const void* src, size_t count);
+
+/* Zero a page (VMM_PAGE_SIZE bytes) using non-temporal stores. <page> Must be page aligned. */
+void clear_page(void* page);
\ No newline at end of file
@@ -0,0 +1,251 @@
+/* 
+ * This file is part of the EspressoOS project (https://github.com/rdex999/EspressoOS.git).
+ * Copyright (c) 2025 David Weizman.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <checksum.h>
+
+#include <immintrin.h>
+#include "cpu.h"
+
+/* Slicing by 8 tables. Table 0 is the classic byte at a time table, table k is the CRC of a byte followed by k zero bytes. */
+typedef struct crc32c_tables
+{
+	uint32_t entries[8][256];
+} crc32c_tables_t;
+
+static constexpr crc32c_tables_t crc32c_make_tables()
+{
+	crc32c_tables_t tables = {};
+	for(uint32_t i = 0; i < 256; ++i)
+	{
+		uint32_t crc = i;
+		for(int bit = 0; bit < 8; ++bit)
+			crc = (crc & 1) ? (crc >> 1) ^ CHECKSUM_CRC32C_POLYNOMIAL : crc >> 1;
+
+		tables.entries[0][i] = crc;
+	}
+
+	for(int k = 1; k < 8; ++k)
+	{
+		for(uint32_t i = 0; i < 256; ++i)
+		{
+			uint32_t previous = tables.entries[k - 1][i];
+			tables.entries[k][i] = (previous >> 8) ^ tables.entries[0][previous & 0xFF];
+		}
+	}
+
+	return tables;
+}
+
+static constexpr crc32c_tables_t s_crc32c_tables = crc32c_make_tables();
+
+/* 
+ * Tables for shifting a CRC over CHECKSUM_CRC32C_LANE_SIZE (and twice that) zero bytes, used to combine the CRCs of the lanes.
+ * Shifting is linear, so each byte of the CRC is shifted on its own with a table, and the results are XORed.
+ */
+static uint32_t s_crc32c_shift_lane[4][256];
+static uint32_t s_crc32c_shift_2lanes[4][256];
+
+static uint32_t crc32c_table(uint32_t crc, const void* data, size_t size);
+static uint32_t (*s_crc32c)(uint32_t crc, const void* data, size_t size) = crc32c_table;
+
+/* Shift <crc> over <zeros> zero bytes, one byte at a time. Only used for building the shift tables. */
+static uint32_t crc32c_shift_slow(uint32_t crc, size_t zeros)
+{
+	for(size_t i = 0; i < zeros; ++i)
+		crc = s_crc32c_tables.entries[0][crc & 0xFF] ^ (crc >> 8);
+
+	return crc;
+}
+
+static void crc32c_make_shift_table(uint32_t table[4][256], size_t zeros)
+{
+	uint32_t bits[32];
+	for(int bit = 0; bit < 32; ++bit)
+		bits[bit] = crc32c_shift_slow((uint32_t)1 << bit, zeros);
+
+	for(int byte = 0; byte < 4; ++byte)
+	{
+		for(uint32_t value = 0; value < 256; ++value)
+		{
+			uint32_t shifted = 0;
+			for(int bit = 0; bit < 8; ++bit)
+			{
+				if(value & (1 << bit))
+					shifted ^= bits[byte * 8 + bit];
+			}
+			table[byte][value] = shifted;
+		}
+	}
+}
+
+static inline uint32_t crc32c_shift(uint32_t table[4][256], uint32_t crc)
+{
+	return table[0][crc & 0xFF] ^ table[1][(crc >> 8) & 0xFF] ^ table[2][(crc >> 16) & 0xFF] ^ table[3][crc >> 24];
+}
+
+static uint32_t crc32c_table(uint32_t crc, const void* data, size_t size)
+{
+	const uint8_t* p = (const uint8_t*)data;
+	const uint32_t (*t)[256] = s_crc32c_tables.entries;
+	crc = ~crc;
+
+	for(; size && ((uint64_t)p & 7); --size)
+		crc = t[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+
+	for(; size >= 8; size -= 8, p += 8)
+	{
+		uint64_t value = *(const uint64_t*)p ^ crc;
+		crc = 	t[7][value & 0xFF] 			^ t[6][(value >> 8) & 0xFF] 	^ 
+				t[5][(value >> 16) & 0xFF] 	^ t[4][(value >> 24) & 0xFF] 	^
+				t[3][(value >> 32) & 0xFF] 	^ t[2][(value >> 40) & 0xFF] 	^ 
+				t[1][(value >> 48) & 0xFF] 	^ t[0][value >> 56];
+	}
+
+	for(; size; --size)
+		crc = t[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+
+	return ~crc;
+}
+
+/* 
+ * CRC32 instruction, 3 lanes at a time. The CRC of the whole block is:
+ * 	shift(crc of lane 0, 2 lanes) ^ shift(crc of lane 1, 1 lane) ^ crc of lane 2
+ * where lanes 1 and 2 start from a CRC of 0.
+ */
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const void* data, size_t size)
+{
+	const uint8_t* p = (const uint8_t*)data;
+	uint64_t crc0 = ~crc;
+
+	for(; size && ((uint64_t)p & 7); --size)
+		crc0 = _mm_crc32_u8((uint32_t)crc0, *p++);
+
+	for(; size >= 3 * CHECKSUM_CRC32C_LANE_SIZE; size -= 3 * CHECKSUM_CRC32C_LANE_SIZE)
+	{
+		const uint64_t* lane0 = (const uint64_t*)p;
+		const uint64_t* lane1 = (const uint64_t*)(p + CHECKSUM_CRC32C_LANE_SIZE);
+		const uint64_t* lane2 = (const uint64_t*)(p + 2 * CHECKSUM_CRC32C_LANE_SIZE);
+		uint64_t crc1 = 0;
+		uint64_t crc2 = 0;
+		for(size_t i = 0; i < CHECKSUM_CRC32C_LANE_SIZE / sizeof(uint64_t); ++i)
+		{
+			crc0 = _mm_crc32_u64(crc0, lane0[i]);
+			crc1 = _mm_crc32_u64(crc1, lane1[i]);
+			crc2 = _mm_crc32_u64(crc2, lane2[i]);
+		}
+
+		crc0 = crc32c_shift(s_crc32c_shift_2lanes, (uint32_t)crc0) ^ crc32c_shift(s_crc32c_shift_lane, (uint32_t)crc1) ^ crc2;
+		p += 3 * CHECKSUM_CRC32C_LANE_SIZE;
+	}
+
+	for(; size >= 8; size -= 8, p += 8)
+		crc0 = _mm_crc32_u64(crc0, *(const uint64_t*)p);
+
+	for(; size; --size)
+		crc0 = _mm_crc32_u8((uint32_t)crc0, *p++);
+
+	return ~(uint32_t)crc0;
+}
+
+/* 
+ * Fold a 128 bit block over <k>, so it can be XORed into the block that comes a fixed distance after it.
+ * For a distance of D bits, <k> holds (x^(D+31) mod P) in its low half and (x^(D-33) mod P) in its high half, bit reflected.
+ */
+__attribute__((target("sse4.2,pclmul")))
+static inline __m128i crc32c_fold(__m128i block, __m128i k)
+{
+	return _mm_xor_si128(_mm_clmulepi64_si128(block, k, 0x00), _mm_clmulepi64_si128(block, k, 0x11));
+}
+
+/*
+ * Carry-less multiplication folding. 4 blocks of 16 bytes are folded 64 bytes forward at a time, then into a single block,
+ * which is reduced to 32 bits with the CRC32 instruction (The initial CRC is XORed into the data, so it starts from 0).
+ */
+__attribute__((target("sse4.2,pclmul")))
+static uint32_t crc32c_pclmul(uint32_t crc, const void* data, size_t size)
+{
+	if(size < 64)
+		return crc32c_sse42(crc, data, size);
+
+	const uint8_t* p = (const uint8_t*)data;
+	const __m128i k512 = _mm_set_epi64x(0x9E4ADDF8, 0x740EEF02);		/* x^479, x^543 */
+	const __m128i k128 = _mm_set_epi64x(0x493C7D27, 0xF20C0DFE);		/* x^95, x^159 */
+
+	__m128i x0 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)p), _mm_cvtsi32_si128((int)~crc));
+	__m128i x1 = _mm_loadu_si128((const __m128i*)(p + 16));
+	__m128i x2 = _mm_loadu_si128((const __m128i*)(p + 32));
+	__m128i x3 = _mm_loadu_si128((const __m128i*)(p + 48));
+	p += 64;
+	size -= 64;
+
+	for(; size >= 64; size -= 64, p += 64)
+	{
+		x0 = _mm_xor_si128(crc32c_fold(x0, k512), _mm_loadu_si128((const __m128i*)p));
+		x1 = _mm_xor_si128(crc32c_fold(x1, k512), _mm_loadu_si128((const __m128i*)(p + 16)));
+		x2 = _mm_xor_si128(crc32c_fold(x2, k512), _mm_loadu_si128((const __m128i*)(p + 32)));
+		x3 = _mm_xor_si128(crc32c_fold(x3, k512), _mm_loadu_si128((const __m128i*)(p + 48)));
+	}
+
+	x0 = _mm_xor_si128(crc32c_fold(x0, k128), x1);
+	x0 = _mm_xor_si128(crc32c_fold(x0, k128), x2);
+	x0 = _mm_xor_si128(crc32c_fold(x0, k128), x3);
+
+	for(; size >= 16; size -= 16, p += 16)
+		x0 = _mm_xor_si128(crc32c_fold(x0, k128), _mm_loadu_si128((const __m128i*)p));
+
+	uint64_t result = _mm_crc32_u64(0, (uint64_t)_mm_cvtsi128_si64(x0));
+	result = _mm_crc32_u64(result, (uint64_t)_mm_extract_epi64(x0, 1));
+
+	/* Continue over the tail. crc32c_sse42 inverts its input and output, so undo it. */
+	return crc32c_sse42(~(uint32_t)result, p, size);
+}
+
+void checksum_init()
+{
+	if(!cpu_has_features(CPU_FEATURE_SSE42))
+		return;
+
+	crc32c_make_shift_table(s_crc32c_shift_lane, CHECKSUM_CRC32C_LANE_SIZE);
+	crc32c_make_shift_table(s_crc32c_shift_2lanes, 2 * CHECKSUM_CRC32C_LANE_SIZE);
+
+	if(cpu_has_features(CPU_FEATURE_PCLMULQDQ))
+		s_crc32c = crc32c_pclmul;
+	else
+		s_crc32c = crc32c_sse42;
+}
+
+uint32_t crc32c(uint32_t crc, const void* data, size_t size)
+{
+	return s_crc32c(crc, data, size);
+}
+
+uint8_t checksum8(const void* data, size_t size)
+{
+	/* PSADBW against zero sums 8 bytes into each 64 bit half, so 16 bytes are summed with one instruction. */
+	const uint8_t* p = (const uint8_t*)data;
+	const __m128i zero = _mm_setzero_si128();
+	__m128i sums = zero;
+	for(; size >= 16; size -= 16, p += 16)
+		sums = _mm_add_epi64(sums, _mm_sad_epu8(_mm_loadu_si128((const __m128i*)p), zero));
+
+	uint64_t sum = (uint64_t)_mm_cvtsi128_si64(sums) + (uint64_t)_mm_cvtsi128_si64(_mm_unpackhi_epi64(sums, sums));
+	for(; size; --size)
+		sum += *p++;
+
+	return (uint8_t)sum;
+}
\ No newline at end of file
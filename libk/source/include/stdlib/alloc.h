@@ -28,16 +28,63 @@
 #define BLOCK_START(block)			((block_meta_t*)(block) + 1)
 #define BLOCK_END(block)			((uint64_t)BLOCK_START(block) + (block)->size)
 
+/* Return the memory of an allocated block from malloc. Used from malloc only, as it takes mallocs return address. */
+#ifdef ALLOC_PROFILE
+	#define ALLOC_RETURN_BLOCK(block)	{ alloc_profile_alloc((block), __builtin_return_address(0)); return BLOCK_START(block); }
+#else
+	#define ALLOC_RETURN_BLOCK(block)	{ return BLOCK_START(block); }
+#endif
+
+/* 
+ * When built with ALLOC_PROFILE, each block remembers the return address of its malloc call (its call site), 
+ * and live bytes/allocations are counted per call site and per size class (power of 2).
+ */
+#define ALLOC_ALIGNMENT					16			/* The alignment of every allocation, block sizes are rounded up to it. */
+
+#define ALLOC_PROFILE_SITES				256
+#define ALLOC_PROFILE_SIZE_CLASSES		64
+
 typedef struct block_meta
 {
 	struct block_meta* next;
 	struct block_meta* prev;
 	bool free;
 	size_t size;				/* The size of the memory block, not including this structure. */
+#ifdef ALLOC_PROFILE
+	void* caller = NULL;		/* The return address of the malloc call which allocated this block. */
+	uint64_t reserved = 0;		/* Keep the size of the header a multiple of ALLOC_ALIGNMENT. */
+#endif
 } block_meta_t;
 
+static_assert(sizeof(block_meta_t) % ALLOC_ALIGNMENT == 0, "The block header must keep allocations aligned.");
+
+typedef struct alloc_profile_site
+{
+	void* caller;				/* NULL for an unused site. */
+	size_t live_bytes;
+	size_t live_count;
+	size_t total_count;			/* Amount of allocations ever made from this site. */
+} alloc_profile_site_t;
+
+typedef struct alloc_profile_size_class
+{
+	size_t live_count;
+	size_t total_count;
+} alloc_profile_size_class_t;
+
 /* Merge free blocks starting from <after>. */
 void alloc_merge_free(block_meta_t* block);
 
 /* Allocate <block>, shrink it to <size> and merge free regions. */
-void alloc_alloc_block(block_meta_t* block, size_t size);
\ No newline at end of file
+void alloc_alloc_block(block_meta_t* block, size_t size);
+
+#ifdef ALLOC_PROFILE
+/* Account the allocation of <block> to the call site <caller> and to its size class. */
+void alloc_profile_alloc(block_meta_t* block, void* caller);
+
+/* Remove the allocation of <block> from its call site and size class. Call before the block is merged. */
+void alloc_profile_free(const block_meta_t* block);
+
+/* Returns the site of <caller>, creates it if it doesnt exist. Returns the overflow site if the site table is full. */
+alloc_profile_site_t* alloc_profile_find_site(void* caller);
+#endif
\ No newline at end of file
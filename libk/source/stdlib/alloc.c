@@ -19,11 +19,20 @@
 
 static block_meta_t* s_first_block = NULL;
 
+#ifdef ALLOC_PROFILE
+static alloc_profile_site_t s_alloc_profile_sites[ALLOC_PROFILE_SITES];
+static alloc_profile_site_t s_alloc_profile_overflow_site;		/* Counts allocations of sites that didnt fit in the table. */
+static alloc_profile_size_class_t s_alloc_profile_size_classes[ALLOC_PROFILE_SIZE_CLASSES];
+#endif
+
 void* malloc(size_t size)
 {
 	if (size == (size_t)0)
 		return NULL;
 	
+	/* Keep every block size a multiple of the alignment, so the next block (and its allocation) stays aligned too. */
+	size = ALIGN_UP(size, ALLOC_ALIGNMENT);
+
 	if(s_first_block == NULL)
 	{
 		size_t chunk_size = ALIGN_UP(size, VMM_PAGE_SIZE);
@@ -41,7 +50,7 @@ void* malloc(size_t size)
 		};
 		alloc_alloc_block(s_first_block, size);
 		
-		return BLOCK_START(s_first_block);
+		ALLOC_RETURN_BLOCK(s_first_block);
 	}
 	
 	block_meta_t* block = s_first_block;
@@ -51,7 +60,7 @@ void* malloc(size_t size)
 		if(block->free && block->size >= size)
 		{
 			alloc_alloc_block(block, size);
-			return BLOCK_START(block);
+			ALLOC_RETURN_BLOCK(block);
 		}
 
 		last_block = block;
@@ -74,7 +83,7 @@ void* malloc(size_t size)
 
 	alloc_alloc_block(new_block, size);
 
-	return BLOCK_START(new_block);
+	ALLOC_RETURN_BLOCK(new_block);
 }
 
 void free(void* ptr)
@@ -91,6 +100,11 @@ void free(void* ptr)
 		return;
 
 	block_meta_t* block = (block_meta_t*)((uint64_t)ptr - sizeof(block_meta_t));
+
+#ifdef ALLOC_PROFILE
+	alloc_profile_free(block);
+#endif
+
 	block->free = true;
 
 	block_meta_t* first_free = block;
@@ -193,4 +207,161 @@ void alloc_alloc_block(block_meta_t* block, size_t size)
 
 	/* Because we just inserted a free block, there might be a free block after that, so in case there is merge them. */
 	alloc_merge_free(block->next);
-}
\ No newline at end of file
+}
+
+void malloc_get_stats(malloc_stats_t* stats)
+{
+	if(!stats)
+		return;
+
+	memset(stats, 0, sizeof(malloc_stats_t));
+
+	/* 
+	 * The blocks of a chunk are sorted by address, so a used block can only share its first page with the previous
+	 * used block. <last_used_page> is the last page that was counted as used, so it isnt counted twice.
+	 */
+	uint64_t last_used_page = (uint64_t)-1;
+	for(const block_meta_t* block = s_first_block; block != NULL; block = block->next)
+	{
+		stats->mapped_bytes += block->size + sizeof(block_meta_t);
+		stats->overhead_bytes += sizeof(block_meta_t);
+
+		if(block->free)
+		{
+			stats->free_bytes += block->size;
+			++stats->free_blocks;
+			stats->largest_free_block = MAX(stats->largest_free_block, block->size);
+			continue;
+		}
+
+		stats->used_bytes += block->size;
+		++stats->used_blocks;
+
+		uint64_t first_page = ALIGN_DOWN((uint64_t)block, VMM_PAGE_SIZE);
+		uint64_t last_page = ALIGN_DOWN(BLOCK_END(block) - 1, VMM_PAGE_SIZE);
+		if(first_page == last_used_page)
+			first_page += VMM_PAGE_SIZE;
+
+		if(first_page <= last_page)
+			stats->used_pages += (last_page - first_page) / VMM_PAGE_SIZE + 1;
+
+		last_used_page = last_page;
+	}
+
+	stats->mapped_pages = stats->mapped_bytes / VMM_PAGE_SIZE;
+	if(stats->free_bytes != 0)
+		stats->fragmentation = 1000 - (unsigned int)(stats->largest_free_block * 1000 / stats->free_bytes);
+}
+
+/* Prints "<name><value>\n" using <print>. */
+static void alloc_dump_value(void (*print)(const char* string), const char* name, uint64_t value, int base)
+{
+	char buffer[65];
+	print(name);
+	if(base == 16)
+		print("0x");
+
+	print(ulltoa(value, buffer, base));
+	print("\n");
+}
+
+void malloc_dump(void (*print)(const char* string))
+{
+	if(!print)
+		return;
+
+	malloc_stats_t stats;
+	malloc_get_stats(&stats);
+
+	print("Heap statistics:\n");
+	alloc_dump_value(print, "  Mapped bytes:         ", stats.mapped_bytes, 10);
+	alloc_dump_value(print, "  Used bytes:           ", stats.used_bytes, 10);
+	alloc_dump_value(print, "  Free bytes:           ", stats.free_bytes, 10);
+	alloc_dump_value(print, "  Header bytes:         ", stats.overhead_bytes, 10);
+	alloc_dump_value(print, "  Used blocks:          ", stats.used_blocks, 10);
+	alloc_dump_value(print, "  Free blocks:          ", stats.free_blocks, 10);
+	alloc_dump_value(print, "  Largest free block:   ", stats.largest_free_block, 10);
+	alloc_dump_value(print, "  Mapped pages:         ", stats.mapped_pages, 10);
+	alloc_dump_value(print, "  Used pages:           ", stats.used_pages, 10);
+	alloc_dump_value(print, "  Fragmentation (0.1%): ", stats.fragmentation, 10);
+
+#ifdef ALLOC_PROFILE
+	print("Live allocations per call site:\n");
+	for(size_t i = 0; i < ALLOC_PROFILE_SITES; ++i)
+	{
+		const alloc_profile_site_t* site = &s_alloc_profile_sites[i];
+		if(site->caller == NULL || site->live_count == 0)
+			continue;
+
+		alloc_dump_value(print, "  Site ", (uint64_t)site->caller, 16);
+		alloc_dump_value(print, "    Live bytes:  ", site->live_bytes, 10);
+		alloc_dump_value(print, "    Live blocks: ", site->live_count, 10);
+		alloc_dump_value(print, "    Total:       ", site->total_count, 10);
+	}
+
+	if(s_alloc_profile_overflow_site.total_count != 0)
+	{
+		print("  Sites that didnt fit in the site table:\n");
+		alloc_dump_value(print, "    Live bytes:  ", s_alloc_profile_overflow_site.live_bytes, 10);
+		alloc_dump_value(print, "    Live blocks: ", s_alloc_profile_overflow_site.live_count, 10);
+		alloc_dump_value(print, "    Total:       ", s_alloc_profile_overflow_site.total_count, 10);
+	}
+
+	print("Allocations per size class:\n");
+	for(size_t i = 0; i < ALLOC_PROFILE_SIZE_CLASSES; ++i)
+	{
+		const alloc_profile_size_class_t* size_class = &s_alloc_profile_size_classes[i];
+		if(size_class->total_count == 0)
+			continue;
+
+		alloc_dump_value(print, "  Up to bytes: ", ((uint64_t)1 << i) * 2 - 1, 10);
+		alloc_dump_value(print, "    Live:  ", size_class->live_count, 10);
+		alloc_dump_value(print, "    Total: ", size_class->total_count, 10);
+	}
+#endif
+}
+
+#ifdef ALLOC_PROFILE
+void alloc_profile_alloc(block_meta_t* block, void* caller)
+{
+	block->caller = caller;
+
+	alloc_profile_site_t* site = alloc_profile_find_site(caller);
+	site->live_bytes += block->size;
+	++site->live_count;
+	++site->total_count;
+
+	alloc_profile_size_class_t* size_class = &s_alloc_profile_size_classes[63 - __builtin_clzll(block->size)];
+	++size_class->live_count;
+	++size_class->total_count;
+}
+
+void alloc_profile_free(const block_meta_t* block)
+{
+	alloc_profile_site_t* site = alloc_profile_find_site(block->caller);
+	site->live_bytes -= block->size;
+	--site->live_count;
+
+	--s_alloc_profile_size_classes[63 - __builtin_clzll(block->size)].live_count;
+}
+
+alloc_profile_site_t* alloc_profile_find_site(void* caller)
+{
+	/* Open addressing with linear probing. Return addresses are at least byte aligned, so mix the bits before indexing. */
+	uint64_t hash = ((uint64_t)caller * 0x9E3779B97F4A7C15llu) >> 32;
+	for(size_t i = 0; i < ALLOC_PROFILE_SITES; ++i)
+	{
+		alloc_profile_site_t* site = &s_alloc_profile_sites[(hash + i) % ALLOC_PROFILE_SITES];
+		if(site->caller == caller)
+			return site;
+
+		if(site->caller == NULL)
+		{
+			site->caller = caller;
+			return site;
+		}
+	}
+
+	return &s_alloc_profile_overflow_site;
+}
+#endif
\ No newline at end of file
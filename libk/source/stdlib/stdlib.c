@@ -21,12 +21,33 @@
 #include <stdint.h>
 #include "cpu.h"
 
-unsigned int popcount64(uint64_t number)
+char* ulltoa(unsigned long long value, char* buffer, int base)
 {
-	uint32_t ecx, unused;
-	cpuid(CPUID_CODE_GET_FEATURES, &unused, &unused, &ecx, &unused);
+	if(base < 2 || base > 16)
+	{
+		buffer[0] = '\0';
+		return buffer;
+	}
+
+	/* Write the digits from the end of a temporary buffer backwards, then copy them to the beginning of <buffer>. */
+	char digits[64];
+	int length = 0;
+	do
+	{
+		digits[length++] = "0123456789ABCDEF"[value % base];
+		value /= base;
+	} while(value);
 
-	if(ecx & CPUID_FEATURE_ECX_POPCNT)					/* If the POPCNT instruction is available, use it. */
+	for(int i = 0; i < length; ++i)
+		buffer[i] = digits[length - i - 1];
+
+	buffer[length] = '\0';
+	return buffer;
+}
+
+unsigned int popcount64(uint64_t number)
+{
+	if(cpu_has_features(CPU_FEATURE_POPCNT))			/* If the POPCNT instruction is available, use it. */
 	{
 		uint64_t count;
 		asm volatile("popcntq %1, %0"
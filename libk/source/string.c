@@ -17,12 +17,161 @@
 
 #include "string.h"
 
-/* TODO: Optimize this function. */
+#include <immintrin.h>
+#include "cpu.h"
+#include "common.h"
+#include "mm/vmm/vmm.h"
+
+/* 
+ * Sizes are split into tiers:
+ * 	- Less than 16 bytes: A few (possibly overlapping) general purpose register loads/stores, no loops.
+ * 	- Up to STRING_REP_THRESHOLD bytes: SSE2 (or AVX2) loops, as REP MOVSB/STOSB has a startup cost. (Unless FSRM)
+ * 	- Bigger: REP MOVSB/STOSB if the CPU has ERMS, which uses full cache line stores. Otherwise the SSE2/AVX2 loops.
+ * The loops finish with a single unaligned (overlapping) vector for the tail, instead of a byte loop.
+ */
+#define STRING_REP_THRESHOLD 	512
+
+/* Below this size the non-temporal functions use the cached versions, as the buffer probably fits in the cache anyway. */
+#define STRING_NT_THRESHOLD 	1024
+
+/* Unaligned types that may alias anything, for loading and storing at any address. */
+typedef uint64_t __attribute__((may_alias, aligned(1))) unaligned_uint64_t;
+typedef uint32_t __attribute__((may_alias, aligned(1))) unaligned_uint32_t;
+typedef uint16_t __attribute__((may_alias, aligned(1))) unaligned_uint16_t;
+
+/* Copy less than 16 bytes. Loads everything before storing, so its safe for overlapping buffers. */
+static inline void string_copy_small(uint8_t* d, const uint8_t* s, size_t count)
+{
+	if(count >= 8)
+	{
+		uint64_t head = *(const unaligned_uint64_t*)s;
+		uint64_t tail = *(const unaligned_uint64_t*)(s + count - 8);
+		*(unaligned_uint64_t*)d = head;
+		*(unaligned_uint64_t*)(d + count - 8) = tail;
+	}
+	else if(count >= 4)
+	{
+		uint32_t head = *(const unaligned_uint32_t*)s;
+		uint32_t tail = *(const unaligned_uint32_t*)(s + count - 4);
+		*(unaligned_uint32_t*)d = head;
+		*(unaligned_uint32_t*)(d + count - 4) = tail;
+	}
+	else if(count >= 2)
+	{
+		uint16_t head = *(const unaligned_uint16_t*)s;
+		uint16_t tail = *(const unaligned_uint16_t*)(s + count - 2);
+		*(unaligned_uint16_t*)d = head;
+		*(unaligned_uint16_t*)(d + count - 2) = tail;
+	}
+	else if(count == 1)
+		*d = *s;
+}
+
+/* 
+ * Copy <count> bytes forwards, <count> must be at least 16. 
+ * Safe for overlapping buffers if <d> is below <s>, as each vector is loaded before the bytes it overlaps are stored.
+ */
+static void string_copy_forward_sse2(uint8_t* d, const uint8_t* s, size_t count)
+{
+	__m128i tail = _mm_loadu_si128((const __m128i*)(s + count - 16));
+	for(size_t i = 0; i < count - 16; i += 16)
+		_mm_storeu_si128((__m128i*)(d + i), _mm_loadu_si128((const __m128i*)(s + i)));
+
+	_mm_storeu_si128((__m128i*)(d + count - 16), tail);
+}
+
+/* Same as string_copy_forward_sse2, with 32 byte vectors. <count> must be at least 32. */
+__attribute__((target("avx2")))
+static void string_copy_forward_avx2(uint8_t* d, const uint8_t* s, size_t count)
+{
+	__m256i tail = _mm256_loadu_si256((const __m256i*)(s + count - 32));
+	for(size_t i = 0; i < count - 32; i += 32)
+		_mm256_storeu_si256((__m256i*)(d + i), _mm256_loadu_si256((const __m256i*)(s + i)));
+
+	_mm256_storeu_si256((__m256i*)(d + count - 32), tail);
+	_mm256_zeroupper();
+}
+
+/* Copy <count> bytes backwards, <count> must be at least 16. Safe for overlapping buffers if <d> is above <s>. */
+static void string_copy_backward_sse2(uint8_t* d, const uint8_t* s, size_t count)
+{
+	__m128i head = _mm_loadu_si128((const __m128i*)s);
+	for(size_t i = count; i > 16; i -= 16)
+		_mm_storeu_si128((__m128i*)(d + i - 16), _mm_loadu_si128((const __m128i*)(s + i - 16)));
+
+	_mm_storeu_si128((__m128i*)d, head);
+}
+
+static void string_set_sse2(uint8_t* d, uint8_t value, size_t count)
+{
+	__m128i v = _mm_set1_epi8((char)value);
+	for(size_t i = 0; i < count - 16; i += 16)
+		_mm_storeu_si128((__m128i*)(d + i), v);
+
+	_mm_storeu_si128((__m128i*)(d + count - 16), v);
+}
+
+__attribute__((target("avx2")))
+static void string_set_avx2(uint8_t* d, uint8_t value, size_t count)
+{
+	__m256i v = _mm256_set1_epi8((char)value);
+	for(size_t i = 0; i < count - 32; i += 32)
+		_mm256_storeu_si256((__m256i*)(d + i), v);
+
+	_mm256_storeu_si256((__m256i*)(d + count - 32), v);
+	_mm256_zeroupper();
+}
+
+/* 
+ * Compare 32 bytes at a time, while at least 32 bytes are left. Writes the offset of the first differing byte into <offset>, 
+ * or the amount of bytes that were compared if there is no difference. Returns true if a difference was found.
+ */
+__attribute__((target("avx2")))
+static bool string_compare_avx2(const uint8_t* l, const uint8_t* r, size_t count, size_t* offset)
+{
+	size_t i = 0;
+	for(; i + 32 <= count; i += 32)
+	{
+		__m256i equal = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(l + i)), _mm256_loadu_si256((const __m256i*)(r + i)));
+		uint32_t mask = (uint32_t)_mm256_movemask_epi8(equal);
+		if(mask != 0xFFFFFFFF)
+		{
+			_mm256_zeroupper();
+			*offset = i + __builtin_ctz(~mask);
+			return true;
+		}
+	}
+
+	_mm256_zeroupper();
+	*offset = i;
+	return false;
+}
+
 void* memset(void* dest, int ch, size_t size)
 {
 	uint8_t* d = (uint8_t*)dest;
-	for(size_t i = 0; i < size; i++)
-		d[i] = (uint8_t)ch;
+	uint8_t value = (uint8_t)ch;
+
+	if(size < 16)
+	{
+		uint64_t pattern = (uint64_t)value * 0x0101010101010101llu;
+		string_copy_small(d, (const uint8_t*)&pattern, MIN(size, (size_t)8));
+		if(size > 8)
+			*(unaligned_uint64_t*)(d + size - 8) = pattern;
+	}
+	else if(cpu_has_features(CPU_FEATURE_FSRM) || (size >= STRING_REP_THRESHOLD && cpu_has_features(CPU_FEATURE_ERMS)))
+	{
+		asm volatile("rep stosb"
+			: "+D"(d), "+c"(size)
+			: "a"(value)
+			: "memory"
+		);
+	}
+	else if(size >= 32 && cpu_has_features(CPU_FEATURE_AVX2))
+		string_set_avx2(d, value, size);
+	else
+		string_set_sse2(d, value, size);
+
 	return dest;
 }
 
@@ -30,7 +179,26 @@ int memcmp(const void* lhs, const void* rhs, size_t count)
 {
 	const uint8_t* l = (const uint8_t*)lhs;
 	const uint8_t* r = (const uint8_t*)rhs;
-	for(size_t i = 0; i < count; ++i)
+
+	size_t i = 0;
+	if(count >= 32 && cpu_has_features(CPU_FEATURE_AVX2))
+	{
+		if(string_compare_avx2(l, r, count, &i))
+			return l[i] < r[i] ? -1 : 1;
+	}
+
+	for(; i + 16 <= count; i += 16)
+	{
+		__m128i equal = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(l + i)), _mm_loadu_si128((const __m128i*)(r + i)));
+		uint32_t mask = (uint32_t)_mm_movemask_epi8(equal);
+		if(mask != 0xFFFF)
+		{
+			i += __builtin_ctz(~mask);
+			return l[i] < r[i] ? -1 : 1;
+		}
+	}
+
+	for(; i < count; ++i)
 	{
 		if(l[i] < r[i])
 			return -1;
@@ -44,7 +212,150 @@ void* memcpy(void* dest, const void* src, size_t count)
 {
 	uint8_t* d = (uint8_t*)dest;
 	const uint8_t* s = (const uint8_t*)src;
-	for(size_t i = 0; i < count; ++i)
-		d[i] = s[i];
+
+	if(count < 16)
+		string_copy_small(d, s, count);
+	else if(cpu_has_features(CPU_FEATURE_FSRM) || (count >= STRING_REP_THRESHOLD && cpu_has_features(CPU_FEATURE_ERMS)))
+	{
+		asm volatile("rep movsb"
+			: "+D"(d), "+S"(s), "+c"(count)
+			:
+			: "memory"
+		);
+	}
+	else if(count >= 32 && cpu_has_features(CPU_FEATURE_AVX2))
+		string_copy_forward_avx2(d, s, count);
+	else
+		string_copy_forward_sse2(d, s, count);
+
 	return dest;
+}
+
+void* memmove(void* dest, const void* src, size_t count)
+{
+	uint8_t* d = (uint8_t*)dest;
+	const uint8_t* s = (const uint8_t*)src;
+
+	/* 
+	 * If <d> is below <s> or the buffers dont overlap, a forward copy is safe. (Including REP MOVSB, which copies byte by byte)
+	 * When <d> is below <s>, <d> - <s> wraps around to a huge number.
+	 */
+	if((uint64_t)d - (uint64_t)s >= count)
+		return memcpy(dest, src, count);
+
+	if(count < 16)
+		string_copy_small(d, s, count);
+	else
+		string_copy_backward_sse2(d, s, count);
+
+	return dest;
+}
+
+void* memchr(const void* ptr, int ch, size_t count)
+{
+	if(count == (size_t)0)
+		return NULL;
+
+	const uint8_t* p = (const uint8_t*)ptr;
+	const uint8_t* end = p + count;
+	__m128i needle = _mm_set1_epi8((char)ch);
+
+	/* 
+	 * Only aligned 16 byte loads are used. They never cross a page boundary, so reading past <end> cant fault.
+	 * The bytes of the first block that are before <ptr> are masked out.
+	 */
+	const uint8_t* block = (const uint8_t*)ALIGN_DOWN((uint64_t)p, (uint64_t)16);
+	uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128((const __m128i*)block), needle));
+	mask &= 0xFFFF << (p - block);
+
+	while(true)
+	{
+		if(mask)
+		{
+			const uint8_t* found = block + __builtin_ctz(mask);
+			return found < end ? (void*)found : NULL;
+		}
+
+		block += 16;
+		if(block >= end)
+			return NULL;
+
+		mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128((const __m128i*)block), needle));
+	}
+}
+
+void* memset_nt(void* dest, int ch, size_t size)
+{
+	if(size < STRING_NT_THRESHOLD)
+		return memset(dest, ch, size);
+
+	/* Set the unaligned head normally, then stream full 64 byte cache lines, then set the tail normally. */
+	uint8_t* d = (uint8_t*)dest;
+	uint8_t* body = (uint8_t*)ALIGN_UP((uint64_t)d, (uint64_t)CPU_CACHE_LINE_SIZE);
+	uint8_t* body_end = (uint8_t*)ALIGN_DOWN((uint64_t)d + size, (uint64_t)CPU_CACHE_LINE_SIZE);
+	memset(d, ch, body - d);
+
+	__m128i v = _mm_set1_epi8((char)ch);
+	for(uint8_t* line = body; line < body_end; line += CPU_CACHE_LINE_SIZE)
+	{
+		_mm_stream_si128((__m128i*)line, v);
+		_mm_stream_si128((__m128i*)(line + 16), v);
+		_mm_stream_si128((__m128i*)(line + 32), v);
+		_mm_stream_si128((__m128i*)(line + 48), v);
+	}
+	_mm_sfence();
+
+	memset(body_end, ch, d + size - body_end);
+	return dest;
+}
+
+void* memcpy_nt(void* dest, const void* src, size_t count)
+{
+	if(count < STRING_NT_THRESHOLD)
+		return memcpy(dest, src, count);
+
+	/* The destination is aligned for the streaming stores, the source may stay unaligned. */
+	uint8_t* d = (uint8_t*)dest;
+	const uint8_t* s = (const uint8_t*)src;
+	size_t head = ALIGN_UP((uint64_t)d, (uint64_t)CPU_CACHE_LINE_SIZE) - (uint64_t)d;
+	memcpy(d, s, head);
+	d += head;
+	s += head;
+	count -= head;
+
+	for(; count >= CPU_CACHE_LINE_SIZE; count -= CPU_CACHE_LINE_SIZE)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i*)s);
+		__m128i b = _mm_loadu_si128((const __m128i*)(s + 16));
+		__m128i c = _mm_loadu_si128((const __m128i*)(s + 32));
+		__m128i e = _mm_loadu_si128((const __m128i*)(s + 48));
+		_mm_stream_si128((__m128i*)d, a);
+		_mm_stream_si128((__m128i*)(d + 16), b);
+		_mm_stream_si128((__m128i*)(d + 32), c);
+		_mm_stream_si128((__m128i*)(d + 48), e);
+		d += CPU_CACHE_LINE_SIZE;
+		s += CPU_CACHE_LINE_SIZE;
+	}
+	_mm_sfence();
+
+	memcpy(d, s, count);
+	return dest;
+}
+
+void clear_page(void* page)
+{
+	/* MOVNTI only needs general purpose registers, 8 of them fill a cache line. */
+	long long* p = (long long*)page;
+	for(size_t i = 0; i < VMM_PAGE_SIZE / sizeof(long long); i += 8)
+	{
+		_mm_stream_si64(&p[i], 0);
+		_mm_stream_si64(&p[i + 1], 0);
+		_mm_stream_si64(&p[i + 2], 0);
+		_mm_stream_si64(&p[i + 3], 0);
+		_mm_stream_si64(&p[i + 4], 0);
+		_mm_stream_si64(&p[i + 5], 0);
+		_mm_stream_si64(&p[i + 6], 0);
+		_mm_stream_si64(&p[i + 7], 0);
+	}
+	_mm_sfence();
 }
\ No newline at end of file
@@ -19,10 +19,15 @@
 
 static void* s_acpi_root_sdt = NULL;
 static int s_acpi_version = -1;
+static hash_map_t<uint32_t, acpi_table_entry_t> s_acpi_tables;
 
 int acpi_init(multiboot_info_t* mbd)
 {
-	return acpi_init_rsdt(mbd);
+	int status = acpi_init_rsdt(mbd);
+	if(status != SUCCESS)
+		return status;
+
+	return acpi_index_tables();
 }
 
 int acpi_init_rsdt(multiboot_info_t* mbd)
@@ -47,7 +52,7 @@ int acpi_init_rsdt(multiboot_info_t* mbd)
 		if(memcmp(xsdp->rsdp.signature, ACPI_RSDP_SIGNATURE, 8) != 0)
 			return ERR_ACPI_RSDP_NOT_FOUND;
 
-		int status = acpi_map_sdt(xsdp->xsdt_address, &s_acpi_root_sdt, NULL);
+		int status = acpi_map_sdt(xsdp->xsdt_address, VMM_PAGE_P, &s_acpi_root_sdt, NULL);
 		if(status != SUCCESS)
 			return status;
 
@@ -67,7 +72,7 @@ int acpi_init_rsdt(multiboot_info_t* mbd)
 		if(memcmp(rsdp->signature, ACPI_RSDP_SIGNATURE, 8) != 0)
 			return ERR_ACPI_RSDP_NOT_FOUND;			
 
-		int status = acpi_map_sdt((phys_addr_t)rsdp->rsdt_address & 0xFFFFFFFF, &s_acpi_root_sdt, NULL);
+		int status = acpi_map_sdt((phys_addr_t)rsdp->rsdt_address & 0xFFFFFFFF, VMM_PAGE_P, &s_acpi_root_sdt, NULL);
 		if(status != SUCCESS)
 			return status;
 
@@ -85,7 +90,74 @@ int acpi_init_rsdt(multiboot_info_t* mbd)
 	return SUCCESS;
 }
 
-int acpi_map_sdt(phys_addr_t sdt, void** mapped_sdt, size_t* page_count)
+int acpi_index_tables()
+{
+	size_t count;
+	if(s_acpi_version == 2)
+		count = (((acpi_xsdt_t*)s_acpi_root_sdt)->header.size - sizeof(acpi_sdt_header_t)) / sizeof(uint64_t);
+	else if(s_acpi_version == 1)
+		count = (((acpi_rsdt_t*)s_acpi_root_sdt)->header.size - sizeof(acpi_sdt_header_t)) / sizeof(uint32_t);
+	else
+		return ERR_ACPI_NOT_INITIALIZED;
+
+	if(!s_acpi_tables.reserve(count))
+		return ERR_OUT_OF_MEMORY;
+
+	for(size_t i = 0; i < count; ++i)
+	{
+		phys_addr_t address;
+		if(s_acpi_version == 2)
+			address = ((acpi_xsdt_t*)s_acpi_root_sdt)->sdt_pointers[i];
+		else
+			address = (phys_addr_t)((acpi_rsdt_t*)s_acpi_root_sdt)->sdt_pointers[i] & 0xFFFFFFFF;
+
+		acpi_sdt_header_t* sdt;
+		int status = acpi_map_sdt(address, VMM_PAGE_P, (void**)&sdt, NULL);
+		if(status != SUCCESS)
+			return status;
+
+		uint32_t key = acpi_signature_key(sdt->signature);
+		const acpi_table_entry_t* existing = s_acpi_tables.find(key);
+		if(existing && existing->valid)
+		{
+			acpi_unmap_sdt(sdt);
+			continue;
+		}
+
+		if(existing)
+			acpi_unmap_sdt((void*)existing->table);
+
+		acpi_table_entry_t entry = {
+			.address = address,
+			.size = sdt->size,
+			.valid = acpi_is_table_valid(sdt, sdt->size),
+			.table = sdt
+		};
+		if(!s_acpi_tables.insert(key, entry))
+			return ERR_OUT_OF_MEMORY;
+	}
+
+	return SUCCESS;
+}
+
+const acpi_table_entry_t* acpi_get_table_entry(const char* signature)
+{
+	if(!signature)
+		return NULL;
+
+	return s_acpi_tables.find(acpi_signature_key(signature));
+}
+
+const void* acpi_get_table(const char* signature)
+{
+	const acpi_table_entry_t* entry = acpi_get_table_entry(signature);
+	if(!entry || !entry->valid)
+		return NULL;
+
+	return entry->table;
+}
+
+int acpi_map_sdt(phys_addr_t sdt, uint64_t flags, void** mapped_sdt, size_t* page_count)
 {
 	/* 
 	 * The actual type of the SDT is unknown for know, but we know each SDT has a header, 
@@ -96,7 +168,7 @@ int acpi_map_sdt(phys_addr_t sdt, void** mapped_sdt, size_t* page_count)
 	 */
 
 	size_t pages = VMM_ADDRESS_SIZE_PAGES(sdt, sizeof(acpi_sdt_header_t));
-	virt_addr_t mapped_pages = vmm_map_physical_pages(sdt, VMM_PAGE_P | VMM_PAGE_RW, pages);
+	virt_addr_t mapped_pages = vmm_map_physical_pages(sdt, flags, pages);
 	if(mapped_pages == (virt_addr_t)-1)
 		return ERR_OUT_OF_MEMORY;
 
@@ -110,7 +182,7 @@ int acpi_map_sdt(phys_addr_t sdt, void** mapped_sdt, size_t* page_count)
 			return status;
 
 		pages = VMM_ADDRESS_SIZE_PAGES(sdt, sdt_size);
-		mapped_pages = vmm_map_physical_pages(sdt, VMM_PAGE_P | VMM_PAGE_RW, pages);
+		mapped_pages = vmm_map_physical_pages(sdt, flags, pages);
 		if(mapped_pages == (virt_addr_t)-1)
 			return ERR_OUT_OF_MEMORY;
 		
@@ -147,89 +219,31 @@ int acpi_find_table(const char* signature, void** table, size_t* page_count)
 	if(!signature || ! table || ! page_count)
 		return ERR_INVALID_PARAMETER;
 	
-	int status;
-	acpi_sdt_header_t* sdt;
-	size_t pages;
-	if(s_acpi_version == 2)
-	{
-		acpi_xsdt_t* xsdt = (acpi_xsdt_t*)s_acpi_root_sdt;
-		int length = (xsdt->header.size - sizeof(xsdt->header)) / sizeof(xsdt->sdt_pointers[0]);
-		for(int i = 0; i < length; ++i)
-		{
-			status = acpi_map_sdt(xsdt->sdt_pointers[i], (void**)&sdt, &pages);
-			if(status != SUCCESS)
-				return status;
-
-			if(memcmp(((acpi_sdt_header_t*)sdt)->signature, signature, 4) == 0 && acpi_is_table_valid(sdt, sdt->size))
-			{
-				*table = sdt;
-				*page_count = pages;
-				return SUCCESS;
-			}
-			status = acpi_unmap_sdt(sdt);
-			if(status != SUCCESS)
-				return status;
-		}
-	}
-	else if(s_acpi_version == 1)
-	{
-		acpi_rsdt_t* rsdt = (acpi_rsdt_t*)s_acpi_root_sdt;
-		int length = (rsdt->header.size - sizeof(rsdt->header)) / sizeof(rsdt->sdt_pointers[0]);
-		for(int i = 0; i < length; ++i)
-		{
-			status = acpi_map_sdt((phys_addr_t)rsdt->sdt_pointers[i] & 0xFFFFFFFF, (void**)&sdt, &pages);
-			if(status != SUCCESS)
-				return status;
-
-			if(memcmp(((acpi_sdt_header_t*)sdt)->signature, signature, 4) == 0 && acpi_is_table_valid(sdt, sdt->size))
-			{
-				*table = sdt;
-				*page_count = pages;
-				return SUCCESS;
-			}
-			status = vmm_unmap_pages((virt_addr_t)sdt, pages);
-			if(status != SUCCESS)
-				return status;
-		}
-	}
-	else
+	if(s_acpi_version == -1)
 		return ERR_ACPI_NOT_INITIALIZED;
-	
-	return ERR_ACPI_TABLE_NOT_FOUND;
+
+	const acpi_table_entry_t* entry = acpi_get_table_entry(signature);
+	if(!entry || !entry->valid)
+		return ERR_ACPI_TABLE_NOT_FOUND;
+
+	return acpi_map_sdt(entry->address, VMM_PAGE_P | VMM_PAGE_RW, table, page_count);
 }
 
 void* acpi_find_table_copy(const char* signature)
 {
-	void* table;
-	size_t pages;
-	int status = acpi_find_table(signature, &table, &pages);
-	if(status != SUCCESS)
+	const acpi_sdt_header_t* table = (const acpi_sdt_header_t*)acpi_get_table(signature);
+	if(!table)
 		return NULL;
 
-	void* table_copy = malloc(((acpi_sdt_header_t*)table)->size);
+	void* table_copy = malloc(table->size);
 	if(!table_copy)
-	{
-		acpi_unmap_sdt(table);
 		return NULL;
-	}
-
-	memcpy(table_copy, table, ((acpi_sdt_header_t*)table)->size);
-	status = acpi_unmap_sdt(table);
-	if(status != SUCCESS)
-	{
-		free(table_copy);
-		return NULL;
-	}
 
+	memcpy(table_copy, table, table->size);
 	return table_copy;
 }
 
 bool acpi_is_table_valid(void* table, size_t size)
 {
-	uint8_t sum = 0;
-	uint8_t* byte_table = (uint8_t*)table;
-	for (size_t i = 0; i < size; ++i)
-		sum += byte_table[i];
-	
-	return sum == 0;
+	return checksum8(table, size) == 0;
 }
\ No newline at end of file
@@ -18,12 +18,15 @@
 #include "apic/apic.h"
 
 #include <stdlib.h>
+#include <static_vector.h>
 #include "error.h"
 #include "cpu.h"
 #include "acpi/acpi.h"
 #include "mm/vmm/vmm.h"
+#include "time/time.h"
 
-static ioapic_descriptor_t* s_ioapic_descriptor;
+/* The descriptors are contiguous, so finding the IO APIC of an IRQ doesnt chase pointers. */
+static static_vector_t<ioapic_descriptor_t, APIC_MAX_IOAPICS> s_ioapics;
 
 /* 
  * The virtual address override, represents the physical address of the mmio for all local APIC's on the system.
@@ -40,23 +43,40 @@ int apic_init()
 	if((edx & CPUID_FEATURE_EDX_APIC) == 0)
 		return ERR_APIC_NOT_SUPPORTED;
 	
-	acpi_madt_t* madt = (acpi_madt_t*)acpi_find_table_copy(ACPI_MADT_SIGNATURE);
+	const acpi_madt_t* madt = (const acpi_madt_t*)acpi_get_table(ACPI_MADT_SIGNATURE);
 	if(!madt)
 		return ERR_ACPI_MADT_NOT_FOUND;
 	
 	pic8259_disable();
 
 	for(
-		acpi_madt_record_header_t* record = madt->records; 
+		const acpi_madt_record_header_t* record = madt->records; 
 		(uint64_t)record < (uint64_t)madt + madt->header.size; 
-		*(uint8_t**)&record += record->size
+		record = (const acpi_madt_record_header_t*)((const uint8_t*)record + record->size)
 	)
 	{
 		switch(record->type)
 		{
+		case ACPI_MADT_TYPE_LOCAL_APIC:
+		{
+			/* The BSP is CPU 0, the other processors get the next indices in the order of the MADT. */
+			const acpi_madt_record_lapic_t* lapic_record = (const acpi_madt_record_lapic_t*)record;
+			if(
+				(lapic_record->flags & (ACPI_MADT_LAPIC_FLAG_ENABLED | ACPI_MADT_LAPIC_FLAG_ONLINE_CAPABLE)) == 0 || 
+				lapic_record->apic_id == g_cpu_locals[0].lapic_id ||
+				g_cpu_count >= CPU_MAX_COUNT
+			)
+				break;
+
+			g_cpu_locals[g_cpu_count].index = g_cpu_count;
+			g_cpu_locals[g_cpu_count].lapic_id = lapic_record->apic_id;
+			++g_cpu_count;
+			break;
+		}
+
 		case ACPI_MADT_TYPE_IOAPIC:
 		{
-			acpi_madt_record_ioapic_t* ioapic_record = (acpi_madt_record_ioapic_t*)record;
+			const acpi_madt_record_ioapic_t* ioapic_record = (const acpi_madt_record_ioapic_t*)record;
 			status = ioapic_init(ioapic_record);
 			if(status != SUCCESS)
 				goto cleanup;
@@ -67,7 +87,7 @@ int apic_init()
 		case ACPI_MADT_TYPE_LOCAL_APIC_ADDRESS_OVERRIDE:
 		{
 			/* The physical address of the local APIC configuration space if guaranteed to be 4 KiB aligned, see intel spec. */
-			acpi_madt_record_lapic_address_override_t* lapic_override = (acpi_madt_record_lapic_address_override_t*)record;
+			const acpi_madt_record_lapic_address_override_t* lapic_override = (const acpi_madt_record_lapic_address_override_t*)record;
 			s_lapic_address_override = vmm_map_physical_page(
 				lapic_override->lapic_address, 
 				VMM_PAGE_P | VMM_PAGE_RW | VMM_PAGE_PCD | VMM_PAGE_PTE_PAT	/* Disable caching, IO memory shouldnt be cached. */
@@ -89,8 +109,6 @@ int apic_init()
 	status = lapic_init();
 
 cleanup:
-	free(madt);
-
 	return status;
 }
 
@@ -103,24 +121,21 @@ void pic8259_disable()
 
 int apic_map_irq(uint8_t irq, uint8_t interrupt)
 {
-	ioapic_descriptor_t* ioapic = s_ioapic_descriptor;
-	while(ioapic)
+	for(const ioapic_descriptor_t& ioapic : s_ioapics)
 	{
-		if(ioapic_irq_in_range(ioapic, irq))
-			return ioapic_map_irq(ioapic, irq, interrupt);
-		
-		ioapic = ioapic->next;
+		if(ioapic_irq_in_range(&ioapic, irq))
+			return ioapic_map_irq(&ioapic, irq, interrupt);
 	}
 
 	return ERR_IRQ_NOT_SUPPORTED;
 }
 
-int ioapic_init(acpi_madt_record_ioapic_t* ioapic_record)
+int ioapic_init(const acpi_madt_record_ioapic_t* ioapic_record)
 {
 	if(!ioapic_record)
 		return ERR_INVALID_PARAMETER;
 	
-	ioapic_descriptor_t* descriptor = (ioapic_descriptor_t*)malloc(sizeof(ioapic_descriptor_t));
+	ioapic_descriptor_t* descriptor = s_ioapics.emplace_back();
 	if(!descriptor)
 		return ERR_OUT_OF_MEMORY;
 
@@ -142,15 +157,10 @@ int ioapic_init(acpi_madt_record_ioapic_t* ioapic_record)
 		descriptor->mmio = (uint8_t*)page;
 
 	if((virt_addr_t)descriptor->mmio == (virt_addr_t)-1)	
+	{
+		s_ioapics.pop_back();
 		return ERR_OUT_OF_MEMORY;
-
-	/* Insert the descriptor to the beginning of the IO APIC list */
-	if(!s_ioapic_descriptor)
-		descriptor->next = NULL;
-	else
-		descriptor->next = s_ioapic_descriptor;
-
-	s_ioapic_descriptor = descriptor;
+	}
 
 	return SUCCESS;
 }
@@ -197,7 +207,7 @@ bool ioapic_irq_in_range(const ioapic_descriptor_t* ioapic, uint8_t irq)
 	uint32_t max_redtbl = APIC_IOAPIC_IOAPICVER_MAX_REDTBL(version_reg);
 	uint8_t last_irq = ioapic->first_irq + APIC_IOAPIC_REDTBL_TO_IRQ(max_redtbl);
 
-	return irq > ioapic->first_irq && irq <= last_irq;
+	return irq >= ioapic->first_irq && irq <= last_irq;
 }
 
 uint32_t ioapic_read32(const ioapic_descriptor_t* ioapic, uint8_t reg)
@@ -256,7 +266,7 @@ int lapic_init()
 
 	/* Spurious interrupt = 0xFF, set enable local apic bit (0x100) */
 	uint32_t old_spurious = lapic_read_reg(LAPIC_REG_SPURIOUS_INT_VECTOR);
-	lapic_write_reg(LAPIC_REG_SPURIOUS_INT_VECTOR, old_spurious | 0xFF | 0x100);	
+	lapic_write_reg(LAPIC_REG_SPURIOUS_INT_VECTOR, old_spurious | LAPIC_SPURIOUS_VECTOR | LAPIC_SPURIOUS_ENABLE);	
 
 	return SUCCESS;
 }
@@ -283,6 +293,11 @@ uint64_t lapic_get_mmio()
 	return s_lapic_address_override;
 }
 
+void lapic_eoi()
+{
+	lapic_write_reg(LAPIC_REG_EOI, 0);
+}
+
 uint32_t lapic_read_reg(uint16_t reg)
 {
 	uint8_t* mmio = (uint8_t*)lapic_get_mmio();
@@ -297,4 +312,34 @@ void lapic_write_reg(uint16_t reg, uint32_t value)
 	uint8_t* mmio = (uint8_t*)lapic_get_mmio();
 	if(mmio)
 		*(uint32_t*)(mmio + (uint64_t)reg) = value; 
+}
+
+void lapic_send_ipi(uint32_t lapic_id, uint32_t command)
+{
+	/* Writing the low register sends the IPI, so the destination goes first. */
+	lapic_write_reg(LAPIC_REG_ICR_HIGH, LAPIC_ICR_DESTINATION(lapic_id));
+	lapic_write_reg(LAPIC_REG_ICR_LOW, command);
+
+	while(lapic_read_reg(LAPIC_REG_ICR_LOW) & LAPIC_ICR_DELIVERY_STATUS)
+		cpu_pause();
+}
+
+uint32_t lapic_timer_ticks_per_ms()
+{
+	/* Count down from the highest value while the TSC measures the time, the timer stays masked. */
+	lapic_write_reg(LAPIC_REG_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+	lapic_write_reg(LAPIC_REG_LVT_TIMER, LAPIC_LVT_MASKED);
+	lapic_write_reg(LAPIC_REG_TIMER_INITIAL_COUNT, 0xFFFFFFFF);
+	time_delay_us(LAPIC_TIMER_CALIBRATION_US);
+	uint32_t elapsed = 0xFFFFFFFF - lapic_read_reg(LAPIC_REG_TIMER_CURRENT_COUNT);
+	lapic_write_reg(LAPIC_REG_TIMER_INITIAL_COUNT, 0);
+
+	return elapsed / (LAPIC_TIMER_CALIBRATION_US / 1000);
+}
+
+void lapic_timer_start_periodic(uint8_t interrupt, uint32_t ticks)
+{
+	lapic_write_reg(LAPIC_REG_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+	lapic_write_reg(LAPIC_REG_LVT_TIMER, LAPIC_LVT_TIMER_PERIODIC | interrupt);
+	lapic_write_reg(LAPIC_REG_TIMER_INITIAL_COUNT, ticks);		/* Starts the timer */
 }
\ No newline at end of file
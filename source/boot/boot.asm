@@ -26,6 +26,7 @@ extern kernel_main
 
 %include "boot/gdt.inc"
 %include "boot/lm_setup.inc"
+%include "boot/ap_boot.inc"
 
 ; General multiboot2 tag.
 ; PARAMETERS
@@ -54,7 +55,7 @@ multiboot2_header_start:
 .end:
 
 section .bss
-resb 4096									; Allocate 4096 bytes for the stack
+resb 16384									; Allocate 16KiB for the stack. Interrupts save their XSAVE area (about 1KiB) on it too.
 stack_top:
 
 section .text
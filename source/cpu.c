@@ -0,0 +1,127 @@
+/* 
+ * This file is part of the EspressoOS project (https://github.com/rdex999/EspressoOS.git).
+ * Copyright (c) 2025 David Weizman.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "cpu.h"
+
+cpu_local_t g_cpu_locals[CPU_MAX_COUNT];
+uint32_t g_cpu_features = 0;
+uint32_t g_cpu_xsave_size = CPU_FXSAVE_AREA_SIZE;
+uint32_t g_cpu_count = 1;
+
+/* Enable SSE, and the XSAVE state components of the features in g_cpu_features, on the current CPU. */
+static void cpu_enable_extensions()
+{
+	/* SSE2 is part of x86-64, so just enable it. */
+	write_cr0((read_cr0() & ~(uint64_t)(CPU_CR0_EM | CPU_CR0_TS)) | CPU_CR0_MP);
+	write_cr4(read_cr4() | CPU_CR4_OSFXSR | CPU_CR4_OSXMMEXCPT);
+
+	if(!cpu_has_features(CPU_FEATURE_XSAVE))
+		return;
+
+	write_cr4(read_cr4() | CPU_CR4_OSXSAVE);
+
+	uint64_t xcr0 = CPU_XCR0_X87 | CPU_XCR0_SSE;
+	if(cpu_has_features(CPU_FEATURE_AVX))
+		xcr0 |= CPU_XCR0_AVX;
+
+	cpu_write_xcr(0, xcr0);
+}
+
+void cpu_init()
+{
+	uint32_t max_code, unused, ebx, ecx, edx;
+	cpuid(CPUID_CODE_GET_VENDOR, &max_code, &ebx, &ecx, &edx);
+	cpuid(CPUID_CODE_GET_FEATURES, &unused, &ebx, &ecx, &edx);
+
+	uint32_t features = 0;
+	if(ecx & CPUID_FEATURE_ECX_POPCNT)
+		features |= CPU_FEATURE_POPCNT;
+
+	if(ecx & CPUID_FEATURE_ECX_SSE42)
+		features |= CPU_FEATURE_SSE42;
+
+	if(ecx & CPUID_FEATURE_ECX_PCLMULQDQ)
+		features |= CPU_FEATURE_PCLMULQDQ;
+
+	if(ecx & CPUID_FEATURE_ECX_XSAVE)
+	{
+		features |= CPU_FEATURE_XSAVE;
+		if(ecx & CPUID_FEATURE_ECX_AVX)
+			features |= CPU_FEATURE_AVX;
+	}
+
+	if(max_code >= CPUID_CODE_GET_EXTENDED_FEATURES)
+	{
+		cpuid_count(CPUID_CODE_GET_EXTENDED_FEATURES, 0, &unused, &ebx, &ecx, &edx);
+
+		/* AVX2 uses the YMM state, which is only enabled if AVX is. */
+		if((ebx & CPUID_EXTENDED_FEATURE_EBX_AVX2) && (features & CPU_FEATURE_AVX))
+			features |= CPU_FEATURE_AVX2;
+
+		if(ebx & CPUID_EXTENDED_FEATURE_EBX_ERMS)
+			features |= CPU_FEATURE_ERMS;
+
+		if(edx & CPUID_EXTENDED_FEATURE_EDX_FSRM)
+			features |= CPU_FEATURE_FSRM;
+	}
+
+	g_cpu_features = features;
+	cpu_enable_extensions();
+
+	if(cpu_has_features(CPU_FEATURE_XSAVE))
+	{
+		/* The interrupt stubs save everything that was enabled, so they need the area size of the new XCR0. */
+		cpuid_count(CPUID_CODE_GET_XSAVE_INFO, 0, &unused, &ebx, &unused, &unused);
+		g_cpu_xsave_size = ebx;
+	}
+}
+
+void cpu_init_ap()
+{
+	cpu_enable_extensions();
+}
+
+void cpu_init_local(uint32_t index)
+{
+	if(index >= CPU_MAX_COUNT)
+		return;
+
+	uint32_t unused, ebx;
+	cpuid(CPUID_CODE_GET_FEATURES, &unused, &ebx, &unused, &unused);
+
+	cpu_local_t* local = &g_cpu_locals[index];
+	local->self = local;
+	local->index = index;
+	local->lapic_id = CPUID_FEATURE_EBX_INIT_APIC_ID(ebx);
+
+	cpu_write_msr(MSR_IA32_GS_BASE, (uint64_t)local);
+	cpu_init_pat();
+}
+
+void cpu_init_pat()
+{
+	uint32_t unused, edx;
+	cpuid(CPUID_CODE_GET_FEATURES, &unused, &unused, &unused, &edx);
+	if((edx & CPUID_FEATURE_EDX_PAT) == 0)
+		return;
+
+	/* Cached lines and TLB entries may have been created with the old memory types, so flush both. (See the Intel SDM) */
+	cpu_flush_caches();
+	cpu_write_msr(MSR_IA32_PAT, CPU_PAT_LAYOUT);
+	cpu_flush_caches();
+	write_cr3(read_cr3());
+}
\ No newline at end of file
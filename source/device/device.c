@@ -16,15 +16,17 @@
  */
 
 #include "device/device.h"
+#include "device/registry.h"
+#include "cpu.h"
 
 device_computer_t g_device_root;
 
 void device_t::destroy()
 {
-	device_t* device = m_children;
+	device_t* device = m_children.front();
 	while (device)
 	{
-		device_t* next = device->m_next;
+		device_t* next = m_children.next(device);
 		
 		device->destroy();
 		
@@ -35,57 +37,81 @@ void device_t::destroy()
 		m_parent->remove_child(this);
 
 	uninitialize();
-	free(this);
+	release();
 }
 
-device_t* device_t::find(const device_t* device) const
+int device_t::add_child(device_t* device)
 {
 	if(!device)
-		return NULL;
+		return ERR_INVALID_PARAMETER;
 
-	if(is_device(device))
-		return (device_t*)this;
-	
-	device_t* child = m_children;
-	while (child)
-	{
-		if(device_t* found = child->find(device))
-			return found;
-
-		child = child->m_next;
-	}
+	int status = device_registry_add(device);
+	if(status != SUCCESS)
+		return status;
 
-	return NULL;
+	m_children.push_front(device);
+	device->m_parent = this;
+	return SUCCESS;
 }
 
-void device_t::add_child(device_t* device)
+void device_t::remove_child(device_t* device)
 {
 	if(!device)
 		return;
 
-	if(m_children)
-		m_children->m_prev = device;
+	device_registry_remove(device);
+	m_children.remove(device);
+	device->m_parent = NULL;
+}
 
-	device->m_next = m_children;
-	m_children = device;
-	device->m_parent = this;
+void device_t::initialize_tree()
+{
+	while(poll_children())
+		cpu_pause();
 }
 
-void device_t::remove_child(device_t* device)
+bool device_t::poll_children()
 {
-	if(!device)
-		return;
+	bool pending = false;
 
-	if (device->m_prev)
-		device->m_prev->m_next = device->m_next;
+	device_t* child = m_children.front();
+	while(child)
+	{
+		device_t* next = m_children.next(child);
+
+		if(child->m_state != DEVICE_STATE_READY)
+		{
+			int status = child->poll_initialize();
+			if(status == SUCCESS)
+				child->m_state = DEVICE_STATE_READY;
+			else if(status == ERR_DEVICE_BUSY)
+			{
+				child->m_state = DEVICE_STATE_INITIALIZING;
+				pending = true;
+			}
+			else
+			{
+				child->destroy();
+				child = next;
+				continue;
+			}
+		}
+
+		/* Children of a device are initialized only once it is ready, their parent may be a bridge for example. */
+		if(child->m_state == DEVICE_STATE_READY && child->poll_children())
+			pending = true;
+
+		child = next;
+	}
 
-	if (device->m_next)
-		device->m_next->m_prev = device->m_prev;
+	return pending;
+}
 
-	if (m_children == device)
-		m_children = device->m_next;
+size_t device_t::get_registry_keys(uint64_t* keys, size_t max) const
+{
+	size_t count = 0;
+	for(device_type_t type = m_type; type && count < max; type &= type - 1)
+		keys[count++] = device_key_type(type & -type);		/* The lowest set bit */
 
-	device->m_parent = NULL;
-	device->m_prev = NULL;
-	device->m_next = NULL;
+	return count;
 }
\ No newline at end of file
@@ -0,0 +1,88 @@
+/* 
+ * This file is part of the EspressoOS project (https://github.com/rdex999/EspressoOS.git).
+ * Copyright (c) 2025 David Weizman.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "device/registry.h"
+
+#include <hash_map.h>
+#include <object_pool.h>
+#include "error.h"
+
+static hash_map_t<uint64_t, device_registry_list_t> s_registry;
+static object_pool_t<device_registry_entry_t, 64> s_registry_entries;
+static const device_registry_list_t s_empty_list;
+
+int device_registry_add(device_t* device)
+{
+	if(!device)
+		return ERR_INVALID_PARAMETER;
+
+	uint64_t keys[DEVICE_REGISTRY_MAX_KEYS];
+	size_t count = device->get_registry_keys(keys, DEVICE_REGISTRY_MAX_KEYS);
+
+	for(size_t i = 0; i < count; ++i)
+	{
+		device_registry_list_t* list = s_registry.find(keys[i]);
+		if(!list)
+			list = s_registry.insert(keys[i], device_registry_list_t());
+
+		device_registry_entry_t* entry = list ? s_registry_entries.create() : NULL;
+		if(!entry)
+		{
+			device_registry_remove(device);
+			return ERR_OUT_OF_MEMORY;
+		}
+
+		entry->device = device;
+		entry->key = keys[i];
+		list->push_back(entry);
+		device->m_registry_entries.push_back(entry);
+	}
+
+	return SUCCESS;
+}
+
+void device_registry_remove(device_t* device)
+{
+	if(!device)
+		return;
+
+	while(device_registry_entry_t* entry = device->m_registry_entries.pop_front())
+	{
+		device_registry_list_t* list = s_registry.find(entry->key);
+		list->remove(entry);
+		if(list->empty())
+			s_registry.remove(entry->key);
+
+		s_registry_entries.destroy(entry);
+	}
+}
+
+device_t* device_registry_find(uint64_t key)
+{
+	device_registry_list_t* list = s_registry.find(key);
+	if(!list || list->empty())
+		return NULL;
+
+	return list->front()->device;
+}
+
+const device_registry_list_t& device_registry_get(uint64_t key)
+{
+	device_registry_list_t* list = s_registry.find(key);
+	return list ? *list : s_empty_list;
+}
\ No newline at end of file
@@ -20,24 +20,44 @@
 #include "cpu.h"
 #include "error.h"
 #include "common.h"
+#include "apic/apic.h"
 
 __attribute__((aligned(0x10)))
-static idt_gate_t s_idt_table[256] = {};		/* initialize to 0 */
+static idt_gate_t s_idt_table[IDT_VECTOR_COUNT] = {};		/* initialize to 0 */
+
+typedef struct idt_handler_entry
+{
+	idt_handler_t handler;
+	void* context;
+} idt_handler_entry_t;
+
+static idt_handler_entry_t s_handlers[IDT_VECTOR_COUNT] = {};
 
 extern "C" void isr_exception_page_fault();
 
+/* The addresses of the IRQ stubs, isr_irq_table[i] is the stub of vector IDT_FIRST_IRQ_VECTOR + i. (See isr.asm) */
+extern "C" const uint64_t isr_irq_table[IDT_VECTOR_COUNT - IDT_FIRST_IRQ_VECTOR];
+
 int idt_init()
+{
+	idt_set_trap_gate(14, (uint64_t)isr_exception_page_fault);
+
+	/* The local APIC raises the spurious vector without an interrupt to handle, so it only needs a gate. (No handler) */
+	idt_set_interrupt_gate(LAPIC_SPURIOUS_VECTOR, isr_irq_table[LAPIC_SPURIOUS_VECTOR - IDT_FIRST_IRQ_VECTOR]);
+	
+	idt_load();
+
+	return SUCCESS;
+}
+
+void idt_load()
 {
 	idt_descriptor_t descriptor = {
 		.size = sizeof(idt_gate_t) * 256 - 1,
 		.address = (uint64_t)&s_idt_table
 	};
 
-	idt_set_trap_gate(14, (uint64_t)isr_exception_page_fault);
-	
 	load_idt(&descriptor);
-
-	return SUCCESS;
 }
 
 void idt_set_gate(uint8_t index, const idt_gate_t* gate)
@@ -83,6 +103,49 @@ uint16_t idt_alloc_interrupt_gate(uint64_t isr_address)
 	return -1;
 }
 
+uint16_t idt_alloc_handler(idt_handler_t handler, void* context)
+{
+	if(!handler)
+		return -1;
+
+	for(unsigned int i = IDT_FIRST_IRQ_VECTOR; i < ARR_LEN(s_idt_table); ++i)
+	{
+		if((s_idt_table[i].attributes & IDT_ATTR_PRESENT) == 0)
+		{
+			s_handlers[i].handler = handler;
+			s_handlers[i].context = context;
+			idt_set_interrupt_gate(i, isr_irq_table[i - IDT_FIRST_IRQ_VECTOR]);
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+void idt_free_handler(uint8_t vector)
+{
+	if(vector < IDT_FIRST_IRQ_VECTOR)
+		return;
+
+	s_idt_table[vector] = {};
+	s_handlers[vector].handler = NULL;
+	s_handlers[vector].context = NULL;
+}
+
+/* Called by the IRQ stubs with the vector that was raised. */
+extern "C" void interrupt_dispatch(uint64_t vector)
+{
+	/* A spurious interrupt isnt in service in the local APIC, so it must not be acknowledged. */
+	if((vector & 0xFF) == LAPIC_SPURIOUS_VECTOR)
+		return;
+
+	const idt_handler_entry_t* entry = &s_handlers[vector & 0xFF];
+	if(entry->handler)
+		entry->handler((uint8_t)vector, entry->context);
+
+	lapic_eoi();
+}
+
 extern "C" void interrupt_page_fault()
 {
 	while(true)
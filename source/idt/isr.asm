@@ -18,9 +18,20 @@
 %define SAVED_GENERAL_REGS_STACK_SIZE (15 * 8)
 %define SAVED_REGS_STACK_SIZE (SAVED_GENERAL_REGS_STACK_SIZE)
 
+%define IDT_FIRST_IRQ_VECTOR 0x20
+%define IDT_VECTOR_COUNT 256
+%define XSAVE_HEADER_OFFSET 512				; The XSAVE header follows the legacy (FXSAVE) region
+%define XSAVE_HEADER_SIZE 64
+%define XSAVE_ALIGNMENT 64
+%define CPU_FEATURE_XSAVE (1 << 3)				; Same as in cpu.h
+
 global isr_exception_page_fault
+global isr_irq_table
 
 extern interrupt_page_fault
+extern interrupt_dispatch
+extern g_cpu_features
+extern g_cpu_xsave_size
 
 %macro ISR_SAVE_GENERAL_REGS 0
 	push rax
@@ -84,3 +95,72 @@ run_exception_handler:
 isr_exception_page_fault:
 	push interrupt_page_fault
 	jmp run_exception_handler
+
+; Saves registers (including the SSE and AVX state, as the handlers are compiled code and may use the string functions), 
+; calls interrupt_dispatch with the vector, restores registers and returns. 
+; To use this routine, push the vector and jump to this routine.
+run_irq_handler:
+	ISR_SAVE_REGS								; Save all registers
+
+	; The size of the XSAVE area depends on the features enabled in XCR0, so it is only known at runtime. 
+	; RBX (already saved, and preserved by the call) keeps the stack pointer from before the area.
+	mov rbx, rsp
+	mov eax, [rel g_cpu_xsave_size]
+	sub rsp, rax
+	and rsp, ~(XSAVE_ALIGNMENT - 1)				; XSAVE needs a 64 byte aligned area, FXSAVE and the call need 16
+	test dword [rel g_cpu_features], CPU_FEATURE_XSAVE
+	jz .fxsave
+
+	; XSAVE only writes XSTATE_BV in the header, and XRSTOR faults if the rest of it isnt zero.
+	xor eax, eax
+%assign header_offset 0
+%rep XSAVE_HEADER_SIZE / 8
+	mov [rsp + XSAVE_HEADER_OFFSET + header_offset], rax
+%assign header_offset header_offset + 8
+%endrep
+
+	mov eax, -1									; Save every state component enabled in XCR0
+	mov edx, -1
+	xsave [rsp]
+	jmp .saved
+.fxsave:
+	fxsave [rsp]
+.saved:
+	cld
+
+	mov rdi, [rbx + SAVED_REGS_STACK_SIZE]		; The vector was pushed right before the registers
+	call interrupt_dispatch
+
+	test dword [rel g_cpu_features], CPU_FEATURE_XSAVE
+	jz .fxrstor
+	mov eax, -1
+	mov edx, -1
+	xrstor [rsp]
+	jmp .restored
+.fxrstor:
+	fxrstor [rsp]
+.restored:
+	mov rsp, rbx
+
+	ISR_RESTORE_REGS							; Restore all registers
+	add rsp, 8									; Remove the vector from the stack
+	iretq
+
+; A stub for each IRQ vector, which pushes its vector and jumps to run_irq_handler.
+%assign vector IDT_FIRST_IRQ_VECTOR
+%rep IDT_VECTOR_COUNT - IDT_FIRST_IRQ_VECTOR
+isr_irq_%+vector:
+	push qword vector
+	jmp run_irq_handler
+%assign vector vector + 1
+%endrep
+
+section .rodata
+
+; The addresses of the IRQ stubs, the entry at index i is the stub of vector IDT_FIRST_IRQ_VECTOR + i.
+isr_irq_table:
+%assign vector IDT_FIRST_IRQ_VECTOR
+%rep IDT_VECTOR_COUNT - IDT_FIRST_IRQ_VECTOR
+	dq isr_irq_%+vector
+%assign vector vector + 1
+%endrep
@@ -21,32 +21,70 @@
 #include <stddef.h>
 #include <string.h>
 #include <stdlib.h>
+#include <checksum.h>
+#include <hash_map.h>
 #include "mm/vmm/vmm.h"
 #include "mm/pmm/pmm.h"
 #include "multiboot.h"
 #include "acpi/tables.h"
 #include "error.h"
 
-/* Initializes ACPI and finds tables. Returns 0 on success, an error code otherwise. */
+/* 
+ * An entry in the index of ACPI tables, which is built once by acpi_init(). 
+ * Each table stays mapped (read only) for the lifetime of the kernel, so looking a table up never touches the page tables.
+ */
+typedef struct acpi_table_entry
+{
+	phys_addr_t address;
+	uint32_t size;
+	bool valid;							/* True if the checksum of the table is valid. */
+	const acpi_sdt_header_t* table;		/* Read only mapping of the table. */
+} acpi_table_entry_t;
+
+/* Returns a 4 byte table signature as a number, the key of the table index. */
+inline uint32_t acpi_signature_key(const char* signature)
+{
+	const uint8_t* s = (const uint8_t*)signature;
+	return (uint32_t)s[0] | ((uint32_t)s[1] << 8) | ((uint32_t)s[2] << 16) | ((uint32_t)s[3] << 24);
+}
+
+/* Initializes ACPI and indexes its tables. Returns 0 on success, an error code otherwise. */
 int acpi_init(multiboot_info_t* mbd);
 
 /* Find the rsdp/xsdp, and set s_acpi_root_sdt to point to it. Returns 0 on success, an error code otherwise. */
 int acpi_init_rsdt(multiboot_info_t* mbd);
 
 /* 
- * Maps the physical address of an SDT to a virtual address. 
+ * Map (read only) every table listed in the RSDT/XSDT, and add it to the table index. 
+ * A signature that appears more than once (SSDT for example) is indexed by its first table with a valid checksum.
+ * Returns 0 on success, an error code otherwise.
+ */
+int acpi_index_tables();
+
+/* Returns the index entry of the table with the given signature, NULL if there is no such table. */
+const acpi_table_entry_t* acpi_get_table_entry(const char* signature);
+
+/* 
+ * Returns a read only pointer to the table with the given signature, without copying or mapping anything.
+ * Returns NULL if there is no such table, or if its checksum is invalid.
+ */
+const void* acpi_get_table(const char* signature);
+
+/* 
+ * Maps the physical address of an SDT to a virtual address, using the page flags <flags>. 
  * Note: This function returns a virtual address which directly points to the SDT. Write to this memory with caution.
  * Writes the virtual address of the SDT into <mapped_sdt>.
  * Writes the amount of allocated pages into <page_count>
  * Returns 0 on success, an error code otherwise.
  */
-int acpi_map_sdt(phys_addr_t sdt, void** mapped_sdt, size_t* page_count);
+int acpi_map_sdt(phys_addr_t sdt, uint64_t flags, void** mapped_sdt, size_t* page_count);
 
 /* Unmap an SDT that was mapped using acpi_map_sdt. */
 int acpi_unmap_sdt(void* mapped_sdt);
 
 /* 
- * Find an SDT table with the given signature.
+ * Find an SDT table with the given signature, and map it writable.
+ * Note: If no writes to the table are needed, use acpi_get_table instead.
  * Note: This function returns a virtual address which directly points to the SDT. Write to this memory with caution.
  * <signature> Must be a 4 byte ascii string.
  * Writes the virtual address of the SDT into <mapped_sdt>.
@@ -56,8 +94,8 @@ int acpi_unmap_sdt(void* mapped_sdt);
 int acpi_find_table(const char* signature, void** table, size_t* page_count);
 
 /* 
- * Find an SDT table with the given signature.
- * Note: If no writes to the raw table are needed, use this function instead of acpi_find_table.
+ * Find an SDT table with the given signature, and copy it.
+ * Note: If the table is only read, use acpi_get_table instead, which doesnt copy it.
  * Note: The returned table is allocated using malloc, free the memory when done.
  * <signature> Must be a 4 byte ascii string.
  * Returns a pointer to the table, NULL on failure.
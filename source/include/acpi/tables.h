@@ -33,6 +33,9 @@
 #define ACPI_MADT_TYPE_LOCAL_APIC_ADDRESS_OVERRIDE		5
 #define ACPI_MADT_TYPE_PROCESSOR_LOCAL_X2APIC			9
 
+#define ACPI_MADT_LAPIC_FLAG_ENABLED					(1 << 0)
+#define ACPI_MADT_LAPIC_FLAG_ONLINE_CAPABLE				(1 << 1)		/* The processor is disabled, but can be enabled by the OS. */
+
 typedef struct acpi_rsdp 
 {
 	char signature[8];
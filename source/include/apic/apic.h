@@ -21,6 +21,8 @@
 #include <stddef.h>
 #include "acpi/acpi.h"
 
+#define APIC_MAX_IOAPICS 					16
+
 #define PIC8259_MASTER_IO_COMMAND 			0x20
 #define PIC8259_MASTER_IO_DATA 				0x21
 #define PIC8259_SLAVE_IO_COMMAND 			0xA1
@@ -63,12 +65,32 @@
 #define LAPIC_REG_VERSION								0x30
 #define LAPIC_REG_EOI									0xB0
 #define LAPIC_REG_SPURIOUS_INT_VECTOR					0xF0
+#define LAPIC_REG_ICR_LOW								0x300		/* Interrupt command register, writing it sends the IPI */
+#define LAPIC_REG_ICR_HIGH								0x310
+#define LAPIC_REG_LVT_TIMER								0x320
+#define LAPIC_REG_TIMER_INITIAL_COUNT					0x380
+#define LAPIC_REG_TIMER_CURRENT_COUNT					0x390
+#define LAPIC_REG_TIMER_DIVIDE							0x3E0
+
+#define LAPIC_SPURIOUS_VECTOR							0xFF
+#define LAPIC_SPURIOUS_ENABLE							(1 << 8)
+
+#define LAPIC_ICR_DELIVERY_MODE_INIT					(5 << 8)
+#define LAPIC_ICR_DELIVERY_MODE_STARTUP					(6 << 8)
+#define LAPIC_ICR_DELIVERY_STATUS						(1 << 12)	/* Set while the IPI is being sent */
+#define LAPIC_ICR_LEVEL_ASSERT							(1 << 14)
+#define LAPIC_ICR_STARTUP_VECTOR(address)				((uint32_t)(address) >> 12)	/* The page the startup IPI starts the CPU at */
+#define LAPIC_ICR_DESTINATION(lapic_id)					((uint32_t)(lapic_id) << 24)
+
+#define LAPIC_LVT_MASKED								(1 << 16)
+#define LAPIC_LVT_TIMER_PERIODIC						(1 << 17)
+#define LAPIC_TIMER_DIVIDE_16							0x3
+#define LAPIC_TIMER_CALIBRATION_US						10000
 
 typedef struct ioapic_descriptor
 {
 	uint8_t* mmio;
 	uint8_t first_irq;
-	struct ioapic_descriptor* next;
 } ioapic_descriptor_t;
 
 typedef struct ioapic_redtbl_entry
@@ -104,7 +126,7 @@ int apic_map_irq(uint8_t irq, uint8_t interrupt);
  * Initialize a found IO APIC. Sets IRQ's, things like that
  * Returns 0 on success, an error code otherwise.
  */
-int ioapic_init(acpi_madt_record_ioapic_t* ioapic_record);
+int ioapic_init(const acpi_madt_record_ioapic_t* ioapic_record);
 
 /* 
  * Map <irq> of <ioapic> to interrupt vector <interrupt>. 
@@ -146,4 +168,19 @@ uint64_t lapic_get_mmio();
 uint32_t lapic_read_reg(uint16_t reg);
 
 /* Write to a register in the local APIC configuration space. Returns 0 on failure. */
-void lapic_write_reg(uint16_t reg, uint32_t value);
\ No newline at end of file
+void lapic_write_reg(uint16_t reg, uint32_t value);
+
+/* Signal the end of the interrupt that is currently being handled to the local APIC of the current CPU. */
+void lapic_eoi();
+
+/* 
+ * Send an inter-processor interrupt to the CPU of the local APIC <lapic_id>, <command> is the low ICR register 
+ * (LAPIC_ICR_* flags). Returns once the local APIC of the current CPU has sent it.
+ */
+void lapic_send_ipi(uint32_t lapic_id, uint32_t command);
+
+/* Measure the local APIC timer of the current CPU against the TSC. Returns its ticks per millisecond, 0 on failure. */
+uint32_t lapic_timer_ticks_per_ms();
+
+/* Raise <interrupt> on the current CPU every <ticks> ticks of its local APIC timer. (See lapic_timer_ticks_per_ms) */
+void lapic_timer_start_periodic(uint8_t interrupt, uint32_t ticks);
\ No newline at end of file
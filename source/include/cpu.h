@@ -18,6 +18,7 @@
 #pragma once
 
 #include <stdint.h>
+#include <stddef.h>
 #include "idt/idt.h"
 
 /* 
@@ -25,13 +26,179 @@
  * https://www.intel.com/content/www/us/en/content-details/843860/intel-architecture-instruction-set-extensions-programming-reference.html?wapkw=Intel%20Architecture%20Instruction%20Set%20Extensions%20Programming%20Reference
  * Page 18 in the PDF version. 
  */
+#define CPUID_CODE_GET_VENDOR 					0		/* EAX is the highest basic CPUID code */
 #define CPUID_CODE_GET_FEATURES 				1
+#define CPUID_CODE_GET_EXTENDED_FEATURES 		7		/* Sub-leaf 0 */
+#define CPUID_CODE_GET_XSAVE_INFO 				0xD		/* Sub-leaf 0, EBX is the XSAVE area size of the features enabled in XCR0 */
 
 #define CPUID_FEATURE_EDX_APIC 					(1 << 9)
+#define CPUID_FEATURE_EDX_PAT 					(1 << 16)
+#define CPUID_FEATURE_EDX_SSE2 					(1 << 26)
 #define CPUID_FEATURE_EBX_INIT_APIC_ID(ebx)		(((ebx) >> 24) & 0xFF)
+#define CPUID_FEATURE_ECX_PCLMULQDQ 			(1 << 1)
+#define CPUID_FEATURE_ECX_SSE42 				(1 << 20)
 #define CPUID_FEATURE_ECX_POPCNT       			(1 << 23)
+#define CPUID_FEATURE_ECX_XSAVE 				(1 << 26)
+#define CPUID_FEATURE_ECX_AVX 					(1 << 28)
+
+#define CPUID_EXTENDED_FEATURE_EBX_AVX2 		(1 << 5)
+#define CPUID_EXTENDED_FEATURE_EBX_ERMS 		(1 << 9)	/* Enhanced REP MOVSB/STOSB */
+#define CPUID_EXTENDED_FEATURE_EDX_FSRM 		(1 << 4)	/* Fast short REP MOVSB */
+
+#define CPU_CR0_MP 								(1 << 1)	/* Monitor co-processor */
+#define CPU_CR0_EM 								(1 << 2)	/* x87 emulation, must be clear for SSE */
+#define CPU_CR0_TS 								(1 << 3)	/* Task switched */
+#define CPU_CR4_OSFXSR 							(1 << 9)	/* FXSAVE/FXRSTOR and SSE instructions */
+#define CPU_CR4_OSXMMEXCPT 						(1 << 10)	/* Unmasked SIMD floating point exceptions */
+#define CPU_CR4_OSXSAVE 						(1 << 18)	/* XSAVE and XGETBV/XSETBV, required for AVX */
+
+#define CPU_XCR0_X87 							(1 << 0)
+#define CPU_XCR0_SSE 							(1 << 1)
+#define CPU_XCR0_AVX 							(1 << 2)
+
+#define CPU_FXSAVE_AREA_SIZE 					512
 
 #define MSR_IA32_APIC_BASE						0x1B
+#define MSR_IA32_PAT							0x277
+#define MSR_IA32_GS_BASE						0xC0000101
+
+/* Memory types of PAT entries, see the Intel System Programming Guide, chapter 13.12 "Page Attribute Table". */
+#define CPU_PAT_TYPE_UC							0x00		/* Uncacheable */
+#define CPU_PAT_TYPE_WC							0x01		/* Write combining */
+#define CPU_PAT_TYPE_WT							0x04		/* Write through */
+#define CPU_PAT_TYPE_WP							0x05		/* Write protected */
+#define CPU_PAT_TYPE_WB							0x06		/* Write back */
+#define CPU_PAT_TYPE_UC_MINUS					0x07		/* Uncacheable, can be overridden by a WC MTRR */
+#define CPU_PAT_ENTRY(index, type)				((uint64_t)(type) << ((index) * 8))
+
+/* 
+ * The PAT programmed on every CPU, the same layout as Linux. Entries 0-3 match the power on defaults, except that entry 1
+ * (PWT) is write combining instead of write through. The page flags for each memory type are VMM_PAGE_CACHE_*.
+ */
+#define CPU_PAT_LAYOUT							( \
+	CPU_PAT_ENTRY(0, CPU_PAT_TYPE_WB) | CPU_PAT_ENTRY(1, CPU_PAT_TYPE_WC) | 		\
+	CPU_PAT_ENTRY(2, CPU_PAT_TYPE_UC_MINUS) | CPU_PAT_ENTRY(3, CPU_PAT_TYPE_UC) | 	\
+	CPU_PAT_ENTRY(4, CPU_PAT_TYPE_WB) | CPU_PAT_ENTRY(5, CPU_PAT_TYPE_WP) | 		\
+	CPU_PAT_ENTRY(6, CPU_PAT_TYPE_UC_MINUS) | CPU_PAT_ENTRY(7, CPU_PAT_TYPE_WT) 	\
+)
+
+#define CPU_MAX_COUNT							64
+#define CPU_CACHE_LINE_SIZE						64
+
+#define CPU_RFLAGS_IF							(1 << 9)	/* Interrupt enable flag */
+
+/* 
+ * Features of the CPU that were detected (and enabled) by cpu_init(), see g_cpu_features.
+ * A SIMD feature is only set if the OS state for it is enabled, so code can use it right away.
+ */
+typedef enum cpu_feature
+{
+	CPU_FEATURE_POPCNT 		= 1 << 0,
+	CPU_FEATURE_SSE42 		= 1 << 1,
+	CPU_FEATURE_PCLMULQDQ 	= 1 << 2,
+	CPU_FEATURE_XSAVE 		= 1 << 3,
+	CPU_FEATURE_AVX 		= 1 << 4,
+	CPU_FEATURE_AVX2 		= 1 << 5,
+	CPU_FEATURE_ERMS 		= 1 << 6,
+	CPU_FEATURE_FSRM 		= 1 << 7,
+} cpu_feature_t;
+
+/* 
+ * Per-CPU data. The GS base of each CPU points to its own cpu_local_t, so the current CPU can find its data 
+ * with a single GS relative load, without touching the local APIC or executing CPUID.
+ */
+typedef struct cpu_local
+{
+	struct cpu_local* self;		/* Points to this structure, so its linear address can be read through GS. */
+	uint32_t index;				/* Sequential index of the CPU, 0 is the BSP. Use it to index per-CPU arrays. */
+	uint32_t lapic_id;
+} __attribute__((aligned(CPU_CACHE_LINE_SIZE))) cpu_local_t;
+
+extern cpu_local_t g_cpu_locals[CPU_MAX_COUNT];
+
+/* 
+ * The amount of CPUs in the system, CPU indices go from 0 to g_cpu_count - 1. At least 1 (the BSP).
+ * Counted from the MADT by apic_init(), which also fills the lapic_id of each CPU's cpu_local_t. 
+ * smp_init() then drops the processors that didnt start, so all counted CPUs are running.
+ */
+extern uint32_t g_cpu_count;
+
+/* A bitmap of cpu_feature_t, set by cpu_init(). Cached, so hot paths dont have to execute CPUID. (Which is serializing) */
+extern uint32_t g_cpu_features;
+
+/* 
+ * The size of the area the interrupt stubs save the SSE/AVX state into, set by cpu_init(). 
+ * The XSAVE area size of the features enabled in XCR0, or the FXSAVE area size without XSAVE.
+ */
+extern uint32_t g_cpu_xsave_size;
+
+/* 
+ * Detect the features of the CPU, and enable SSE (and AVX, if supported) on it.
+ * Must be called before anything else, as the string functions use SSE.
+ */
+void cpu_init();
+
+/* 
+ * Enable SSE (and AVX) on an application processor, with the features cpu_init() detected on the BSP. 
+ * Must be called before anything else on the AP, like cpu_init() on the BSP.
+ */
+void cpu_init_ap();
+
+/* 
+ * Initialize the per-CPU data of the current CPU, and point its GS base to it. Programs the PAT of the CPU.
+ * <index> Must be less than CPU_MAX_COUNT. 
+ */
+void cpu_init_local(uint32_t index);
+
+/* Program the PAT MSR of the current CPU with CPU_PAT_LAYOUT. The PAT must be the same on all CPUs. */
+void cpu_init_pat();
+
+inline uint64_t read_cr0()
+{
+	uint64_t res;
+	asm volatile("mov %%cr0, %0"
+		: "=r"(res)
+		:
+	);
+	return res;
+}
+
+inline void write_cr0(uint64_t value)
+{
+	asm volatile("mov %0, %%cr0"
+		:
+		: "r"(value)
+		: "memory"
+	);
+}
+
+inline uint64_t read_cr4()
+{
+	uint64_t res;
+	asm volatile("mov %%cr4, %0"
+		: "=r"(res)
+		:
+	);
+	return res;
+}
+
+inline void write_cr4(uint64_t value)
+{
+	asm volatile("mov %0, %%cr4"
+		:
+		: "r"(value)
+		: "memory"
+	);
+}
+
+/* Write <value> into the extended control register <xcr>. Requires CR4.OSXSAVE. */
+inline void cpu_write_xcr(uint32_t xcr, uint64_t value)
+{
+	asm volatile("xsetbv"
+		:
+		: "c"(xcr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32))
+	);
+}
 
 inline uint64_t read_cr3()
 {
@@ -53,6 +220,46 @@ inline void write_cr3(uint64_t value)
 
 }
 
+/* Returns the time stamp counter of the current CPU. */
+inline uint64_t cpu_read_tsc()
+{
+	uint32_t low, high;
+	asm volatile("rdtsc"
+		: "=a"(low), "=d"(high)
+	);
+	return ((uint64_t)high << 32) | low;
+}
+
+/* Hint the CPU that this is a spin-wait loop. */
+inline void cpu_pause()
+{
+	asm volatile("pause" ::: "memory");
+}
+
+/* 
+ * Prevent the compiler from moving memory accesses across this point. 
+ * x86 doesnt reorder stores with other stores, so this is enough to order writes to memory before an MMIO write (a doorbell).
+ */
+inline void cpu_barrier()
+{
+	asm volatile("" ::: "memory");
+}
+
+/* 
+ * Order all memory accesses before this point before all memory accesses after it, including loads after stores,
+ * which x86 may otherwise reorder.
+ */
+inline void cpu_memory_barrier()
+{
+	asm volatile("mfence" ::: "memory");
+}
+
+/* Write back and invalidate all caches of the current CPU. */
+inline void cpu_flush_caches()
+{
+	asm volatile("wbinvd" ::: "memory");
+}
+
 inline void tlb_native_flush_page(void* virtual_address)
 {
 	asm volatile("invlpg (%0)"
@@ -147,6 +354,21 @@ inline void cpuid(uint32_t code, uint32_t* eax, uint32_t* ebx, uint32_t* ecx, ui
 	);
 }
 
+/* Same as cpuid(), but also sets ECX=<subleaf>. */
+inline void cpuid_count(uint32_t code, uint32_t subleaf, uint32_t* eax, uint32_t* ebx, uint32_t* ecx, uint32_t* edx)
+{
+	asm volatile("cpuid"
+		: "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+		: "a"(code), "c"(subleaf)
+	);
+}
+
+/* Returns true if all features in <features> (cpu_feature_t bits) are supported. */
+inline bool cpu_has_features(uint32_t features)
+{
+	return (g_cpu_features & features) == features;
+}
+
 inline uint64_t cpu_read_msr(uint32_t msr)
 {
 	uint32_t low, high;
@@ -164,4 +386,43 @@ inline void cpu_write_msr(uint32_t msr, uint64_t value)
 		:
 		: "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32))
 	);
-}
\ No newline at end of file
+}
+
+/* Returns the index of the current CPU. Only valid after cpu_init_local() was called on this CPU. */
+inline uint32_t cpu_current_index()
+{
+	uint32_t index;
+	asm volatile("movl %%gs:%c1, %0"
+		: "=r"(index)
+		: "i"(offsetof(cpu_local_t, index))
+	);
+	return index;
+}
+
+/* Disable interrupts on the current CPU, returns the previous value of RFLAGS. Use with cpu_irq_restore(). */
+inline uint64_t cpu_irq_save()
+{
+	uint64_t flags;
+	asm volatile("pushfq; popq %0; cli"
+		: "=r"(flags)
+		:
+		: "memory"
+	);
+	return flags;
+}
+
+/* 
+ * Enable interrupts and halt until one arrives, then disable them again. STI only takes effect after the next instruction, 
+ * so an interrupt cant slip in between and leave the CPU halted.
+ */
+inline void cpu_wait_for_interrupt()
+{
+	asm volatile("sti; hlt; cli" : : : "memory");
+}
+
+/* Restore the interrupt flag from <flags>, which was returned by cpu_irq_save(). */
+inline void cpu_irq_restore(uint64_t flags)
+{
+	if(flags & CPU_RFLAGS_IF)
+		asm volatile("sti" : : : "memory");
+}
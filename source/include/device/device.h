@@ -20,6 +20,7 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <stdlib.h>
+#include <list.h>
 #include "error.h"
 
 /* Used for down-casting only. */
@@ -31,17 +32,28 @@ typedef uint64_t device_type_t;
 #define DEVICE_TYPE_STORAGE			((device_type_t)1 << 3)
 #define DEVICE_TYPE_NVME			((device_type_t)1 << 4)
 
-class device_t
+typedef enum device_state
+{
+	DEVICE_STATE_DISCOVERED,		/* In the device tree, not initialized yet. */
+	DEVICE_STATE_INITIALIZING,		/* poll_initialize() was called and returned ERR_DEVICE_BUSY. */
+	DEVICE_STATE_READY,
+} device_state_t;
+
+typedef struct device_registry_entry device_registry_entry_t;
+struct device_registry_device_tag;
+
+/* The list node links a device into the children list of its parent. */
+class device_t : public list_node_t<>
 {
 public:
 	/* Only initializes device identifiers. This function does not initialize the device nor adds it to the device tree. */
 	inline device_t(device_type_t type, void* self)
-		: m_type(type), m_self(self), m_parent(NULL), m_children(NULL), m_next(NULL), m_prev(NULL) {}
+		: m_type(type), m_self(self), m_parent(NULL), m_children(), m_state(DEVICE_STATE_DISCOVERED), m_registry_entries() {}
 
 	/*
 	 * This function acts as the destructor of the device.
 	 * Destroys all child devices of this device, Removes this device from the device tree.
-	 * Uses device::uninitialize(), and free's this device (free(this))
+	 * Uses device::uninitialize(), and free's this device using device::release()
 	 * Note: After calling this function, do not use this object anymore.
 	 */
 	void destroy();
@@ -61,17 +73,39 @@ public:
 	virtual int initialize() = 0;
 
 	/* 
-	 * Check if this device matches <dev>, if not check this for all children. (recursive). 
-	 * Returns a pointer to the first matching device, NULL on failure.
+	 * Continue initializing the device without waiting for the hardware. Called repeatedly by initialize_tree().
+	 * Returns 0 when the device is initialized, ERR_DEVICE_BUSY if its still waiting for the hardware 
+	 * (Call again later), or an error code on failure.
+	 * Devices that wait for their hardware (a controller becoming ready for example) override this as a state machine, 
+	 * so other devices are initialized in the meantime. The default calls initialize().
+	 */
+	virtual int poll_initialize() { return initialize(); }
+
+	/* 
+	 * Initialize every discovered device below this device. A device is initialized only after its parent is ready, 
+	 * and all devices that are ready to be initialized are polled together, so devices that wait for their hardware
+	 * wait at the same time. Devices that fail to initialize are destroyed.
+	 * Returns when no device below this one is still initializing.
 	 */
-	device_t* find(const device_t* device) const;
+	void initialize_tree();
 
-	/* Add a child to the child devices linked list. (Appends to the beginning of the list)*/
-	void add_child(device_t* device);
+	inline device_state_t get_state() const { return m_state; }
+
+	/* 
+	 * Add a child to the child devices list (Appends to the beginning of the list), and register it in the device registry.
+	 * Returns 0 on success, an error code otherwise. On failure the child is not added.
+	 */
+	int add_child(device_t* device);
 	
-	/* Remove a child from the child devices linked list. */
+	/* Remove a child from the child devices list, and from the device registry. */
 	void remove_child(device_t* device);
 
+	/* 
+	 * Write the keys this device is registered under in the device registry into <keys>. (See device/registry.h)
+	 * By default, a key for each bit of the device type. Returns the amount of keys written, at most <max>.
+	 */
+	virtual size_t get_registry_keys(uint64_t* keys, size_t max) const;
+
 	const device_type_t m_type;
 	
 	/* 
@@ -86,19 +120,27 @@ public:
 	void const* m_self;
 
 protected:
-	/* 
-	 * Check if this device is the same as <dev>, from the most general identifiers to the most specific.
-	 * For example if <dev> is a PCI device, then if its class ID doesnt exist, this function would check vendor ID and device ID.
-	 */
-	virtual bool is_device(const device_t* device) const = 0;
-	
 	/* Discover all children of this device. */
 	virtual void discover_children() = 0;
 
+	/* 
+	 * Free the memory of this device object. Devices that are allocated with malloc/new use this default.
+	 * Devices that are allocated from an object pool override this function to return themselves to the pool.
+	 */
+	virtual void release() { free((void*)m_self); }
+
 	device_t* m_parent;
-	device_t* m_children;
-	device_t* m_next;
-	device_t* m_prev;
+	list_t<device_t> m_children;
+	device_state_t m_state;
+
+private:
+	/* Poll the initialization of the children of this device, and of the children of the ready ones. (recursive) Returns true if any device is still initializing. */
+	bool poll_children();
+
+	friend int device_registry_add(device_t* device);
+	friend void device_registry_remove(device_t* device);
+
+	list_t<device_registry_entry_t, device_registry_device_tag> m_registry_entries;		/* The registry entries of this device. */
 };
 
 /* The topmost device in the device tree, it doesnt realy count as a device but it discovers all other devices. */
@@ -116,11 +158,10 @@ public:
 	 * For example, a PCI device would add itself to the children of the root device.
 	 * This is done so devices can add themselves whenever their ready, and not only when the root device is initialized.
 	 */
-	inline void add_child(device_t* device) 		{ device_t::add_child(device); }
+	inline int add_child(device_t* device) 			{ return device_t::add_child(device); }
 	inline void remove_child(device_t* device) 		{ device_t::remove_child(device); }
 
 protected:
-	bool is_device(const device_t*) const override { return false; };
 	void discover_children() override {};
 };
 
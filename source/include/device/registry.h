@@ -0,0 +1,83 @@
+/* 
+ * This file is part of the EspressoOS project (https://github.com/rdex999/EspressoOS.git).
+ * Copyright (c) 2025 David Weizman.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <list.h>
+#include "device/device.h"
+
+/* 
+ * Keys of the device registry. A device is registered under one key for each of its type bits, and PCI devices also under 
+ * their class, class/subclass, class/subclass/prog-if and vendor/device ID. The kind of a key is in its top byte.
+ */
+#define DEVICE_KEY_KIND_TYPE					((uint64_t)1 << 56)
+#define DEVICE_KEY_KIND_PCI_CLASS				((uint64_t)2 << 56)
+#define DEVICE_KEY_KIND_PCI_SUBCLASS			((uint64_t)3 << 56)
+#define DEVICE_KEY_KIND_PCI_PROG_IF				((uint64_t)4 << 56)
+#define DEVICE_KEY_KIND_PCI_ID					((uint64_t)5 << 56)
+
+#define DEVICE_KEY_PCI_CLASS(class_code) 						(DEVICE_KEY_KIND_PCI_CLASS | (uint64_t)(class_code))
+#define DEVICE_KEY_PCI_SUBCLASS(class_code, subclass) 			(DEVICE_KEY_KIND_PCI_SUBCLASS | ((uint64_t)(class_code) << 8) | (uint64_t)(subclass))
+#define DEVICE_KEY_PCI_PROG_IF(class_code, subclass, prog_if) 	\
+	(DEVICE_KEY_KIND_PCI_PROG_IF | ((uint64_t)(class_code) << 16) | ((uint64_t)(subclass) << 8) | (uint64_t)(prog_if))
+#define DEVICE_KEY_PCI_ID(vendor_id, device_id) 				(DEVICE_KEY_KIND_PCI_ID | ((uint64_t)(vendor_id) << 16) | (uint64_t)(device_id))
+
+#define DEVICE_REGISTRY_MAX_KEYS				16		/* Maximum amount of keys of a single device */
+
+struct device_registry_key_tag;
+
+/* Registers a device under a single key. It is on the list of the key, and on the list of entries of the device. */
+typedef struct device_registry_entry : public list_node_t<device_registry_key_tag>, public list_node_t<device_registry_device_tag>
+{
+	device_t* device;
+	uint64_t key;
+} device_registry_entry_t;
+
+typedef list_t<device_registry_entry_t, device_registry_key_tag> device_registry_list_t;
+
+/* 
+ * Returns the key of a device type, for finding devices of the type. 
+ * Device types include the bits of their base types (DEVICE_TYPE_PCI_BRIDGE includes DEVICE_TYPE_PCI), 
+ * so the key is of the most specific (highest) bit of <type>.
+ */
+inline uint64_t device_key_type(device_type_t type)
+{
+	return type ? DEVICE_KEY_KIND_TYPE | (uint64_t)(63 - __builtin_clzll(type)) : DEVICE_KEY_KIND_TYPE;
+}
+
+/* 
+ * Register <device> under all of its keys. (See device_t::get_registry_keys) 
+ * Called by device_t::add_child, so every device in the device tree is registered.
+ * Returns 0 on success, an error code otherwise. On failure, the device is not registered under any key.
+ */
+int device_registry_add(device_t* device);
+
+/* Remove <device> from the registry. Called by device_t::remove_child. */
+void device_registry_remove(device_t* device);
+
+/* Returns the first device registered under <key>, NULL if there is none. */
+device_t* device_registry_find(uint64_t key);
+
+/* 
+ * Returns the list of entries registered under <key>, which is empty if there are none. For example:
+ * for(device_registry_entry_t& entry : device_registry_get(DEVICE_KEY_PCI_CLASS(PCI_CLASSCODE_MASS_STORAGE))) ...
+ * Note: The list is valid until a device is added or removed.
+ */
+const device_registry_list_t& device_registry_get(uint64_t key);
\ No newline at end of file
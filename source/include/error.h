@@ -32,4 +32,13 @@ typedef enum error
 	ERR_IRQ_NOT_SUPPORTED,
 	ERR_DEVICE_MSI_NOT_SUPPORTED,
 	ERR_DEVICE_MSIX_NOT_SUPPORTED,
+	ERR_SERIAL_NOT_FOUND,
+	ERR_PCI_NO_FREE_BUS,
+	ERR_DEVICE_BUSY,
+	ERR_DEVICE_NOT_READY,
+	ERR_TIME_CALIBRATION,
+	ERR_TIMEOUT,
+	ERR_NVME_CONTROLLER_FATAL,
+	ERR_NVME_COMMAND_FAILED,
+	ERR_NVME_NAMESPACE_NOT_FOUND,
 } error_t;
\ No newline at end of file
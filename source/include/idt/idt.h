@@ -21,6 +21,8 @@
 #include <stddef.h>
 
 #define IDT_LAST_EXCEPTION_VECTOR 		0x1F
+#define IDT_FIRST_IRQ_VECTOR			(IDT_LAST_EXCEPTION_VECTOR + 1)
+#define IDT_VECTOR_COUNT				256
 
 #define IDT_GATE_GET_ADDRESS(gate) ((gate)->address0 | ((gate)->address16 << 16) | ((gate)->address32 << 32))
 #define IDT_GATE_SET_ADDRESS(gate, address) { 				\
@@ -61,9 +63,19 @@ typedef struct idt_gate
 	uint32_t reserved;				/* Must be set to 0 */
 } __attribute__((packed)) idt_gate_t;
 
-/* Initialize the IDT. Returns 0 on success, an error code otherwise. */
+/* 
+ * A handler for a device interrupt, called with interrupts disabled. <context> Is the pointer given to idt_alloc_handler().
+ * The local APIC is acknowledged (EOI) after the handler returns.
+ * The SSE and AVX registers are saved around the handler (XSAVE, or FXSAVE without it), so handlers may use the string functions.
+ */
+typedef void (*idt_handler_t)(uint8_t vector, void* context);
+
+/* Initialize the IDT, and load it on the current CPU (the BSP). Returns 0 on success, an error code otherwise. */
 int idt_init();
 
+/* Load the IDT on the current CPU. Application processors call this when they start, the BSP loads it in idt_init(). */
+void idt_load();
+
 /* Set the value of a gate in the IDT. */
 void idt_set_gate(uint8_t index, const idt_gate_t* gate);
 
@@ -78,4 +90,13 @@ void idt_set_trap_gate(uint8_t index, uint64_t isr_address);
  * and initializes it to point to <isr_address>.
  * Returns -1 on failure. 
  */
-uint16_t idt_alloc_interrupt_gate(uint64_t isr_address);
\ No newline at end of file
+uint16_t idt_alloc_interrupt_gate(uint64_t isr_address);
+
+/* 
+ * Allocate a free interrupt vector, and call <handler> with <context> when it is raised. 
+ * Returns the vector in the lower 8 bits (high 8 bits are clear), -1 on failure.
+ */
+uint16_t idt_alloc_handler(idt_handler_t handler, void* context);
+
+/* Free a vector that was allocated with idt_alloc_handler(). */
+void idt_free_handler(uint8_t vector);
\ No newline at end of file
@@ -73,6 +73,15 @@ typedef uint64_t virt_addr_t;
 #define VMM_PAGE_PDE_PDPE_PAT	(1 << 12)	/* Page Attribute Table, for page directory entries and page directory pointer table entries. */
 #define VMM_PAGE_NX 			(1 << 63)	/* No Execute, for page table entries */
 
+/* Memory type flags of a page table entry, for the PAT layout cpu_init_pat() programs. (CPU_PAT_LAYOUT) */
+#define VMM_PAGE_CACHE_WB			0												/* Write back */
+#define VMM_PAGE_CACHE_WC			(VMM_PAGE_PWT)									/* Write combining */
+#define VMM_PAGE_CACHE_UC_MINUS		(VMM_PAGE_PCD)									/* Uncacheable, unless a WC MTRR covers it */
+#define VMM_PAGE_CACHE_UC			(VMM_PAGE_PCD | VMM_PAGE_PWT)					/* Uncacheable */
+#define VMM_PAGE_CACHE_WP			(VMM_PAGE_PTE_PAT | VMM_PAGE_PWT)				/* Write protected */
+#define VMM_PAGE_CACHE_WT			(VMM_PAGE_PTE_PAT | VMM_PAGE_PCD | VMM_PAGE_PWT)	/* Write through */
+#define VMM_PAGE_CACHE_MASK			(VMM_PAGE_PTE_PAT | VMM_PAGE_PCD | VMM_PAGE_PWT)
+
 #define VMM_ENTRY_BASE_FLAGS(entry)			((entry) & ((virt_addr_t)0x1FFF | ((virt_addr_t)1 << 63)))
 
 #define VMM_VADDR_PML4E_IDX(vaddr) 			(((vaddr) >> 39) & (virt_addr_t)0x1FF)
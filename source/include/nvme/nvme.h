@@ -17,6 +17,9 @@
 
 #pragma once
 
+#include <stddef.h>
+#include <spinlock.h>
+#include <ring_buffer.h>
 #include "device/device.h"
 #include "storage/storage.h"
 #include "pci/pci.h"
@@ -47,6 +50,83 @@
 	((uint64_t)2 * (queue_index) + (uint64_t)1) * ((uint64_t)1 << (registers->capabilities.stride + (uint64_t)2))	\
 )
 
+/* A volatile pointer of type <type> to the register <field>, the registers must be accessed as a whole. */
+#define NVME_REG(registers, type, field)	((volatile type*)((uint8_t*)(registers) + offsetof(nvme_registers_t, field)))
+
+/* Bits of the CC and CSTS registers, which are always accessed as a whole 32 bit register. */
+#define NVME_CC_ENABLE						(1 << 0)
+#define NVME_CC_CSS_NVM						(0 << 4)
+#define NVME_CC_MPS(mps)					((uint32_t)(mps) << 7)			/* Page size is 2**(12+MPS) */
+#define NVME_CC_IOSQES(exponent)			((uint32_t)(exponent) << 16)
+#define NVME_CC_IOCQES(exponent)			((uint32_t)(exponent) << 20)
+#define NVME_CSTS_READY						(1 << 0)
+#define NVME_CSTS_FATAL						(1 << 1)
+#define NVME_AQA(sbms_size, cmpl_size)		((uint32_t)((sbms_size) - 1) | ((uint32_t)((cmpl_size) - 1) << 16))
+
+#define NVME_PAGE_SIZE						4096		/* The memory page size the driver uses (CC.MPS = 0) */
+#define NVME_ADMIN_QUEUE_ENTRIES			32
+#define NVME_IO_QUEUE_ENTRIES				64			/* 64 submission entries fill a single page */
+#define NVME_MAX_QUEUE_ENTRIES				NVME_IO_QUEUE_ENTRIES		/* The largest queue of either kind, must be a power of 2. */
+#define NVME_MAX_IO_QUEUES					CPU_MAX_COUNT		/* One queue pair per CPU */
+#define NVME_SBMS_ENTRY_SIZE_EXPONENT		6			/* 64 bytes */
+#define NVME_CMPL_ENTRY_SIZE_EXPONENT		4			/* 16 bytes */
+#define NVME_PRP_LIST_ENTRIES				(NVME_PAGE_SIZE / sizeof(uint64_t))
+#define NVME_MAX_TRANSFER_PAGES				NVME_PRP_LIST_ENTRIES		/* A transfer may need one more page than that, PRP1 covers it. */
+#define NVME_SGL_LIST_ENTRIES				(NVME_PAGE_SIZE / sizeof(nvme_sgl_descriptor_t))
+#define NVME_COMMAND_LIST_PAGES				4			/* The most PRP/SGL list pages of a command, SGL segments are chained. */
+#define NVME_QUEUE_LIST_PAGES				8			/* List pages allocated for each I/O queue up front, more are allocated when needed. */
+#define NVME_TIMEOUT_UNIT_MS				500			/* CAP.TO is in units of 500 milliseconds */
+#define NVME_COMMAND_TIMEOUT_MS				5000
+
+#define NVME_CMPL_STATUS_PHASE				(1 << 0)
+#define NVME_CMPL_STATUS_GET_CODE(status)	(((status) >> 1) & 0x7FFF)		/* Status code and status code type, 0 on success. */
+
+/* Admin command set opcodes. */
+#define NVME_ADMIN_DELETE_IO_SBMS_QUEUE		0x00
+#define NVME_ADMIN_CREATE_IO_SBMS_QUEUE		0x01
+#define NVME_ADMIN_DELETE_IO_CMPL_QUEUE		0x04
+#define NVME_ADMIN_CREATE_IO_CMPL_QUEUE		0x05
+#define NVME_ADMIN_IDENTIFY					0x06
+#define NVME_ADMIN_SET_FEATURES				0x09
+#define NVME_ADMIN_DOORBELL_BUFFER_CONFIG	0x7C
+
+/* NVM command set opcodes. */
+#define NVME_IO_FLUSH						0x00
+#define NVME_IO_WRITE						0x01
+#define NVME_IO_READ						0x02
+
+#define NVME_IDENTIFY_CNS_NAMESPACE			0x00
+#define NVME_IDENTIFY_CNS_CONTROLLER		0x01
+#define NVME_IDENTIFY_CNS_ACTIVE_NAMESPACES	0x02
+
+#define NVME_FEATURE_NUMBER_OF_QUEUES		0x07
+
+#define NVME_QUEUE_PHYSICALLY_CONTIGUOUS	(1 << 0)
+#define NVME_QUEUE_INTERRUPTS_ENABLED		(1 << 1)
+#define NVME_QUEUE_INTERRUPT_VECTOR(entry)	((uint32_t)(entry) << 16)		/* The MSI-X entry of a completion queue */
+
+/* The result of Set Features (Number of Queues), the zero based amount of allocated submission and completion queues. */
+#define NVME_QUEUES_GET_SBMS_COUNT(result)	(((result) & 0xFFFF) + 1)
+#define NVME_QUEUES_GET_CMPL_COUNT(result)	(((result) >> 16) + 1)
+#define NVME_QUEUES_SET_COUNT(count)		((uint32_t)((count) - 1) | ((uint32_t)((count) - 1) << 16))
+
+/* The PSDT bits of the command flags, selecting how the data pointer (PRP1 and PRP2) is interpreted. */
+#define NVME_COMMAND_FLAGS_PRP				(0 << 6)
+#define NVME_COMMAND_FLAGS_SGL				(1 << 6)
+#define NVME_COMMAND_FLAGS_PSDT_MASK		(3 << 6)
+
+/* SGL descriptor types, in the high 4 bits of the identifier. (Sub type 0 - an address) */
+#define NVME_SGL_TYPE_DATA_BLOCK			0x00
+#define NVME_SGL_TYPE_SEGMENT				0x20		/* Points to a list of descriptors, the last one points to the next list. */
+#define NVME_SGL_TYPE_LAST_SEGMENT			0x30		/* Points to the last list of descriptors */
+
+/* The OACS field of Identify Controller. */
+#define NVME_OACS_DOORBELL_BUFFER_CONFIG	(1 << 8)
+
+/* The SGLS field of Identify Controller. */
+#define NVME_SGLS_SUPPORTED(sgls)			(((sgls) & 3) != 0)
+#define NVME_SGLS_DWORD_ALIGNED(sgls)		(((sgls) & 3) == 2)	/* Data blocks must be 4 byte aligned, and their size a multiple of 4 */
+
 typedef struct nvme_reg_capabilities				/* CAP */
 {
 	uint64_t max_queue_entry_count 			: 16;	/* MQES - Maximum amount of queue entries, minus 1. */
@@ -125,25 +205,290 @@ typedef struct nvme_registers
 	uint8_t 					reserved2[0xFFF - 0xE1C + 1];		/* Command set specific */
 } __attribute__((packed)) nvme_registers_t;
 
+/* A submission queue entry, a command. See the NVMe 1.4 specification, chapter 4.2 */
+typedef struct nvme_sbms_entry
+{
+	uint8_t opcode;
+	uint8_t flags;						/* Fused operation and PRP/SGL selection */
+	uint16_t command_id;
+	uint32_t namespace_id;
+	uint64_t reserved;
+	uint64_t metadata;
+	uint64_t prp1;
+	uint64_t prp2;
+	uint32_t cdw10;
+	uint32_t cdw11;
+	uint32_t cdw12;
+	uint32_t cdw13;
+	uint32_t cdw14;
+	uint32_t cdw15;
+} __attribute__((packed)) nvme_sbms_entry_t;
+
+/* A completion queue entry. See the NVMe 1.4 specification, chapter 4.6 */
+typedef struct nvme_cmpl_entry
+{
+	uint32_t result;					/* Command specific */
+	uint32_t reserved;
+	uint16_t sbms_head;					/* The head of the submission queue, entries up to it can be reused. */
+	uint16_t sbms_id;
+	uint16_t command_id;
+	uint16_t status;					/* Bit 0 is the phase tag */
+} __attribute__((packed)) nvme_cmpl_entry_t;
+
+/* The data returned by Identify Controller. Only the used fields are named. */
+typedef struct nvme_identify_controller
+{
+	uint16_t vendor_id;
+	uint16_t subsystem_vendor_id;
+	char serial_number[20];
+	char model_number[40];
+	char firmware_revision[8];
+	uint8_t recommended_arbitration_burst;
+	uint8_t ieee_oui[3];
+	uint8_t multi_interface_caps;
+	uint8_t max_data_transfer_size;		/* MDTS - In units of the minimum page size, as a power of 2. 0 means no limit. */
+	uint16_t controller_id;
+	uint32_t version;
+	uint8_t reserved0[256 - 84];
+	uint16_t optional_admin_commands;	/* OACS - See NVME_OACS_* */
+	uint8_t reserved1[512 - 258];
+	uint8_t sbms_entry_size;			/* SQES */
+	uint8_t cmpl_entry_size;			/* CQES */
+	uint16_t max_commands;
+	uint32_t namespace_count;			/* NN */
+	uint16_t optional_commands;			/* ONCS */
+	uint16_t fused_operations;
+	uint8_t format_nvm_attributes;
+	uint8_t volatile_write_cache;		/* VWC - Bit 0 is set if a volatile write cache is present. */
+	uint16_t atomic_write_unit_normal;
+	uint16_t atomic_write_unit_power_fail;
+	uint8_t vendor_specific_config;
+	uint8_t write_protect_caps;
+	uint16_t atomic_compare_write_unit;
+	uint16_t reserved2;
+	uint32_t sgl_support;				/* SGLS - See NVME_SGLS_SUPPORTED */
+	uint8_t reserved3[4096 - 540];
+} __attribute__((packed)) nvme_identify_controller_t;
+
+/* An SGL descriptor. See the NVMe 1.4 specification, chapter 4.4 */
+typedef struct nvme_sgl_descriptor
+{
+	uint64_t address;
+	uint32_t length;
+	uint8_t reserved[3];
+	uint8_t type;						/* NVME_SGL_TYPE_* */
+} __attribute__((packed)) nvme_sgl_descriptor_t;
+
+typedef struct nvme_lba_format
+{
+	uint16_t metadata_size;
+	uint8_t lba_data_size;				/* LBADS - The size of a sector is 2**LBADS */
+	uint8_t relative_performance;
+} __attribute__((packed)) nvme_lba_format_t;
+
+/* The data returned by Identify Namespace. Only the used fields are named. */
+typedef struct nvme_identify_namespace
+{
+	uint64_t size;						/* NSZE - In sectors */
+	uint64_t capacity;					/* NCAP */
+	uint64_t utilization;				/* NUSE */
+	uint8_t features;
+	uint8_t lba_format_count;			/* NLBAF - Zero based */
+	uint8_t formatted_lba_size;			/* FLBAS - The low 4 bits are the index of the LBA format in use. */
+	uint8_t reserved0[128 - 27];
+	nvme_lba_format_t lba_formats[16];
+	uint8_t reserved1[4096 - 192];
+} __attribute__((packed)) nvme_identify_namespace_t;
+
+/* 
+ * The state of a submitted command, indexed by its command ID. 
+ * A command ID is in use from submission until its completion is reaped, which is independent of its submission slot,
+ * as the controller frees a slot as soon as it fetches the command.
+ */
+typedef struct nvme_command_state
+{
+	bio_t* bio;							/* The request of an I/O command, NULL for admin commands. */
+	void* lists[NVME_COMMAND_LIST_PAGES];	/* The PRP or SGL list pages of the command, returned to the queue on completion. */
+	uint8_t list_count;
+	uint32_t result;
+	uint16_t status;
+	bool done;
+} nvme_command_state_t;
+
+/* 
+ * A submission queue and its completion queue. Each queue is a single page of physically contiguous memory.
+ * The command ID of a command is the index of its submission queue slot, so the completion finds its state (and request) directly.
+ * Each CPU submits to its own I/O queue pair with interrupts disabled, and the completion interrupt of the pair is 
+ * aimed at the same CPU, so no lock is needed. Only when there are less queues than CPUs (<shared>) is the lock taken.
+ */
+typedef struct nvme_queue
+{
+	nvme_sbms_entry_t* sbms;
+	nvme_cmpl_entry_t* cmpl;
+	nvme_command_state_t* commands;		/* <size> entries, indexed by command ID. */
+	volatile uint32_t* sbms_doorbell;
+	volatile uint32_t* cmpl_doorbell;
+	volatile uint32_t* sbms_shadow;		/* The shadow doorbells and event indexes of the queue, NULL if not used. */
+	volatile uint32_t* cmpl_shadow;
+	volatile uint32_t* sbms_event;
+	volatile uint32_t* cmpl_event;
+	uint64_t doorbell_writes;			/* MMIO doorbell writes */
+	uint64_t doorbell_writes_avoided;	/* Doorbell updates that only went to the shadow doorbell */
+	void* free_lists;					/* A stack of free PRP/SGL list pages, linked through their first bytes. */
+	ring_buffer_t<uint16_t, NVME_MAX_QUEUE_ENTRIES> free_command_ids;	/* <size> - 1 IDs, so the completion queue cant overflow. */
+	spinlock_t lock;
+	bool shared;						/* True if more than one CPU submits to this queue. */
+	uint16_t id;
+	uint16_t size;
+	uint16_t sbms_tail;
+	uint16_t sbms_head;					/* As last reported by the controller. */
+	uint16_t cmpl_head;
+	uint16_t msix_entry;				/* -1 for a polled queue */
+	uint16_t interrupt;					/* IDT vector, -1 for a polled queue */
+	uint8_t phase;						/* The phase tag of new completion entries, flips each time the queue wraps. */
+} nvme_queue_t;
+
+static_assert(NVME_ADMIN_QUEUE_ENTRIES <= NVME_MAX_QUEUE_ENTRIES, "The command IDs of the admin queue must fit the free ID buffer.");
+
+/* Doorbell counters, summed over all I/O queues. (See get_doorbell_stats) */
+typedef struct nvme_doorbell_stats
+{
+	uint64_t writes;
+	uint64_t writes_avoided;
+} nvme_doorbell_stats_t;
+
+typedef enum nvme_init_state
+{
+	NVME_INIT_START,
+	NVME_INIT_WAIT_DISABLED,			/* Waiting for CSTS.RDY to clear after clearing CC.EN */
+	NVME_INIT_WAIT_READY,				/* Waiting for CSTS.RDY to be set after setting CC.EN */
+} nvme_init_state_t;
+
 class device_storage_pci_nvme_t : public device_storage_t, public device_pci_t
 {
 public:	
-	device_storage_pci_nvme_t(uint8_t bus, uint8_t device, uint8_t function) : 
+	device_storage_pci_nvme_t(const pci_config_shadow_t& config) : 
 		device_t(DEVICE_TYPE_STORAGE | DEVICE_TYPE_PCI | DEVICE_TYPE_NVME, this),
-		device_pci_t(DEVICE_TYPE_STORAGE | DEVICE_TYPE_PCI | DEVICE_TYPE_NVME, bus, device, function) {}
+		device_pci_t(DEVICE_TYPE_STORAGE | DEVICE_TYPE_PCI | DEVICE_TYPE_NVME, config), 
+		m_mmio(NULL), m_init_state(NVME_INIT_START), m_admin_queue(), m_io_queues(NULL), m_io_queue_count(0), m_sgl_support(0), 
+		m_shadow_doorbells(NULL), m_event_indexes(NULL) {}
+
+	/* Allocate an NVMe device object from the NVMe device pool. Returns NULL if out of memory. */
+	static device_storage_pci_nvme_t* create(const pci_config_shadow_t& config);
 
+	/* Initialize the controller, waiting for it. Prefer poll_initialize() which doesnt wait. */
 	int initialize() override;
+
+	/* 
+	 * Reset and enable the controller, without waiting for it to become ready. 
+	 * Once ready, identifies the controller and its first namespace and creates the I/O queues.
+	 */
+	int poll_initialize() override;
+
 	int uninitialize() override;
 
 	void discover_children() override {};
+
+	/* Queue <bio> on the I/O queue pair of the current CPU. Returns ERR_DEVICE_BUSY if the queue is full. */
+	int submit(bio_t* bio) const override;
+
+	/* Reap the completion queue of the current CPU. */
+	size_t poll() const override;
+
+	/* Write the doorbell counters of the I/O queues into <stats>. */
+	void get_doorbell_stats(nvme_doorbell_stats_t* stats) const;
+
+	size_t get_max_transfer_sectors() const override { return m_max_transfer_size / m_sector_size; }
+
+	/* 
+	 * PRPs describe whole pages, so only a segment that ends a page can be followed by one that starts a page.
+	 * If the controller supports SGLs any segments can follow each other, the request is sent with an SGL.
+	 */
+	bool can_merge_segments(const bio_segment_t* first, const bio_segment_t* second) const override
+	{
+		if(NVME_SGLS_SUPPORTED(m_sgl_support))
+			return !NVME_SGLS_DWORD_ALIGNED(m_sgl_support) || (((uint64_t)second->buffer | second->size) % sizeof(uint32_t) == 0);
+
+		return ((uint64_t)first->buffer + first->size) % NVME_PAGE_SIZE == 0 && (uint64_t)second->buffer % NVME_PAGE_SIZE == 0;
+	}
 	
 protected:
-	inline bool is_device(const device_t* device) const override { return device_pci_t::is_device(device); };
+	void release() override;
 
 	int read_sectors(uint64_t lba, size_t count, void* buffer) const override;
 	int write_sectors(uint64_t lba, size_t count, const void* buffer) const override;
 
 private:
+	/* Allocate the memory of <queue>, and set its doorbells. Returns 0 on success, an error code otherwise. */
+	int queue_init(nvme_queue_t* queue, uint16_t id, uint16_t size);
+
+	/* Free the memory of <queue>. */
+	void queue_free(nvme_queue_t* queue);
+
+	/* 
+	 * Submit <command> to the admin queue, and wait for its completion. Writes the result of the command into <result> if not NULL.
+	 * Returns 0 on success, an error code otherwise.
+	 */
+	int submit_admin(nvme_sbms_entry_t* command, uint32_t* result = NULL);
+
+	/* Returns the I/O queue pair of the current CPU. */
+	nvme_queue_t* current_queue() const;
+
+	/* Create I/O queue pair <queue>, with its completion interrupt aimed at the CPU of index <cpu>. */
+	int create_io_queue(nvme_queue_t* queue, uint16_t id, uint32_t cpu);
+
+	/* 
+	 * Point the data pointer of <command> to the segments of <bio>. Uses PRPs if the segments allow it, otherwise an SGL 
+	 * if the controller supports SGLs. List pages are taken from <queue>, and recorded in <state>.
+	 * Returns 0 on success, an error code otherwise, in which case the list pages were given back.
+	 */
+	int set_data_pointer(nvme_queue_t* queue, nvme_command_state_t* state, nvme_sbms_entry_t* command, const bio_t* bio) const;
+
+	/* 
+	 * Point the PRP entries of <command> to the segments of <bio>. Segments must be 4 byte aligned, 
+	 * and only the first may start (and the last end) inside a page. Returns 0 on success, an error code otherwise.
+	 */
+	int set_prps(nvme_queue_t* queue, nvme_command_state_t* state, nvme_sbms_entry_t* command, const bio_t* bio) const;
+
+	/* 
+	 * Point the data pointer of <command> to an SGL describing the segments of <bio>, with a data block descriptor for 
+	 * each physically contiguous run. Returns 0 on success, an error code otherwise.
+	 */
+	int set_sgls(nvme_queue_t* queue, nvme_command_state_t* state, nvme_sbms_entry_t* command, const bio_t* bio) const;
+
+	/* Read or write <count> sectors starting at <lba>, as requests of at most m_max_transfer_size, one at a time. */
+	int transfer(bio_op_t op, uint64_t lba, size_t count, void* buffer) const;
+
+	/* 
+	 * Give the controller the shadow doorbell and event index buffers, if it supports Doorbell Buffer Config.
+	 * Shadow doorbells are only an optimization, so on any failure the MMIO doorbells are used.
+	 */
+	void setup_shadow_doorbells(const nvme_identify_controller_t* controller);
+
+	/* Identify the controller and the first active namespace, and create the I/O queues. Returns 0 on success, an error code otherwise. */
+	int setup();
+
+	/* Returns the value of the CAP register. */
+	nvme_reg_capabilities_t read_capabilities() const;
+
 	/* The memory mapped registers used by the NVME controller. */
 	nvme_registers_t* m_mmio;
+
+	nvme_init_state_t m_init_state;
+	uint64_t m_init_deadline;				/* TSC deadline of the current init step. (See time_deadline_ms) */
+
+	nvme_queue_t m_admin_queue;
+	nvme_queue_t* m_io_queues;
+	size_t m_io_queue_count;
+
+	uint32_t m_namespace_id;
+	uint32_t m_sgl_support;					/* SGLS of Identify Controller */
+
+	/* 
+	 * Shadow doorbells, NULL if not used. The driver writes the doorbell values here, and only writes the MMIO doorbell 
+	 * when the value passes the event index the controller wrote for that doorbell. (Each is a page, laid out like the doorbells)
+	 */
+	uint32_t* m_shadow_doorbells;
+	uint32_t* m_event_indexes;
+	size_t m_max_transfer_size;				/* In bytes */
 };
\ No newline at end of file
@@ -0,0 +1,203 @@
+/* 
+ * This file is part of the EspressoOS project (https://github.com/rdex999/EspressoOS.git).
+ * Copyright (c) 2025 David Weizman.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define PCI_CONFIG_SHADOW_SIZE		256		/* The PCI compatible configuration space, the PCIe extended space isnt shadowed. */
+
+typedef struct pci_config_device
+{
+	uint32_t base_address[6];
+	uint32_t cardbus_cis_pointer;
+	uint16_t subsystem_vendor_id;
+	uint16_t subsystem_id;
+	uint32_t expansion_rom_base_address;
+	uint8_t capabilities_pointer;
+	uint8_t reserved[7];
+	uint8_t interrupt_line;
+	uint8_t interrupt_pin;
+	uint8_t min_grant;
+	uint8_t max_latency;
+} __attribute__((packed)) pci_config_device_t;
+
+typedef struct pci_config_bridge_pci_to_pci
+{
+	uint32_t base_address[2];
+	uint8_t primary_bus;
+	uint8_t secondary_bus;
+	uint8_t subordinate_bus;
+	uint8_t secondary_latency_timer;
+	uint8_t io_base;
+	uint8_t io_limit;
+	uint16_t secondary_status;
+	uint16_t memory_base;
+	uint16_t memory_limit;
+	uint16_t prefetchable_memory_base;
+	uint16_t prefetchable_memory_limit;
+	uint32_t prefetchable_base_upper;
+	uint32_t prefetchable_limit_upper;
+	uint16_t io_base_upper;
+	uint16_t io_limit_upper;
+	uint8_t capability_pointer;
+	uint8_t reserved[3];
+	uint8_t expansion_rom_base_address;
+	uint8_t interrupt_line;
+	uint8_t interrupt_pin;
+	uint16_t bridge_control;
+} __attribute__((packed)) pci_config_bridge_pci_to_pci_t;
+
+typedef struct pci_config 
+{
+	uint16_t vendor_id;
+	uint16_t device_id;
+	uint16_t command;
+	uint16_t status;
+	uint8_t revision_id;
+	uint8_t prog_if;
+	uint8_t subclass;
+	uint8_t class_code;
+	uint8_t cache_line_size;
+	uint8_t latency_timer;
+	uint8_t header_type;
+	uint8_t bist;
+
+	union
+	{
+		pci_config_device_t device;
+		pci_config_bridge_pci_to_pci_t bridge_pci_to_pci;
+	};
+	
+} __attribute__((packed)) pci_config_t;
+
+/*
+ * A copy of the configuration space header of a PCI function, read once (using 32 bit reads) when the function is discovered.
+ * Reading a field returns the copy, so repeated reads of IDs, class codes, BARs and capabilities dont do any port IO or MMIO.
+ * Fields are accessed by a chain of member pointers into pci_config_t, so the offset and size of the access come from the
+ * struct layout. For example:
+ * 		config.read<&pci_config_t::subclass>()
+ * 		config.write<&pci_config_t::bridge_pci_to_pci, &pci_config_bridge_pci_to_pci_t::secondary_bus>(bus)
+ * Note: Fields the device may change by itself (status bits for example) must be re-read with reload().
+ */
+class pci_config_shadow_t
+{
+public:
+	/* Read the configuration space header of the function at the given location into the shadow. */
+	void load(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function);
+
+	/* Returns the value of a field in the shadow. */
+	template<auto... Members>
+	inline auto read() const { return (m_config .* ... .* Members); }
+
+	/* Write <value> into a field, both in the shadow and in the device. */
+	template<auto... Members, typename T>
+	void write(T value)
+	{
+		typedef decltype(read<Members...>()) field_t;
+		static_assert(sizeof(field_t) == 1 || sizeof(field_t) == 2 || sizeof(field_t) == 4, "Unsupported field size.");
+
+		(m_config .* ... .* Members) = (field_t)value;
+		write_register(offset<Members...>(), sizeof(field_t), (uint32_t)(field_t)value);
+	}
+
+	/* Read a field from the device into the shadow. Returns the new value. */
+	template<auto... Members>
+	auto reload()
+	{
+		typedef decltype(read<Members...>()) field_t;
+		static_assert(sizeof(field_t) == 1 || sizeof(field_t) == 2 || sizeof(field_t) == 4, "Unsupported field size.");
+
+		(m_config .* ... .* Members) = (field_t)read_register(offset<Members...>(), sizeof(field_t));
+		return read<Members...>();
+	}
+
+	/* 
+	 * Returns the value of type <T> at <offset> in the shadow, for registers that arent in pci_config_t (capabilities).
+	 * Returns all ones if <offset> is out of the shadow.
+	 */
+	template<typename T>
+	T read_raw(uint16_t offset) const
+	{
+		if((size_t)offset + sizeof(T) > PCI_CONFIG_SHADOW_SIZE)
+			return (T)-1;
+
+		T value;
+		memcpy(&value, &m_bytes[offset], sizeof(T));
+		return value;
+	}
+
+	/* Read the register of type <T> at <offset> from the device into the shadow. Returns the new value. */
+	template<typename T>
+	T reload_raw(uint16_t offset)
+	{
+		static_assert(sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4, "Unsupported register size.");
+
+		T value = (T)read_register(offset, sizeof(T));
+		if((size_t)offset + sizeof(T) <= PCI_CONFIG_SHADOW_SIZE)
+			memcpy(&m_bytes[offset], &value, sizeof(T));
+
+		return value;
+	}
+
+	/* Write <value> of type <T> at <offset>, both in the shadow and in the device. */
+	template<typename T>
+	void write_raw(uint16_t offset, T value)
+	{
+		static_assert(sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4, "Unsupported register size.");
+
+		if((size_t)offset + sizeof(T) <= PCI_CONFIG_SHADOW_SIZE)
+			memcpy(&m_bytes[offset], &value, sizeof(T));
+
+		write_register(offset, sizeof(T), (uint32_t)value);
+	}
+
+	/* 
+	 * Find a capability of <capability> ID (pci_capability_id_t) in the capabilities list in the shadow.
+	 * Returns the offset of the capability, -1 if not found. (Or if the function doesnt support capabilities)
+	 */
+	uint16_t find_capability(uint8_t capability) const;
+
+	inline uint16_t segment() const 	{ return m_segment; }
+	inline uint8_t bus() const 			{ return m_bus; }
+	inline uint8_t device() const 		{ return m_device; }
+	inline uint8_t function() const 	{ return m_function; }
+
+private:
+	/* Returns the offset of a field in the configuration space. */
+	template<auto... Members>
+	inline uint16_t offset() const { return (uint16_t)((const uint8_t*)&(m_config .* ... .* Members) - m_bytes); }
+
+	/* Read/write a 1, 2 or 4 byte register of the device. */
+	uint32_t read_register(uint16_t offset, size_t size) const;
+	void write_register(uint16_t offset, size_t size, uint32_t value) const;
+
+	uint16_t m_segment;
+	uint8_t m_bus;
+	uint8_t m_device;
+	uint8_t m_function;
+
+	union
+	{
+		pci_config_t m_config;
+		uint8_t m_bytes[PCI_CONFIG_SHADOW_SIZE];
+		uint32_t m_dwords[PCI_CONFIG_SHADOW_SIZE / sizeof(uint32_t)];
+	};
+};
\ No newline at end of file
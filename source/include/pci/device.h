@@ -20,31 +20,75 @@
 #include <stdint.h>
 #include <stddef.h>
 #include "device/device.h"
+#include "pci/config.h"
+#include "mm/pmm/pmm.h"
 
 typedef enum pci_capability_id
 {
 	PCI_CAPABILITY_ID_MSI 	= 0x05,
+	PCI_CAPABILITY_ID_PCIE	= 0x10,
 	PCI_CAPABILITY_ID_MSIX	= 0x11,
 } pci_capability_id_t;
 
+/* IDs of PCI Express extended capabilities, which are in the extended configuration space (offset 0x100 and above). */
+typedef enum pci_ext_capability_id
+{
+	PCI_EXT_CAPABILITY_ID_AER 		= 0x01,		/* Advanced Error Reporting */
+	PCI_EXT_CAPABILITY_ID_DSN 		= 0x03,		/* Device Serial Number */
+	PCI_EXT_CAPABILITY_ID_ACS 		= 0x0D,		/* Access Control Services */
+	PCI_EXT_CAPABILITY_ID_ARI 		= 0x0E,		/* Alternative Routing-ID Interpretation */
+	PCI_EXT_CAPABILITY_ID_SRIOV		= 0x10,		/* Single Root IO Virtualization */
+	PCI_EXT_CAPABILITY_ID_LTR 		= 0x18,		/* Latency Tolerance Reporting */
+	PCI_EXT_CAPABILITY_ID_L1SS 		= 0x1E,		/* L1 PM Substates */
+} pci_ext_capability_id_t;
+
+#define PCI_MAX_BARS	6
+
+/* A Base Address Register of a device, and the range it decodes. Filled by probing the BAR when the device is initialized. */
+typedef struct pci_bar
+{
+	phys_addr_t address;		/* Physical address of the range, or the first IO port for IO BARs. */
+	uint64_t size;				/* Size of the range in bytes, 0 if the BAR isnt implemented. */
+	bool io;					/* True for IO space BARs. */
+	bool is_64bit;				/* True if the BAR uses the next BAR as the high 32 bits of the address. */
+	bool prefetchable;
+	void* mapping;				/* Virtual address of the whole range, NULL if not mapped yet. */
+} pci_bar_t;
+
 class device_pci_t : public virtual device_t
 {
 public:
-	device_pci_t(device_type_t type, uint8_t bus, uint8_t device, uint8_t function)
-		: device_t(type | DEVICE_TYPE_PCI, this), m_bus(bus), m_device(device), m_function(function) {}
+	device_pci_t(device_type_t type, const pci_config_shadow_t& config)
+		: device_t(type | DEVICE_TYPE_PCI, this), m_segment(config.segment()), m_bus(config.bus()), 
+		m_device(config.device()), m_function(config.function()), m_config(config), m_msix_table_size(0) {}
 
 	virtual int initialize() override;
 
+	/* 
+	 * Discover the devices behind this one while enumerating, before any device is initialized. 
+	 * Returns 0 on success, an error code otherwise. The default does nothing, as most functions have no devices behind them.
+	 */
+	virtual int enumerate() { return SUCCESS; }
+
+	/* Registers PCI devices also under their class, class/subclass, class/subclass/prog-if and vendor/device ID. */
+	virtual size_t get_registry_keys(uint64_t* keys, size_t max) const override;
+
 protected:
-	virtual bool is_device(const device_t* device) const override;
+	/* 
+	 * Probe the size of every BAR of the device, by writing all ones to it and restoring it, and fill <m_bars>.
+	 * Memory and IO decoding are disabled while probing.
+	 */
+	void probe_bars();
 
 	/* 
-	 * Map <pages> pages of a 64 bit Base Address Register (bar). Sets <flags> as the virtual address flags .
-	 * Uses bar <bar> as the low 32 bits, and bar <bar>+1 as the high 32 bits of the physical address. 
-	 * <bar> is the number of the bar (bar 0, bar 1, ...)
-	 * Returns a valid pointer on success, -1 on failure.
+	 * Map the whole range of memory BAR <bar> (bar 0, bar 1, ...). Prefetchable BARs are mapped write combining, 
+	 * others uncacheable. A BAR is mapped only once, later calls return the same mapping.
+	 * Returns a valid pointer on success, -1 on failure. (Out of memory, or not an implemented memory BAR)
 	 */
-	void* map_bar(uint8_t bar, size_t pages) const;
+	void* map_bar(uint8_t bar);
+
+	/* Same as map_bar(bar), with the memory type <cache> (VMM_PAGE_CACHE_*) for the first mapping of the BAR. */
+	void* map_bar(uint8_t bar, uint64_t cache);
 
 	/* 
 	 * Find a capability of <capability> ID in the device's capabilities linked list.
@@ -53,6 +97,13 @@ protected:
 	 */
 	uint16_t find_capability(pci_capability_id_t capability) const;
 
+	/* 
+	 * Find an extended capability of <capability> ID in the device's PCI Express extended capabilities list.
+	 * Returns an offset into the device's configuration space which has the capability.
+	 * Returns -1 on failure. (Not a PCI Express device, no ECAM access, or the capability is not found.)
+	 */
+	uint16_t find_ext_capability(pci_ext_capability_id_t capability) const;
+
 	/* 
 	 * Initialize MSI-X for the device. Enable MSI and mask all interrupts.
 	 * Returns 0 on success, an error code otherwise.
@@ -60,22 +111,37 @@ protected:
 	int msix_init();
 
 	/* Mask all interrupts for this device. Sets the mask bit in the MSIX-X control register. */
-	void msix_mask_all() const;
+	void msix_mask_all();
 
 	/* Unmask all interrupts for this device. Clears the mask bit in the MSIX-X control register. */
-	void msix_unmask_all() const;
+	void msix_unmask_all();
 
+	/* 
+	 * Make MSI-X table entry <entry> raise interrupt vector <vector> on the CPU with the local APIC ID <lapic_id>, and unmask it.
+	 * Returns 0 on success, an error code otherwise.
+	 */
+	int msix_set_vector(uint16_t entry, uint8_t vector, uint32_t lapic_id);
+
+	/* Mask MSI-X table entry <entry>. */
+	void msix_mask(uint16_t entry);
+
+	const uint16_t m_segment;		/* PCI segment group */
 	const uint8_t m_bus;
 	const uint8_t m_device;
 	const uint8_t m_function;
 
+	pci_config_shadow_t m_config;	/* Shadow of the configuration space header, read when the device was discovered. */
+	pci_bar_t m_bars[PCI_MAX_BARS];
+
 	uint16_t m_vendor_id;
 	uint16_t m_device_id;
 	uint8_t m_class_code;
 	uint8_t m_subclass;
 	uint8_t m_prog_if;
 
+	uint16_t m_pcie_capability;		/* Offset of the PCI Express capability, -1 for conventional PCI devices. */
 	uint16_t m_msix_capability;
+	uint16_t m_msix_table_size;		/* Amount of entries in the MSI-X table, 0 before msix_init() */
 	struct pci_msix_table_entry* m_msix_table;
 	uint64_t* m_msix_pending;
 };
@@ -83,13 +149,19 @@ protected:
 class device_pci_bridge_pci2pci_t : public device_pci_t
 {
 public:
-	device_pci_bridge_pci2pci_t(uint8_t bus, uint8_t device, uint8_t function) : 
+	device_pci_bridge_pci2pci_t(const pci_config_shadow_t& config) : 
 		device_t(DEVICE_TYPE_PCI_BRIDGE, this), 
-		device_pci_t(DEVICE_TYPE_PCI_BRIDGE, bus, device, function) {}
+		device_pci_t(DEVICE_TYPE_PCI_BRIDGE, config) {}
+
+	/* Allocate a bridge object from the bridge pool. Returns NULL if out of memory. */
+	static device_pci_bridge_pci2pci_t* create(const pci_config_shadow_t& config);
 
-	int initialize() override;
 	int uninitialize() override { return SUCCESS; };
 
+	/* Give the bridge its secondary bus number, and enumerate the secondary bus. */
+	int enumerate() override;
+
 protected:
 	void discover_children() override;
+	void release() override;
 };
\ No newline at end of file
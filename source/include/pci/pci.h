@@ -19,10 +19,14 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include "pci/config.h"
 #include "pci/device.h"
 
 #define PCI_DEVICES_PER_BUS 		32
 #define PCI_FUNCTIONS_PER_DEVICE 	8
+#define PCI_BUSES_PER_SEGMENT		256
+#define PCI_MAX_SEGMENTS			16		/* Maximum amount of ECAM windows (MCFG entries) */
+#define PCI_MAX_ROOT_BUSES			32		/* Maximum amount of root buses, in all segments */
 #define PCI_CONFIG_PORT 			0xCF8
 #define PCI_DATA_PORT 				0xCFC
 
@@ -34,8 +38,17 @@
 
 #define PCI_STATUS_CAPABILITIES		(1 << 4)
 
+#define PCI_COMMAND_IO_SPACE		(1 << 0)
+#define PCI_COMMAND_MEMORY_SPACE	(1 << 1)
+#define PCI_COMMAND_BUS_MASTER		(1 << 2)
+
+#define PCI_BAR_IO_SPACE				(1 << 0)
 #define PCI_BAR_GET_TYPE(bar)			(((bar) >> 1) & 0b11)
 #define PCI_BAR_GET_PREFETCHABLE(bar)	(((bar) >> 3) & 0b1)
+#define PCI_BAR_MEMORY_ADDRESS_MASK		(~(uint64_t)0xF)
+#define PCI_BAR_IO_ADDRESS_MASK			(~(uint32_t)0x3)
+#define PCI_BARS_DEVICE					6		/* Amount of BARs of a type 0 header (device) */
+#define PCI_BARS_BRIDGE					2		/* Amount of BARs of a type 1 header (PCI to PCI bridge) */
 
 #define PCI_BAR_TYPE_64BIT			0b10
 #define PCI_BAR_TYPE_32BIT			0b00
@@ -63,11 +76,48 @@
 #define PCI_MSIX_MSG_ADDR_DEST_MODE									(1 << 2)		/* DM=0 and RH=1 - Destination ID is physical, DM=1 and RH=1 - Destination ID is logical, RH=0 - Independent (See intel spec)*/
 #define PCI_MSIX_MSG_ADDR_REDIRECT_HINT								(1 << 3)
 #define PCI_MSIX_MSG_ADDR_GET_LAPIC_ID(msg_addr)					(((msg_addr) >> 12) & 0xFF)
-#define PCI_MSIX_MSG_ADDR_SET_LAPIC_ID(msg_addr, id)				(((msg_addr) & (0xFF << 12)) | id)
+#define PCI_MSIX_MSG_ADDR_SET_LAPIC_ID(msg_addr, id)				(((msg_addr) & ~(0xFF << 12)) | ((uint64_t)(id) << 12))
 #define PCI_MSIX_MSG_ADDR_GET_ADDR(msg_addr)						((msg_addr) & ~0xFFFFF)
 #define PCI_MSIX_MSG_ADDR_SET_ADDR(msg_addr, address)				(((msg_addr) & ~0xFFFFF) | (address))
 
-#define PCI_MSIX_MSG_DATA_MASK										(1 << 0)	/* When set, the interrupt is masked. */
+#define PCI_MSIX_MSG_ADDR_BASE										0xFEE00000		/* Messages are writes to the local APIC range */
+#define PCI_MSIX_MSG_DATA_MASK										(1 << 0)	/* When set, the interrupt is masked. (In the vector control) */
+
+/* 
+ * For the PCI Express capability and extended capabilities, see the PCI Express Base Specification 4.0, chapter 7.5.3 and 7.6.
+ * MPS (Max Payload Size) and MRRS (Max Read Request Size) are encoded as 128 << value.
+ */
+#define PCIE_CAPS_GET_PORT_TYPE(caps)						(((caps) >> 4) & 0xF)
+#define PCIE_PORT_TYPE_ENDPOINT								0x0
+#define PCIE_PORT_TYPE_LEGACY_ENDPOINT						0x1
+#define PCIE_PORT_TYPE_ROOT_PORT							0x4
+#define PCIE_PORT_TYPE_UPSTREAM_SWITCH						0x5
+#define PCIE_PORT_TYPE_DOWNSTREAM_SWITCH					0x6
+#define PCIE_PORT_TYPE_PCIE_TO_PCI_BRIDGE					0x7
+#define PCIE_PORT_TYPE_PCI_TO_PCIE_BRIDGE					0x8
+#define PCIE_PORT_TYPE_ROOT_COMPLEX_ENDPOINT				0x9
+#define PCIE_PORT_TYPE_ROOT_COMPLEX_EVENT_COLLECTOR			0xA
+
+#define PCIE_DEVCAP_GET_MAX_PAYLOAD(devcap)					((devcap) & 0b111)
+
+#define PCIE_DEVCTL_RELAXED_ORDERING						(1 << 4)
+#define PCIE_DEVCTL_NO_SNOOP								(1 << 11)
+#define PCIE_DEVCTL_GET_MAX_PAYLOAD(devctl)					(((devctl) >> 5) & 0b111)
+#define PCIE_DEVCTL_SET_MAX_PAYLOAD(devctl, mps)			(((devctl) & ~(0b111 << 5)) | ((mps) << 5))
+#define PCIE_DEVCTL_GET_MAX_READ_REQUEST(devctl)			(((devctl) >> 12) & 0b111)
+#define PCIE_DEVCTL_SET_MAX_READ_REQUEST(devctl, mrrs)		(((devctl) & ~(0b111 << 12)) | ((mrrs) << 12))
+
+#define PCIE_PAYLOAD_128									0
+#define PCIE_PAYLOAD_4096									5
+#define PCIE_PAYLOAD_SIZE(encoded)							(128 << (encoded))
+
+#define PCIE_LNKSTA_GET_SPEED(lnksta)						((lnksta) & 0xF)			/* 1 - 2.5 GT/s, 2 - 5 GT/s, 3 - 8 GT/s ... */
+#define PCIE_LNKSTA_GET_WIDTH(lnksta)						(((lnksta) >> 4) & 0x3F)
+
+#define PCIE_EXT_CAPABILITY_START							0x100
+#define PCIE_EXT_CAPABILITY_GET_ID(header)					((header) & 0xFFFF)
+#define PCIE_EXT_CAPABILITY_GET_VERSION(header)				(((header) >> 16) & 0xF)
+#define PCIE_EXT_CAPABILITY_GET_NEXT(header)				(((header) >> 20) & 0xFFC)
 
 #define PCI_CLASSCODE_MASS_STORAGE 	1
 
@@ -81,69 +131,26 @@ typedef enum pci_access_mechanism
 	PCI_ACCESS_MMCONFIG,
 } pci_access_mechanism_t;
 
-typedef struct pci_config_device
+/* A range of buses of a PCI segment group, and its ECAM (memory mapped configuration space) window. */
+typedef struct pci_segment
 {
-	uint32_t base_address[6];
-	uint32_t cardbus_cis_pointer;
-	uint16_t subsystem_vendor_id;
-	uint16_t subsystem_id;
-	uint32_t expansion_rom_base_address;
-	uint8_t capabilities_pointer;
-	uint8_t reserved[7];
-	uint8_t interrupt_line;
-	uint8_t interrupt_pin;
-	uint8_t min_grant;
-	uint8_t max_latency;
-} __attribute__((packed)) pci_config_device_t;
-
-typedef struct pci_config_bridge_pci_to_pci
-{
-	uint32_t base_address[2];
-	uint8_t primary_bus;
-	uint8_t secondary_bus;
-	uint8_t subordinate_bus;
-	uint8_t secondary_latency_timer;
-	uint8_t io_base;
-	uint8_t io_limit;
-	uint16_t secondary_status;
-	uint16_t memory_base;
-	uint16_t memory_limit;
-	uint16_t prefetchable_memory_base;
-	uint16_t prefetchable_memory_limit;
-	uint32_t prefetchable_base_upper;
-	uint32_t prefetchable_limit_upper;
-	uint16_t io_base_upper;
-	uint16_t io_limit_upper;
-	uint8_t capability_pointer;
-	uint8_t reserved[3];
-	uint8_t expansion_rom_base_address;
-	uint8_t interrupt_line;
-	uint8_t interrupt_pin;
-	uint16_t bridge_control;
-} __attribute__((packed)) pci_config_bridge_pci_to_pci_t;
-
-typedef struct pci_config 
+	uint16_t segment;
+	uint8_t start_bus;
+	uint8_t end_bus;
+	uint8_t* mmconfig;			/* Virtual address of the configuration space of bus 0. Only buses start_bus-end_bus are mapped. */
+} pci_segment_t;
+
+/* 
+ * A bus that is not behind any PCI to PCI bridge. Besides the first bus of a segment, these are the buses of extra host
+ * bridges, like QEMU's pxb-pcie. Bridges below a root bus get bus numbers from bus + 1 up to the next root bus.
+ */
+typedef struct pci_root_bus
 {
-	uint16_t vendor_id;
-	uint16_t device_id;
-	uint16_t command;
-	uint16_t status;
-	uint8_t revision_id;
-	uint8_t prog_if;
-	uint8_t subclass;
-	uint8_t class_code;
-	uint8_t cache_line_size;
-	uint8_t latency_timer;
-	uint8_t header_type;
-	uint8_t bist;
-
-	union
-	{
-		pci_config_device_t device;
-		pci_config_bridge_pci_to_pci_t bridge_pci_to_pci;
-	};
-	
-} __attribute__((packed)) pci_config_t;
+	uint16_t segment;
+	uint8_t bus;
+	uint8_t end_bus;			/* The last bus number of the range of this root bus. */
+	uint8_t next_free_bus;		/* The next bus number to give to a bridge. */
+} pci_root_bus_t;
 
 typedef struct pci_capability_header
 {
@@ -173,6 +180,18 @@ typedef struct pci_capability_msi64
 	uint32_t pending;
 } __attribute__((packed)) pci_capability_msi64_t;
 
+typedef struct pci_capability_pcie
+{
+	pci_capability_header_t header;
+	uint16_t capabilities;
+	uint32_t device_capabilities;
+	uint16_t device_control;
+	uint16_t device_status;
+	uint32_t link_capabilities;
+	uint16_t link_control;
+	uint16_t link_status;
+} __attribute__((packed)) pci_capability_pcie_t;
+
 typedef struct pci_msix_table_entry
 {
 	uint64_t msg_address;
@@ -190,42 +209,91 @@ typedef struct pci_capability_msix
 	uint32_t pending_descriptor;						/* Use PCI_MSIX_REG_BAR_ADDR_* macros for accessing the BIR and the offset. */
 } __attribute__((packed)) pci_capability_msix_t;
 
-/* Initialize PCI, detect available access mechanisms. Returns 0 on success, an error code otherwise. */
+/* 
+ * Initialize PCI, detect available access mechanisms. 
+ * With ECAM, every MCFG entry becomes a segment (a bus range of a segment group) which is mapped and enumerated.
+ * The enumerated devices are added to the device tree, but not initialized. (See device_t::initialize_tree)
+ * Returns 0 on success, an error code otherwise. 
+ */
 int pci_init();
 
-/* Enumerate devices on the given bus, add them to the children of <parent>. */
-void pci_enumerate_bus(uint8_t bus, device_t* parent);
+/* 
+ * Enumerate devices on the given bus of <segment>, add them to the children of <parent>, and enumerate the buses behind bridges.
+ * The configuration space header of each function that exists is read once, into the shadow the device object keeps.
+ * Note: This function doesnt initialize the devices.
+ */
+void pci_enumerate_bus(uint16_t segment, uint8_t bus, device_t* parent);
 
 /* 
- * Returns a device object describing the connected device at the given location (bus, device, function).
- * Returns NULL if no device is found at the given location.
+ * Returns a device object describing the function whose configuration space is shadowed in <config>.
+ * Returns NULL if there is no driver for the function.
  * Note: This function does not initialize the device nor does it add it to the device tree.
  */
-device_pci_t* pci_create_device(uint8_t bus, uint8_t device, uint8_t function);
+device_pci_t* pci_create_device(const pci_config_shadow_t& config);
+
+/* Called for a single function by the PCI walking functions, <context> is passed as is. */
+typedef void (*pci_function_visitor_t)(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function, void* context);
+
+/* Call <visitor> for every function on <bus>. Reads only the vendor ID and header type of each function. */
+void pci_for_each_function(uint16_t segment, uint8_t bus, pci_function_visitor_t visitor, void* context);
+
+/* Call <visitor> for the given function, and if it is a bridge, for every function below it. (recursive) */
+void pci_for_each_in_hierarchy(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function, pci_function_visitor_t visitor, void* context);
+
+/* 
+ * Tune the PCI Express settings of every hierarchy. (Every function on a root bus and all functions below it)
+ * The Max Payload Size of every function in a hierarchy is set to the highest size all of them support, storage devices
+ * get the maximal Max Read Request Size and relaxed ordering. Writes the link speed and width of every link to the serial port.
+ */
+void pci_tune_pcie();
+
+/* 
+ * Find an extended capability of <capability> ID in the PCI Express extended capabilities list of a function.
+ * Returns the offset of the capability, -1 if not found or if the extended configuration space is not accessible. (no ECAM)
+ */
+uint16_t pci_find_ext_capability(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function, pci_ext_capability_id_t capability);
+
+/* Returns the bus range descriptor which contains <bus> of <segment>, NULL if there is no such bus. */
+pci_segment_t* pci_find_segment(uint16_t segment, uint8_t bus);
+
+/* Returns the root bus whose bus range contains <bus> of <segment>, NULL if there is no such bus. */
+pci_root_bus_t* pci_find_root_bus(uint16_t segment, uint8_t bus);
+
+/* Get a free bus number of <segment> for the secondary bus of a bridge on <bus>. Returns the bus number, -1 if there is none. */
+int pci_allocate_bus(uint16_t segment, uint8_t bus);
+
+/* Returns the last bus number given by pci_allocate_bus for the root bus range of <segment> that contains <bus>. */
+uint8_t pci_last_allocated_bus(uint16_t segment, uint8_t bus);
 
 /* Read an 8 byte value from a devices memory (two 32bit reads)*/
-uint64_t pci_read64(uint8_t bus, uint8_t device, uint8_t function, uint16_t offset);
+uint64_t pci_read64(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function, uint16_t offset);
 
 /* Read a 4 byte value from a devices memory */
-uint32_t pci_read32(uint8_t bus, uint8_t device, uint8_t function, uint16_t offset);
+uint32_t pci_read32(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function, uint16_t offset);
 
 /* Read a 2 byte value from a devices memory */
-uint16_t pci_read16(uint8_t bus, uint8_t device, uint8_t function, uint16_t offset);
+uint16_t pci_read16(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function, uint16_t offset);
 
 /* Read a byte from a devices memory */
-uint8_t pci_read8(uint8_t bus, uint8_t device, uint8_t function, uint16_t offset);
+uint8_t pci_read8(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function, uint16_t offset);
 
 /* Write a 8 byte value to a devices memory. (two 32bit writes) */
-void pci_write64(uint8_t bus, uint8_t device, uint8_t function, uint16_t offset, uint64_t value);
+void pci_write64(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function, uint16_t offset, uint64_t value);
 
 /* Write a 4 byte value to a devices memory */
-void pci_write32(uint8_t bus, uint8_t device, uint8_t function, uint16_t offset, uint32_t value);
+void pci_write32(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function, uint16_t offset, uint32_t value);
 
 /* Write a 2 byte value to a devices memory */
-void pci_write16(uint8_t bus, uint8_t device, uint8_t function, uint16_t offset, uint16_t value);
+void pci_write16(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function, uint16_t offset, uint16_t value);
 
 /* Write a byte to a devices memory */
-void pci_write8(uint8_t bus, uint8_t device, uint8_t function, uint16_t offset, uint8_t value);
+void pci_write8(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function, uint16_t offset, uint8_t value);
+
+/* 
+ * Returns a pointer to the given offset in the ECAM window of a function, NULL if the bus isnt in any ECAM window.
+ * Note: Only valid when using ECAM (MMCONFIG) access.
+ */
+uint8_t* pci_mmconfig_address(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function, uint16_t offset);
 
 /* Read a 4 byte value from a devices memory using access mechanism 1. (CPU IO ports) Note: <offset> must be 4 byte aligned. */
 uint32_t pci_read_mechanism1(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset);
@@ -0,0 +1,49 @@
+/* 
+ * This file is part of the EspressoOS project (https://github.com/rdex999/EspressoOS.git).
+ * Copyright (c) 2025 David Weizman.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* The 16550 UART of COM1, used for debug output. See: https://wiki.osdev.org/Serial_Ports */
+#define SERIAL_COM1_PORT 				0x3F8
+#define SERIAL_BAUD_RATE_BASE 			115200
+#define SERIAL_BAUD_RATE 				38400
+
+#define SERIAL_REG_DATA 				0		/* When DLAB is set, the low byte of the divisor. */
+#define SERIAL_REG_INTERRUPT_ENABLE 	1		/* When DLAB is set, the high byte of the divisor. */
+#define SERIAL_REG_FIFO_CONTROL 		2
+#define SERIAL_REG_LINE_CONTROL 		3
+#define SERIAL_REG_MODEM_CONTROL 		4
+#define SERIAL_REG_LINE_STATUS 			5
+
+#define SERIAL_LINE_CONTROL_8N1 		0x03
+#define SERIAL_LINE_CONTROL_DLAB 		(1 << 7)
+#define SERIAL_FIFO_CONTROL_ENABLE_14 	0xC7	/* Enable and clear the FIFOs, 14 byte interrupt threshold. */
+#define SERIAL_MODEM_CONTROL_DTR_RTS 	0x03
+#define SERIAL_MODEM_CONTROL_LOOPBACK 	(1 << 4)
+#define SERIAL_LINE_STATUS_THR_EMPTY 	(1 << 5)
+
+/* Initialize COM1. Returns 0 on success, an error code otherwise. (If there is no working serial port) */
+int serial_init();
+
+/* Write a single character to the serial port. Does nothing if the serial port is not initialized. */
+void serial_write_char(char character);
+
+/* Write a null terminated string to the serial port. "\n" is written as "\r\n". */
+void serial_write(const char* string);
\ No newline at end of file
@@ -0,0 +1,53 @@
+/* 
+ * This file is part of the EspressoOS project (https://github.com/rdex999/EspressoOS.git).
+ * Copyright (c) 2025 David Weizman.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* 
+ * The application processors (APs) are started with the INIT-SIPI-SIPI sequence, see the Intel SDM volume 3, section 9.4.4.
+ * The startup IPI starts them in real mode at a page below 1 MiB, so the trampoline (see boot/ap_boot.inc) is copied there.
+ * The first MiB is identity mapped by vmm_init(), so the trampoline keeps running from the same address after enabling paging.
+ */
+#define SMP_TRAMPOLINE_ADDRESS				0x8000		/* Same as in ap_boot.inc */
+#define SMP_AP_STACK_PAGES					4
+#define SMP_INIT_DELAY_US					10000		/* Between the INIT IPI and the first startup IPI */
+#define SMP_STARTUP_RETRY_MS				1			/* The second startup IPI is sent if the AP didnt start by then */
+#define SMP_START_TIMEOUT_MS				100			/* After the second startup IPI */
+
+/* Filled by smp_init() in the copy of the trampoline before starting each AP. The layout must match ap_boot.inc. */
+typedef struct smp_trampoline_data
+{
+	uint64_t cr3;						/* The page tables of the BSP, must be below 4 GiB as it is loaded in real mode. */
+	uint64_t stack;						/* The top of the stack of the AP */
+	uint64_t entry;						/* Called with the index of the AP, in long mode. (smp_ap_main) */
+	uint32_t index;
+} __attribute__((packed)) smp_trampoline_data_t;
+
+/* 
+ * Start the application processors counted by apic_init(), one at a time. Each AP initializes its per-CPU state and then 
+ * waits for interrupts. APs that dont start are left out, and g_cpu_count is set to the amount of running CPUs.
+ * Call after apic_init(), and before anything sizes per-CPU resources by g_cpu_count. (pci_init)
+ * Returns 0 on success, an error code otherwise.
+ */
+int smp_init();
+
+/* The entry point of the APs, called by the trampoline. Doesnt return. */
+extern "C" void smp_ap_main(uint32_t index);
\ No newline at end of file
@@ -0,0 +1,106 @@
+/* 
+ * This file is part of the EspressoOS project (https://github.com/rdex999/EspressoOS.git).
+ * Copyright (c) 2025 David Weizman.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <list.h>
+#include "cpu.h"
+#include "error.h"
+
+typedef enum bio_op
+{
+	BIO_OP_READ,
+	BIO_OP_WRITE,
+	BIO_OP_FLUSH,						/* Make previous writes durable. Has no LBA range or data. */
+} bio_op_t;
+
+/* A contiguous piece of the buffer of a request. */
+typedef struct bio_segment
+{
+	void* buffer;
+	size_t size;						/* In bytes */
+} bio_segment_t;
+
+struct bio;
+
+/* Called when a request completes, from an interrupt handler or from the submitting/polling CPU. Must not wait. */
+typedef void (*bio_callback_t)(struct bio* bio, void* context);
+
+struct bio_list_tag;
+
+/*
+ * An asynchronous block I/O request. The data of the request is a scatter list of <segment_count> segments, 
+ * which together hold exactly <count> sectors. The request is submitted with device_storage_t::submit(), and is 
+ * completed by the driver which sets <status> and <done>, and then calls <callback> if set.
+ * A request without a callback is waited for with device_storage_t::wait(). A request with a callback belongs to the driver
+ * until the callback is called, and the callback is the last place the driver touches it, so the callback may free it.
+ * While in flight, the request is on a list of the driver. (The list node)
+ */
+typedef struct bio : public list_node_t<bio_list_tag>
+{
+	bio_op_t op;
+	uint64_t lba;
+	size_t count;						/* In sectors */
+	const bio_segment_t* segments;		/* Owned by the submitter, must stay valid until the request completes. */
+	size_t segment_count;
+	bio_callback_t callback;			/* NULL if waited for */
+	void* context;
+	int status;
+	volatile bool done;
+} bio_t;
+
+typedef list_t<bio_t, bio_list_tag> bio_list_t;
+
+/* Initialize <bio> to <op> <count> sectors at <lba>, with the data in <segments>. */
+inline void bio_init(bio_t* bio, bio_op_t op, uint64_t lba, size_t count, const bio_segment_t* segments, size_t segment_count)
+{
+	new(bio) bio_t();
+	bio->op = op;
+	bio->lba = lba;
+	bio->count = count;
+	bio->segments = segments;
+	bio->segment_count = segment_count;
+	bio->callback = NULL;
+	bio->context = NULL;
+	bio->status = SUCCESS;
+	bio->done = false;
+}
+
+/* Complete <bio> with <status>. Called by drivers, <bio> Must not be on a list. */
+inline void bio_complete(bio_t* bio, int status)
+{
+	bio_callback_t callback = bio->callback;
+	bio->status = status;
+	cpu_barrier();						/* A waiter may free the request once it sees <done> */
+	bio->done = true;
+
+	if(callback)
+		callback(bio, bio->context);
+}
+
+/* Complete all requests on <list> with their own status. Empties the list. */
+inline void bio_complete_list(bio_list_t* list)
+{
+	while(!list->empty())
+	{
+		bio_t* bio = list->pop_front();
+		bio_complete(bio, bio->status);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,116 @@
+/* 
+ * This file is part of the EspressoOS project (https://github.com/rdex999/EspressoOS.git).
+ * Copyright (c) 2025 David Weizman.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <list.h>
+#include "storage/bio.h"
+
+#define BLOCK_MAX_SEGMENTS			32		/* The most segments a request (submitted or merged) can have. */
+#define BLOCK_PLUG_MAX_REQUESTS		32		/* A plug is flushed when it holds this many requests. */
+
+class device_storage_t;
+
+struct block_request_tag;
+
+/* 
+ * A request of the block layer, which is what is actually sent to the device. 
+ * Holds the bios that were merged into it, which are completed together with it.
+ */
+typedef struct block_request : public list_node_t<block_request_tag>
+{
+	bio_t bio;									/* The merged request that is sent to the device */
+	bio_segment_t segments[BLOCK_MAX_SEGMENTS];
+	bio_list_t bios;							/* The submitted bios that were merged into this request */
+	volatile bool finished;						/* Set after the merged bios were completed, the request can be freed. */
+} block_request_t;
+
+/* Merge statistics, summed over all CPUs. (See block_get_stats) */
+typedef struct block_stats
+{
+	uint64_t submitted;							/* Requests given to plugs */
+	uint64_t merged;							/* Requests that were merged into a neighbouring request */
+	uint64_t dispatched;						/* Requests sent to devices */
+	uint64_t flushes;							/* Times a plug was flushed */
+	uint64_t threshold_flushes;					/* Flushes because a plug was full */
+} block_stats_t;
+
+/*
+ * Batches requests to a device while plugged. Requests are kept sorted by LBA, and a request that continues (or is continued by)
+ * a neighbouring request of the same operation is merged into it, up to the largest transfer of the device. 
+ * The batch is sent to the device on flush(), or when it holds BLOCK_PLUG_MAX_REQUESTS requests.
+ * A plug is used by a single thread of execution, usually on the stack:
+ *
+ *	block_plug_t plug(device);
+ *	plug.add(BIO_OP_WRITE, lba, count, buffer);
+ *	plug.add(BIO_OP_WRITE, lba + count, count, other_buffer);
+ *	status = plug.finish();		(Flush, and wait for all requests)
+ *
+ * Note: Requests in a plug may be reordered, so requests to overlapping sectors must be ordered by the caller. (finish() between them)
+ */
+class block_plug_t
+{
+public:
+	block_plug_t(const device_storage_t* device) : m_device(device), m_pending(), m_dispatched(), m_status(SUCCESS) {}
+
+	/* Finishes the plug, see finish(). */
+	~block_plug_t() { finish(); }
+
+	/* 
+	 * Queue <bio> in the plug. <bio> Completes as usual (see bio_t), once the request it was merged into completes.
+	 * Returns 0 on success, an error code otherwise, in which case <bio> was not queued.
+	 */
+	int submit(bio_t* bio);
+
+	/* 
+	 * Queue <op> of <count> sectors at <lba> with the data at <buffer>, split into requests of at most the largest transfer 
+	 * of the device. Wait for it with finish(). Returns 0 on success, an error code otherwise.
+	 */
+	int add(bio_op_t op, uint64_t lba, size_t count, void* buffer);
+
+	/* Send the queued requests to the device, in LBA order. Returns 0 on success, an error code otherwise. */
+	int flush();
+
+	/* Flush, and wait for all requests of the plug to complete. Returns 0 if all requests succeeded, an error code otherwise. */
+	int finish();
+
+private:
+	/* Allocate a request for <op> on <lba>, with no segments. Returns NULL if out of memory. */
+	static block_request_t* alloc_request(bio_op_t op, uint64_t lba);
+
+	/* Insert <request> into the pending requests in LBA order, and merge it with its neighbours if possible. */
+	void queue(block_request_t* request);
+
+	/* Merge <second> into <first> if <second> continues it. Returns true if merged, in which case <second> was freed. */
+	bool try_merge(block_request_t* first, block_request_t* second);
+
+	/* Send <request> to the device. */
+	void dispatch(block_request_t* request);
+
+	/* Wait for all dispatched requests to complete and free them, keeping the first error in m_status. */
+	void wait_dispatched();
+
+	const device_storage_t* m_device;
+	list_t<block_request_t, block_request_tag> m_pending;		/* Sorted by LBA */
+	list_t<block_request_t, block_request_tag> m_dispatched;	/* Sent to the device, not yet finished */
+	int m_status;												/* The first error of the plug */
+};
+
+/* Write the merge statistics of all CPUs into <stats>. */
+void block_get_stats(block_stats_t* stats);
\ No newline at end of file
@@ -0,0 +1,286 @@
+/* 
+ * This file is part of the EspressoOS project (https://github.com/rdex999/EspressoOS.git).
+ * Copyright (c) 2025 David Weizman.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <list.h>
+#include <hash_map.h>
+#include <object_pool.h>
+#include <spinlock.h>
+#include "mm/vmm/vmm.h"
+#include "storage/bio.h"
+#include "error.h"
+
+#define BLOCK_CACHE_BLOCK_SIZE		VMM_PAGE_SIZE		/* Each cached block is a page */
+#define BLOCK_CACHE_CAPACITY		1024				/* Blocks of data (4 MiB). As many ghost entries are kept. */
+#define BLOCK_CACHE_BATCH			32					/* The most blocks acquired at once, misses of a batch are read together. */
+#define BLOCK_CACHE_STREAMS			8					/* Sequential streams tracked at once */
+#define BLOCK_CACHE_SEQUENTIAL_RUN	4					/* Sequential blocks read before reading ahead */
+#define BLOCK_CACHE_READAHEAD_MIN	4					/* Read-ahead window, in blocks */
+#define BLOCK_CACHE_READAHEAD_MAX	256
+#define BLOCK_CACHE_DIRTY_MAX		256					/* Dirty blocks are written back when there are this many */
+#define BLOCK_CACHE_DIRTY_AGE_MS	5000				/* Dirty blocks are written back when they are this old */
+#define BLOCK_CACHE_WRITEBACK_BATCH	64					/* The most blocks written back together */
+#define BLOCK_CACHE_STREAM_WRITE	(64 * 1024)			/* Writes of at least this many bytes fill the cache with non-temporal stores */
+
+class device_storage_t;
+
+typedef struct block_cache_key
+{
+	const device_storage_t* device;
+	uint64_t block;										/* The byte address on the device, divided by BLOCK_CACHE_BLOCK_SIZE */
+
+	inline bool operator==(const block_cache_key& other) const { return device == other.device && block == other.block; }
+} block_cache_key_t;
+
+template<>
+struct hash_t<block_cache_key_t>
+{
+	inline uint64_t operator()(const block_cache_key_t& key) const { return hash_u64((uint64_t)key.device ^ hash_u64(key.block)); }
+};
+
+/* 
+ * The lists of ARC. T1 holds blocks that were used once recently, T2 blocks that were used at least twice.
+ * B1 and B2 are ghost lists, which only remember the keys of blocks that were evicted from T1 and T2.
+ */
+typedef enum block_cache_list
+{
+	BLOCK_CACHE_T1,
+	BLOCK_CACHE_T2,
+	BLOCK_CACHE_B1,
+	BLOCK_CACHE_B2,
+	BLOCK_CACHE_LIST_COUNT
+} block_cache_list_t;
+
+typedef enum block_cache_state
+{
+	BLOCK_CACHE_EMPTY,									/* The buffer doesnt hold the data of the block */
+	BLOCK_CACHE_LOADING,								/* A CPU is reading the block into the buffer */
+	BLOCK_CACHE_VALID,
+} block_cache_state_t;
+
+struct block_cache_tag;
+struct block_cache_dirty_tag;
+
+typedef struct block_cache_entry : public list_node_t<block_cache_tag>, public list_node_t<block_cache_dirty_tag>
+{
+	block_cache_key_t key;
+	uint8_t* data;										/* NULL for ghost entries */
+	uint32_t pins;										/* A pinned entry is in use, and is never evicted. */
+	uint8_t list;										/* block_cache_list_t */
+	volatile uint8_t state;								/* block_cache_state_t */
+	bool prefetched;									/* Read ahead, and not used yet */
+	bool dirty;											/* Written, and not written back yet. Never evicted. */
+	uint64_t dirtied;									/* When the entry became dirty, in milliseconds (See time_now_ms) */
+} block_cache_entry_t;
+
+typedef struct block_cache_stats
+{
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t ghost_hits_recent;							/* Misses that were found in B1, which grow T1 */
+	uint64_t ghost_hits_frequent;						/* Misses that were found in B2, which grow T2 */
+	uint64_t evictions;
+	uint64_t bypasses;									/* Accesses that couldnt be cached, and went to the device directly */
+	uint64_t prefetched;								/* Blocks that were read ahead */
+	uint64_t prefetch_hits;								/* Reads of blocks that were read ahead */
+	uint64_t writebacks;								/* Dirty blocks that were written back */
+	uint64_t pressure_writebacks;						/* Times there were too many dirty blocks */
+	uint64_t flushes;
+} block_cache_stats_t;
+
+/* 
+ * A sequential reader of a device. The read-ahead window grows while the blocks that were read ahead are used, 
+ * and shrinks when they are not. (Evicted before being read, or the reader jumped elsewhere)
+ */
+typedef struct block_cache_stream
+{
+	const device_storage_t* device;						/* NULL if the stream is free */
+	uint64_t next_block;								/* The block a sequential reader reads next */
+	uint64_t ahead;										/* The first block that was not read ahead yet */
+	size_t run;											/* Blocks read sequentially */
+	size_t window;										/* In blocks, 0 while not reading ahead */
+	size_t accesses;									/* Blocks read since the window last changed */
+	size_t hits;										/* Of them, blocks that were cached or being read ahead */
+	uint64_t last_used;
+} block_cache_stream_t;
+
+class block_cache_t;
+
+/* Blocks that are read ahead together, by a single asynchronous request. */
+typedef struct block_cache_prefetch
+{
+	bio_t bio;
+	bio_segment_t segments[BLOCK_CACHE_BATCH];
+	block_cache_entry_t* entries[BLOCK_CACHE_BATCH];
+	size_t count;
+	block_cache_t* cache;
+} block_cache_prefetch_t;
+
+/*
+ * A cache of device blocks, keyed by (device, block), using Adaptive Replacement (ARC, Megiddo and Modha).
+ * ARC splits the cache between recently used blocks (T1) and frequently used blocks (T2), and moves the split (<m_target>, 
+ * the target size of T1) by the hits on the ghost lists. A sequential scan only passes through T1, so it doesnt flush 
+ * the frequently used blocks (like file system metadata) out of T2.
+ * By default writes go through the cache to the device. (write-through) Callers that flush() their data can enable 
+ * write-back mode with set_write_back(), then writes only update the cached blocks and mark them dirty. Dirty blocks are 
+ * written back when there are too many of them or when they get old, the oldest first, and adjacent dirty blocks are 
+ * written together, by balance(). It runs after reads and writes, and from the idle loop on every timer tick, 
+ * so the dirty blocks of an idle cache are written back once they get old. Data is only durable after flush().
+ * Sequential readers are detected, and the blocks after them are read ahead asynchronously, so a stream of small reads 
+ * finds its blocks already cached instead of waiting for the device on each read.
+ * Note: The constructor is constexpr, so the cache can be a global variable.
+ */
+class block_cache_t
+{
+public:
+	constexpr block_cache_t() : m_lock(), m_index(), m_entries(), m_lists(), m_target(0), m_free_buffers(NULL), m_buffer_count(0), m_stats(), 
+		m_streams(), m_stream_clock(0), m_prefetches(), m_dirty(), m_write_back(false), m_writeback_status(SUCCESS) {}
+
+	/* Read <size> bytes at <offset> from the sector at <lba> of <device> into <buffer>. Returns 0 on success, an error code otherwise. */
+	int read(const device_storage_t* device, uint64_t lba, size_t offset, size_t size, void* buffer);
+
+	/* Write <size> bytes at <offset> from the sector at <lba> of <device> from <buffer>. Returns 0 on success, an error code otherwise. */
+	int write(const device_storage_t* device, uint64_t lba, size_t offset, size_t size, const void* buffer);
+
+	/* 
+	 * Write back the dirty blocks of <device>, and make all writes to it durable. (Flushes the write cache of the device)
+	 * Returns 0 on success, an error code otherwise, including errors of writing back blocks since the last flush.
+	 */
+	int flush(const device_storage_t* device);
+
+	/* Enable or disable write-back mode. Disabling it writes back all dirty blocks. */
+	void set_write_back(bool write_back);
+
+	/* 
+	 * Write back dirty blocks if there are too many of them, or if they are too old. Called after each read and write, 
+	 * and periodically by the idle loop. Must not be called from an interrupt handler, as it waits for the writes.
+	 */
+	void balance();
+
+	/* Write back the dirty blocks that hold any of the <count> sectors at <lba> of <device>. Returns 0 on success, an error code otherwise. */
+	int writeback_range(const device_storage_t* device, uint64_t lba, size_t count);
+
+	/* Drop the cached blocks that hold any of the <count> sectors at <lba> of <device>, which were written directly. */
+	void discard_range(const device_storage_t* device, uint64_t lba, size_t count);
+
+	/* 
+	 * Write back, then drop all blocks of <device>, including dirty blocks that failed to be written back. Blocks that are in use 
+	 * are kept. Must be called before a device is destroyed, as the cache refers to devices by their address.
+	 */
+	void invalidate(const device_storage_t* device);
+
+	/* Returns a copy of the statistics of the cache. */
+	block_cache_stats_t get_stats();
+
+private:
+	/* Returns true if <device> can be cached, (Its sector size divides the block size) */
+	static bool cacheable(const device_storage_t* device);
+
+	/* 
+	 * Pin the <count> blocks starting at <block> of <device> into <entries>, and read the blocks that are not cached and 
+	 * have <load> set (all at once). Blocks without <load> that are not cached are left loading, and the caller must set
+	 * their state. If <misses> is not NULL, the amount of blocks that were read is written to it. 
+	 * Returns 0 on success, an error code otherwise, in which case no block is pinned.
+	 */
+	int acquire(const device_storage_t* device, uint64_t block, size_t count, const bool* load, 
+		block_cache_entry_t** entries, size_t* misses = NULL);
+
+	/* 
+	 * Write back up to <count> of the oldest dirty blocks of <device>. If <device> is NULL, of the device of the oldest dirty block
+	 * (in each batch). Returns 0 on success, an error code otherwise.
+	 */
+	int writeback(const device_storage_t* device, size_t count);
+
+	/* Write back the dirty blocks that hold any of the <size> bytes at byte <address> of <device>. (See writeback_range) */
+	int writeback_bytes(const device_storage_t* device, uint64_t address, size_t size);
+
+	/* 
+	 * Write the <count> pinned entries of <device>, which were taken off the dirty list, to the device and unpin them. 
+	 * Entries that failed are marked dirty again. Returns 0 on success, an error code otherwise.
+	 */
+	int write_entries(const device_storage_t* device, block_cache_entry_t** entries, size_t count);
+
+	/* Mark <entry> dirty, if it isnt already. m_lock must be held. */
+	void mark_dirty(block_cache_entry_t* entry);
+
+	/* Drop the <count> cached blocks at <block> of <device>, after they were written directly. Blocks in use or dirty are kept. */
+	void discard(const device_storage_t* device, uint64_t block, size_t count);
+
+	/* Unpin <count> entries. */
+	void release(block_cache_entry_t** entries, size_t count);
+
+	/* 
+	 * Apply ARC to an access of <key>. Returns the pinned entry with a buffer, NULL if no buffer could be found. 
+	 * A <prefetch> access is for a block that is not in the cache, the entry is not pinned. m_lock must be held.
+	 */
+	block_cache_entry_t* access(const block_cache_key_t& key, bool prefetch = false);
+
+	/* 
+	 * Account a read of <count> blocks at <block> of <device> which missed <misses> blocks, to the stream it continues.
+	 * Returns the amount of blocks to read ahead (starting at <ahead>), 0 if none. m_lock must be held.
+	 */
+	size_t stream_update(const device_storage_t* device, uint64_t block, size_t count, size_t misses, uint64_t* ahead);
+
+	/* Start reading the <count> blocks at <block> of <device> into the cache, without waiting. Blocks that are cached are skipped. */
+	void prefetch(const device_storage_t* device, uint64_t block, size_t count);
+
+	/* Submit <request>, which has at least one block. */
+	void prefetch_submit(const device_storage_t* device, block_cache_prefetch_t* request);
+
+	/* Called when a read-ahead request completes. */
+	static void prefetch_complete(bio_t* bio, void* context);
+
+	/* Evict the LRU entry of T1 or T2 (chosen by ARC) into its ghost list, freeing its buffer. m_lock must be held. */
+	void replace(bool in_frequent_ghost);
+
+	/* Returns the least recently used entry of <list> that is not pinned or loading, NULL if there is none. m_lock must be held. */
+	block_cache_entry_t* lru(block_cache_list_t list) const;
+
+	/* Move <entry> to the MRU end of <list>. m_lock must be held. */
+	void move(block_cache_entry_t* entry, block_cache_list_t list);
+
+	/* Remove <entry> from the cache completely. m_lock must be held. */
+	void remove(block_cache_entry_t* entry);
+
+	/* Returns a free buffer, NULL if none. m_lock must be held. */
+	uint8_t* alloc_buffer();
+
+	/* Give <buffer> back to the free buffers. m_lock must be held. */
+	void free_buffer(uint8_t* buffer);
+
+	inline size_t list_size(block_cache_list_t list) const { return m_lists[list].size(); }
+
+	spinlock_t m_lock;
+	hash_map_t<block_cache_key_t, block_cache_entry_t*> m_index;
+	object_pool_t<block_cache_entry_t, 128> m_entries;
+	list_t<block_cache_entry_t, block_cache_tag> m_lists[BLOCK_CACHE_LIST_COUNT];		/* Front is MRU, back is LRU */
+	size_t m_target;								/* <p> of ARC, the target size of T1 */
+	uint8_t* m_free_buffers;						/* A stack of free buffers, linked through their first bytes */
+	size_t m_buffer_count;							/* Buffers allocated so far, at most BLOCK_CACHE_CAPACITY */
+	block_cache_stats_t m_stats;
+	block_cache_stream_t m_streams[BLOCK_CACHE_STREAMS];
+	uint64_t m_stream_clock;						/* Incremented on each stream update, for finding the LRU stream */
+	percpu_object_pool_t<block_cache_prefetch_t, 16> m_prefetches;
+	list_t<block_cache_entry_t, block_cache_dirty_tag> m_dirty;		/* Front is the oldest */
+	bool m_write_back;
+	int m_writeback_status;							/* The first error of writing back since the last flush() */
+};
+
+extern block_cache_t g_block_cache;
\ No newline at end of file
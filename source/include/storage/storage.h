@@ -21,31 +21,88 @@
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
+#include <spinlock.h>
 #include "device/device.h"
 #include "pci/pci.h"
+#include "storage/bio.h"
+#include "mm/vmm/vmm.h"
+
+#define STORAGE_BOUNCE_BUFFERS		4						/* Bounce buffers allocated for each device up front */
+#define STORAGE_DIRECT_MIN_SIZE		(64 * 1024)				/* Aligned transfers at least this large skip the block cache */
 
 class device_storage_t : public virtual device_t
 {
 public:
 	device_storage_t()
-		: device_t(DEVICE_TYPE_STORAGE, this) {}
-
-	virtual bool is_device(const device_t* device) const override;
+		: device_t(DEVICE_TYPE_STORAGE, this), m_sector_size(0), m_sector_count(0), m_bounce_lock(), m_bounce_free(NULL) {}
 
 	/* 
-	 * Read <size> bytes on offset <offset> from the sector at <lba> into <buffer>. 
+	 * Read <size> bytes on offset <offset> from the sector at <lba> into <buffer>, through the block cache. (See block_cache_t)
+	 * Large transfers where the address on the device, <buffer> and <size> are page aligned go straight to <buffer> instead.
 	 * Returns 0 on success, an error code otherwise. 
 	 * WARNING: Untested
 	 */
 	int read(uint64_t lba, size_t offset, size_t size, void* buffer) const;
 
 	/* 
-	 * Write <size> bytes on offset <offset> to the sector at <lba> from <buffer>.
+	 * Write <size> bytes on offset <offset> to the sector at <lba> from <buffer>, through the block cache. (See block_cache_t)
 	 * Returns 0 on success, an error code otherwise. 
 	 * WARNING: Untested
 	 */
 	int write(uint64_t lba, size_t offset, size_t size, const void* buffer) const;
 
+	/* 
+	 * Read the sectors starting at <lba> into the <segment_count> buffers of <segments>, one after another.
+	 * The size of each segment must be a multiple of the sector size. The data goes straight from the device into the buffers,
+	 * and the plug merges the segments, so a large read into a scattered buffer is a single request when the driver allows it.
+	 * Returns 0 on success, an error code otherwise.
+	 */
+	int readv(uint64_t lba, const bio_segment_t* segments, size_t segment_count) const;
+
+	/* Write the sectors starting at <lba> from the <segment_count> buffers of <segments>. See readv(). */
+	int writev(uint64_t lba, const bio_segment_t* segments, size_t segment_count) const;
+
+	/* 
+	 * Write the cached writes of the device back, and make all writes that completed so far durable. (See block_cache_t)
+	 * Returns 0 on success, an error code otherwise.
+	 */
+	int flush() const;
+
+	/* 
+	 * Like read(), but reads from the device itself, not through the block cache. Whole sectors go straight into <buffer>,
+	 * partial sectors at the edges go through a bounce buffer of the device.
+	 */
+	int read_direct(uint64_t lba, size_t offset, size_t size, void* buffer) const;
+
+	/* Like write(), but writes to the device itself. The block cache is not updated. */
+	int write_direct(uint64_t lba, size_t offset, size_t size, const void* buffer) const;
+
+	/* 
+	 * Submit <bio> to the device, it completes later. (See bio_t) 
+	 * Returns 0 if the request was queued, ERR_DEVICE_BUSY if the queue of the device is full (poll() and retry), 
+	 * another error code if the request is invalid. The request is only completed if 0 is returned.
+	 * The default runs the request right away with read_sectors/write_sectors, for drivers that dont queue requests.
+	 */
+	virtual int submit(bio_t* bio) const;
+
+	/* Complete the finished requests of the current CPU. Returns the amount of requests that were completed. */
+	virtual size_t poll() const { return 0; }
+
+	/* Wait for <bio>, which has no callback, to complete by polling the device. Returns the status of the request. */
+	int wait(bio_t* bio) const;
+
+	/* Submit <bio> (retrying while the device is busy) and wait for it. Returns the status of the request. */
+	int submit_wait(bio_t* bio) const;
+
+	/* Returns the largest request the device accepts, in sectors. */
+	virtual size_t get_max_transfer_sectors() const { return (size_t)-1; }
+
+	/* Returns true if a request may have segment <second> right after segment <first>. Used when merging requests. */
+	virtual bool can_merge_segments(const bio_segment_t*, const bio_segment_t*) const { return true; }
+
+	inline size_t get_sector_size() const { return m_sector_size; }
+	inline uint64_t get_sector_count() const { return m_sector_count; }
+
 protected:
 	/* 
 	 * Read <count> sectors starting from <lba>, data goes into <buffer>
@@ -59,5 +116,37 @@ protected:
 	 */	
 	virtual int write_sectors(uint64_t lba, size_t count, const void* buffer) const = 0;
 
+	/* Run <op> on the sectors at <lba> with the data in <segments>, bypassing the block cache. (See readv) */
+	int transfer_vector(bio_op_t op, uint64_t lba, const bio_segment_t* segments, size_t segment_count) const;
+
+	/* 
+	 * Allocate the bounce buffers of the device. Drivers call this once the sector size is known. 
+	 * Returns 0 on success, an error code otherwise.
+	 */
+	int bounce_init();
+
+	/* Free the bounce buffers of the device. None may be in use. */
+	void bounce_release();
+
 	size_t m_sector_size;
+	uint64_t m_sector_count;
+
+private:
+	/* 
+	 * Returns a bounce buffer, which holds two sectors (the head and the tail of a transfer) and is page aligned, 
+	 * so each sector is within a single page. A new buffer is only allocated if all are in use. Returns NULL if out of memory.
+	 */
+	void* bounce_alloc() const;
+
+	/* Give <buffer> back to the bounce buffers of the device. */
+	void bounce_free(void* buffer) const;
+
+	/* Returns the size of a bounce buffer, in pages. */
+	inline size_t bounce_buffer_pages() const { return DIV_ROUND_UP(2 * m_sector_size, (size_t)VMM_PAGE_SIZE); }
+
+	/* Returns true if a transfer of <size> bytes at <offset> from <lba> with <buffer> should skip the block cache. */
+	bool is_direct(uint64_t lba, size_t offset, size_t size, const void* buffer) const;
+
+	mutable spinlock_t m_bounce_lock;
+	mutable void* m_bounce_free;						/* A stack of free bounce buffers, linked through their first bytes */
 };
\ No newline at end of file
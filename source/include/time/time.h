@@ -0,0 +1,71 @@
+/* 
+ * This file is part of the EspressoOS project (https://github.com/rdex999/EspressoOS.git).
+ * Copyright (c) 2025 David Weizman.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* 
+ * The PIT is only used to measure the frequency of the TSC, see: https://wiki.osdev.org/Programmable_Interval_Timer 
+ * Channel 2 is used, as its gate and output can be controlled and read through port 0x61, without any interrupts.
+ */
+#define TIME_PIT_FREQUENCY					1193182		/* Hz */
+#define TIME_PIT_PORT_CHANNEL2				0x42
+#define TIME_PIT_PORT_COMMAND				0x43
+#define TIME_PIT_PORT_CONTROL				0x61
+#define TIME_PIT_COMMAND_CHANNEL2_MODE0		0xB0		/* Channel 2, low byte then high byte, mode 0 (interrupt on terminal count) */
+#define TIME_PIT_CONTROL_GATE2				(1 << 0)
+#define TIME_PIT_CONTROL_SPEAKER			(1 << 1)
+#define TIME_PIT_CONTROL_OUT2				(1 << 5)
+#define TIME_CALIBRATION_MS					10
+#define TIME_TICK_MS						100			/* The period of the timer interrupt, see time_tick_init() */
+
+/* 
+ * Measure the frequency of the TSC using the PIT. Returns 0 on success, an error code otherwise. 
+ * Note: Assumes an invariant TSC, which is the case for every CPU that QEMU/KVM and modern hardware provide.
+ */
+int time_init();
+
+/* 
+ * Start a timer interrupt on the current CPU every TIME_TICK_MS, using its local APIC timer. The interrupt only wakes 
+ * the CPU, so its idle loop runs periodic work (like writing back old dirty blocks) even if nothing else happens.
+ * Call after time_init(), idt_init() and apic_init(). Returns 0 on success, an error code otherwise.
+ */
+int time_tick_init();
+
+/* Returns the amount of TSC ticks in a millisecond. */
+uint64_t time_tsc_per_ms();
+
+/* Returns the amount of nanoseconds since time_init(). */
+uint64_t time_now_ns();
+
+/* Returns the amount of microseconds since time_init(). */
+inline uint64_t time_now_us() { return time_now_ns() / 1000; }
+
+/* Returns the amount of milliseconds since time_init(). */
+inline uint64_t time_now_ms() { return time_now_ns() / 1000000; }
+
+/* Busy wait for <microseconds> microseconds. */
+void time_delay_us(uint64_t microseconds);
+
+/* Returns the TSC value <milliseconds> milliseconds from now, for checking timeouts with time_expired(). */
+uint64_t time_deadline_ms(uint64_t milliseconds);
+
+/* Returns true if the TSC passed <deadline>. (See time_deadline_ms) */
+bool time_expired(uint64_t deadline);
\ No newline at end of file
@@ -18,13 +18,19 @@
 #include "kernel/kernel.h"
 #include <string.h>
 #include <stdlib.h>
+#include <checksum.h>
 #include "mm/pmm/pmm.h"
 #include "mm/vmm/vmm.h"
 #include "acpi/acpi.h"
 #include "pci/pci.h"
 #include "idt/idt.h"
 #include "apic/apic.h"
+#include "smp/smp.h"
 #include "nvme/nvme.h"
+#include "storage/cache.h"
+#include "cpu.h"
+#include "serial/serial.h"
+#include "time/time.h"
 
 #define VIDEO ((uint32_t*)0xA0000)
 
@@ -37,13 +43,35 @@ void kernel_main(multiboot_info_t* mbd)
 	if(mmap == NULL)	/* Always do null checks people, you dont want a damn headache. */
 		while(true) { asm volatile("cli"); asm volatile("hlt"); }
 
+	cpu_init();
+	checksum_init();
+	cpu_init_local(0);		/* The BSP is CPU 0 */
+	serial_init();
+	time_init();
 	pmm_init(mmap);
 	vmm_init();
 	device_root_init();
 	acpi_init(mbd);
 	idt_init();
 	apic_init();
+	smp_init();				/* Before pci_init, drivers create their per-CPU resources for the CPUs that started. */
+	time_tick_init();
 	pci_init();
+	g_device_root.initialize_tree();
 
-	while(true) { asm volatile("cli"); asm volatile("hlt"); }
+#ifdef ALLOC_PROFILE
+	malloc_dump(serial_write);
+#endif
+
+	/* 
+	 * Interrupts are only enabled while waiting for them, so a handler never runs in the middle of the code above,
+	 * or while this CPU holds a lock that the handler might take.
+	 */
+	while(true)
+	{
+		cpu_wait_for_interrupt();
+
+		/* The timer wakes this CPU at least every TIME_TICK_MS, so old dirty blocks are written back even without I/O. */
+		g_block_cache.balance();
+	}
 } 
\ No newline at end of file
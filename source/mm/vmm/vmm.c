@@ -27,7 +27,8 @@ int vmm_init()
 {
 	new(&g_vmm_alloc_map) bitmap_t(VMM_ALLOC_MAP, VMM_ALLOC_MAP_SIZE);
 
-	memset(VMM_REVERSE_MAP, -1, VMM_REVERSE_MAP_SIZE);
+	/* The reverse map is several MiB, and only a few entries are read soon. Dont evict the whole cache for it. */
+	memset_nt(VMM_REVERSE_MAP, -1, VMM_REVERSE_MAP_SIZE);
 
 	/* Allocate the physical memory of the kernel, including the reverse mapping. +1 for page map level 4. */
 	phys_addr_t identity_map_end = ALIGN_UP((uint64_t)VMM_REVERSE_MAP_END, VMM_PAGE_SIZE);
@@ -63,6 +64,7 @@ phys_addr_t vmm_init_first_tables(phys_addr_t end_address)
 	pmm_alloc_address(0, blocks);
 	vmm_mark_alloc_virtual_pages((virt_addr_t)0, blocks);
 	g_vmm_pml4 = (uint64_t*)(end_address - VMM_PAGE_SIZE);
+	clear_page(g_vmm_pml4);
 	
 	for(phys_addr_t address = 0; address < end_address; address += VMM_PAGE_SIZE)
 	{
@@ -84,6 +86,7 @@ phys_addr_t vmm_init_first_tables(phys_addr_t end_address)
 			end_address += VMM_PAGE_SIZE;
 			*pml4e = VMM_CREATE_TABLE_ENTRY(VMM_PAGE_P | VMM_PAGE_RW, pdp_paddr);
 			pdp = (uint64_t*)pdp_paddr;		
+			clear_page(pdp);
 		}
 	
 		/* Check if the page directory pointer entry is valid (points to something), if not, create it. */
@@ -101,6 +104,7 @@ phys_addr_t vmm_init_first_tables(phys_addr_t end_address)
 			*pdpe = VMM_CREATE_TABLE_ENTRY(VMM_PAGE_P | VMM_PAGE_RW, pd_paddr);
 			*pml4e = VMM_INC_ENTRY_LU(*pml4e);
 			pd = (uint64_t*)pd_paddr;
+			clear_page(pd);
 		}
 	
 		/* Check if the page directory entry is valid (points to something), if not, create it. */
@@ -118,6 +122,7 @@ phys_addr_t vmm_init_first_tables(phys_addr_t end_address)
 			*pde = VMM_CREATE_TABLE_ENTRY(VMM_PAGE_P | VMM_PAGE_RW, pt_paddr);
 			*pdpe = VMM_INC_ENTRY_LU(*pdpe);
 			pt = (uint64_t*)pt_paddr;
+			clear_page(pt);
 		}
 
 		/* Create the page table entry, make it point to <address>. */
@@ -140,7 +145,7 @@ virt_addr_t vmm_alloc_pages(uint64_t flags, size_t count)
 {
 	virt_addr_t address = vmm_alloc_virtual_pages(count);
 	if(address == (virt_addr_t)-1)
-		return ERR_OUT_OF_MEMORY;
+		return (virt_addr_t)-1;
 	
 	int status = vmm_map_virtual_pages(address, flags, count);
 	if(status != SUCCESS)
@@ -316,6 +321,7 @@ int vmm_map_virtual_to_physical_page(virt_addr_t vaddr, phys_addr_t paddr, uint6
 		*pml4e = VMM_CREATE_TABLE_ENTRY(VMM_PAGE_P | VMM_PAGE_RW, pdp_paddr);
 		pdp = (uint64_t*)vmm_temp_map(pdp_paddr);
 		pdp_temp_map = true;
+		clear_page(pdp);
 	}
 	
 	/* Check if the page directory pointer entry is valid (points to something), if not, create it. */
@@ -336,6 +342,7 @@ int vmm_map_virtual_to_physical_page(virt_addr_t vaddr, phys_addr_t paddr, uint6
 		
 		pd = (uint64_t*)vmm_temp_map(pd_paddr);
 		pd_temp_map = true;
+		clear_page(pd);
 	}
 
 	/* Check if the page directory entry is valid (points to something), if not, create it. */
@@ -356,7 +363,7 @@ int vmm_map_virtual_to_physical_page(virt_addr_t vaddr, phys_addr_t paddr, uint6
 		
 		pt = (uint64_t*)vmm_temp_map(pt_paddr);
 		pt_temp_map = true;
-		memset(pt, 0, VMM_PAGE_TABLE_LENGTH * sizeof(uint64_t));
+		clear_page(pt);
 	}
 	
 	uint64_t* pte = &pt[VMM_VADDR_PTE_IDX(vaddr)];
@@ -416,6 +423,7 @@ int vmm_temp_map_init(virt_addr_t temp_map_address)
 	
 			*pml4e = VMM_CREATE_TABLE_ENTRY(VMM_PAGE_P | VMM_PAGE_RW, pdp_paddr);
 			pdp = (uint64_t*)pdp_paddr;		
+			clear_page(pdp);
 		}
 	
 		uint64_t* pdpe = &pdp[VMM_VADDR_PDPE_IDX(vaddr)];
@@ -431,6 +439,7 @@ int vmm_temp_map_init(virt_addr_t temp_map_address)
 			*pdpe = VMM_CREATE_TABLE_ENTRY(VMM_PAGE_P | VMM_PAGE_RW, pd_paddr);
 			*pml4e = VMM_INC_ENTRY_LU(*pml4e);
 			pd = (uint64_t*)pd_paddr;
+			clear_page(pd);
 		}
 	
 		uint64_t* pde = &pd[VMM_VADDR_PDE_IDX(vaddr)];
@@ -442,6 +451,7 @@ int vmm_temp_map_init(virt_addr_t temp_map_address)
 			
 			*pde = VMM_CREATE_TABLE_ENTRY(VMM_PAGE_P | VMM_PAGE_RW, pt_paddr);
 			*pdpe = VMM_INC_ENTRY_LU(*pdpe);
+			clear_page((void*)pt_paddr);
 		}
 	
 		*pde = VMM_INC_ENTRY_LU(*pde);
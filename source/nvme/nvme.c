@@ -17,40 +17,943 @@
 
 #include "nvme/nvme.h"
 
+#include <object_pool.h>
+#include <string.h>
 #include "error.h"
+#include "cpu.h"
+#include "common.h"
 #include "mm/vmm/vmm.h"
+#include "time/time.h"
+#include "idt/idt.h"
+#include "storage/cache.h"
+
+static object_pool_t<device_storage_pci_nvme_t, 8> s_nvme_pool;
+
+/* Take ownership of <queue>. Interrupts are disabled, so the completion interrupt of the queue cant run in between. */
+static uint64_t nvme_queue_acquire(nvme_queue_t* queue)
+{
+	if(queue->shared)
+		return queue->lock.lock_irq_save();
+
+	return cpu_irq_save();
+}
+
+/* Release <queue>, <flags> Is the value returned by nvme_queue_acquire(). */
+static void nvme_queue_release(nvme_queue_t* queue, uint64_t flags)
+{
+	if(queue->shared)
+		queue->lock.unlock_irq_restore(flags);
+	else
+		cpu_irq_restore(flags);
+}
+
+/* Returns true if <queue> has no free submission slot. One slot is kept free, as a full queue looks like an empty one. */
+static bool nvme_queue_full(const nvme_queue_t* queue)
+{
+	return (uint16_t)((queue->sbms_tail + 1) % queue->size) == queue->sbms_head;
+}
+
+/* 
+ * Returns true if the controller must be told that a doorbell moved from <old> to <value>, which is when the doorbell passed 
+ * <event>, the index the controller asked to be notified at. (Wrapping 16 bit arithmetic, like the queue indexes)
+ */
+static inline bool nvme_doorbell_need_event(uint16_t event, uint16_t value, uint16_t old)
+{
+	return (uint16_t)(value - event - 1) < (uint16_t)(value - old);
+}
+
+/* 
+ * Write <value> to a doorbell of <queue>. With shadow doorbells the value is written to <shadow>, and the MMIO <doorbell> 
+ * (a VM exit under virtualization) is only written if the controller needs it according to <event>.
+ */
+static void nvme_queue_ring(nvme_queue_t* queue, volatile uint32_t* doorbell, volatile uint32_t* shadow, volatile uint32_t* event, uint16_t value)
+{
+	if(shadow)
+	{
+		uint16_t old = (uint16_t)*shadow;
+		*shadow = value;
+
+		/* The shadow must be visible to the controller before the event index is read, or an update may be missed. */
+		cpu_memory_barrier();
+		if(!nvme_doorbell_need_event((uint16_t)*event, value, old))
+		{
+			++queue->doorbell_writes_avoided;
+			return;
+		}
+	}
+
+	++queue->doorbell_writes;
+	*doorbell = value;
+}
+
+/* 
+ * Write <command> into the next slot of <queue> with the command ID <command_id>, and ring its doorbell. 
+ * The queue must be owned and not full, and <command_id> must be taken from the free command IDs of the queue.
+ */
+static void nvme_queue_post(nvme_queue_t* queue, nvme_sbms_entry_t* command, uint16_t command_id)
+{
+	uint16_t slot = queue->sbms_tail;
+	command->command_id = command_id;
+	queue->commands[command_id].done = false;
+	queue->sbms[slot] = *command;
+	queue->sbms_tail = (uint16_t)((slot + 1) % queue->size);
+
+	/* The command must be in memory before the controller is told about it. */
+	cpu_barrier();
+	nvme_queue_ring(queue, queue->sbms_doorbell, queue->sbms_shadow, queue->sbms_event, queue->sbms_tail);
+}
+
+/* Take a PRP/SGL list page from the pool of <queue>, allocating one if the pool is empty. The queue must be owned. Returns NULL if out of memory. */
+static void* nvme_queue_alloc_list(nvme_queue_t* queue)
+{
+	if(queue->free_lists)
+	{
+		void* page = queue->free_lists;
+		queue->free_lists = *(void**)page;
+		return page;
+	}
+
+	virt_addr_t page = vmm_alloc_page(VMM_PAGE_P | VMM_PAGE_RW);
+	return page == (virt_addr_t)-1 ? NULL : (void*)page;
+}
+
+/* Give the list pages of <state> back to the pool of <queue>. The queue must be owned. */
+static void nvme_queue_free_lists(nvme_queue_t* queue, nvme_command_state_t* state)
+{
+	for(uint8_t i = 0; i < state->list_count; ++i)
+	{
+		*(void**)state->lists[i] = queue->free_lists;
+		queue->free_lists = state->lists[i];
+	}
+
+	state->list_count = 0;
+}
+
+/* 
+ * Consume all new completion entries of <queue>, marking their commands as done. The queue must be owned.
+ * Finished requests are moved to <completed>, and should be completed with bio_complete_list() after releasing the queue.
+ */
+static void nvme_queue_reap(nvme_queue_t* queue, bio_list_t* completed)
+{
+	bool reaped = false;
+	while(true)
+	{
+		volatile nvme_cmpl_entry_t* entry = &queue->cmpl[queue->cmpl_head];
+		uint16_t status = entry->status;
+		if((status & NVME_CMPL_STATUS_PHASE) != queue->phase)
+			break;
+
+		uint16_t command_id = entry->command_id;
+		queue->sbms_head = entry->sbms_head;
+
+		/* An ID that isnt in flight would release it twice, so such entries are only consumed. */
+		nvme_command_state_t* command = command_id < queue->size ? &queue->commands[command_id] : NULL;
+		if(command && !command->done)
+		{
+			command->result = entry->result;
+			command->status = status;
+			command->done = true;
+			nvme_queue_free_lists(queue, command);
+
+			if(command->bio)
+			{
+				command->bio->status = NVME_CMPL_STATUS_GET_CODE(status) == 0 ? SUCCESS : ERR_NVME_COMMAND_FAILED;
+				completed->push_back(command->bio);
+				command->bio = NULL;
+			}
+
+			queue->free_command_ids.push(command_id);
+		}
+
+		queue->cmpl_head = (uint16_t)((queue->cmpl_head + 1) % queue->size);
+		if(queue->cmpl_head == 0)
+			queue->phase ^= 1;
+
+		reaped = true;
+	}
+
+	/* A single doorbell write for the whole batch. */
+	if(reaped)
+		nvme_queue_ring(queue, queue->cmpl_doorbell, queue->cmpl_shadow, queue->cmpl_event, queue->cmpl_head);
+}
+
+/* The MSI-X handler of an I/O queue pair. Runs on the CPU that owns the queue, with interrupts disabled. */
+static void nvme_queue_interrupt(uint8_t, void* context)
+{
+	nvme_queue_t* queue = (nvme_queue_t*)context;
+	bio_list_t completed;
+
+	if(queue->shared)
+		queue->lock.lock();
+
+	nvme_queue_reap(queue, &completed);
+
+	if(queue->shared)
+		queue->lock.unlock();
+
+	bio_complete_list(&completed);
+}
+
+device_storage_pci_nvme_t* device_storage_pci_nvme_t::create(const pci_config_shadow_t& config)
+{
+	return s_nvme_pool.create(config);
+}
 
 int device_storage_pci_nvme_t::initialize()
 {
 	int status;
-	status = device_pci_t::initialize();
+	while((status = poll_initialize()) == ERR_DEVICE_BUSY)
+		cpu_pause();
+
+	return status;
+}
+
+int device_storage_pci_nvme_t::poll_initialize()
+{
+	int status;
+	volatile uint32_t* configuration = NVME_REG(m_mmio, uint32_t, configuration);
+	volatile uint32_t* controller_status = NVME_REG(m_mmio, uint32_t, status);
+
+	switch(m_init_state)
+	{
+	case NVME_INIT_START:
+	{
+		status = device_pci_t::initialize();
+		if(status != SUCCESS)
+			return status;
+
+		m_mmio = (nvme_registers_t*)map_bar(0);
+		if(m_mmio == (void*)-1)
+			return ERR_OUT_OF_MEMORY;
+
+		status = msix_init();
+		if(status != SUCCESS)
+			return status;
+
+		/* Reset the controller, it may have been left enabled by the firmware. */
+		configuration = NVME_REG(m_mmio, uint32_t, configuration);
+		*configuration = *configuration & ~(uint32_t)NVME_CC_ENABLE;
+
+		m_init_deadline = time_deadline_ms((uint64_t)read_capabilities().timeout * NVME_TIMEOUT_UNIT_MS);
+		m_init_state = NVME_INIT_WAIT_DISABLED;
+		return ERR_DEVICE_BUSY;
+	}
+	case NVME_INIT_WAIT_DISABLED:
+	{
+		if(*controller_status & NVME_CSTS_READY)
+			return time_expired(m_init_deadline) ? ERR_TIMEOUT : ERR_DEVICE_BUSY;
+
+		status = queue_init(&m_admin_queue, 0, NVME_ADMIN_QUEUE_ENTRIES);
+		if(status != SUCCESS)
+			return status;
+
+		*NVME_REG(m_mmio, uint32_t, queue_attr) = NVME_AQA(NVME_ADMIN_QUEUE_ENTRIES, NVME_ADMIN_QUEUE_ENTRIES);
+		*NVME_REG(m_mmio, uint64_t, admin_sbms_queue_addr) = vmm_get_physical_of((virt_addr_t)m_admin_queue.sbms);
+		*NVME_REG(m_mmio, uint64_t, admin_cmpl_queue_addr) = vmm_get_physical_of((virt_addr_t)m_admin_queue.cmpl);
+
+		*configuration = NVME_CC_CSS_NVM | NVME_CC_MPS(0) | NVME_CC_IOSQES(NVME_SBMS_ENTRY_SIZE_EXPONENT) | 
+			NVME_CC_IOCQES(NVME_CMPL_ENTRY_SIZE_EXPONENT) | NVME_CC_ENABLE;
+
+		m_init_deadline = time_deadline_ms((uint64_t)read_capabilities().timeout * NVME_TIMEOUT_UNIT_MS);
+		m_init_state = NVME_INIT_WAIT_READY;
+		return ERR_DEVICE_BUSY;
+	}
+	case NVME_INIT_WAIT_READY:
+	{
+		uint32_t csts = *controller_status;
+		if(csts & NVME_CSTS_FATAL)
+			return ERR_NVME_CONTROLLER_FATAL;
+
+		if(!(csts & NVME_CSTS_READY))
+			return time_expired(m_init_deadline) ? ERR_TIMEOUT : ERR_DEVICE_BUSY;
+
+		return setup();
+	}
+	}
+
+	return ERR_INVALID_PARAMETER;
+}
+
+int device_storage_pci_nvme_t::setup()
+{
+	int status;
+	nvme_sbms_entry_t command;
+	const nvme_identify_controller_t* controller;
+	const nvme_identify_namespace_t* name_space;
+	const nvme_lba_format_t* format;
+	size_t max_pages;
+	uint32_t wanted, allocated;
+
+	/* The identify data structures are a page each. */
+	void* identify = (void*)vmm_alloc_page(VMM_PAGE_P | VMM_PAGE_RW);
+	if(identify == (void*)-1)
+		return ERR_OUT_OF_MEMORY;
+
+	phys_addr_t identify_physical = vmm_get_physical_of((virt_addr_t)identify);
+
+	memset(&command, 0, sizeof(command));
+	command.opcode = NVME_ADMIN_IDENTIFY;
+	command.prp1 = identify_physical;
+	command.cdw10 = NVME_IDENTIFY_CNS_CONTROLLER;
+	status = submit_admin(&command);
+	if(status != SUCCESS)
+		goto cleanup;
+
+	/* MDTS is in units of the minimum page size, and we also limit a transfer to what a single PRP list can describe. */
+	controller = (const nvme_identify_controller_t*)identify;
+	max_pages = NVME_MAX_TRANSFER_PAGES;
+	if(controller->max_data_transfer_size != 0)
+	{
+		size_t mdts_pages = ((size_t)1 << controller->max_data_transfer_size) << read_capabilities().min_page_size;
+		max_pages = MIN(max_pages, mdts_pages);
+	}
+	m_max_transfer_size = max_pages * NVME_PAGE_SIZE;
+	m_sgl_support = controller->sgl_support;
+
+	/* Before creating the I/O queues, which use the shadow doorbells. */
+	setup_shadow_doorbells(controller);
+
+	/* 
+	 * Request a queue pair for each CPU. MSI-X entry 0 is left for the admin queue, which is polled, 
+	 * so each I/O completion queue gets its own entry. The controller may allocate less queues than requested.
+	 */
+	wanted = MIN(g_cpu_count, (uint32_t)NVME_MAX_IO_QUEUES);
+	if(m_msix_table_size > 1)
+		wanted = MIN(wanted, (uint32_t)m_msix_table_size - 1);
+
+	memset(&command, 0, sizeof(command));
+	command.opcode = NVME_ADMIN_SET_FEATURES;
+	command.cdw10 = NVME_FEATURE_NUMBER_OF_QUEUES;
+	command.cdw11 = NVME_QUEUES_SET_COUNT(wanted);
+	status = submit_admin(&command, &allocated);
+	if(status != SUCCESS)
+		goto cleanup;
+
+	m_io_queue_count = MIN(wanted, MIN(NVME_QUEUES_GET_SBMS_COUNT(allocated), NVME_QUEUES_GET_CMPL_COUNT(allocated)));
+	m_io_queues = (nvme_queue_t*)malloc(m_io_queue_count * sizeof(nvme_queue_t));
+	if(!m_io_queues)
+	{
+		status = ERR_OUT_OF_MEMORY;
+		goto cleanup;
+	}
+
+	memset(m_io_queues, 0, m_io_queue_count * sizeof(nvme_queue_t));
+	for(size_t i = 0; i < m_io_queue_count; ++i)
+	{
+		status = create_io_queue(&m_io_queues[i], (uint16_t)(i + 1), (uint32_t)i);
+		if(status != SUCCESS)
+			goto cleanup;
+	}
+
+	msix_unmask_all();
+
+	/* Use the first active namespace. The list is sorted, and zero terminated. */
+	memset(&command, 0, sizeof(command));
+	command.opcode = NVME_ADMIN_IDENTIFY;
+	command.prp1 = identify_physical;
+	command.cdw10 = NVME_IDENTIFY_CNS_ACTIVE_NAMESPACES;
+	status = submit_admin(&command);
+	if(status != SUCCESS)
+		goto cleanup;
+
+	m_namespace_id = ((const uint32_t*)identify)[0];
+	if(m_namespace_id == 0)
+	{
+		status = ERR_NVME_NAMESPACE_NOT_FOUND;
+		goto cleanup;
+	}
+
+	memset(&command, 0, sizeof(command));
+	command.opcode = NVME_ADMIN_IDENTIFY;
+	command.namespace_id = m_namespace_id;
+	command.prp1 = identify_physical;
+	command.cdw10 = NVME_IDENTIFY_CNS_NAMESPACE;
+	status = submit_admin(&command);
+	if(status != SUCCESS)
+		goto cleanup;
+
+	name_space = (const nvme_identify_namespace_t*)identify;
+	format = &name_space->lba_formats[name_space->formatted_lba_size & 0xF];
+	m_sector_size = (size_t)1 << format->lba_data_size;
+	m_sector_count = name_space->size;
+	status = bounce_init();
+
+cleanup:
+	vmm_free_page((virt_addr_t)identify);
+	return status;
+}
+
+void device_storage_pci_nvme_t::setup_shadow_doorbells(const nvme_identify_controller_t* controller)
+{
+	nvme_sbms_entry_t command;
+	if(!(controller->optional_admin_commands & NVME_OACS_DOORBELL_BUFFER_CONFIG))
+		return;
+
+	virt_addr_t shadow_doorbells = vmm_alloc_page(VMM_PAGE_P | VMM_PAGE_RW);
+	virt_addr_t event_indexes = vmm_alloc_page(VMM_PAGE_P | VMM_PAGE_RW);
+	if(shadow_doorbells == (virt_addr_t)-1 || event_indexes == (virt_addr_t)-1)
+		goto failure;
+
+	memset((void*)shadow_doorbells, 0, VMM_PAGE_SIZE);
+	memset((void*)event_indexes, 0, VMM_PAGE_SIZE);
+
+	memset(&command, 0, sizeof(command));
+	command.opcode = NVME_ADMIN_DOORBELL_BUFFER_CONFIG;
+	command.prp1 = vmm_get_physical_of(shadow_doorbells);
+	command.prp2 = vmm_get_physical_of(event_indexes);
+	if(submit_admin(&command) != SUCCESS)
+		goto failure;
+
+	m_shadow_doorbells = (uint32_t*)shadow_doorbells;
+	m_event_indexes = (uint32_t*)event_indexes;
+	return;
+
+failure:
+	if(shadow_doorbells != (virt_addr_t)-1)
+		vmm_free_page(shadow_doorbells);
+
+	if(event_indexes != (virt_addr_t)-1)
+		vmm_free_page(event_indexes);
+}
+
+int device_storage_pci_nvme_t::create_io_queue(nvme_queue_t* queue, uint16_t id, uint32_t cpu)
+{
+	int status = queue_init(queue, id, MIN(NVME_IO_QUEUE_ENTRIES, read_capabilities().max_queue_entry_count + 1));
 	if(status != SUCCESS)
 		return status;
-	
-	m_mmio = (nvme_registers_t*)map_bar(0, 1);
-	if(m_mmio == (void*)-1)
-		return ERR_OUT_OF_MEMORY;
 
-	status = msix_init();
+	/* Some CPUs share a queue if the controller has less queues than there are CPUs. */
+	queue->shared = m_io_queue_count < g_cpu_count;
+
+	/* Without an MSI-X entry for the queue, its completions are only polled by the submitter. */
+	uint32_t interrupts = 0;
+	if(id < m_msix_table_size)
+	{
+		queue->interrupt = idt_alloc_handler(nvme_queue_interrupt, queue);
+		if(queue->interrupt == (uint16_t)-1)
+			return ERR_OUT_OF_MEMORY;
+
+		queue->msix_entry = id;
+		status = msix_set_vector(queue->msix_entry, (uint8_t)queue->interrupt, g_cpu_locals[cpu].lapic_id);
+		if(status != SUCCESS)
+			return status;
+
+		interrupts = NVME_QUEUE_INTERRUPT_VECTOR(queue->msix_entry) | NVME_QUEUE_INTERRUPTS_ENABLED;
+	}
+
+	/* The completion queue must exist before the submission queue that posts to it. */
+	nvme_sbms_entry_t command;
+	memset(&command, 0, sizeof(command));
+	command.opcode = NVME_ADMIN_CREATE_IO_CMPL_QUEUE;
+	command.prp1 = vmm_get_physical_of((virt_addr_t)queue->cmpl);
+	command.cdw10 = ((uint32_t)(queue->size - 1) << 16) | queue->id;
+	command.cdw11 = interrupts | NVME_QUEUE_PHYSICALLY_CONTIGUOUS;
+	status = submit_admin(&command);
 	if(status != SUCCESS)
 		return status;
 
-	// status = msix_unmask_all();
+	memset(&command, 0, sizeof(command));
+	command.opcode = NVME_ADMIN_CREATE_IO_SBMS_QUEUE;
+	command.prp1 = vmm_get_physical_of((virt_addr_t)queue->sbms);
+	command.cdw10 = ((uint32_t)(queue->size - 1) << 16) | queue->id;
+	command.cdw11 = ((uint32_t)queue->id << 16) | NVME_QUEUE_PHYSICALLY_CONTIGUOUS;
+	return submit_admin(&command);
+}
+
+int device_storage_pci_nvme_t::uninitialize()
+{
+	/* While the queues still work, so the dirty blocks of the device can be written back. */
+	g_block_cache.invalidate(this);
+
+	if(m_mmio && m_mmio != (void*)-1)
+	{
+		volatile uint32_t* configuration = NVME_REG(m_mmio, uint32_t, configuration);
+		*configuration = *configuration & ~(uint32_t)NVME_CC_ENABLE;
+	}
+
+	if(m_msix_table_size != 0)
+		msix_mask_all();
+
+	if(m_io_queues)
+	{
+		for(size_t i = 0; i < m_io_queue_count; ++i)
+			queue_free(&m_io_queues[i]);
 
+		free(m_io_queues);
+		m_io_queues = NULL;
+		m_io_queue_count = 0;
+	}
+
+	queue_free(&m_admin_queue);
+	bounce_release();
+
+	if(m_shadow_doorbells)
+	{
+		vmm_free_page((virt_addr_t)m_shadow_doorbells);
+		vmm_free_page((virt_addr_t)m_event_indexes);
+		m_shadow_doorbells = NULL;
+		m_event_indexes = NULL;
+	}
+
+	m_init_state = NVME_INIT_START;
 	return SUCCESS;
 }
 
-int device_storage_pci_nvme_t::uninitialize()
+void device_storage_pci_nvme_t::release()
+{
+	s_nvme_pool.destroy(this);
+}
+
+int device_storage_pci_nvme_t::read_sectors(uint64_t lba, size_t count, void* buffer) const
+{
+	return transfer(BIO_OP_READ, lba, count, buffer);
+}
+
+int device_storage_pci_nvme_t::write_sectors(uint64_t lba, size_t count, const void* buffer) const
+{
+	return transfer(BIO_OP_WRITE, lba, count, (void*)buffer);
+}
+
+int device_storage_pci_nvme_t::transfer(bio_op_t op, uint64_t lba, size_t count, void* buffer) const
+{
+	if(!buffer || count == 0)
+		return ERR_INVALID_PARAMETER;
+
+	size_t max_sectors = get_max_transfer_sectors();
+	uint8_t* current = (uint8_t*)buffer;
+	while(count > 0)
+	{
+		size_t sectors = MIN(count, max_sectors);
+		bio_segment_t segment = { .buffer = current, .size = sectors * m_sector_size };
+
+		bio_t bio;
+		bio_init(&bio, op, lba, sectors, &segment, 1);
+		int status = submit_wait(&bio);
+		if(status != SUCCESS)
+			return status;
+
+		lba += sectors;
+		count -= sectors;
+		current += sectors * m_sector_size;
+	}
+
+	return SUCCESS;
+}
+
+int device_storage_pci_nvme_t::submit(bio_t* bio) const
+{
+	if(!bio || !m_io_queues)
+		return ERR_INVALID_PARAMETER;
+
+	nvme_sbms_entry_t command;
+	memset(&command, 0, sizeof(command));
+	command.namespace_id = m_namespace_id;
+
+	if(bio->op == BIO_OP_FLUSH)
+		command.opcode = NVME_IO_FLUSH;
+	else
+	{
+		if(bio->count == 0 || bio->count > get_max_transfer_sectors() || bio->lba + bio->count > m_sector_count || bio->lba + bio->count < bio->lba)
+			return ERR_INVALID_PARAMETER;
+
+		command.opcode = bio->op == BIO_OP_READ ? NVME_IO_READ : NVME_IO_WRITE;
+		command.cdw10 = (uint32_t)bio->lba;
+		command.cdw11 = (uint32_t)(bio->lba >> 32);
+		command.cdw12 = (uint32_t)(bio->count - 1);				/* NLB - Zero based */
+	}
+
+	bio->done = false;
+	bio_list_t completed;
+	nvme_queue_t* queue = current_queue();
+	uint64_t flags = nvme_queue_acquire(queue);
+
+	/* The controller may have finished commands that werent reaped yet, which frees their slots and command IDs. */
+	if(nvme_queue_full(queue) || queue->free_command_ids.empty())
+		nvme_queue_reap(queue, &completed);
+
+	int status = ERR_DEVICE_BUSY;
+	uint16_t command_id;
+	if(!nvme_queue_full(queue) && queue->free_command_ids.pop(&command_id))
+	{
+		nvme_command_state_t* state = &queue->commands[command_id];
+		status = bio->op == BIO_OP_FLUSH ? SUCCESS : set_data_pointer(queue, state, &command, bio);
+		if(status == SUCCESS)
+		{
+			state->bio = bio;
+			nvme_queue_post(queue, &command, command_id);
+		}
+		else
+			queue->free_command_ids.push(command_id);
+	}
+
+	nvme_queue_release(queue, flags);
+	bio_complete_list(&completed);
+	return status;
+}
+
+size_t device_storage_pci_nvme_t::poll() const
+{
+	if(!m_io_queues)
+		return 0;
+
+	bio_list_t completed;
+	nvme_queue_t* queue = current_queue();
+	uint64_t flags = nvme_queue_acquire(queue);
+	nvme_queue_reap(queue, &completed);
+	nvme_queue_release(queue, flags);
+
+	size_t count = completed.size();
+	bio_complete_list(&completed);
+	return count;
+}
+
+int device_storage_pci_nvme_t::set_data_pointer(nvme_queue_t* queue, nvme_command_state_t* state, nvme_sbms_entry_t* command, const bio_t* bio) const
+{
+	/* PRPs are simpler for the controller, so SGLs are only used for requests that PRPs cant describe. */
+	bool prp_compatible = true;
+	for(size_t i = 0; i < bio->segment_count && prp_compatible; ++i)
+	{
+		uint64_t start = (uint64_t)bio->segments[i].buffer;
+		uint64_t end = start + bio->segments[i].size;
+		prp_compatible = IS_ALIGNED(start, sizeof(uint32_t)) && 
+			(i == 0 || start % NVME_PAGE_SIZE == 0) && 
+			(i == bio->segment_count - 1 || end % NVME_PAGE_SIZE == 0);
+	}
+
+	int status;
+	if(prp_compatible || !NVME_SGLS_SUPPORTED(m_sgl_support))
+		status = set_prps(queue, state, command, bio);
+	else
+		status = set_sgls(queue, state, command, bio);
+
+	if(status != SUCCESS)
+		nvme_queue_free_lists(queue, state);
+
+	return status;
+}
+
+int device_storage_pci_nvme_t::set_prps(nvme_queue_t* queue, nvme_command_state_t* state, nvme_sbms_entry_t* command, const bio_t* bio) const
+{
+	/* 
+	 * PRP1 may point anywhere in a page, all other entries must point to the start of a page, and all pages but the 
+	 * last must be used up to their end. So only the first segment may start, and only the last may end, inside a page.
+	 */
+	size_t entries = 0;
+	size_t total = 0;
+	bool page_ended = true;
+	uint64_t* list = NULL;
+	for(size_t i = 0; i < bio->segment_count; ++i)
+	{
+		virt_addr_t address = (virt_addr_t)bio->segments[i].buffer;
+		size_t left = bio->segments[i].size;
+		if(!IS_ALIGNED(address, sizeof(uint32_t)) || left == 0)
+			return ERR_INVALID_PARAMETER;
+
+		total += left;
+		while(left > 0)
+		{
+			if(entries > 0 && (!page_ended || address % NVME_PAGE_SIZE != 0))
+				return ERR_INVALID_PARAMETER;
+
+			size_t chunk = MIN(left, NVME_PAGE_SIZE - address % NVME_PAGE_SIZE);
+			phys_addr_t physical = vmm_get_physical_of(address);
+			if(entries == 0)
+				command->prp1 = physical;
+			else
+			{
+				if(entries - 1 >= NVME_PRP_LIST_ENTRIES)
+					return ERR_INVALID_PARAMETER;
+
+				if(!list)
+				{
+					list = (uint64_t*)nvme_queue_alloc_list(queue);
+					if(!list)
+						return ERR_OUT_OF_MEMORY;
+
+					state->lists[state->list_count++] = list;
+				}
+
+				list[entries - 1] = physical;
+			}
+
+			++entries;
+			address += chunk;
+			left -= chunk;
+			page_ended = address % NVME_PAGE_SIZE == 0;
+		}
+	}
+
+	if(total != bio->count * m_sector_size)
+		return ERR_INVALID_PARAMETER;
+
+	/* With exactly two pages PRP2 points to the second page itself, with more it points to the list. */
+	if(entries == 2)
+		command->prp2 = list[0];
+	else if(entries > 2)
+		command->prp2 = vmm_get_physical_of((virt_addr_t)list);
+
+	command->flags = (command->flags & ~NVME_COMMAND_FLAGS_PSDT_MASK) | NVME_COMMAND_FLAGS_PRP;
+	return SUCCESS;
+}
+
+int device_storage_pci_nvme_t::set_sgls(nvme_queue_t* queue, nvme_command_state_t* state, nvme_sbms_entry_t* command, const bio_t* bio) const
 {
+	/* 
+	 * A single run is described by a data block descriptor in the command itself. Otherwise the command points to a list page 
+	 * of data block descriptors, and when a page fills up its last descriptor is moved to a new page, and replaced by a 
+	 * segment descriptor pointing to the new page. The descriptor pointing to the last page is a last segment descriptor.
+	 */
+	nvme_sgl_descriptor_t pointer;					/* The data pointer of the command */
+	nvme_sgl_descriptor_t* link = &pointer;			/* The descriptor that points to the current list page */
+	nvme_sgl_descriptor_t* list = NULL;				/* The current list page */
+	nvme_sgl_descriptor_t* run = NULL;				/* The last data block descriptor */
+	size_t used = 0;								/* Descriptors used in the current list page */
+	size_t total = 0;
+	size_t alignment = NVME_SGLS_DWORD_ALIGNED(m_sgl_support) ? sizeof(uint32_t) : 1;
+
+	memset(&pointer, 0, sizeof(pointer));
+	for(size_t i = 0; i < bio->segment_count; ++i)
+	{
+		virt_addr_t address = (virt_addr_t)bio->segments[i].buffer;
+		size_t left = bio->segments[i].size;
+		if(!IS_ALIGNED(address, alignment) || !IS_ALIGNED(left, alignment) || left == 0)
+			return ERR_INVALID_PARAMETER;
+
+		total += left;
+		while(left > 0)
+		{
+			size_t chunk = MIN(left, NVME_PAGE_SIZE - address % NVME_PAGE_SIZE);
+			phys_addr_t physical = vmm_get_physical_of(address);
+			address += chunk;
+			left -= chunk;
+
+			/* Pages that are physically contiguous extend the current run. */
+			if(run && run->address + run->length == physical)
+			{
+				run->length += chunk;
+				continue;
+			}
+
+			if(!run)
+			{
+				pointer.address = physical;
+				pointer.length = chunk;
+				pointer.type = NVME_SGL_TYPE_DATA_BLOCK;
+				run = &pointer;
+				continue;
+			}
+
+			if(!list || used == NVME_SGL_LIST_ENTRIES)
+			{
+				if(state->list_count == NVME_COMMAND_LIST_PAGES)
+					return ERR_INVALID_PARAMETER;
+
+				nvme_sgl_descriptor_t* next = (nvme_sgl_descriptor_t*)nvme_queue_alloc_list(queue);
+				if(!next)
+					return ERR_OUT_OF_MEMORY;
+
+				state->lists[state->list_count++] = next;
+
+				/* The descriptor that points to the new page takes the place of the last descriptor, which moves to the new page. */
+				nvme_sgl_descriptor_t* last = list ? &list[used - 1] : &pointer;
+				next[0] = *last;
+				if(list)
+				{
+					link->length = NVME_SGL_LIST_ENTRIES * sizeof(nvme_sgl_descriptor_t);
+					link->type = NVME_SGL_TYPE_SEGMENT;
+				}
+
+				memset(last, 0, sizeof(nvme_sgl_descriptor_t));
+				last->address = vmm_get_physical_of((virt_addr_t)next);
+				link = last;
+				list = next;
+				used = 1;
+			}
+
+			run = &list[used++];
+			memset(run, 0, sizeof(nvme_sgl_descriptor_t));
+			run->address = physical;
+			run->length = chunk;
+			run->type = NVME_SGL_TYPE_DATA_BLOCK;
+		}
+	}
+
+	if(total != bio->count * m_sector_size)
+		return ERR_INVALID_PARAMETER;
+
+	if(list)
+	{
+		link->length = used * sizeof(nvme_sgl_descriptor_t);
+		link->type = NVME_SGL_TYPE_LAST_SEGMENT;
+	}
+
+	/* The descriptor takes the place of PRP1 and PRP2. */
+	command->prp1 = pointer.address;
+	command->prp2 = (uint64_t)pointer.length | ((uint64_t)pointer.type << 56);
+	command->flags = (command->flags & ~NVME_COMMAND_FLAGS_PSDT_MASK) | NVME_COMMAND_FLAGS_SGL;
 	return SUCCESS;
 }
 
-int device_storage_pci_nvme_t::read_sectors(uint64_t, size_t, void*) const
+int device_storage_pci_nvme_t::submit_admin(nvme_sbms_entry_t* command, uint32_t* result)
 {
+	nvme_queue_t* queue = &m_admin_queue;
+	bio_list_t completed;				/* Admin commands have no requests, so this stays empty. */
+
+	uint16_t command_id;
+	uint64_t deadline = time_deadline_ms(NVME_COMMAND_TIMEOUT_MS);
+	while(nvme_queue_full(queue) || !queue->free_command_ids.pop(&command_id))
+	{
+		nvme_queue_reap(queue, &completed);
+		if(time_expired(deadline))
+			return ERR_TIMEOUT;
+	}
+
+	nvme_command_state_t* state = &queue->commands[command_id];
+	state->bio = NULL;
+	nvme_queue_post(queue, command, command_id);
+
+	deadline = time_deadline_ms(NVME_COMMAND_TIMEOUT_MS);
+	while(true)
+	{
+		nvme_queue_reap(queue, &completed);
+		if(state->done)
+			break;
+
+		if(time_expired(deadline))
+			return ERR_TIMEOUT;
+
+		cpu_pause();
+	}
+
+	if(result)
+		*result = state->result;
+
+	if(NVME_CMPL_STATUS_GET_CODE(state->status) != 0)
+		return ERR_NVME_COMMAND_FAILED;
+
 	return SUCCESS;
 }
 
-int device_storage_pci_nvme_t::write_sectors(uint64_t, size_t, const void*) const
+void device_storage_pci_nvme_t::get_doorbell_stats(nvme_doorbell_stats_t* stats) const
+{
+	stats->writes = 0;
+	stats->writes_avoided = 0;
+	for(size_t i = 0; i < m_io_queue_count; ++i)
+	{
+		stats->writes += m_io_queues[i].doorbell_writes;
+		stats->writes_avoided += m_io_queues[i].doorbell_writes_avoided;
+	}
+}
+
+nvme_queue_t* device_storage_pci_nvme_t::current_queue() const
+{
+	return &m_io_queues[cpu_current_index() % m_io_queue_count];
+}
+
+int device_storage_pci_nvme_t::queue_init(nvme_queue_t* queue, uint16_t id, uint16_t size)
 {
+	memset(queue, 0, sizeof(nvme_queue_t));
+	queue->id = id;
+	queue->size = size;
+	queue->phase = 1;
+	queue->msix_entry = -1;
+	queue->interrupt = -1;
+
+	queue->commands = (nvme_command_state_t*)malloc(size * sizeof(nvme_command_state_t));
+	if(!queue->commands)
+	{
+		queue_free(queue);
+		return ERR_OUT_OF_MEMORY;
+	}
+
+	memset(queue->commands, 0, size * sizeof(nvme_command_state_t));
+	for(uint16_t i = 0; i < size - 1; ++i)
+	{
+		queue->commands[i].done = true;		/* Not in flight */
+		queue->free_command_ids.push(i);
+	}
+
+	/* I/O queues start with some list pages, so most requests dont allocate. The admin queue doesnt use lists. */
+	for(size_t i = 0; i < NVME_QUEUE_LIST_PAGES && id != 0; ++i)
+	{
+		virt_addr_t page = vmm_alloc_page(VMM_PAGE_P | VMM_PAGE_RW);
+		if(page == (virt_addr_t)-1)
+		{
+			queue_free(queue);
+			return ERR_OUT_OF_MEMORY;
+		}
+
+		*(void**)page = queue->free_lists;
+		queue->free_lists = (void*)page;
+	}
+
+	queue->sbms = (nvme_sbms_entry_t*)vmm_alloc_page(VMM_PAGE_P | VMM_PAGE_RW);
+	queue->cmpl = (nvme_cmpl_entry_t*)vmm_alloc_page(VMM_PAGE_P | VMM_PAGE_RW);
+	if(queue->sbms == (void*)-1 || queue->cmpl == (void*)-1)
+	{
+		queue_free(queue);
+		return ERR_OUT_OF_MEMORY;
+	}
+
+	memset(queue->sbms, 0, VMM_PAGE_SIZE);
+	memset(queue->cmpl, 0, VMM_PAGE_SIZE);
+
+	queue->sbms_doorbell = (volatile uint32_t*)NVME_REG_SBMS_QUEUE_DOORBELL(m_mmio, id);
+	queue->cmpl_doorbell = (volatile uint32_t*)NVME_REG_CMPL_QUEUE_DOORBELL(m_mmio, id);
+
+	/* The shadow buffers have the layout of the doorbell registers. The admin queue always uses the MMIO doorbells. */
+	if(id != 0 && m_shadow_doorbells)
+	{
+		size_t stride = ((size_t)1 << (read_capabilities().stride + 2)) / sizeof(uint32_t);
+		queue->sbms_shadow = &m_shadow_doorbells[2 * id * stride];
+		queue->cmpl_shadow = &m_shadow_doorbells[(2 * id + 1) * stride];
+		queue->sbms_event = &m_event_indexes[2 * id * stride];
+		queue->cmpl_event = &m_event_indexes[(2 * id + 1) * stride];
+	}
+
 	return SUCCESS;
+}
+
+void device_storage_pci_nvme_t::queue_free(nvme_queue_t* queue)
+{
+	if(queue->msix_entry != (uint16_t)-1)
+		msix_mask(queue->msix_entry);
+
+	if(queue->interrupt != (uint16_t)-1)
+		idt_free_handler((uint8_t)queue->interrupt);
+
+	if(queue->commands)
+	{
+		for(uint16_t i = 0; i < queue->size; ++i)
+			nvme_queue_free_lists(queue, &queue->commands[i]);
+
+		free(queue->commands);
+	}
+
+	while(queue->free_lists)
+	{
+		void* page = queue->free_lists;
+		queue->free_lists = *(void**)page;
+		vmm_free_page((virt_addr_t)page);
+	}
+
+	if(queue->sbms && queue->sbms != (void*)-1)
+		vmm_free_page((virt_addr_t)queue->sbms);
+
+	if(queue->cmpl && queue->cmpl != (void*)-1)
+		vmm_free_page((virt_addr_t)queue->cmpl);
+
+	queue->sbms = NULL;
+	queue->cmpl = NULL;
+	queue->commands = NULL;
+	queue->msix_entry = -1;
+	queue->interrupt = -1;
+}
+
+nvme_reg_capabilities_t device_storage_pci_nvme_t::read_capabilities() const
+{
+	uint64_t value = *NVME_REG(m_mmio, uint64_t, capabilities);
+	nvme_reg_capabilities_t capabilities;
+	memcpy(&capabilities, &value, sizeof(capabilities));
+	return capabilities;
 }
\ No newline at end of file
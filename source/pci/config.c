@@ -0,0 +1,78 @@
+/* 
+ * This file is part of the EspressoOS project (https://github.com/rdex999/EspressoOS.git).
+ * Copyright (c) 2025 David Weizman.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "pci/config.h"
+#include "pci/pci.h"
+
+void pci_config_shadow_t::load(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function)
+{
+	m_segment = segment;
+	m_bus = bus;
+	m_device = device;
+	m_function = function;
+
+	for(size_t i = 0; i < PCI_CONFIG_SHADOW_SIZE / sizeof(uint32_t); ++i)
+		m_dwords[i] = pci_read32(segment, bus, device, function, i * sizeof(uint32_t));
+}
+
+uint16_t pci_config_shadow_t::find_capability(uint8_t capability) const
+{
+	if((read<&pci_config_t::status>() & PCI_STATUS_CAPABILITIES) == 0)
+		return -1;
+	
+	/* The low 2 bits of the pointers are reserved, and must be masked before the pointer is used. */
+	uint8_t current = read<&pci_config_t::device, &pci_config_device_t::capabilities_pointer>() & 0xFC;
+	for(int i = 0; current && i < 48; ++i)			/* At most 48 capabilities fit, so a looping list is stopped. */
+	{
+		if(read_raw<uint8_t>((uint16_t)current + offsetof(pci_capability_header_t, id)) == capability)
+			return (uint16_t)current;
+		
+		current = read_raw<uint8_t>((uint16_t)current + offsetof(pci_capability_header_t, next)) & 0xFC;
+	}
+
+	return -1;
+}
+
+uint32_t pci_config_shadow_t::read_register(uint16_t offset, size_t size) const
+{
+	switch(size)
+	{
+	case sizeof(uint8_t):
+		return pci_read8(m_segment, m_bus, m_device, m_function, offset);
+	case sizeof(uint16_t):
+		return pci_read16(m_segment, m_bus, m_device, m_function, offset);
+	default:
+		return pci_read32(m_segment, m_bus, m_device, m_function, offset);
+	}
+}
+
+void pci_config_shadow_t::write_register(uint16_t offset, size_t size, uint32_t value) const
+{
+	switch(size)
+	{
+	case sizeof(uint8_t):
+		pci_write8(m_segment, m_bus, m_device, m_function, offset, (uint8_t)value);
+		break;
+	case sizeof(uint16_t):
+		pci_write16(m_segment, m_bus, m_device, m_function, offset, (uint16_t)value);
+		break;
+	default:
+		pci_write32(m_segment, m_bus, m_device, m_function, offset, value);
+		break;
+	}
+}
\ No newline at end of file
@@ -19,65 +19,53 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <object_pool.h>
+#include <string.h>
 #include "mm/vmm/vmm.h"
 #include "common.h"
+#include "device/registry.h"
+#include "error.h"
+
+static object_pool_t<device_pci_bridge_pci2pci_t, 16> s_bridge_pool;
 
 int device_pci_t::initialize()
 {
-	m_vendor_id = pci_read16(m_bus, m_device, m_function, offsetof(pci_config_t, vendor_id));
-	m_device_id = pci_read16(m_bus, m_device, m_function, offsetof(pci_config_t, device_id));
-	m_class_code = pci_read8(m_bus, m_device, m_function, offsetof(pci_config_t, class_code));
-	m_subclass = pci_read8(m_bus, m_device, m_function, offsetof(pci_config_t, subclass));
-	m_prog_if = pci_read8(m_bus, m_device, m_function, offsetof(pci_config_t, prog_if));
+	m_vendor_id = m_config.read<&pci_config_t::vendor_id>();
+	m_device_id = m_config.read<&pci_config_t::device_id>();
+	m_class_code = m_config.read<&pci_config_t::class_code>();
+	m_subclass = m_config.read<&pci_config_t::subclass>();
+	m_prog_if = m_config.read<&pci_config_t::prog_if>();
+	m_pcie_capability = find_capability(PCI_CAPABILITY_ID_PCIE);
+
+	/* The shadow was loaded while enumerating, before pci_tune_pcie changed the device control register. */
+	if(m_pcie_capability != (uint16_t)-1)
+		m_config.reload_raw<uint16_t>(m_pcie_capability + offsetof(pci_capability_pcie_t, device_control));
+
+	probe_bars();
 
 	return SUCCESS;
 }
 
-bool device_pci_t::is_device(const device_t* device) const
+size_t device_pci_t::get_registry_keys(uint64_t* keys, size_t max) const
 {
-	/* 
-	 * Okay so if class code if specified (not -1), check if it matches. 
-	 * If doesnt matche, return false. If it matches, check if subclass is specified (not -1).
-	 * if not specified, return true. If specified, check if it matches. If it doesnt, return false, else return true.
-	 * And so on, check from the least specific to the most specific identifiers.
-	 */
-
-	/* If its not even a PCI device, return false. */
-	if((device->m_type & DEVICE_TYPE_PCI) == 0)
-		return false;
-	
-	const device_pci_t* pci_device = (const device_pci_t*)(device->m_self);
-
-	if(pci_device->m_class_code != m_class_code)
-		return false;
-
-	/* User searched only for class code */
-	if(pci_device->m_subclass == (uint8_t)-1)
-		return true;
-
-	if(pci_device->m_subclass != m_subclass)
-		return false;
+	size_t count = device_t::get_registry_keys(keys, max);
 
-	/* User searched only for prog if */	
-	if(pci_device->m_prog_if == (uint8_t)-1)
-		return true;
+	/* Read from the shadow, as the device may be registered before it is initialized. */
+	uint8_t class_code = m_config.read<&pci_config_t::class_code>();
+	uint8_t subclass = m_config.read<&pci_config_t::subclass>();
+	uint8_t prog_if = m_config.read<&pci_config_t::prog_if>();
 
-	if(pci_device->m_prog_if != m_prog_if)
-		return false;
+	const uint64_t pci_keys[] = {
+		DEVICE_KEY_PCI_CLASS(class_code),
+		DEVICE_KEY_PCI_SUBCLASS(class_code, subclass),
+		DEVICE_KEY_PCI_PROG_IF(class_code, subclass, prog_if),
+		DEVICE_KEY_PCI_ID(m_config.read<&pci_config_t::vendor_id>(), m_config.read<&pci_config_t::device_id>()),
+	};
 
-	/* User searched only for class code, subclass */
-	if(pci_device->m_vendor_id == (uint16_t)-1)
-		return true;
-	
-	if(pci_device->m_vendor_id != m_vendor_id)
-		return false;
-	
-	/* User searched for class code, subclass, device id */
-	if(pci_device->m_device_id == (uint16_t)-1)
-		return true;
+	for(size_t i = 0; i < sizeof(pci_keys) / sizeof(pci_keys[0]) && count < max; ++i)
+		keys[count++] = pci_keys[i];
 
-	/* User made a specific search on all identifiers. */
-	return pci_device->m_device_id == m_device_id;
+	return count;
 }
 
 int device_pci_t::msix_init()
@@ -86,197 +74,203 @@ int device_pci_t::msix_init()
 	if(m_msix_capability == (uint16_t)-1)
 		return ERR_DEVICE_MSIX_NOT_SUPPORTED;
 
-	uint16_t message_control = pci_read16(
-		m_bus, 
-		m_device, 
-		m_function, 
-		m_msix_capability + offsetof(pci_capability_msix_t, message_control)
-	);
+	uint16_t message_control = m_config.read_raw<uint16_t>(m_msix_capability + offsetof(pci_capability_msix_t, message_control));
 
 	message_control |= PCI_MSIX_REG_CTRL_ENABLE;		/* Enable MSI-X */
 	message_control |= PCI_MSIX_REG_CTRL_MASK;			/* Mask (disable) all interrupts. */
 
-	pci_write16(
-		m_bus, 
-		m_device, 
-		m_function, 
-		m_msix_capability + offsetof(pci_capability_msix_t, message_control), 
-		message_control
-	);
+	m_config.write_raw<uint16_t>(m_msix_capability + offsetof(pci_capability_msix_t, message_control), message_control);
+	m_msix_table_size = PCI_MSIX_REG_CTRL_GET_TABLE_LENGTH(message_control);
 
-	uint32_t table_desc = pci_read32(
-		m_bus, 
-		m_device, 
-		m_function, 
-		m_msix_capability + offsetof(pci_capability_msix_t, table_descriptor)
-	);
-	uint8_t table_bar_index = PCI_MSIX_REG_BAR_ADDR_BAR_IDX(table_desc);
-	uint32_t table_offset = PCI_MSIX_REG_BAR_ADDR_OFFSET(table_desc);
-	size_t table_pages = DIV_ROUND_UP(
-		table_offset + PCI_MSIX_REG_CTRL_GET_TABLE_LENGTH(message_control) * sizeof(pci_msix_table_entry_t), 
-		VMM_PAGE_SIZE
-	);
+	uint32_t table_desc = m_config.read_raw<uint32_t>(m_msix_capability + offsetof(pci_capability_msix_t, table_descriptor));
+	uint32_t pending_desc = m_config.read_raw<uint32_t>(m_msix_capability + offsetof(pci_capability_msix_t, pending_descriptor));
 
-	uint32_t pending_desc = pci_read32(
-		m_bus, 
-		m_device, 
-		m_function, 
-		m_msix_capability + offsetof(pci_capability_msix_t, pending_descriptor)
-	);
-	uint8_t pending_bar_index = PCI_MSIX_REG_BAR_ADDR_BAR_IDX(pending_desc);
-	uint32_t pending_offset = PCI_MSIX_REG_BAR_ADDR_OFFSET(pending_desc);
-	size_t pending_pages = DIV_ROUND_UP(
-		pending_offset + DIV_ROUND_UP(PCI_MSIX_REG_CTRL_GET_TABLE_LENGTH(message_control), 8), 	/* Amount of bytes for the bitmap */
-		VMM_PAGE_SIZE
-	);	
-
-	if(pending_bar_index == table_bar_index)
-	{
-		size_t pages = MAX(table_pages, pending_pages);
-		void* mapped_bar = map_bar(table_bar_index, pages);
-		if(mapped_bar == (void*)-1)
-			return ERR_OUT_OF_MEMORY;
-		
-		m_msix_table = (pci_msix_table_entry_t*)((uint8_t*)mapped_bar + (uint64_t)table_offset);
-		m_msix_pending = (pci_msix_pending_entry_t*)((uint8_t*)mapped_bar + (uint64_t)pending_offset);
-	}
-	else
-	{
-		void* mapped_table_bar = map_bar(table_bar_index, table_pages);
-		if(mapped_table_bar == (void*)-1)
-			return ERR_OUT_OF_MEMORY;
+	/* If the table and the pending bits are in the same BAR, the second map_bar returns the same mapping. */
+	void* mapped_table_bar = map_bar(PCI_MSIX_REG_BAR_ADDR_BAR_IDX(table_desc));
+	if(mapped_table_bar == (void*)-1)
+		return ERR_OUT_OF_MEMORY;
 
-		void* mapped_pending_bar = map_bar(pending_bar_index, pending_pages);
-		if(mapped_pending_bar == (void*)-1)
-			return ERR_OUT_OF_MEMORY;
+	void* mapped_pending_bar = map_bar(PCI_MSIX_REG_BAR_ADDR_BAR_IDX(pending_desc));
+	if(mapped_pending_bar == (void*)-1)
+		return ERR_OUT_OF_MEMORY;
 
-		m_msix_table = (pci_msix_table_entry_t*)((uint8_t*)mapped_table_bar + (uint64_t)table_offset);
-		m_msix_pending = (pci_msix_pending_entry_t*)((uint8_t*)mapped_pending_bar + (uint64_t)pending_offset);
-	}
+	m_msix_table = (pci_msix_table_entry_t*)((uint8_t*)mapped_table_bar + (uint64_t)PCI_MSIX_REG_BAR_ADDR_OFFSET(table_desc));
+	m_msix_pending = (pci_msix_pending_entry_t*)((uint8_t*)mapped_pending_bar + (uint64_t)PCI_MSIX_REG_BAR_ADDR_OFFSET(pending_desc));
 	
 	return SUCCESS;
 }
 
-void device_pci_t::msix_unmask_all() const
+void device_pci_t::msix_unmask_all()
 {
-	uint16_t message_control = pci_read16(
-		m_bus, 
-		m_device, 
-		m_function, 
-		m_msix_capability + offsetof(pci_capability_msix_t, message_control)
-	);
-
-	message_control &= ~PCI_MSIX_REG_CTRL_MASK;
+	uint16_t offset = m_msix_capability + offsetof(pci_capability_msix_t, message_control);
+	m_config.write_raw<uint16_t>(offset, m_config.read_raw<uint16_t>(offset) & ~PCI_MSIX_REG_CTRL_MASK);
+}
 
-	pci_write16(
-		m_bus,
-		m_device,
-		m_function,
-		m_msix_capability + offsetof(pci_capability_msix_t, message_control),
-		message_control
-	);
+int device_pci_t::msix_set_vector(uint16_t entry, uint8_t vector, uint32_t lapic_id)
+{
+	if(entry >= m_msix_table_size || lapic_id > 0xFF)
+		return ERR_INVALID_PARAMETER;
+
+	/* The table is MMIO, and must be accessed with aligned dword or qword accesses. Mask the entry while changing it. */
+	volatile pci_msix_table_entry_t* table_entry = &m_msix_table[entry];
+	table_entry->msg_control = PCI_MSIX_MSG_DATA_MASK;
+	table_entry->msg_address = PCI_MSIX_MSG_ADDR_SET_LAPIC_ID((uint64_t)PCI_MSIX_MSG_ADDR_BASE, lapic_id);
+	table_entry->msg_data = vector;					/* Fixed delivery mode, edge triggered */
+	table_entry->msg_control = 0;
+	return SUCCESS;
 }
 
-void device_pci_t::msix_mask_all() const
+void device_pci_t::msix_mask(uint16_t entry)
 {
-	uint16_t message_control = pci_read16(
-		m_bus, 
-		m_device, 
-		m_function, 
-		m_msix_capability + offsetof(pci_capability_msix_t, message_control)
-	);
+	if(entry >= m_msix_table_size)
+		return;
 
-	message_control |= PCI_MSIX_REG_CTRL_MASK;
+	volatile pci_msix_table_entry_t* table_entry = &m_msix_table[entry];
+	table_entry->msg_control = PCI_MSIX_MSG_DATA_MASK;
+}
 
-	pci_write16(
-		m_bus,
-		m_device,
-		m_function,
-		m_msix_capability + offsetof(pci_capability_msix_t, message_control),
-		message_control
-	);
+void device_pci_t::msix_mask_all()
+{
+	uint16_t offset = m_msix_capability + offsetof(pci_capability_msix_t, message_control);
+	m_config.write_raw<uint16_t>(offset, m_config.read_raw<uint16_t>(offset) | PCI_MSIX_REG_CTRL_MASK);
 }
 
-void* device_pci_t::map_bar(uint8_t bar, size_t pages) const
+void device_pci_t::probe_bars()
 {
-	uint32_t low = pci_read32(
-		m_bus, 
-		m_device, 
-		m_function, 
-		offsetof(pci_config_t, device.base_address[0]) + bar * sizeof(uint32_t)
-	);
+	memset(m_bars, 0, sizeof(m_bars));
+
+	uint8_t header_type = m_config.read<&pci_config_t::header_type>() & 0x7F;
+	uint8_t count = header_type == 0 ? PCI_BARS_DEVICE : (header_type == 1 ? PCI_BARS_BRIDGE : 0);
+	if(count == 0)
+		return;
 
-	uint64_t flags = VMM_PAGE_P | VMM_PAGE_RW;
-	phys_addr_t physical = (uint64_t)low & ~0xF;
+	/* While a BAR holds all ones it decodes a bogus range, so stop decoding until all BARs are restored. */
+	uint16_t command = m_config.read<&pci_config_t::command>();
+	m_config.write<&pci_config_t::command>(command & ~(PCI_COMMAND_IO_SPACE | PCI_COMMAND_MEMORY_SPACE));
 
-	if(PCI_BAR_GET_TYPE(low) == PCI_BAR_TYPE_64BIT)
+	for(uint8_t i = 0; i < count; ++i)
 	{
-		uint32_t high = pci_read32(
-			m_bus, 
-			m_device, 
-			m_function, 
-			offsetof(pci_config_t, device.base_address[0]) + (bar + 1) * sizeof(uint32_t)
-		);
-
-		physical |= (uint64_t)high << 32;
+		uint16_t offset = offsetof(pci_config_t, device.base_address[0]) + i * sizeof(uint32_t);
+		uint32_t low = m_config.read_raw<uint32_t>(offset);
+
+		pci_write32(m_segment, m_bus, m_device, m_function, offset, 0xFFFFFFFF);
+		uint32_t low_mask = pci_read32(m_segment, m_bus, m_device, m_function, offset);
+		pci_write32(m_segment, m_bus, m_device, m_function, offset, low);
+
+		pci_bar_t* bar = &m_bars[i];
+		if(low & PCI_BAR_IO_SPACE)
+		{
+			/* The upper 16 bits of an IO BAR may be hardwired to 0, IO space is only 64 KiB anyway. */
+			uint32_t mask = low_mask & PCI_BAR_IO_ADDRESS_MASK & 0xFFFF;
+			bar->io = true;
+			bar->address = low & PCI_BAR_IO_ADDRESS_MASK;
+			bar->size = mask ? (~mask & 0xFFFF) + 1 : 0;
+			continue;
+		}
+
+		/* The address bits that read back as 0 give the size, if all of them do the BAR isnt implemented. */
+		uint64_t address = (uint64_t)low & PCI_BAR_MEMORY_ADDRESS_MASK;
+		uint64_t mask = ((uint64_t)low_mask & PCI_BAR_MEMORY_ADDRESS_MASK & 0xFFFFFFFF);
+		if(mask)
+			mask |= 0xFFFFFFFF00000000;
+
+		bar->prefetchable = PCI_BAR_GET_PREFETCHABLE(low);
+
+		if(PCI_BAR_GET_TYPE(low) == PCI_BAR_TYPE_64BIT && i + 1 < count)
+		{
+			uint32_t high = m_config.read_raw<uint32_t>(offset + sizeof(uint32_t));
+
+			pci_write32(m_segment, m_bus, m_device, m_function, offset + sizeof(uint32_t), 0xFFFFFFFF);
+			uint32_t high_mask = pci_read32(m_segment, m_bus, m_device, m_function, offset + sizeof(uint32_t));
+			pci_write32(m_segment, m_bus, m_device, m_function, offset + sizeof(uint32_t), high);
+
+			address |= (uint64_t)high << 32;
+			mask = ((uint64_t)low_mask & PCI_BAR_MEMORY_ADDRESS_MASK) | ((uint64_t)high_mask << 32);
+			bar->is_64bit = true;
+			++i;			/* The next BAR is the high half of this one. */
+		}
+
+		bar->address = address;
+		bar->size = mask ? ~mask + 1 : 0;
 	}
 
-	/* The osdev wiki states that if a page is prefetchable, paging should mark it as write-through for maximum performance. */
-	if(PCI_BAR_GET_PREFETCHABLE(low) == 1)
-		flags |= VMM_PAGE_PWT;
-	else
-		flags |= VMM_PAGE_PCD | VMM_PAGE_PTE_PAT;
+	m_config.write<&pci_config_t::command>(command);
+}
 
-	return (void*)vmm_map_physical_pages(
-		physical, 
-		flags, 
-		pages
-	);
+void* device_pci_t::map_bar(uint8_t bar)
+{
+	if(bar >= PCI_MAX_BARS)
+		return (void*)-1;
+
+	/* Reads of prefetchable memory have no side effects and writes may be merged, so let the CPU combine writes to it. */
+	return map_bar(bar, m_bars[bar].prefetchable ? VMM_PAGE_CACHE_WC : VMM_PAGE_CACHE_UC);
 }
 
-uint16_t device_pci_t::find_capability(pci_capability_id_t capability) const
+void* device_pci_t::map_bar(uint8_t bar, uint64_t cache)
 {
-	int reg_status = pci_read16(m_bus, m_device, m_function, offsetof(pci_config_t, status));
-	if((reg_status & PCI_STATUS_CAPABILITIES) == 0)
-		return -1;
-	
-	uint8_t current = pci_read8(m_bus, m_device, m_function, offsetof(pci_config_t, device.capabilities_pointer));
-	while(current)
-	{
-		uint8_t id = pci_read8(m_bus, m_device, m_function, (uint16_t)current + offsetof(pci_capability_header_t, id));
-		if(id == (uint8_t)capability)
-			return (uint16_t)current;
-		
-		current = pci_read8(m_bus, m_device, m_function, (uint16_t)current + offsetof(pci_capability_header_t, next));
-	}
+	if(bar >= PCI_MAX_BARS || m_bars[bar].io || m_bars[bar].size == 0)
+		return (void*)-1;
+
+	if(m_bars[bar].mapping)
+		return m_bars[bar].mapping;
+
+	/* Small BARs (at least 16 bytes) may not start on a page boundary. */
+	phys_addr_t physical = ALIGN_DOWN(m_bars[bar].address, VMM_PAGE_SIZE);
+	size_t offset = m_bars[bar].address - physical;
+	size_t pages = DIV_ROUND_UP(offset + m_bars[bar].size, VMM_PAGE_SIZE);
+
+	virt_addr_t mapped = vmm_map_physical_pages(physical, VMM_PAGE_P | VMM_PAGE_RW | (cache & VMM_PAGE_CACHE_MASK), pages);
+	if(mapped == (virt_addr_t)-1)
+		return (void*)-1;
 
-	return -1;
+	m_bars[bar].mapping = (void*)(mapped + offset);
+	return m_bars[bar].mapping;
 }
 
-int device_pci_bridge_pci2pci_t::initialize()
+uint16_t device_pci_t::find_capability(pci_capability_id_t capability) const
 {
-	static int next_free_bus = 1;
+	return m_config.find_capability((uint8_t)capability);
+}
 
-	int status = device_pci_t::initialize();
-	if(status != SUCCESS)
-		return status;
+uint16_t device_pci_t::find_ext_capability(pci_ext_capability_id_t capability) const
+{
+	if(m_pcie_capability == (uint16_t)-1)
+		return -1;
 
-	uint8_t secondary_bus = next_free_bus++;
-	uint8_t subordinate_bus = secondary_bus;
+	return pci_find_ext_capability(m_segment, m_bus, m_device, m_function, capability);
+}
+
+int device_pci_bridge_pci2pci_t::enumerate()
+{
+	int secondary_bus = pci_allocate_bus(m_segment, m_bus);
+	if(secondary_bus == -1)
+		return ERR_PCI_NO_FREE_BUS;
 
-	pci_write8(m_bus, m_device, m_function, offsetof(pci_config_t, bridge_pci_to_pci.primary_bus), m_bus);
-	pci_write8(m_bus, m_device, m_function, offsetof(pci_config_t, bridge_pci_to_pci.secondary_bus), secondary_bus);
-	pci_write8(m_bus, m_device, m_function, offsetof(pci_config_t, bridge_pci_to_pci.subordinate_bus), subordinate_bus);
+	m_config.write<&pci_config_t::bridge_pci_to_pci, &pci_config_bridge_pci_to_pci_t::primary_bus>(m_bus);
+	m_config.write<&pci_config_t::bridge_pci_to_pci, &pci_config_bridge_pci_to_pci_t::secondary_bus>(secondary_bus);
+	m_config.write<&pci_config_t::bridge_pci_to_pci, &pci_config_bridge_pci_to_pci_t::subordinate_bus>(secondary_bus);
 
 	discover_children();
 
-	pci_write8(m_bus, m_device, m_function, offsetof(pci_config_t, bridge_pci_to_pci.subordinate_bus), next_free_bus - 1);
+	m_config.write<&pci_config_t::bridge_pci_to_pci, &pci_config_bridge_pci_to_pci_t::subordinate_bus>(
+		pci_last_allocated_bus(m_segment, m_bus)
+	);
 
 	return SUCCESS;
 }
 
 void device_pci_bridge_pci2pci_t::discover_children()
 {
-	uint8_t secondary_bus = pci_read8(m_bus, m_device, m_function, offsetof(pci_config_t, bridge_pci_to_pci.secondary_bus));
-	pci_enumerate_bus(secondary_bus, this);
+	uint8_t secondary_bus = m_config.read<&pci_config_t::bridge_pci_to_pci, &pci_config_bridge_pci_to_pci_t::secondary_bus>();
+	pci_enumerate_bus(m_segment, secondary_bus, this);
+}
+
+device_pci_bridge_pci2pci_t* device_pci_bridge_pci2pci_t::create(const pci_config_shadow_t& config)
+{
+	return s_bridge_pool.create(config);
+}
+
+void device_pci_bridge_pci2pci_t::release()
+{
+	s_bridge_pool.destroy(this);
 }
\ No newline at end of file
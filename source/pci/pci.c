@@ -19,83 +19,410 @@
 #include "pci/device.h"
 
 #include <stdlib.h>
+#include <string.h>
 #include "error.h"
 #include "mm/pmm/pmm.h"
 #include "mm/vmm/vmm.h"
 #include "acpi/acpi.h"
 #include "cpu.h"
 #include "nvme/nvme.h"
+#include <static_vector.h>
+#include "serial/serial.h"
 
 static pci_access_mechanism_t s_pci_access_mechanism = (pci_access_mechanism_t)-1;
-static uint8_t* s_pci_mmconfig = NULL;
+static static_vector_t<pci_segment_t, PCI_MAX_SEGMENTS> s_pci_segments;
+static static_vector_t<pci_root_bus_t, PCI_MAX_ROOT_BUSES> s_pci_root_buses;
+
+typedef struct pci_root_bus_scan
+{
+	bool has_functions[PCI_BUSES_PER_SEGMENT];
+	bool behind_bridge[PCI_BUSES_PER_SEGMENT];
+} pci_root_bus_scan_t;
+
+/* Marks the bus of the function as populated, and if the function is a configured bridge, marks the buses behind it. */
+static void pci_root_bus_scan_visitor(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function, void* context)
+{
+	pci_root_bus_scan_t* scan = (pci_root_bus_scan_t*)context;
+	scan->has_functions[bus] = true;
+
+	uint8_t header_type = pci_read8(segment, bus, device, function, offsetof(pci_config_t, header_type));
+	if((header_type & 0x7F) != 1)
+		return;
+
+	uint8_t secondary_bus = pci_read8(segment, bus, device, function, offsetof(pci_config_t, bridge_pci_to_pci.secondary_bus));
+	uint8_t subordinate_bus = pci_read8(segment, bus, device, function, offsetof(pci_config_t, bridge_pci_to_pci.subordinate_bus));
+	if(secondary_bus <= bus || subordinate_bus < secondary_bus)
+		return;
+
+	for(int i = secondary_bus; i <= subordinate_bus; ++i)
+		scan->behind_bridge[i] = true;
+}
+
+/* 
+ * Find the root buses of a segment. Host bridges have no bus number registers, so the buses of extra host bridges 
+ * (QEMU pxb-pcie for example) are found by probing every bus of the segment before any bridge is renumbered.
+ * A bus with functions that is not behind a bridge the firmware configured is a root bus.
+ */
+static void pci_find_root_buses(const pci_segment_t& segment)
+{
+	static pci_root_bus_scan_t scan;
+	memset(&scan, 0, sizeof(scan));
+
+	for(int bus = segment.start_bus; bus <= segment.end_bus; ++bus)
+		pci_for_each_function(segment.segment, (uint8_t)bus, pci_root_bus_scan_visitor, &scan);
+
+	size_t first_root = s_pci_root_buses.size();
+	for(int bus = segment.start_bus; bus <= segment.end_bus && !s_pci_root_buses.full(); ++bus)
+	{
+		/* The first bus of a segment is always a root bus, even if it is empty. */
+		if(bus != segment.start_bus && (!scan.has_functions[bus] || scan.behind_bridge[bus]))
+			continue;
+
+		pci_root_bus_t root_bus = {
+			.segment = segment.segment,
+			.bus = (uint8_t)bus,
+			.end_bus = segment.end_bus,
+			.next_free_bus = (uint8_t)(bus + 1)
+		};
+		s_pci_root_buses.push_back(root_bus);
+	}
+
+	/* Each root bus gives bus numbers only up to the next root bus, so a bridge never takes the number of a root bus. */
+	for(size_t i = first_root + 1; i < s_pci_root_buses.size(); ++i)
+		s_pci_root_buses[i - 1].end_bus = (uint8_t)(s_pci_root_buses[i].bus - 1);
+}
 
 int pci_init()
 {
-	uint8_t start_bus = 0;
-	acpi_mcfg_t* mcfg = (acpi_mcfg_t*)acpi_find_table_copy(ACPI_MCFG_SIGNATURE);
+	const acpi_mcfg_t* mcfg = (const acpi_mcfg_t*)acpi_get_table(ACPI_MCFG_SIGNATURE);
 	if(mcfg)
 	{
 		s_pci_access_mechanism = PCI_ACCESS_MMCONFIG;
 
-		acpi_mcfg_config_t* mcfg_config = &mcfg->configurations[0];
-		phys_addr_t base_address = mcfg_config->base_address;
-		int buses = (int)(mcfg_config->end_bus_number - mcfg_config->start_bus_number + 1);
-		size_t mmconfig_size = (size_t)buses * PCI_DEVICES_PER_BUS * PCI_FUNCTIONS_PER_DEVICE * 4096;
-		start_bus = mcfg_config->start_bus_number;
-		free(mcfg);
-	
-		s_pci_mmconfig = (uint8_t*)vmm_map_physical_pages(
-			base_address, 
-			VMM_PAGE_P | VMM_PAGE_RW,
-			mmconfig_size / VMM_PAGE_SIZE
-		);
-	
-		if(s_pci_mmconfig == (uint8_t*)-1)
-			return ERR_OUT_OF_MEMORY;
+		size_t count = (mcfg->header.size - offsetof(acpi_mcfg_t, configurations)) / sizeof(acpi_mcfg_config_t);
+		for(size_t i = 0; i < count && !s_pci_segments.full(); ++i)
+		{
+			const acpi_mcfg_config_t* mcfg_config = &mcfg->configurations[i];
+			if(mcfg_config->end_bus_number < mcfg_config->start_bus_number)
+				continue;
+
+			/* The base address is of bus 0 of the segment group, even if the range starts at a later bus. */
+			uint64_t start_offset = PCI_MMCONFIG_ADDRESS_OFFSET(mcfg_config->start_bus_number, 0, 0, 0);
+			int buses = (int)(mcfg_config->end_bus_number - mcfg_config->start_bus_number + 1);
+			size_t mmconfig_size = (size_t)buses * PCI_DEVICES_PER_BUS * PCI_FUNCTIONS_PER_DEVICE * 4096;
+		
+			uint8_t* mmconfig = (uint8_t*)vmm_map_physical_pages(
+				mcfg_config->base_address + start_offset, 
+				VMM_PAGE_P | VMM_PAGE_RW | VMM_PAGE_CACHE_UC,
+				mmconfig_size / VMM_PAGE_SIZE
+			);
+		
+			if(mmconfig == (uint8_t*)-1)
+				return ERR_OUT_OF_MEMORY;
+
+			pci_segment_t segment = {
+				.segment = mcfg_config->segment_group_number,
+				.start_bus = mcfg_config->start_bus_number,
+				.end_bus = mcfg_config->end_bus_number,
+				.mmconfig = mmconfig - start_offset
+			};
+			s_pci_segments.push_back(segment);
+		}
 	}
 	else
+	{
 		s_pci_access_mechanism = PCI_ACCESS_MECHANISM1;
 
-	pci_enumerate_bus(start_bus, &g_device_root);
+		/* Mechanism 1 can only access segment 0. */
+		pci_segment_t segment = {
+			.segment = 0,
+			.start_bus = 0,
+			.end_bus = PCI_BUSES_PER_SEGMENT - 1,
+			.mmconfig = NULL
+		};
+		s_pci_segments.push_back(segment);
+	}
+
+	/* All root buses are found before enumerating, as enumerating renumbers the bridges. */
+	for(const pci_segment_t& segment : s_pci_segments)
+		pci_find_root_buses(segment);
+
+	for(const pci_root_bus_t& root_bus : s_pci_root_buses)
+		pci_enumerate_bus(root_bus.segment, root_bus.bus, &g_device_root);
+
+	pci_tune_pcie();
 	return SUCCESS;
 }
 
-void pci_enumerate_bus(uint8_t bus, device_t* parent)
+void pci_enumerate_bus(uint16_t segment, uint8_t bus, device_t* parent)
 {
 	for(uint8_t device = 0; device < PCI_DEVICES_PER_BUS; device++)
 	{
 		for(uint8_t function = 0; function < PCI_FUNCTIONS_PER_DEVICE; function++)
 		{
-			uint16_t vendor_id = pci_read16(bus, device, function, offsetof(pci_config_t, vendor_id));
+			/* Only the vendor ID is read to check if the function exists, the whole header is read only for functions that do. */
+			uint16_t vendor_id = pci_read16(segment, bus, device, function, offsetof(pci_config_t, vendor_id));
 			if(vendor_id == 0xFFFF)
+			{
+				/* Every device implements function 0, so if it doesnt exist there is no device in this slot. */
+				if(function == 0)
+					break;
+
 				continue;
+			}
+
+			pci_config_shadow_t config;
+			config.load(segment, bus, device, function);
 			
-			device_pci_t* pci_device = pci_create_device(bus, device, function);
+			device_pci_t* pci_device = pci_create_device(config);
 			if(pci_device)
 			{
-				parent->add_child(pci_device);
-				int status = pci_device->initialize();
-				if(status != SUCCESS)
-					parent->remove_child(pci_device);
+				/* Devices are only initialized after the whole tree is enumerated. (See device_t::initialize_tree) */
+				if(parent->add_child(pci_device) != SUCCESS || pci_device->enumerate() != SUCCESS)
+					pci_device->destroy();
 			}
 			
 			/* If its not a multi-function device, continue to the next device and dont enumerate functions for this device. */
-			uint8_t header_type = pci_read8(bus, device, function, offsetof(pci_config_t, header_type));
+			uint8_t header_type = config.read<&pci_config_t::header_type>();
 			if(function == 0 && (header_type & (1 << 7)) == 0)		
 				break;
 		}
 	}
 }
 
-device_pci_t* pci_create_device(uint8_t bus, uint8_t device, uint8_t function)
+void pci_for_each_function(uint16_t segment, uint8_t bus, pci_function_visitor_t visitor, void* context)
+{
+	for(uint8_t device = 0; device < PCI_DEVICES_PER_BUS; device++)
+	{
+		for(uint8_t function = 0; function < PCI_FUNCTIONS_PER_DEVICE; function++)
+		{
+			uint16_t vendor_id = pci_read16(segment, bus, device, function, offsetof(pci_config_t, vendor_id));
+			if(vendor_id == 0xFFFF)
+			{
+				if(function == 0)
+					break;
+
+				continue;
+			}
+
+			visitor(segment, bus, device, function, context);
+
+			uint8_t header_type = pci_read8(segment, bus, device, function, offsetof(pci_config_t, header_type));
+			if(function == 0 && (header_type & (1 << 7)) == 0)
+				break;
+		}
+	}
+}
+
+typedef struct pci_hierarchy_walk
+{
+	pci_function_visitor_t visitor;
+	void* context;
+} pci_hierarchy_walk_t;
+
+static void pci_hierarchy_walk_visitor(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function, void* context)
+{
+	pci_hierarchy_walk_t* walk = (pci_hierarchy_walk_t*)context;
+	pci_for_each_in_hierarchy(segment, bus, device, function, walk->visitor, walk->context);
+}
+
+void pci_for_each_in_hierarchy(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function, pci_function_visitor_t visitor, void* context)
+{
+	visitor(segment, bus, device, function, context);
+
+	uint8_t header_type = pci_read8(segment, bus, device, function, offsetof(pci_config_t, header_type));
+	if((header_type & 0x7F) != 1)
+		return;
+
+	/* A secondary bus that isnt above the bridge's bus is not configured, and walking it would loop. */
+	uint8_t secondary_bus = pci_read8(segment, bus, device, function, offsetof(pci_config_t, bridge_pci_to_pci.secondary_bus));
+	if(secondary_bus <= bus)
+		return;
+
+	pci_hierarchy_walk_t walk = { .visitor = visitor, .context = context };
+	pci_for_each_function(segment, secondary_bus, pci_hierarchy_walk_visitor, &walk);
+}
+
+/* Lowers <context> (an uint8_t, encoded payload size) to the Max Payload Size supported by the function. */
+static void pci_pcie_min_payload_visitor(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function, void* context)
+{
+	pci_config_shadow_t config;
+	config.load(segment, bus, device, function);
+
+	uint16_t pcie = config.find_capability(PCI_CAPABILITY_ID_PCIE);
+	if(pcie == (uint16_t)-1)
+		return;
+
+	uint32_t devcap = config.read_raw<uint32_t>(pcie + offsetof(pci_capability_pcie_t, device_capabilities));
+	uint8_t* max_payload = (uint8_t*)context;
+	*max_payload = MIN(*max_payload, (uint8_t)PCIE_DEVCAP_GET_MAX_PAYLOAD(devcap));
+}
+
+static void pci_write_number(unsigned long long value, int base)
+{
+	char buffer[24];
+	serial_write(ulltoa(value, buffer, base));
+}
+
+/* Write the location, link and payload sizes of a PCI Express function to the serial port. */
+static void pci_pcie_report(const pci_config_shadow_t& config, uint16_t pcie)
+{
+	static const char* const speeds[] = { "?", "2.5", "5", "8", "16", "32", "64" };
+
+	uint16_t link_status = config.read_raw<uint16_t>(pcie + offsetof(pci_capability_pcie_t, link_status));
+	uint16_t devctl = config.read_raw<uint16_t>(pcie + offsetof(pci_capability_pcie_t, device_control));
+	uint8_t speed = PCIE_LNKSTA_GET_SPEED(link_status);
+
+	serial_write("PCIe ");
+	pci_write_number(config.segment(), 16);
+	serial_write(":");
+	pci_write_number(config.bus(), 16);
+	serial_write(":");
+	pci_write_number(config.device(), 16);
+	serial_write(".");
+	pci_write_number(config.function(), 16);
+	serial_write(" link ");
+	serial_write(speeds[speed < sizeof(speeds) / sizeof(speeds[0]) ? speed : 0]);
+	serial_write(" GT/s x");
+	pci_write_number(PCIE_LNKSTA_GET_WIDTH(link_status), 10);
+	serial_write(", MPS ");
+	pci_write_number(PCIE_PAYLOAD_SIZE(PCIE_DEVCTL_GET_MAX_PAYLOAD(devctl)), 10);
+	serial_write(", MRRS ");
+	pci_write_number(PCIE_PAYLOAD_SIZE(PCIE_DEVCTL_GET_MAX_READ_REQUEST(devctl)), 10);
+	serial_write("\n");
+}
+
+/* Sets the Max Payload Size of the function to <context> (an uint8_t), and tunes storage devices. */
+static void pci_pcie_tune_visitor(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function, void* context)
+{
+	pci_config_shadow_t config;
+	config.load(segment, bus, device, function);
+
+	uint16_t pcie = config.find_capability(PCI_CAPABILITY_ID_PCIE);
+	if(pcie == (uint16_t)-1)
+		return;
+
+	uint16_t devctl_offset = pcie + offsetof(pci_capability_pcie_t, device_control);
+	uint16_t devctl = config.read_raw<uint16_t>(devctl_offset);
+	devctl = PCIE_DEVCTL_SET_MAX_PAYLOAD(devctl, *(uint8_t*)context);
+
+	/* 
+	 * Storage devices move large blocks, so let them read as much as possible with a single request, 
+	 * and allow their writes to pass each other. No snoop is left as is, DMA buffers are not flushed from the cache. 
+	 */
+	if(config.read<&pci_config_t::class_code>() == PCI_CLASSCODE_MASS_STORAGE)
+	{
+		devctl = PCIE_DEVCTL_SET_MAX_READ_REQUEST(devctl, PCIE_PAYLOAD_4096);
+		devctl |= PCIE_DEVCTL_RELAXED_ORDERING;
+	}
+
+	config.write_raw<uint16_t>(devctl_offset, devctl);
+
+	uint16_t caps = config.read_raw<uint16_t>(pcie + offsetof(pci_capability_pcie_t, capabilities));
+	uint8_t port_type = PCIE_CAPS_GET_PORT_TYPE(caps);
+	if(port_type != PCIE_PORT_TYPE_ROOT_COMPLEX_ENDPOINT && port_type != PCIE_PORT_TYPE_ROOT_COMPLEX_EVENT_COLLECTOR)
+		pci_pcie_report(config, pcie);
+}
+
+/* 
+ * Tune a single hierarchy, rooted at a function on a root bus. 
+ * Every function in the hierarchy gets the same Max Payload Size, so no port ever receives a TLP bigger than it can take.
+ */
+static void pci_pcie_tune_hierarchy(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function, void*)
+{
+	uint8_t max_payload = PCIE_PAYLOAD_4096;
+	pci_for_each_in_hierarchy(segment, bus, device, function, pci_pcie_min_payload_visitor, &max_payload);
+	pci_for_each_in_hierarchy(segment, bus, device, function, pci_pcie_tune_visitor, &max_payload);
+}
+
+void pci_tune_pcie()
+{
+	for(const pci_root_bus_t& root_bus : s_pci_root_buses)
+		pci_for_each_function(root_bus.segment, root_bus.bus, pci_pcie_tune_hierarchy, NULL);
+}
+
+uint16_t pci_find_ext_capability(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function, pci_ext_capability_id_t capability)
+{
+	/* The extended configuration space is accessible only through ECAM. */
+	if(s_pci_access_mechanism != PCI_ACCESS_MMCONFIG)
+		return -1;
+
+	uint16_t current = PCIE_EXT_CAPABILITY_START;
+	for(int i = 0; current >= PCIE_EXT_CAPABILITY_START && i < 960; ++i)		/* (4096 - 256) / 4, stops a looping list */
+	{
+		uint32_t header = pci_read32(segment, bus, device, function, current);
+		if(header == 0 || header == 0xFFFFFFFF)
+			return -1;
+
+		if(PCIE_EXT_CAPABILITY_GET_ID(header) == (uint32_t)capability)
+			return current;
+
+		current = PCIE_EXT_CAPABILITY_GET_NEXT(header);
+	}
+
+	return -1;
+}
+
+pci_segment_t* pci_find_segment(uint16_t segment, uint8_t bus)
+{
+	for(pci_segment_t& pci_segment : s_pci_segments)
+	{
+		if(pci_segment.segment == segment && bus >= pci_segment.start_bus && bus <= pci_segment.end_bus)
+			return &pci_segment;
+	}
+
+	return NULL;
+}
+
+pci_root_bus_t* pci_find_root_bus(uint16_t segment, uint8_t bus)
+{
+	for(pci_root_bus_t& root_bus : s_pci_root_buses)
+	{
+		if(root_bus.segment == segment && bus >= root_bus.bus && bus <= root_bus.end_bus)
+			return &root_bus;
+	}
+
+	return NULL;
+}
+
+int pci_allocate_bus(uint16_t segment, uint8_t bus)
+{
+	pci_root_bus_t* root_bus = pci_find_root_bus(segment, bus);
+	if(!root_bus || root_bus->next_free_bus == 0)		/* next_free_bus wraps to 0 after the last bus is given. */
+		return -1;
+
+	if(root_bus->next_free_bus > root_bus->end_bus)
+		return -1;
+
+	return root_bus->next_free_bus++;
+}
+
+uint8_t pci_last_allocated_bus(uint16_t segment, uint8_t bus)
+{
+	pci_root_bus_t* root_bus = pci_find_root_bus(segment, bus);
+	if(!root_bus)
+		return bus;
+
+	return (uint8_t)(root_bus->next_free_bus - 1);
+}
+
+uint8_t* pci_mmconfig_address(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function, uint16_t offset)
+{
+	pci_segment_t* pci_segment = pci_find_segment(segment, bus);
+	if(!pci_segment || !pci_segment->mmconfig)
+		return NULL;
+
+	return pci_segment->mmconfig + PCI_MMCONFIG_ADDRESS_OFFSET(bus, device, function, offset);
+}
+
+device_pci_t* pci_create_device(const pci_config_shadow_t& config)
 {
-	uint8_t header_type = pci_read8(bus, device, function, offsetof(pci_config_t, header_type));
-	uint8_t class_code = pci_read8(bus, device, function, offsetof(pci_config_t, class_code));
-	uint8_t subclass = pci_read8(bus, device, function, offsetof(pci_config_t, subclass));
-	// uint8_t prog_if = pci_read8(bus, device, function, offsetof(pci_config_t, prog_if));
+	uint8_t header_type = config.read<&pci_config_t::header_type>();
+	uint8_t class_code = config.read<&pci_config_t::class_code>();
+	uint8_t subclass = config.read<&pci_config_t::subclass>();
 
 	if((header_type & 1) == 1 || (class_code == 6 && subclass == 4 ))
-		return new device_pci_bridge_pci2pci_t(bus, device, function);
+		return device_pci_bridge_pci2pci_t::create(config);
 
 	switch(class_code)
 	{
@@ -104,7 +431,7 @@ device_pci_t* pci_create_device(uint8_t bus, uint8_t device, uint8_t function)
 		switch(subclass)
 		{
 		case PCI_SUBCLASS_NVM:
-			return new device_storage_pci_nvme_t(bus, device, function);
+			return device_storage_pci_nvme_t::create(config);
 
 		default:
 			break;
@@ -120,20 +447,21 @@ device_pci_t* pci_create_device(uint8_t bus, uint8_t device, uint8_t function)
 	return NULL; 
 }
 
-uint64_t pci_read64(uint8_t bus, uint8_t device, uint8_t function, uint16_t offset)
+uint64_t pci_read64(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function, uint16_t offset)
 {
-	uint32_t low = pci_read32(bus, device, function, offset);
-	uint32_t high = pci_read32(bus, device, function, offset + sizeof(uint32_t));
+	uint32_t low = pci_read32(segment, bus, device, function, offset);
+	uint32_t high = pci_read32(segment, bus, device, function, offset + sizeof(uint32_t));
 	return (uint64_t)low | ((uint64_t)high << 32);
 }
 
-uint32_t pci_read32(uint8_t bus, uint8_t device, uint8_t function, uint16_t offset)
+uint32_t pci_read32(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function, uint16_t offset)
 {
 	if(s_pci_access_mechanism == PCI_ACCESS_MMCONFIG)
 	{
-		return *(uint32_t*)(s_pci_mmconfig + PCI_MMCONFIG_ADDRESS_OFFSET(bus, device, function, offset));
+		uint32_t* address = (uint32_t*)pci_mmconfig_address(segment, bus, device, function, offset);
+		return address ? *address : -1;
 	}
-	else if(s_pci_access_mechanism == PCI_ACCESS_MECHANISM1)
+	else if(s_pci_access_mechanism == PCI_ACCESS_MECHANISM1 && segment == 0)
 	{
 		if(IS_ALIGNED(offset, 4))
 			return pci_read_mechanism1(bus, device, function, offset);
@@ -146,13 +474,14 @@ uint32_t pci_read32(uint8_t bus, uint8_t device, uint8_t function, uint16_t offs
 	return -1;
 }
 
-uint16_t pci_read16(uint8_t bus, uint8_t device, uint8_t function, uint16_t offset)
+uint16_t pci_read16(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function, uint16_t offset)
 {
 	if(s_pci_access_mechanism == PCI_ACCESS_MMCONFIG)
 	{
-		return *(uint16_t*)(s_pci_mmconfig + PCI_MMCONFIG_ADDRESS_OFFSET(bus, device, function, offset));
+		uint16_t* address = (uint16_t*)pci_mmconfig_address(segment, bus, device, function, offset);
+		return address ? *address : -1;
 	}
-	else if(s_pci_access_mechanism == PCI_ACCESS_MECHANISM1)
+	else if(s_pci_access_mechanism == PCI_ACCESS_MECHANISM1 && segment == 0)
 	{
 		if(offset % 4 <= 2)
 			return pci_read_mechanism1(bus, device, function, offset) >> ((offset % 4) * 8);
@@ -165,13 +494,14 @@ uint16_t pci_read16(uint8_t bus, uint8_t device, uint8_t function, uint16_t offs
 	return -1;
 }
 
-uint8_t pci_read8(uint8_t bus, uint8_t device, uint8_t function, uint16_t offset)
+uint8_t pci_read8(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function, uint16_t offset)
 {
 	if(s_pci_access_mechanism == PCI_ACCESS_MMCONFIG)
 	{
-		return *(uint8_t*)(s_pci_mmconfig + PCI_MMCONFIG_ADDRESS_OFFSET(bus, device, function, offset));
+		uint8_t* address = (uint8_t*)pci_mmconfig_address(segment, bus, device, function, offset);
+		return address ? *address : -1;
 	}
-	else if(s_pci_access_mechanism == PCI_ACCESS_MECHANISM1)
+	else if(s_pci_access_mechanism == PCI_ACCESS_MECHANISM1 && segment == 0)
 	{
 		return pci_read_mechanism1(bus, device, function, offset) >> ((offset % 4) * 8);
 	}
@@ -179,19 +509,21 @@ uint8_t pci_read8(uint8_t bus, uint8_t device, uint8_t function, uint16_t offset
 	return -1;
 }
 
-void pci_write64(uint8_t bus, uint8_t device, uint8_t function, uint16_t offset, uint64_t value)
+void pci_write64(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function, uint16_t offset, uint64_t value)
 {
-	pci_write32(bus, device, function, offset, (uint32_t)value);
-	pci_write32(bus, device, function, offset + sizeof(uint32_t), (uint32_t)(value >> 32));
+	pci_write32(segment, bus, device, function, offset, (uint32_t)value);
+	pci_write32(segment, bus, device, function, offset + sizeof(uint32_t), (uint32_t)(value >> 32));
 }
 
-void pci_write32(uint8_t bus, uint8_t device, uint8_t function, uint16_t offset, uint32_t value)
+void pci_write32(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function, uint16_t offset, uint32_t value)
 {
 	if(s_pci_access_mechanism == PCI_ACCESS_MMCONFIG)
 	{
-		*(uint32_t*)(s_pci_mmconfig + PCI_MMCONFIG_ADDRESS_OFFSET(bus, device, function, offset)) = value;
+		uint32_t* address = (uint32_t*)pci_mmconfig_address(segment, bus, device, function, offset);
+		if(address)
+			*address = value;
 	}
-	else if(s_pci_access_mechanism == PCI_ACCESS_MECHANISM1)
+	else if(s_pci_access_mechanism == PCI_ACCESS_MECHANISM1 && segment == 0)
 	{
 		if(IS_ALIGNED(offset, 4))
 			pci_write_mechanism1(bus, device, function, offset, value);
@@ -210,13 +542,15 @@ void pci_write32(uint8_t bus, uint8_t device, uint8_t function, uint16_t offset,
 	}
 }
 
-void pci_write16(uint8_t bus, uint8_t device, uint8_t function, uint16_t offset, uint16_t value)
+void pci_write16(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function, uint16_t offset, uint16_t value)
 {
 	if(s_pci_access_mechanism == PCI_ACCESS_MMCONFIG)
 	{
-		*(uint16_t*)(s_pci_mmconfig + PCI_MMCONFIG_ADDRESS_OFFSET(bus, device, function, offset)) = value;
+		uint16_t* address = (uint16_t*)pci_mmconfig_address(segment, bus, device, function, offset);
+		if(address)
+			*address = value;
 	}
-	else if(s_pci_access_mechanism == PCI_ACCESS_MECHANISM1)
+	else if(s_pci_access_mechanism == PCI_ACCESS_MECHANISM1 && segment == 0)
 	{
 		if(offset % 4 <= 2)
 		{
@@ -238,13 +572,15 @@ void pci_write16(uint8_t bus, uint8_t device, uint8_t function, uint16_t offset,
 	}
 }
 
-void pci_write8(uint8_t bus, uint8_t device, uint8_t function, uint16_t offset, uint8_t value)
+void pci_write8(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function, uint16_t offset, uint8_t value)
 {
 	if(s_pci_access_mechanism == PCI_ACCESS_MMCONFIG)
 	{
-		*(uint8_t*)(s_pci_mmconfig + PCI_MMCONFIG_ADDRESS_OFFSET(bus, device, function, offset)) = value;
+		uint8_t* address = (uint8_t*)pci_mmconfig_address(segment, bus, device, function, offset);
+		if(address)
+			*address = value;
 	}
-	else if(s_pci_access_mechanism == PCI_ACCESS_MECHANISM1)
+	else if(s_pci_access_mechanism == PCI_ACCESS_MECHANISM1 && segment == 0)
 	{
 		uint32_t mask = 0xFF << ((offset % 4) * 8);
 		uint32_t old = pci_read_mechanism1(bus, device, function, offset);
@@ -0,0 +1,66 @@
+/* 
+ * This file is part of the EspressoOS project (https://github.com/rdex999/EspressoOS.git).
+ * Copyright (c) 2025 David Weizman.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "serial/serial.h"
+#include "cpu.h"
+#include "error.h"
+
+static bool s_serial_initialized = false;
+
+int serial_init()
+{
+	outb(SERIAL_COM1_PORT + SERIAL_REG_INTERRUPT_ENABLE, 0);		/* Polling only */
+
+	uint16_t divisor = SERIAL_BAUD_RATE_BASE / SERIAL_BAUD_RATE;
+	outb(SERIAL_COM1_PORT + SERIAL_REG_LINE_CONTROL, SERIAL_LINE_CONTROL_DLAB);
+	outb(SERIAL_COM1_PORT + SERIAL_REG_DATA, divisor & 0xFF);
+	outb(SERIAL_COM1_PORT + SERIAL_REG_INTERRUPT_ENABLE, divisor >> 8);
+	outb(SERIAL_COM1_PORT + SERIAL_REG_LINE_CONTROL, SERIAL_LINE_CONTROL_8N1);
+	outb(SERIAL_COM1_PORT + SERIAL_REG_FIFO_CONTROL, SERIAL_FIFO_CONTROL_ENABLE_14);
+
+	/* Send a byte in loopback mode and check that it comes back, so we dont write into nothing if there is no UART. */
+	outb(SERIAL_COM1_PORT + SERIAL_REG_MODEM_CONTROL, SERIAL_MODEM_CONTROL_LOOPBACK | SERIAL_MODEM_CONTROL_DTR_RTS);
+	outb(SERIAL_COM1_PORT + SERIAL_REG_DATA, 0xAE);
+	if(inb(SERIAL_COM1_PORT + SERIAL_REG_DATA) != 0xAE)
+		return ERR_SERIAL_NOT_FOUND;
+
+	outb(SERIAL_COM1_PORT + SERIAL_REG_MODEM_CONTROL, SERIAL_MODEM_CONTROL_DTR_RTS);
+	s_serial_initialized = true;
+	return SUCCESS;
+}
+
+void serial_write_char(char character)
+{
+	if(!s_serial_initialized)
+		return;
+
+	while((inb(SERIAL_COM1_PORT + SERIAL_REG_LINE_STATUS) & SERIAL_LINE_STATUS_THR_EMPTY) == 0)
+		asm volatile("pause");
+
+	outb(SERIAL_COM1_PORT + SERIAL_REG_DATA, character);
+}
+
+void serial_write(const char* string)
+{
+	for(; *string; ++string)
+	{
+		if(*string == '\n')
+			serial_write_char('\r');
+
+		serial_write_char(*string);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,117 @@
+/* 
+ * This file is part of the EspressoOS project (https://github.com/rdex999/EspressoOS.git).
+ * Copyright (c) 2025 David Weizman.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "smp/smp.h"
+#include <string.h>
+#include "cpu.h"
+#include "error.h"
+#include "apic/apic.h"
+#include "idt/idt.h"
+#include "mm/vmm/vmm.h"
+#include "time/time.h"
+
+/* The trampoline, and its data. (See boot/ap_boot.inc) */
+extern "C" const uint8_t smp_trampoline_start[];
+extern "C" const uint8_t smp_trampoline_end[];
+extern "C" const uint8_t smp_trampoline_data[];
+
+/* The index of the last AP that finished starting, written by the AP itself. */
+static uint32_t s_smp_started_index = 0;
+
+/* Send the startup sequence to the AP of <lapic_id>, and wait for it to report <index>. Returns 0 if it started. */
+static int smp_start_ap(uint32_t lapic_id, uint32_t index)
+{
+	lapic_send_ipi(lapic_id, LAPIC_ICR_DELIVERY_MODE_INIT | LAPIC_ICR_LEVEL_ASSERT);
+	time_delay_us(SMP_INIT_DELAY_US);
+
+	/* A started AP ignores startup IPIs, the second one is only for CPUs that missed the first. */
+	for(int i = 0; i < 2; ++i)
+	{
+		lapic_send_ipi(lapic_id, LAPIC_ICR_DELIVERY_MODE_STARTUP | LAPIC_ICR_STARTUP_VECTOR(SMP_TRAMPOLINE_ADDRESS));
+
+		uint64_t deadline = time_deadline_ms(i == 0 ? SMP_STARTUP_RETRY_MS : SMP_START_TIMEOUT_MS);
+		while(!time_expired(deadline))
+		{
+			if(__atomic_load_n(&s_smp_started_index, __ATOMIC_ACQUIRE) == index)
+				return SUCCESS;
+
+			cpu_pause();
+		}
+	}
+
+	/* Put the AP back into waiting for a startup IPI, so it cant start later with an index that is given to another CPU. */
+	lapic_send_ipi(lapic_id, LAPIC_ICR_DELIVERY_MODE_INIT | LAPIC_ICR_LEVEL_ASSERT);
+	return ERR_TIMEOUT;
+}
+
+int smp_init()
+{
+	if(g_cpu_count == 1)
+		return SUCCESS;
+
+	uint64_t cr3 = read_cr3();
+	if(cr3 > UINT32_MAX)
+	{
+		g_cpu_count = 1;
+		return ERR_INVALID_PARAMETER;
+	}
+
+	memcpy((void*)SMP_TRAMPOLINE_ADDRESS, smp_trampoline_start, smp_trampoline_end - smp_trampoline_start);
+	smp_trampoline_data_t* data = (smp_trampoline_data_t*)(SMP_TRAMPOLINE_ADDRESS + (smp_trampoline_data - smp_trampoline_start));
+	data->cr3 = cr3;
+	data->entry = (uint64_t)smp_ap_main;
+
+	/* The APs are started one at a time, so they can share the trampoline data. Indices stay contiguous if an AP fails. */
+	uint32_t count = g_cpu_count;
+	g_cpu_count = 1;
+	for(uint32_t i = 1; i < count; ++i)
+	{
+		uint32_t lapic_id = g_cpu_locals[i].lapic_id;
+		uint32_t index = g_cpu_count;
+
+		virt_addr_t stack = vmm_alloc_pages(VMM_PAGE_P | VMM_PAGE_RW, SMP_AP_STACK_PAGES);
+		if(stack == (virt_addr_t)-1)
+			return ERR_OUT_OF_MEMORY;
+
+		g_cpu_locals[index].index = index;
+		g_cpu_locals[index].lapic_id = lapic_id;
+		data->stack = stack + SMP_AP_STACK_PAGES * VMM_PAGE_SIZE;
+		data->index = index;
+
+		if(smp_start_ap(lapic_id, index) == SUCCESS)
+			++g_cpu_count;
+		else
+			vmm_free_pages(stack, SMP_AP_STACK_PAGES);
+	}
+
+	return SUCCESS;
+}
+
+extern "C" void smp_ap_main(uint32_t index)
+{
+	cpu_init_ap();
+	cpu_init_local(index);
+	idt_load();
+	lapic_init();
+
+	__atomic_store_n(&s_smp_started_index, index, __ATOMIC_RELEASE);
+
+	/* There is nothing to run on the APs yet, so they only handle the interrupts that are steered to them. */
+	while(true)
+		cpu_wait_for_interrupt();
+}
\ No newline at end of file
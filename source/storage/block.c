@@ -0,0 +1,269 @@
+/* 
+ * This file is part of the EspressoOS project (https://github.com/rdex999/EspressoOS.git).
+ * Copyright (c) 2025 David Weizman.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "storage/block.h"
+
+#include <object_pool.h>
+#include <string.h>
+#include "storage/storage.h"
+#include "common.h"
+#include "cpu.h"
+#include "error.h"
+
+static percpu_object_pool_t<block_request_t, 16> s_request_pool;
+
+/* Each CPU only counts its own statistics, so the counters need no atomic operations. */
+typedef struct alignas(CPU_CACHE_LINE_SIZE) block_cpu_stats
+{
+	block_stats_t stats;
+} block_cpu_stats_t;
+
+static block_cpu_stats_t s_stats[CPU_MAX_COUNT];
+
+static inline block_stats_t* block_current_stats()
+{
+	return &s_stats[cpu_current_index()].stats;
+}
+
+/* The completion callback of a merged request, completes the bios that were merged into it. */
+static void block_request_complete(bio_t* bio, void* context)
+{
+	block_request_t* request = (block_request_t*)context;
+	while(!request->bios.empty())
+		bio_complete(request->bios.pop_front(), bio->status);
+
+	/* The plug may free the request as soon as it sees this, so its the last access. */
+	cpu_barrier();
+	request->finished = true;
+}
+
+block_request_t* block_plug_t::alloc_request(bio_op_t op, uint64_t lba)
+{
+	block_request_t* request = s_request_pool.create();
+	if(!request)
+		return NULL;
+
+	bio_init(&request->bio, op, lba, 0, request->segments, 0);
+	request->bio.callback = block_request_complete;
+	request->bio.context = request;
+	request->finished = false;
+	return request;
+}
+
+int block_plug_t::submit(bio_t* bio)
+{
+	if(!bio || bio->segment_count > BLOCK_MAX_SEGMENTS)
+		return ERR_INVALID_PARAMETER;
+
+	/* 
+	 * A flush only covers the writes that completed before it was submitted, so send everything first and wait for it. 
+	 * Flushes are never merged.
+	 */
+	if(bio->op == BIO_OP_FLUSH)
+	{
+		flush();
+		wait_dispatched();
+	}
+
+	block_request_t* request = alloc_request(bio->op, bio->lba);
+	if(!request)
+		return ERR_OUT_OF_MEMORY;
+
+	request->bio.count = bio->count;
+	request->bio.segment_count = bio->segment_count;
+	memcpy(request->segments, bio->segments, bio->segment_count * sizeof(bio_segment_t));
+
+	bio->done = false;
+	request->bios.push_back(bio);
+
+	if(bio->op == BIO_OP_FLUSH)
+		dispatch(request);
+	else
+		queue(request);
+
+	return SUCCESS;
+}
+
+int block_plug_t::add(bio_op_t op, uint64_t lba, size_t count, void* buffer)
+{
+	if(op == BIO_OP_FLUSH || count == 0 || !buffer)
+		return ERR_INVALID_PARAMETER;
+
+	size_t max_sectors = m_device->get_max_transfer_sectors();
+	size_t sector_size = m_device->get_sector_size();
+	uint8_t* current = (uint8_t*)buffer;
+	while(count > 0)
+	{
+		block_request_t* request = alloc_request(op, lba);
+		if(!request)
+			return ERR_OUT_OF_MEMORY;
+
+		size_t sectors = MIN(count, max_sectors);
+		request->bio.count = sectors;
+		request->bio.segment_count = 1;
+		request->segments[0].buffer = current;
+		request->segments[0].size = sectors * sector_size;
+		queue(request);
+
+		lba += sectors;
+		count -= sectors;
+		current += sectors * sector_size;
+	}
+
+	return SUCCESS;
+}
+
+void block_plug_t::queue(block_request_t* request)
+{
+	++block_current_stats()->submitted;
+
+	/* Insert after the requests that start before or at the same LBA, so requests to the same LBA keep their order. */
+	block_request_t* next = m_pending.back();
+	while(next && next->bio.lba > request->bio.lba)
+		next = m_pending.prev(next);
+
+	if(next)
+		m_pending.insert_after(next, request);
+	else
+		m_pending.push_front(request);
+
+	/* Merge into the previous request, and then merge the next request into the result. */
+	block_request_t* previous = m_pending.prev(request);
+	if(previous && try_merge(previous, request))
+		request = previous;
+
+	next = m_pending.next(request);
+	if(next)
+		try_merge(request, next);
+
+	if(m_pending.size() >= BLOCK_PLUG_MAX_REQUESTS)
+	{
+		++block_current_stats()->threshold_flushes;
+		flush();
+	}
+}
+
+bool block_plug_t::try_merge(block_request_t* first, block_request_t* second)
+{
+	bio_t* a = &first->bio;
+	bio_t* b = &second->bio;
+	if(a->op != b->op || a->op == BIO_OP_FLUSH || a->lba + a->count != b->lba)
+		return false;
+
+	if(a->count + b->count > m_device->get_max_transfer_sectors())
+		return false;
+
+	/* Segments that are contiguous in memory become a single segment. */
+	bio_segment_t* last = &first->segments[a->segment_count - 1];
+	const bio_segment_t* head = &second->segments[0];
+	bool contiguous = (uint8_t*)last->buffer + last->size == (uint8_t*)head->buffer;
+	size_t segments = a->segment_count + b->segment_count - (contiguous ? 1 : 0);
+	if(segments > BLOCK_MAX_SEGMENTS || (!contiguous && !m_device->can_merge_segments(last, head)))
+		return false;
+
+	if(contiguous)
+	{
+		last->size += head->size;
+		memcpy(&first->segments[a->segment_count], &second->segments[1], (b->segment_count - 1) * sizeof(bio_segment_t));
+	}
+	else
+		memcpy(&first->segments[a->segment_count], second->segments, b->segment_count * sizeof(bio_segment_t));
+
+	a->segment_count = segments;
+	a->count += b->count;
+
+	while(!second->bios.empty())
+		first->bios.push_back(second->bios.pop_front());
+
+	m_pending.remove(second);
+	s_request_pool.destroy(second);
+	++block_current_stats()->merged;
+	return true;
+}
+
+void block_plug_t::dispatch(block_request_t* request)
+{
+	int status;
+	while((status = m_device->submit(&request->bio)) == ERR_DEVICE_BUSY)
+		m_device->poll();
+
+	/* A rejected request is completed here, so its bios dont wait forever. */
+	if(status != SUCCESS)
+	{
+		if(m_status == SUCCESS)
+			m_status = status;
+
+		bio_complete(&request->bio, status);
+	}
+
+	m_dispatched.push_back(request);
+	++block_current_stats()->dispatched;
+}
+
+int block_plug_t::flush()
+{
+	if(m_pending.empty())
+		return m_status;
+
+	++block_current_stats()->flushes;
+	while(!m_pending.empty())
+		dispatch(m_pending.pop_front());
+
+	return m_status;
+}
+
+int block_plug_t::finish()
+{
+	flush();
+	wait_dispatched();
+
+	int status = m_status;
+	m_status = SUCCESS;
+	return status;
+}
+
+void block_plug_t::wait_dispatched()
+{
+	while(!m_dispatched.empty())
+	{
+		block_request_t* request = m_dispatched.pop_front();
+		while(!request->finished)
+		{
+			if(m_device->poll() == 0)
+				cpu_pause();
+		}
+
+		if(request->bio.status != SUCCESS && m_status == SUCCESS)
+			m_status = request->bio.status;
+
+		s_request_pool.destroy(request);
+	}
+}
+
+void block_get_stats(block_stats_t* stats)
+{
+	memset(stats, 0, sizeof(block_stats_t));
+	for(size_t i = 0; i < CPU_MAX_COUNT; ++i)
+	{
+		const block_stats_t* cpu = &s_stats[i].stats;
+		stats->submitted += cpu->submitted;
+		stats->merged += cpu->merged;
+		stats->dispatched += cpu->dispatched;
+		stats->flushes += cpu->flushes;
+		stats->threshold_flushes += cpu->threshold_flushes;
+	}
+}
\ No newline at end of file
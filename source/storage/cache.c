@@ -0,0 +1,1017 @@
+/* 
+ * This file is part of the EspressoOS project (https://github.com/rdex999/EspressoOS.git).
+ * Copyright (c) 2025 David Weizman.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "storage/cache.h"
+
+#include <string.h>
+#include "storage/storage.h"
+#include "storage/block.h"
+#include "common.h"
+#include "cpu.h"
+#include "error.h"
+#include "time/time.h"
+
+block_cache_t g_block_cache;
+
+bool block_cache_t::cacheable(const device_storage_t* device)
+{
+	size_t sector_size = device->get_sector_size();
+	return sector_size != 0 && sector_size <= BLOCK_CACHE_BLOCK_SIZE && BLOCK_CACHE_BLOCK_SIZE % sector_size == 0;
+}
+
+int block_cache_t::read(const device_storage_t* device, uint64_t lba, size_t offset, size_t size, void* buffer)
+{
+	if(!device || !buffer || size == 0)
+		return ERR_INVALID_PARAMETER;
+
+	if(!cacheable(device))
+	{
+		m_lock.lock();
+		++m_stats.bypasses;
+		m_lock.unlock();
+		return device->read_direct(lba, offset, size, buffer);
+	}
+
+	bool load[BLOCK_CACHE_BATCH];
+	block_cache_entry_t* entries[BLOCK_CACHE_BATCH];
+	for(size_t i = 0; i < BLOCK_CACHE_BATCH; ++i)
+		load[i] = true;
+
+	uint64_t address = lba * device->get_sector_size() + offset;
+	uint8_t* destination = (uint8_t*)buffer;
+	while(size > 0)
+	{
+		uint64_t block = address / BLOCK_CACHE_BLOCK_SIZE;
+		size_t block_offset = address % BLOCK_CACHE_BLOCK_SIZE;
+		size_t count = MIN(DIV_ROUND_UP(block_offset + size, BLOCK_CACHE_BLOCK_SIZE), (size_t)BLOCK_CACHE_BATCH);
+		size_t chunk = MIN(size, count * BLOCK_CACHE_BLOCK_SIZE - block_offset);
+
+		size_t misses = count;
+		int status = acquire(device, block, count, load, entries, &misses);
+		if(status == ERR_OUT_OF_MEMORY)
+		{
+			/* 
+			 * All buffers are in use, read this part straight from the device. (The LBA is 0, the offset is the byte address)
+			 * Dirty blocks of the range are newer than the device, so they are written back first.
+			 */
+			m_lock.lock();
+			++m_stats.bypasses;
+			m_lock.unlock();
+
+			status = writeback_bytes(device, address, chunk);
+			if(status == SUCCESS)
+				status = device->read_direct(0, address, chunk, destination);
+		}
+		else if(status == SUCCESS)
+		{
+			size_t left = chunk;
+			for(size_t i = 0; i < count; ++i)
+			{
+				size_t from = i == 0 ? block_offset : 0;
+				size_t copy = MIN(left, BLOCK_CACHE_BLOCK_SIZE - from);
+				memcpy(destination + (chunk - left), entries[i]->data + from, copy);
+				left -= copy;
+			}
+
+			release(entries, count);
+		}
+
+		if(status != SUCCESS)
+			return status;
+
+		uint64_t ahead;
+		m_lock.lock();
+		size_t ahead_count = stream_update(device, block, count, misses, &ahead);
+		m_lock.unlock();
+
+		if(ahead_count != 0)
+			prefetch(device, ahead, ahead_count);
+
+		address += chunk;
+		destination += chunk;
+		size -= chunk;
+	}
+
+	balance();
+	return SUCCESS;
+}
+
+int block_cache_t::write(const device_storage_t* device, uint64_t lba, size_t offset, size_t size, const void* buffer)
+{
+	if(!device || !buffer || size == 0)
+		return ERR_INVALID_PARAMETER;
+
+	if(!cacheable(device))
+	{
+		m_lock.lock();
+		++m_stats.bypasses;
+		m_lock.unlock();
+		return device->write_direct(lba, offset, size, buffer);
+	}
+
+	bool load[BLOCK_CACHE_BATCH];
+	block_cache_entry_t* entries[BLOCK_CACHE_BATCH];
+	size_t sector_size = device->get_sector_size();
+	size_t sectors_per_block = BLOCK_CACHE_BLOCK_SIZE / sector_size;
+	uint64_t device_size = device->get_sector_count() * sector_size;
+
+	/* 
+	 * The blocks of a big write are next read by the device, not by the CPU, so they are filled with non-temporal stores 
+	 * and dont evict the working set of the caller.
+	 */
+	void* (*copy)(void*, const void*, size_t) = size >= BLOCK_CACHE_STREAM_WRITE ? memcpy_nt : memcpy;
+
+	uint64_t address = lba * sector_size + offset;
+	const uint8_t* source = (const uint8_t*)buffer;
+	while(size > 0)
+	{
+		uint64_t block = address / BLOCK_CACHE_BLOCK_SIZE;
+		size_t block_offset = address % BLOCK_CACHE_BLOCK_SIZE;
+		size_t count = MIN(DIV_ROUND_UP(block_offset + size, BLOCK_CACHE_BLOCK_SIZE), (size_t)BLOCK_CACHE_BATCH);
+		size_t chunk = MIN(size, count * BLOCK_CACHE_BLOCK_SIZE - block_offset);
+
+		/* Only blocks that are partly written need their old data. The last block of the device may be shorter than a block. */
+		for(size_t i = 0; i < count; ++i)
+		{
+			uint64_t block_start = (block + i) * BLOCK_CACHE_BLOCK_SIZE;
+			uint64_t block_end = MIN(block_start + BLOCK_CACHE_BLOCK_SIZE, device_size);
+			load[i] = MAX(address, block_start) != block_start || MIN(address + chunk, block_end) != block_end;
+		}
+
+		int status = acquire(device, block, count, load, entries);
+		if(status == ERR_OUT_OF_MEMORY)
+		{
+			/* 
+			 * Dirty blocks of the range must reach the device before this write, otherwise they would be written over it later,
+			 * and once written back the stale copies can be dropped.
+			 */
+			m_lock.lock();
+			++m_stats.bypasses;
+			m_lock.unlock();
+
+			status = writeback_bytes(device, address, chunk);
+			if(status == SUCCESS)
+			{
+				status = device->write_direct(0, address, chunk, source);
+				discard(device, block, count);
+			}
+		}
+		else if(status == SUCCESS && m_write_back)
+		{
+			/* Only update the cached blocks, they are written to the device later. (See writeback) */
+			for(size_t i = 0; i < count; ++i)
+			{
+				uint64_t block_start = (block + i) * BLOCK_CACHE_BLOCK_SIZE;
+				size_t from = MAX(address, block_start) - block_start;
+				size_t to = MIN(address + chunk, block_start + BLOCK_CACHE_BLOCK_SIZE) - block_start;
+				copy(entries[i]->data + from, source + (block_start + from - address), to - from);
+			}
+
+			m_lock.lock();
+			for(size_t i = 0; i < count; ++i)
+			{
+				entries[i]->state = BLOCK_CACHE_VALID;
+				mark_dirty(entries[i]);
+			}
+			m_lock.unlock();
+
+			release(entries, count);
+		}
+		else if(status == SUCCESS)
+		{
+			/* Update the cached blocks, and write the sectors that changed from them. */
+			block_plug_t plug(device);
+			for(size_t i = 0; i < count; ++i)
+			{
+				uint64_t block_start = (block + i) * BLOCK_CACHE_BLOCK_SIZE;
+				size_t from = MAX(address, block_start) - block_start;
+				size_t to = MIN(address + chunk, block_start + BLOCK_CACHE_BLOCK_SIZE) - block_start;
+				copy(entries[i]->data + from, source + (block_start + from - address), to - from);
+
+				size_t first_sector = from / sector_size;
+				size_t end_sector = DIV_ROUND_UP(to, sector_size);
+				int add_status = plug.add(
+					BIO_OP_WRITE, 
+					(block + i) * sectors_per_block + first_sector, 
+					end_sector - first_sector, 
+					entries[i]->data + first_sector * sector_size
+				);
+				if(status == SUCCESS)
+					status = add_status;
+			}
+
+			int finish_status = plug.finish();
+			if(status == SUCCESS)
+				status = finish_status;
+
+			/* If the write failed the content of the device is unknown, so drop the data. */
+			m_lock.lock();
+			for(size_t i = 0; i < count; ++i)
+				entries[i]->state = status == SUCCESS ? BLOCK_CACHE_VALID : BLOCK_CACHE_EMPTY;
+			m_lock.unlock();
+
+			release(entries, count);
+		}
+
+		if(status != SUCCESS)
+			return status;
+
+		address += chunk;
+		source += chunk;
+		size -= chunk;
+	}
+
+	/* Errors of writing back other blocks are reported by flush(), not by this write. */
+	balance();
+	return SUCCESS;
+}
+
+int block_cache_t::flush(const device_storage_t* device)
+{
+	if(!device)
+		return ERR_INVALID_PARAMETER;
+
+	int status = writeback(device, (size_t)-1);
+
+	m_lock.lock();
+	if(status == SUCCESS)
+		status = m_writeback_status;
+
+	m_writeback_status = SUCCESS;
+	++m_stats.flushes;
+	m_lock.unlock();
+
+	/* Make the writes durable, they may still be in the volatile write cache of the device. */
+	bio_t bio;
+	bio_init(&bio, BIO_OP_FLUSH, 0, 0, NULL, 0);
+	int flush_status = device->submit_wait(&bio);
+	return status == SUCCESS ? flush_status : status;
+}
+
+void block_cache_t::set_write_back(bool write_back)
+{
+	m_write_back = write_back;
+	if(!write_back)
+	{
+		int status = writeback(NULL, (size_t)-1);
+
+		m_lock.lock();
+		if(m_writeback_status == SUCCESS)
+			m_writeback_status = status;
+		m_lock.unlock();
+	}
+}
+
+void block_cache_t::balance()
+{
+	uint64_t now = time_now_ms();
+	size_t dirty;
+	size_t expired = 0;
+
+	m_lock.lock();
+	dirty = m_dirty.size();
+	for(block_cache_entry_t* entry = m_dirty.front(); entry && now - entry->dirtied >= BLOCK_CACHE_DIRTY_AGE_MS; entry = m_dirty.next(entry))
+		++expired;
+
+	if(dirty >= BLOCK_CACHE_DIRTY_MAX)
+		++m_stats.pressure_writebacks;
+	m_lock.unlock();
+
+	/* Under pressure write back the oldest blocks down to half the limit, otherwise only the blocks that are too old. */
+	int status = SUCCESS;
+	if(dirty >= BLOCK_CACHE_DIRTY_MAX)
+		status = writeback(NULL, MAX(dirty - BLOCK_CACHE_DIRTY_MAX / 2, expired));
+	else if(expired != 0)
+		status = writeback(NULL, expired);
+
+	if(status != SUCCESS)
+	{
+		m_lock.lock();
+		if(m_writeback_status == SUCCESS)
+			m_writeback_status = status;
+		m_lock.unlock();
+	}
+}
+
+int block_cache_t::writeback(const device_storage_t* device, size_t count)
+{
+	block_cache_entry_t* entries[BLOCK_CACHE_WRITEBACK_BATCH];
+	int status = SUCCESS;
+	while(count > 0 && status == SUCCESS)
+	{
+		/* Take the oldest dirty blocks of a single device, the plug sorts them and merges adjacent blocks into large writes. */
+		const device_storage_t* target = device;
+		size_t taken = 0;
+
+		m_lock.lock();
+		block_cache_entry_t* entry = m_dirty.front();
+		while(entry && taken < MIN(count, (size_t)BLOCK_CACHE_WRITEBACK_BATCH))
+		{
+			block_cache_entry_t* next = m_dirty.next(entry);
+			if(!target)
+				target = entry->key.device;
+
+			if(entry->key.device == target)
+			{
+				m_dirty.remove(entry);
+				entry->dirty = false;
+				++entry->pins;
+				entries[taken++] = entry;
+			}
+
+			entry = next;
+		}
+
+		m_stats.writebacks += taken;
+		m_lock.unlock();
+
+		if(taken == 0)
+			break;
+
+		count -= taken;
+		status = write_entries(target, entries, taken);
+	}
+
+	return status;
+}
+
+int block_cache_t::writeback_range(const device_storage_t* device, uint64_t lba, size_t count)
+{
+	if(!device || count == 0 || !cacheable(device))
+		return SUCCESS;
+
+	size_t sectors_per_block = BLOCK_CACHE_BLOCK_SIZE / device->get_sector_size();
+	uint64_t block = lba / sectors_per_block;
+	uint64_t last = (lba + count - 1) / sectors_per_block;
+
+	block_cache_entry_t* entries[BLOCK_CACHE_WRITEBACK_BATCH];
+	int status = SUCCESS;
+	while(block <= last && status == SUCCESS)
+	{
+		size_t taken = 0;
+
+		m_lock.lock();
+		for(; block <= last && taken < BLOCK_CACHE_WRITEBACK_BATCH; ++block)
+		{
+			block_cache_entry_t** found = m_index.find({ .device = device, .block = block });
+			block_cache_entry_t* entry = found ? *found : NULL;
+			if(!entry || !entry->dirty)
+				continue;
+
+			m_dirty.remove(entry);
+			entry->dirty = false;
+			++entry->pins;
+			entries[taken++] = entry;
+		}
+
+		m_stats.writebacks += taken;
+		m_lock.unlock();
+
+		if(taken != 0)
+			status = write_entries(device, entries, taken);
+	}
+
+	return status;
+}
+
+int block_cache_t::writeback_bytes(const device_storage_t* device, uint64_t address, size_t size)
+{
+	size_t sector_size = device->get_sector_size();
+	uint64_t lba = address / sector_size;
+	return writeback_range(device, lba, DIV_ROUND_UP(address + size, sector_size) - lba);
+}
+
+void block_cache_t::discard_range(const device_storage_t* device, uint64_t lba, size_t count)
+{
+	if(!device || count == 0 || !cacheable(device))
+		return;
+
+	size_t sectors_per_block = BLOCK_CACHE_BLOCK_SIZE / device->get_sector_size();
+	uint64_t block = lba / sectors_per_block;
+	discard(device, block, (lba + count - 1) / sectors_per_block - block + 1);
+}
+
+int block_cache_t::write_entries(const device_storage_t* device, block_cache_entry_t** entries, size_t count)
+{
+	size_t sectors_per_block = BLOCK_CACHE_BLOCK_SIZE / device->get_sector_size();
+	uint64_t sector_count = device->get_sector_count();
+	int status = SUCCESS;
+
+	block_plug_t plug(device);
+	for(size_t i = 0; i < count; ++i)
+	{
+		uint64_t lba = entries[i]->key.block * sectors_per_block;
+		int add_status = plug.add(BIO_OP_WRITE, lba, MIN((uint64_t)sectors_per_block, sector_count - lba), entries[i]->data);
+		if(status == SUCCESS)
+			status = add_status;
+	}
+
+	int finish_status = plug.finish();
+	if(status == SUCCESS)
+		status = finish_status;
+
+	/* Blocks that failed stay dirty, so they are written again later. */
+	m_lock.lock();
+	for(size_t i = 0; i < count; ++i)
+	{
+		if(status != SUCCESS)
+			mark_dirty(entries[i]);
+
+		--entries[i]->pins;
+	}
+	m_lock.unlock();
+
+	return status;
+}
+
+void block_cache_t::mark_dirty(block_cache_entry_t* entry)
+{
+	if(entry->dirty)
+		return;
+
+	entry->dirty = true;
+	entry->dirtied = time_now_ms();
+	m_dirty.push_back(entry);
+}
+
+void block_cache_t::discard(const device_storage_t* device, uint64_t block, size_t count)
+{
+	m_lock.lock();
+	for(size_t i = 0; i < count; ++i)
+	{
+		block_cache_entry_t** found = m_index.find({ .device = device, .block = block + i });
+		block_cache_entry_t* entry = found ? *found : NULL;
+		if(!entry || entry->pins != 0 || entry->dirty || entry->state == BLOCK_CACHE_LOADING)
+			continue;
+
+		/* Keep the key on its ghost list, like an eviction. */
+		if(entry->list == BLOCK_CACHE_T1 || entry->list == BLOCK_CACHE_T2)
+		{
+			free_buffer(entry->data);
+			entry->data = NULL;
+			entry->state = BLOCK_CACHE_EMPTY;
+			entry->prefetched = false;
+			move(entry, entry->list == BLOCK_CACHE_T1 ? BLOCK_CACHE_B1 : BLOCK_CACHE_B2);
+		}
+	}
+	m_lock.unlock();
+}
+
+int block_cache_t::acquire(const device_storage_t* device, uint64_t block, size_t count, const bool* load, 
+	block_cache_entry_t** entries, size_t* misses)
+{
+	size_t sectors_per_block = BLOCK_CACHE_BLOCK_SIZE / device->get_sector_size();
+	uint64_t sector_count = device->get_sector_count();
+	if(count == 0 || count > BLOCK_CACHE_BATCH || (block + count - 1) * sectors_per_block >= sector_count)
+		return ERR_INVALID_PARAMETER;
+
+	bool claimed[BLOCK_CACHE_BATCH];
+	size_t loads = 0;
+	bool retried = false;
+
+	m_lock.lock();
+	for(size_t i = 0; i < count; ++i)
+	{
+		entries[i] = access({ .device = device, .block = block + i });
+		if(entries[i])
+			continue;
+
+		for(size_t j = 0; j < i; ++j)
+			--entries[j]->pins;
+
+		bool dirty = !m_dirty.empty();
+		m_lock.unlock();
+
+		/* Dirty blocks are never evicted, so if there are any, write some back and try again. */
+		if(retried || !dirty || writeback(NULL, BLOCK_CACHE_DIRTY_MAX) != SUCCESS)
+			return ERR_OUT_OF_MEMORY;
+
+		retried = true;
+		m_lock.lock();
+		i = (size_t)-1;
+	}
+	m_lock.unlock();
+
+	/* Let reads that are in flight finish first, a read ahead that was dropped leaves its block empty, so it is read here. */
+	for(size_t i = 0; i < count; ++i)
+	{
+		while(entries[i]->state == BLOCK_CACHE_LOADING)
+		{
+			if(device->poll() == 0)
+				cpu_pause();
+		}
+	}
+
+	/* Blocks that are about to be overwritten completely are claimed as well, so no one reads them meanwhile. */
+	m_lock.lock();
+	for(size_t i = 0; i < count; ++i)
+	{
+		claimed[i] = entries[i]->state == BLOCK_CACHE_EMPTY;
+		if(claimed[i])
+		{
+			entries[i]->state = BLOCK_CACHE_LOADING;
+			loads += load[i] ? 1 : 0;
+		}
+	}
+	m_lock.unlock();
+
+	if(misses)
+		*misses = loads;
+
+	/* Read all missing blocks together, adjacent blocks are merged into larger reads. */
+	int status = SUCCESS;
+	if(loads != 0)
+	{
+		block_plug_t plug(device);
+		for(size_t i = 0; i < count; ++i)
+		{
+			if(!claimed[i] || !load[i])
+				continue;
+
+			uint64_t lba = (block + i) * sectors_per_block;
+			int add_status = plug.add(BIO_OP_READ, lba, MIN((uint64_t)sectors_per_block, sector_count - lba), entries[i]->data);
+			if(status == SUCCESS)
+				status = add_status;
+		}
+
+		int finish_status = plug.finish();
+		if(status == SUCCESS)
+			status = finish_status;
+
+		m_lock.lock();
+		for(size_t i = 0; i < count; ++i)
+		{
+			if(claimed[i] && load[i])
+				entries[i]->state = status == SUCCESS ? BLOCK_CACHE_VALID : BLOCK_CACHE_EMPTY;
+		}
+		m_lock.unlock();
+	}
+
+	/* Wait for blocks that other CPUs started reading meanwhile. */
+	for(size_t i = 0; i < count && status == SUCCESS; ++i)
+	{
+		if(claimed[i])
+			continue;
+
+		while(entries[i]->state == BLOCK_CACHE_LOADING)
+		{
+			if(device->poll() == 0)
+				cpu_pause();
+		}
+
+		if(load[i] && entries[i]->state != BLOCK_CACHE_VALID)
+			status = ERR_INVALID_PARAMETER;
+	}
+
+	if(status != SUCCESS)
+	{
+		m_lock.lock();
+		for(size_t i = 0; i < count; ++i)
+		{
+			if(claimed[i] && !load[i])
+				entries[i]->state = BLOCK_CACHE_EMPTY;
+		}
+		m_lock.unlock();
+
+		release(entries, count);
+	}
+
+	return status;
+}
+
+void block_cache_t::release(block_cache_entry_t** entries, size_t count)
+{
+	m_lock.lock();
+	for(size_t i = 0; i < count; ++i)
+		--entries[i]->pins;
+	m_lock.unlock();
+}
+
+block_cache_entry_t* block_cache_t::access(const block_cache_key_t& key, bool prefetch)
+{
+	block_cache_entry_t** found = m_index.find(key);
+	block_cache_entry_t* entry = found ? *found : NULL;
+	if(entry && (entry->list == BLOCK_CACHE_T1 || entry->list == BLOCK_CACHE_T2))
+	{
+		/* 
+		 * Case I - A hit, the block is now frequently used. 
+		 * The first read of a block that was read ahead is its first use, so it stays in T1. (Streams dont fill T2)
+		 */
+		++m_stats.hits;
+		if(entry->prefetched)
+		{
+			++m_stats.prefetch_hits;
+			entry->prefetched = false;
+			move(entry, BLOCK_CACHE_T1);
+		}
+		else
+			move(entry, BLOCK_CACHE_T2);
+
+		++entry->pins;
+		return entry;
+	}
+
+	if(!prefetch)
+		++m_stats.misses;
+	if(entry)
+	{
+		/* 
+		 * Case II and III - The block was evicted recently. A hit in B1 means T1 was too small, and a hit in B2 means T2 was too small,
+		 * so move the target size of T1 towards the list that missed, by the ratio of the ghost list sizes.
+		 */
+		if(entry->list == BLOCK_CACHE_B1)
+		{
+			++m_stats.ghost_hits_recent;
+			size_t delta = MAX(list_size(BLOCK_CACHE_B2) / list_size(BLOCK_CACHE_B1), (size_t)1);
+			m_target = MIN(m_target + delta, (size_t)BLOCK_CACHE_CAPACITY);
+			replace(false);
+		}
+		else
+		{
+			++m_stats.ghost_hits_frequent;
+			size_t delta = MAX(list_size(BLOCK_CACHE_B1) / list_size(BLOCK_CACHE_B2), (size_t)1);
+			m_target = m_target > delta ? m_target - delta : 0;
+			replace(true);
+		}
+
+		uint8_t* data = alloc_buffer();
+		if(!data)
+			return NULL;
+
+		entry->data = data;
+		entry->state = BLOCK_CACHE_EMPTY;
+		entry->prefetched = false;
+		move(entry, BLOCK_CACHE_T2);
+		++entry->pins;
+		return entry;
+	}
+
+	/* Case IV - A new block. Keep T1 + B1 and the total size of the lists within their limits. */
+	size_t recent = list_size(BLOCK_CACHE_T1) + list_size(BLOCK_CACHE_B1);
+	size_t total = recent + list_size(BLOCK_CACHE_T2) + list_size(BLOCK_CACHE_B2);
+	if(recent >= BLOCK_CACHE_CAPACITY)
+	{
+		if(list_size(BLOCK_CACHE_T1) < BLOCK_CACHE_CAPACITY)
+		{
+			remove(m_lists[BLOCK_CACHE_B1].back());
+			replace(false);
+		}
+		else
+		{
+			block_cache_entry_t* victim = lru(BLOCK_CACHE_T1);
+			if(victim)
+			{
+				remove(victim);
+				++m_stats.evictions;
+			}
+		}
+	}
+	else if(total >= BLOCK_CACHE_CAPACITY)
+	{
+		if(total >= 2 * BLOCK_CACHE_CAPACITY && !m_lists[BLOCK_CACHE_B2].empty())
+			remove(m_lists[BLOCK_CACHE_B2].back());
+
+		replace(false);
+	}
+
+	uint8_t* data = alloc_buffer();
+	if(!data)
+		return NULL;
+
+	entry = m_entries.create();
+	if(!entry)
+	{
+		free_buffer(data);
+		return NULL;
+	}
+
+	entry->key = key;
+	entry->data = data;
+	entry->pins = prefetch ? 0 : 1;
+	entry->state = BLOCK_CACHE_EMPTY;
+	entry->prefetched = prefetch;
+	entry->dirty = false;
+	entry->list = BLOCK_CACHE_T1;
+	m_lists[BLOCK_CACHE_T1].push_front(entry);
+
+	if(!m_index.insert(key, entry))
+	{
+		m_lists[BLOCK_CACHE_T1].remove(entry);
+		m_entries.destroy(entry);
+		free_buffer(data);
+		return NULL;
+	}
+
+	return entry;
+}
+
+void block_cache_t::replace(bool in_frequent_ghost)
+{
+	size_t recent = list_size(BLOCK_CACHE_T1);
+	block_cache_entry_t* victim = NULL;
+	if(recent >= 1 && ((in_frequent_ghost && recent == m_target) || recent > m_target))
+		victim = lru(BLOCK_CACHE_T1);
+
+	/* If the list ARC chose has only pinned blocks, evict from the other one. */
+	if(!victim)
+		victim = lru(BLOCK_CACHE_T2);
+
+	if(!victim)
+		victim = lru(BLOCK_CACHE_T1);
+
+	if(!victim)
+		return;
+
+	free_buffer(victim->data);
+	victim->data = NULL;
+	victim->state = BLOCK_CACHE_EMPTY;
+	move(victim, victim->list == BLOCK_CACHE_T1 ? BLOCK_CACHE_B1 : BLOCK_CACHE_B2);
+	++m_stats.evictions;
+}
+
+size_t block_cache_t::stream_update(const device_storage_t* device, uint64_t block, size_t count, size_t misses, uint64_t* ahead)
+{
+	/* A read continues a stream if it starts at the next block, or at the last block. (Reads that are smaller than a block) */
+	block_cache_stream_t* stream = NULL;
+	block_cache_stream_t* oldest = &m_streams[0];
+	for(size_t i = 0; i < BLOCK_CACHE_STREAMS && !stream; ++i)
+	{
+		block_cache_stream_t* current = &m_streams[i];
+		if(current->device == device && (block == current->next_block || block + 1 == current->next_block))
+			stream = current;
+		else if(!current->device || (oldest->device && current->last_used < oldest->last_used))
+			oldest = current;
+	}
+
+	uint64_t end = block + count;
+	++m_stream_clock;
+	if(!stream)
+	{
+		*oldest = {
+			.device 	= device,
+			.next_block = end,
+			.ahead 		= end,
+			.run 		= count,
+			.window 	= 0,
+			.accesses 	= 0,
+			.hits 		= 0,
+			.last_used 	= m_stream_clock,
+		};
+		return 0;
+	}
+
+	stream->run += end > stream->next_block ? end - stream->next_block : 0;
+	stream->next_block = MAX(stream->next_block, end);
+	stream->accesses += count;
+	stream->hits += count - misses;
+	stream->last_used = m_stream_clock;
+	if(stream->run < BLOCK_CACHE_SEQUENTIAL_RUN)
+		return 0;
+
+	if(stream->window == 0)
+	{
+		stream->window = BLOCK_CACHE_READAHEAD_MIN;
+		stream->accesses = 0;
+		stream->hits = 0;
+	}
+	else if(stream->accesses >= stream->window)
+	{
+		/* Grow the window while almost all blocks were read ahead in time, shrink it when many were missing. */
+		if(stream->hits * 4 >= stream->accesses * 3)
+			stream->window = MIN(stream->window * 2, (size_t)BLOCK_CACHE_READAHEAD_MAX);
+		else if(stream->hits * 2 < stream->accesses)
+			stream->window = MAX(stream->window / 2, (size_t)BLOCK_CACHE_READAHEAD_MIN);
+
+		stream->accesses = 0;
+		stream->hits = 0;
+	}
+
+	/* Read ahead again once the reader is within half a window of the end of the blocks that were read ahead. */
+	stream->ahead = MAX(stream->ahead, stream->next_block);
+	if(stream->ahead - stream->next_block > stream->window / 2)
+		return 0;
+
+	size_t ahead_count = stream->next_block + stream->window - stream->ahead;
+	*ahead = stream->ahead;
+	stream->ahead += ahead_count;
+	return ahead_count;
+}
+
+void block_cache_t::prefetch(const device_storage_t* device, uint64_t block, size_t count)
+{
+	size_t sector_size = device->get_sector_size();
+	size_t sectors_per_block = BLOCK_CACHE_BLOCK_SIZE / sector_size;
+	uint64_t sector_count = device->get_sector_count();
+	size_t max_blocks = MIN(MAX(device->get_max_transfer_sectors() / sectors_per_block, (size_t)1), (size_t)BLOCK_CACHE_BATCH);
+
+	/* Each run of adjacent blocks that are not cached is read by a single request. */
+	block_cache_prefetch_t* request = NULL;
+	for(size_t i = 0; i < count; ++i)
+	{
+		uint64_t lba = (block + i) * sectors_per_block;
+		if(lba >= sector_count)
+			break;
+
+		block_cache_key_t key = { .device = device, .block = block + i };
+		block_cache_entry_t* entry = NULL;
+
+		m_lock.lock();
+		if(!m_index.find(key))
+			entry = access(key, true);
+
+		if(entry)
+		{
+			entry->state = BLOCK_CACHE_LOADING;
+			++m_stats.prefetched;
+		}
+		m_lock.unlock();
+
+		if(request && (!entry || request->count == max_blocks))
+		{
+			prefetch_submit(device, request);
+			request = NULL;
+		}
+
+		if(!entry)
+			continue;
+
+		if(!request)
+		{
+			request = m_prefetches.create();
+			if(!request)
+			{
+				entry->state = BLOCK_CACHE_EMPTY;
+				break;
+			}
+
+			request->count = 0;
+			request->cache = this;
+		}
+
+		size_t sectors = MIN((uint64_t)sectors_per_block, sector_count - lba);
+		request->segments[request->count] = { .buffer = entry->data, .size = sectors * sector_size };
+		request->entries[request->count] = entry;
+		++request->count;
+	}
+
+	if(request)
+		prefetch_submit(device, request);
+}
+
+void block_cache_t::prefetch_submit(const device_storage_t* device, block_cache_prefetch_t* request)
+{
+	size_t sector_size = device->get_sector_size();
+	size_t sectors = 0;
+	for(size_t i = 0; i < request->count; ++i)
+		sectors += request->segments[i].size / sector_size;
+
+	uint64_t lba = request->entries[0]->key.block * (BLOCK_CACHE_BLOCK_SIZE / sector_size);
+	bio_init(&request->bio, BIO_OP_READ, lba, sectors, request->segments, request->count);
+	request->bio.callback = prefetch_complete;
+	request->bio.context = request;
+
+	/* Reading ahead is only a hint, so if the device is busy the blocks are dropped. */
+	int status = device->submit(&request->bio);
+	if(status != SUCCESS)
+		bio_complete(&request->bio, status);
+}
+
+void block_cache_t::prefetch_complete(bio_t* bio, void* context)
+{
+	/* 
+	 * Runs in an interrupt handler, so m_lock is not taken. A loading entry is never evicted, and its state is only
+	 * written by the CPU that loads it, so setting the state is enough.
+	 */
+	block_cache_prefetch_t* request = (block_cache_prefetch_t*)context;
+	for(size_t i = 0; i < request->count; ++i)
+		request->entries[i]->state = bio->status == SUCCESS ? BLOCK_CACHE_VALID : BLOCK_CACHE_EMPTY;
+
+	request->cache->m_prefetches.destroy(request);
+}
+
+block_cache_entry_t* block_cache_t::lru(block_cache_list_t list) const
+{
+	block_cache_entry_t* entry = m_lists[list].back();
+	while(entry && (entry->pins != 0 || entry->dirty || entry->state == BLOCK_CACHE_LOADING))
+		entry = m_lists[list].prev(entry);
+
+	return entry;
+}
+
+void block_cache_t::move(block_cache_entry_t* entry, block_cache_list_t list)
+{
+	m_lists[entry->list].remove(entry);
+	m_lists[list].push_front(entry);
+	entry->list = list;
+}
+
+void block_cache_t::remove(block_cache_entry_t* entry)
+{
+	if(!entry)
+		return;
+
+	m_lists[entry->list].remove(entry);
+	m_index.remove(entry->key);
+	if(entry->dirty)
+		m_dirty.remove(entry);
+
+	if(entry->data)
+		free_buffer(entry->data);
+
+	m_entries.destroy(entry);
+}
+
+uint8_t* block_cache_t::alloc_buffer()
+{
+	if(m_free_buffers)
+	{
+		uint8_t* buffer = m_free_buffers;
+		m_free_buffers = *(uint8_t**)buffer;
+		return buffer;
+	}
+
+	if(m_buffer_count >= BLOCK_CACHE_CAPACITY)
+		return NULL;
+
+	virt_addr_t page = vmm_alloc_page(VMM_PAGE_P | VMM_PAGE_RW);
+	if(page == (virt_addr_t)-1)
+		return NULL;
+
+	++m_buffer_count;
+	return (uint8_t*)page;
+}
+
+void block_cache_t::free_buffer(uint8_t* buffer)
+{
+	*(uint8_t**)buffer = m_free_buffers;
+	m_free_buffers = buffer;
+}
+
+void block_cache_t::invalidate(const device_storage_t* device)
+{
+	int status = writeback(device, (size_t)-1);
+
+	/* Reads of the device that are in flight (read ahead) write into its entries, so they must finish first. */
+	bool loading = true;
+	while(loading)
+	{
+		loading = false;
+		m_lock.lock();
+		for(size_t i = 0; i < BLOCK_CACHE_LIST_COUNT && !loading; ++i)
+		{
+			for(block_cache_entry_t* entry = m_lists[i].front(); entry && !loading; entry = m_lists[i].next(entry))
+				loading = entry->key.device == device && entry->state == BLOCK_CACHE_LOADING;
+		}
+		m_lock.unlock();
+
+		if(loading && device->poll() == 0)
+			cpu_pause();
+	}
+
+	m_lock.lock();
+	if(m_writeback_status == SUCCESS)
+		m_writeback_status = status;
+
+	/* Blocks that couldnt be written back are dropped as well, the device may be going away. */
+	for(size_t i = 0; i < BLOCK_CACHE_LIST_COUNT; ++i)
+	{
+		block_cache_entry_t* entry = m_lists[i].front();
+		while(entry)
+		{
+			block_cache_entry_t* next = m_lists[i].next(entry);
+			if(entry->key.device == device && entry->pins == 0)
+				remove(entry);
+
+			entry = next;
+		}
+	}
+
+	for(size_t i = 0; i < BLOCK_CACHE_STREAMS; ++i)
+	{
+		if(m_streams[i].device == device)
+			m_streams[i].device = NULL;
+	}
+	m_lock.unlock();
+}
+
+block_cache_stats_t block_cache_t::get_stats()
+{
+	m_lock.lock();
+	block_cache_stats_t stats = m_stats;
+	m_lock.unlock();
+	return stats;
+}
\ No newline at end of file
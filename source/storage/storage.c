@@ -16,19 +16,105 @@
  */
 
 #include "storage/storage.h"
+#include "storage/block.h"
+#include "storage/cache.h"
 
-bool device_storage_t::is_device(const device_t* device) const
+int device_storage_t::read(uint64_t lba, size_t offset, size_t size, void* buffer) const
 {
-	if(!device)
-		return false;
-	
-	if((device->m_type & DEVICE_TYPE_STORAGE) == 0)
+	if(is_direct(lba, offset, size, buffer))
+	{
+		bio_segment_t segment = { .buffer = buffer, .size = size };
+		return transfer_vector(BIO_OP_READ, lba + offset / m_sector_size, &segment, 1);
+	}
+
+	return g_block_cache.read(this, lba, offset, size, buffer);
+}
+
+int device_storage_t::write(uint64_t lba, size_t offset, size_t size, const void* buffer) const
+{
+	if(is_direct(lba, offset, size, buffer))
+	{
+		bio_segment_t segment = { .buffer = (void*)buffer, .size = size };
+		return transfer_vector(BIO_OP_WRITE, lba + offset / m_sector_size, &segment, 1);
+	}
+
+	return g_block_cache.write(this, lba, offset, size, buffer);
+}
+
+bool device_storage_t::is_direct(uint64_t lba, size_t offset, size_t size, const void* buffer) const
+{
+	/* 
+	 * Small transfers use the cache even if aligned, a cache hit is cheaper than a request to the device, 
+	 * and sequential small reads are read ahead by the cache.
+	 */
+	if(!buffer || m_sector_size == 0 || size < STORAGE_DIRECT_MIN_SIZE)
 		return false;
-	
-	return true;
+
+	uint64_t address = lba * m_sector_size + offset;
+	return IS_ALIGNED(address, VMM_PAGE_SIZE) && IS_ALIGNED((uint64_t)buffer, VMM_PAGE_SIZE) && 
+		IS_ALIGNED(size, VMM_PAGE_SIZE) && size % m_sector_size == 0;
 }
 
-int device_storage_t::read(uint64_t lba, size_t offset, size_t size, void* buffer) const
+int device_storage_t::readv(uint64_t lba, const bio_segment_t* segments, size_t segment_count) const
+{
+	return transfer_vector(BIO_OP_READ, lba, segments, segment_count);
+}
+
+int device_storage_t::writev(uint64_t lba, const bio_segment_t* segments, size_t segment_count) const
+{
+	return transfer_vector(BIO_OP_WRITE, lba, segments, segment_count);
+}
+
+int device_storage_t::transfer_vector(bio_op_t op, uint64_t lba, const bio_segment_t* segments, size_t segment_count) const
+{
+	if(!segments || segment_count == 0)
+		return ERR_INVALID_PARAMETER;
+
+	size_t count = 0;
+	for(size_t i = 0; i < segment_count; ++i)
+	{
+		if(!segments[i].buffer || segments[i].size == 0 || segments[i].size % m_sector_size != 0)
+			return ERR_INVALID_PARAMETER;
+
+		count += segments[i].size / m_sector_size;
+	}
+
+	if(lba + count > m_sector_count || lba + count < lba)
+		return ERR_INVALID_PARAMETER;
+
+	/* 
+	 * The device must have the cached writes of the range before it is read or written (so they dont overwrite this write later),
+	 * and after writing the cached copies of the range are stale.
+	 */
+	int status = g_block_cache.writeback_range(this, lba, count);
+	if(status != SUCCESS)
+		return status;
+
+	block_plug_t plug(this);
+	uint64_t current = lba;
+	for(size_t i = 0; i < segment_count && status == SUCCESS; ++i)
+	{
+		size_t sectors = segments[i].size / m_sector_size;
+		status = plug.add(op, current, sectors, segments[i].buffer);
+		current += sectors;
+	}
+
+	int finish_status = plug.finish();
+	if(status == SUCCESS)
+		status = finish_status;
+
+	if(op == BIO_OP_WRITE)
+		g_block_cache.discard_range(this, lba, count);
+
+	return status;
+}
+
+int device_storage_t::flush() const
+{
+	return g_block_cache.flush(this);
+}
+
+int device_storage_t::read_direct(uint64_t lba, size_t offset, size_t size, void* buffer) const
 {
 	if(!buffer || size == (size_t)0)
 		return ERR_INVALID_PARAMETER;
@@ -36,86 +122,55 @@ int device_storage_t::read(uint64_t lba, size_t offset, size_t size, void* buffe
 	lba += offset / m_sector_size;						/* If offset is greater than the size of a sector, update the LBA */
 	offset -= (offset / m_sector_size) * m_sector_size;
 
-	int status;	
-	uint8_t* destination = (uint8_t*)buffer;
-	size_t bytes_left = size;
-	uint8_t* sector_buffer = NULL;
-	uint64_t current_lba = lba;
-
 	/* 
-	 * If doing an unaligned (by sector size) read, or a read thats less then the size of a sector,
-	 * read the first sector into a temporary buffer, and do an offseted copy into <destination>.
+	 * The read is split into a partial head sector, whole sectors which are read straight into <buffer>, and a partial tail sector.
+	 * The partial sectors are read into a bounce buffer. All parts are plugged together, so adjacent parts can be merged.
 	 */
-	if(offset != 0 || bytes_left < m_sector_size - offset)
+	size_t head_size = (offset != 0 || size < m_sector_size) ? MIN(size, m_sector_size - offset) : 0;
+	size_t sectors = (size - head_size) / m_sector_size;
+	size_t tail_size = size - head_size - sectors * m_sector_size;
+	uint64_t sectors_lba = lba + (head_size != 0 ? 1 : 0);
+
+	uint8_t* destination = (uint8_t*)buffer;
+	uint8_t* sector_buffer = NULL;
+	if(head_size != 0 || tail_size != 0)
 	{
-		sector_buffer = (uint8_t*)malloc(m_sector_size);
+		sector_buffer = (uint8_t*)bounce_alloc();		/* The head sector, followed by the tail sector */
 		if(!sector_buffer)
 			return ERR_OUT_OF_MEMORY;
-		
-		status = read_sectors(current_lba, (size_t)1, sector_buffer);
-		if(status != SUCCESS)
-			goto cleanup;
-	
-		size_t read_size;
-		if(bytes_left < m_sector_size - offset)
-		{
-			read_size = bytes_left;
-		}
-		else
-		{
-			read_size = m_sector_size - offset;
-			++current_lba;
-		}
-		
-		memcpy(destination, sector_buffer + offset, read_size);
-		destination += read_size;
-		bytes_left -= read_size;
 	}
 
-	/* Check if we can read full sectors straight into <buffer> (<destination>) */
-	if(bytes_left >= m_sector_size)
-	{
-		size_t sectors = bytes_left / m_sector_size;
-		size_t read_size = sectors * m_sector_size;
+	int status = SUCCESS;
+	block_plug_t plug(this);
+	if(head_size != 0)
+		status = plug.add(BIO_OP_READ, lba, 1, sector_buffer);
 
-		status = read_sectors(current_lba, sectors, destination);
-		if(status != SUCCESS)
-			goto cleanup;
+	if(status == SUCCESS && sectors != 0)
+		status = plug.add(BIO_OP_READ, sectors_lba, sectors, destination + head_size);
 
-		destination += read_size;
-		bytes_left -= read_size;
-		current_lba += sectors;
-	}
+	if(status == SUCCESS && tail_size != 0)
+		status = plug.add(BIO_OP_READ, sectors_lba + sectors, 1, sector_buffer + m_sector_size);
 
-	/* 
-	 * Here we know that <bytes_left> is less than a sector. 
-	 * If its not 0, then read into the temporary buffer and then copy the left over bytes into <destination>.
-	 */
-	if(bytes_left != 0)
+	int finish_status = plug.finish();
+	if(status == SUCCESS)
+		status = finish_status;
+
+	if(status == SUCCESS)
 	{
-		if(!sector_buffer)
-		{
-			sector_buffer = (uint8_t*)malloc(m_sector_size);
-			if(!sector_buffer)
-				return ERR_OUT_OF_MEMORY;
-		}
+		if(head_size != 0)
+			memcpy(destination, sector_buffer + offset, head_size);
 
-		status = read_sectors(current_lba, 1, sector_buffer);
-		if(status != SUCCESS)
-			goto cleanup;
-		
-		memcpy(destination, sector_buffer, bytes_left);	
+		if(tail_size != 0)
+			memcpy(destination + head_size + sectors * m_sector_size, sector_buffer + m_sector_size, tail_size);
 	}
 
-	status = SUCCESS;
-cleanup:
 	if(sector_buffer)
-		free(sector_buffer);
+		bounce_free(sector_buffer);
 
 	return status;
 }
 
-int device_storage_t::write(uint64_t lba, size_t offset, size_t size, const void* buffer) const
+int device_storage_t::write_direct(uint64_t lba, size_t offset, size_t size, const void* buffer) const
 {
 	if(!buffer || size == (size_t)0)
 		return ERR_INVALID_PARAMETER;
@@ -123,85 +178,169 @@ int device_storage_t::write(uint64_t lba, size_t offset, size_t size, const void
 	lba += offset / m_sector_size;							/* If offset is greater than the size of a sector, update the LBA */
 	offset -= (offset / m_sector_size) * m_sector_size;
 
-	int status;
-	uint8_t* sector_buffer = NULL;
-	const uint8_t* source = (const uint8_t*)buffer;
-	uint64_t current_lba = lba;
-	size_t bytes_left = size;
-
 	/* 
-	 * If writing unaligned (by sector size), or write of size less then the size of a sector,
-	 * read the first sector (<lba>), update the needed bytes on <offset>, and write the sector back to disk.
+	 * Split like read_direct(). The partial head and tail sectors are read first (together), updated, 
+	 * and then written back together with the whole sectors, which are written straight from <buffer>.
 	 */
-	if(offset != 0 || size < m_sector_size - offset)
+	size_t head_size = (offset != 0 || size < m_sector_size) ? MIN(size, m_sector_size - offset) : 0;
+	size_t sectors = (size - head_size) / m_sector_size;
+	size_t tail_size = size - head_size - sectors * m_sector_size;
+	uint64_t sectors_lba = lba + (head_size != 0 ? 1 : 0);
+
+	const uint8_t* source = (const uint8_t*)buffer;
+	uint8_t* sector_buffer = NULL;
+	int status = SUCCESS;
+	int finish_status;
+
+	block_plug_t plug(this);
+	if(head_size != 0 || tail_size != 0)
 	{
-		sector_buffer = (uint8_t*)malloc(m_sector_size);
+		sector_buffer = (uint8_t*)bounce_alloc();		/* The head sector, followed by the tail sector */
 		if(!sector_buffer)
 			return ERR_OUT_OF_MEMORY;
-		
-		status = read_sectors(current_lba, (size_t)1, sector_buffer);
-		if(status != SUCCESS)
-			goto cleanup;
-		
-		size_t write_size;
-		if(bytes_left < m_sector_size - offset)
-			write_size = bytes_left;
-		else
-			write_size = m_sector_size - offset;
 
-		memcpy(sector_buffer + offset, source, write_size);
+		if(head_size != 0)
+			status = plug.add(BIO_OP_READ, lba, 1, sector_buffer);
 
-		status = write_sectors(current_lba++, (size_t)1, sector_buffer);
-		if(status != SUCCESS)
-			goto cleanup;
-		
-		bytes_left -= write_size;
-		source += write_size;
-	}
+		if(status == SUCCESS && tail_size != 0)
+			status = plug.add(BIO_OP_READ, sectors_lba + sectors, 1, sector_buffer + m_sector_size);
+
+		finish_status = plug.finish();
+		if(status == SUCCESS)
+			status = finish_status;
 
-	/* Check if we can write full sectors from <source> into <current_lba> */
-	if(bytes_left >= m_sector_size)
-	{
-		int sectors = bytes_left / m_sector_size;
-		size_t write_size = sectors * m_sector_size;
-		status = write_sectors(current_lba, sectors, source);
 		if(status != SUCCESS)
 			goto cleanup;
-		
-		source += write_size;
-		current_lba += sectors;
-		bytes_left -= write_size;
+
+		if(head_size != 0)
+			memcpy(sector_buffer + offset, source, head_size);
+
+		if(tail_size != 0)
+			memcpy(sector_buffer + m_sector_size, source + head_size + sectors * m_sector_size, tail_size);
 	}
 
-	/* 
-	 * If there are still some bytes to write (and we know its less then the size of a sector), 
-	 * read the sector, update the needed bytes, and write it back to disk.
-	 */
-	if(bytes_left != (size_t)0)
+	if(head_size != 0)
+		status = plug.add(BIO_OP_WRITE, lba, 1, sector_buffer);
+
+	if(status == SUCCESS && sectors != 0)
+		status = plug.add(BIO_OP_WRITE, sectors_lba, sectors, (void*)(source + head_size));
+
+	if(status == SUCCESS && tail_size != 0)
+		status = plug.add(BIO_OP_WRITE, sectors_lba + sectors, 1, sector_buffer + m_sector_size);
+
+	finish_status = plug.finish();
+	if(status == SUCCESS)
+		status = finish_status;
+
+cleanup:
+	if(sector_buffer)
+		bounce_free(sector_buffer);
+
+	return status;
+}
+
+int device_storage_t::bounce_init()
+{
+	if(m_sector_size == 0)
+		return ERR_INVALID_PARAMETER;
+
+	for(size_t i = 0; i < STORAGE_BOUNCE_BUFFERS; ++i)
 	{
-		if(!sector_buffer)
+		virt_addr_t buffer = vmm_alloc_pages(VMM_PAGE_P | VMM_PAGE_RW, bounce_buffer_pages());
+		if(buffer == (virt_addr_t)-1)
 		{
-			sector_buffer = (uint8_t*)malloc(m_sector_size);
-			if(!sector_buffer)
-				return ERR_OUT_OF_MEMORY;
+			bounce_release();
+			return ERR_OUT_OF_MEMORY;
 		}
 
-		status = read_sectors(current_lba, (size_t)1, sector_buffer);
-		if(status != SUCCESS)
-			goto cleanup;
-		
-		memcpy(sector_buffer, source, bytes_left);
-		
-		status = write_sectors(current_lba, (size_t)1, sector_buffer);
-		if(status != SUCCESS)
-			goto cleanup;
+		bounce_free((void*)buffer);
 	}
 
-	status = SUCCESS;
+	return SUCCESS;
+}
 
-cleanup:
-	if(sector_buffer)
-		free(sector_buffer);
+void device_storage_t::bounce_release()
+{
+	while(m_bounce_free)
+	{
+		void* buffer = m_bounce_free;
+		m_bounce_free = *(void**)buffer;
+		vmm_free_pages((virt_addr_t)buffer, bounce_buffer_pages());
+	}
+}
 
-	return status;
+void* device_storage_t::bounce_alloc() const
+{
+	uint64_t flags = m_bounce_lock.lock_irq_save();
+	void* buffer = m_bounce_free;
+	if(buffer)
+		m_bounce_free = *(void**)buffer;
+	m_bounce_lock.unlock_irq_restore(flags);
+
+	if(buffer)
+		return buffer;
+
+	/* All buffers are in use by other CPUs, the pool grows by one, which is kept for later. */
+	virt_addr_t page = vmm_alloc_pages(VMM_PAGE_P | VMM_PAGE_RW, bounce_buffer_pages());
+	if(page == (virt_addr_t)-1)
+		return NULL;
+
+	return (void*)page;
+}
+
+void device_storage_t::bounce_free(void* buffer) const
+{
+	uint64_t flags = m_bounce_lock.lock_irq_save();
+	*(void**)buffer = m_bounce_free;
+	m_bounce_free = buffer;
+	m_bounce_lock.unlock_irq_restore(flags);
+}
+
+int device_storage_t::submit(bio_t* bio) const
+{
+	if(!bio || (bio->op != BIO_OP_FLUSH && (bio->count == 0 || !bio->segments)))
+		return ERR_INVALID_PARAMETER;
+
+	int status = SUCCESS;
+	uint64_t lba = bio->lba;
+	for(size_t i = 0; i < bio->segment_count && bio->op != BIO_OP_FLUSH && status == SUCCESS; ++i)
+	{
+		const bio_segment_t* segment = &bio->segments[i];
+		size_t sectors = segment->size / m_sector_size;
+		if(sectors * m_sector_size != segment->size)
+			return ERR_INVALID_PARAMETER;
+
+		if(bio->op == BIO_OP_READ)
+			status = read_sectors(lba, sectors, segment->buffer);
+		else
+			status = write_sectors(lba, sectors, segment->buffer);
+
+		lba += sectors;
+	}
+
+	bio_complete(bio, status);
+	return SUCCESS;
+}
+
+int device_storage_t::wait(bio_t* bio) const
+{
+	while(!bio->done)
+	{
+		if(poll() == 0)
+			cpu_pause();
+	}
+
+	return bio->status;
+}
+
+int device_storage_t::submit_wait(bio_t* bio) const
+{
+	int status;
+	while((status = submit(bio)) == ERR_DEVICE_BUSY)
+		poll();
+
+	if(status != SUCCESS)
+		return status;
+
+	return wait(bio);
 }
\ No newline at end of file
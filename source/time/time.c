@@ -0,0 +1,105 @@
+/* 
+ * This file is part of the EspressoOS project (https://github.com/rdex999/EspressoOS.git).
+ * Copyright (c) 2025 David Weizman.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "time/time.h"
+#include "cpu.h"
+#include "error.h"
+#include "idt/idt.h"
+#include "apic/apic.h"
+
+static uint64_t s_tsc_per_ms = 0;
+static uint64_t s_tsc_start = 0;
+
+int time_init()
+{
+	uint16_t count = TIME_PIT_FREQUENCY * TIME_CALIBRATION_MS / 1000;
+
+	/* Enable the gate of channel 2, and keep the speaker off. */
+	outb(TIME_PIT_PORT_CONTROL, (inb(TIME_PIT_PORT_CONTROL) & ~TIME_PIT_CONTROL_SPEAKER) | TIME_PIT_CONTROL_GATE2);
+
+	outb(TIME_PIT_PORT_COMMAND, TIME_PIT_COMMAND_CHANNEL2_MODE0);
+	outb(TIME_PIT_PORT_CHANNEL2, count & 0xFF);
+	outb(TIME_PIT_PORT_CHANNEL2, count >> 8);		/* Counting starts here */
+
+	uint64_t start = cpu_read_tsc();
+	while((inb(TIME_PIT_PORT_CONTROL) & TIME_PIT_CONTROL_OUT2) == 0)
+		cpu_pause();
+
+	uint64_t end = cpu_read_tsc();
+
+	outb(TIME_PIT_PORT_CONTROL, inb(TIME_PIT_PORT_CONTROL) & ~TIME_PIT_CONTROL_GATE2);
+
+	s_tsc_per_ms = (end - start) / TIME_CALIBRATION_MS;
+	if(s_tsc_per_ms == 0)
+		return ERR_TIME_CALIBRATION;
+
+	s_tsc_start = end;
+	return SUCCESS;
+}
+
+/* The handler of the timer interrupt. Waking the CPU is all it is for, the idle loop does the periodic work. */
+static void time_tick(uint8_t, void*)
+{
+}
+
+int time_tick_init()
+{
+	uint32_t ticks_per_ms = lapic_timer_ticks_per_ms();
+	if(ticks_per_ms == 0)
+		return ERR_TIME_CALIBRATION;
+
+	uint16_t interrupt = idt_alloc_handler(time_tick, NULL);
+	if(interrupt == (uint16_t)-1)
+		return ERR_OUT_OF_MEMORY;
+
+	lapic_timer_start_periodic((uint8_t)interrupt, ticks_per_ms * TIME_TICK_MS);
+	return SUCCESS;
+}
+
+uint64_t time_tsc_per_ms()
+{
+	return s_tsc_per_ms;
+}
+
+uint64_t time_now_ns()
+{
+	if(s_tsc_per_ms == 0)
+		return 0;
+
+	/* Split so the multiplication doesnt overflow, even after years of uptime. */
+	uint64_t ticks = cpu_read_tsc() - s_tsc_start;
+	uint64_t ms = ticks / s_tsc_per_ms;
+	return ms * 1000000 + (ticks % s_tsc_per_ms) * 1000000 / s_tsc_per_ms;
+}
+
+void time_delay_us(uint64_t microseconds)
+{
+	uint64_t end = cpu_read_tsc() + microseconds * s_tsc_per_ms / 1000;
+	while(cpu_read_tsc() < end)
+		cpu_pause();
+}
+
+uint64_t time_deadline_ms(uint64_t milliseconds)
+{
+	return cpu_read_tsc() + milliseconds * s_tsc_per_ms;
+}
+
+bool time_expired(uint64_t deadline)
+{
+	return cpu_read_tsc() >= deadline;
+}
\ No newline at end of file